@@ -0,0 +1,102 @@
+/**
+ * @file async_memcached_store.h Non-blocking memcached client
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef ASYNC_MEMCACHED_STORE_H_
+#define ASYNC_MEMCACHED_STORE_H_
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async_store.h"
+
+/**
+ * Reads and writes records in memcached (or Astaire) without blocking the
+ * caller.
+ *
+ * Each event loop is a thread with its own connection to the server.
+ * Requests are spread across the loops, and each loop pipelines the requests
+ * it is given on its connection, using the memcached binary protocol, so a
+ * few threads can keep many requests in flight. The requests of a multi-get
+ * or multi-set all go to one loop, and are written to its connection
+ * together.
+ *
+ * Records are keyed in the same way as by cpp-common's memcached stores, so
+ * this reads the records that they write.
+ */
+class AsyncMemcachedStore : public AsyncStore
+{
+public:
+  static const int DEFAULT_PORT = 11311;
+  static const int DEFAULT_TIMEOUT_MS = 500;
+
+  /// @param server       - The server to connect to, as "host[:port]". The
+  ///                       host is resolved when the store is started, and
+  ///                       each loop moves on to the next address it
+  ///                       resolved to if its connection fails.
+  /// @param event_loops  - The number of event loops.
+  /// @param timeout_ms   - How long a request may take. If it takes longer, it
+  ///                       fails with ERROR, and the loop reconnects.
+  AsyncMemcachedStore(const std::string& server,
+                      int event_loops,
+                      int timeout_ms = DEFAULT_TIMEOUT_MS);
+  virtual ~AsyncMemcachedStore();
+
+  /// Resolves the server and starts the event loops. Returns false if the
+  /// server can't be resolved.
+  bool start();
+
+  /// Stops the event loops. Any requests that haven't completed fail with
+  /// ERROR.
+  void stop();
+
+  /// The callbacks are run on one of the event loops, unless the store isn't
+  /// running, in which case they're run (with ERROR) before these return.
+  void get_data_async(const std::string& table,
+                      const std::string& key,
+                      SAS::TrailId trail,
+                      get_callback callback) override;
+  void get_multi_data_async(const std::string& table,
+                            const std::vector<std::string>& keys,
+                            SAS::TrailId trail,
+                            multi_get_callback callback) override;
+  void set_multi_data_async(const std::string& table,
+                            const std::vector<std::pair<std::string, std::string>>& records,
+                            int expiry,
+                            SAS::TrailId trail,
+                            multi_set_callback callback) override;
+
+  /// The key of a record in memcached.
+  static std::string fq_key(const std::string& table, const std::string& key);
+
+private:
+  class EventLoop;
+
+  struct Address
+  {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+  };
+
+  bool resolve(std::vector<Address>& addresses);
+
+  const std::string _server;
+  const int _num_loops;
+  const int _timeout_ms;
+
+  std::vector<std::unique_ptr<EventLoop>> _loops;
+  std::atomic<unsigned int> _next_loop;
+};
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * @file async_store.h Interface to stores that can be used without blocking
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef ASYNC_STORE_H_
+#define ASYNC_STORE_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sas.h"
+#include "store.h"
+
+/**
+ * A store whose records can be read, and written, without blocking the
+ * calling thread.
+ *
+ * Records are addressed by table and key in the same way as in a Store, so
+ * an AsyncStore can be used alongside the Store that writes the records.
+ *
+ * The multi-record operations send all their records to the server
+ * together. If the records are on the same server (see
+ * ImpuStore::set_hash_tags), that's a single round trip.
+ */
+class AsyncStore
+{
+public:
+  /// Called once a get completes. The data and CAS are only valid if the
+  /// status is OK.
+  typedef std::function<void(Store::Status status,
+                             const std::string& data,
+                             uint64_t cas)> get_callback;
+
+  struct Result
+  {
+    Store::Status status;
+    std::string data;
+    uint64_t cas;
+  };
+
+  /// Called once all the gets of a multi-get complete, with their results
+  /// in the order of the keys.
+  typedef std::function<void(std::vector<Result>& results)> multi_get_callback;
+
+  /// Called once all the sets of a multi-set complete, with their statuses
+  /// in the order of the records.
+  typedef std::function<void(std::vector<Store::Status>& statuses)> multi_set_callback;
+
+  virtual ~AsyncStore() {}
+
+  /// Gets a record, passing it to the callback. The callback may be run on
+  /// one of the store's own threads, so it mustn't block.
+  virtual void get_data_async(const std::string& table,
+                              const std::string& key,
+                              SAS::TrailId trail,
+                              get_callback callback) = 0;
+
+  /// Gets a number of records from the same table.
+  virtual void get_multi_data_async(const std::string& table,
+                                    const std::vector<std::string>& keys,
+                                    SAS::TrailId trail,
+                                    multi_get_callback callback) = 0;
+
+  /// Writes a number of records to the same table, without CAS, each given
+  /// as its key and data. They all expire after the same number of seconds.
+  virtual void set_multi_data_async(const std::string& table,
+                                    const std::vector<std::pair<std::string, std::string>>& records,
+                                    int expiry,
+                                    SAS::TrailId trail,
+                                    multi_set_callback callback) = 0;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file cpu_affinity.h Pinning Homestead's thread pools to sets of CPUs
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CPU_AFFINITY_H_
+#define CPU_AFFINITY_H_
+
+#include <sched.h>
+
+#include <string>
+
+/**
+ * The thread pools Homestead uses are mostly created by other libraries
+ * (cpp-common, freeDiameter), which don't let us say where their threads
+ * run. However, a new thread inherits the CPU affinity of the thread that
+ * creates it. So, to pin a pool, we set our own affinity while the pool is
+ * started, and put it back afterwards.
+ *
+ * Memory that a pinned thread allocates and first writes (e.g. its LZ4
+ * stream) is then on that thread's NUMA node, under the kernel's default
+ * policy.
+ */
+namespace CpuAffinity
+{
+  /// Parses a set of CPUs, e.g. "0-3,8,10-11". An item may also be "nodeN",
+  /// meaning all the CPUs on NUMA node N. Returns false if the set is
+  /// invalid or empty.
+  bool parse(const std::string& spec, cpu_set_t& cpus);
+
+  /// Restricts the calling thread to a set of CPUs until this goes out of
+  /// scope, so that threads it creates meanwhile are pinned to the set. An
+  /// empty spec leaves the affinity alone.
+  class Scope
+  {
+  public:
+    Scope(const std::string& spec);
+    ~Scope();
+
+  private:
+    bool _changed;
+    cpu_set_t _saved;
+  };
+}
+
+#endif
@@ -12,6 +12,8 @@
 #ifndef CX_H__
 #define CX_H__
 
+#include <boost/utility/string_ref.hpp>
+
 #include "diameterstack.h"
 #include "authvector.h"
 #include "servercapabilities.h"
@@ -106,6 +108,78 @@ public:
   const Diameter::Dictionary::AVP UAR_FLAGS;
 };
 
+// An index of the AVPs that Homestead reads from Cx answers, built in one
+// pass over the message. Looking each AVP up on the message walks its AVPs
+// again every time, and copies the value out.
+//
+// The string accessors return views of the values in the message, so are
+// only valid for the life of the message. As with the message accessors,
+// only the first of each AVP is used.
+class AnswerAvps
+{
+public:
+  AnswerAvps(const Diameter::Message& msg);
+
+  inline bool server_name(boost::string_ref& str) const
+  {
+    return view(_server_name, str);
+  }
+  inline bool user_data(boost::string_ref& str) const
+  {
+    return view(_user_data, str);
+  }
+  inline bool wildcarded_public_identity(boost::string_ref& str) const
+  {
+    return view(_wildcarded_public_identity, str);
+  }
+  inline bool sip_auth_scheme(boost::string_ref& str) const
+  {
+    return view(_sip_auth_scheme, str);
+  }
+
+  void charging_addrs(ChargingAddresses& charging_addrs) const;
+
+  // These create the AuthVector* and pass ownership to the calling function
+  DigestAuthVector* digest_auth_vector() const;
+  AKAAuthVector* aka_auth_vector() const;
+  AKAAuthVector* akav2_auth_vector() const;
+
+private:
+  void index_sip_auth_data_item(struct avp* item, const Dictionary* dict);
+  void index_sip_digest_authenticate(struct avp* digest, const Dictionary* dict);
+  void index_charging_information(struct avp* info, const Dictionary* dict);
+
+  static bool view(const struct avp_hdr* hdr, boost::string_ref& str);
+
+  // The header of each AVP we've found, or NULL if it isn't present.
+  const struct avp_hdr* _server_name;
+  const struct avp_hdr* _user_data;
+  const struct avp_hdr* _wildcarded_public_identity;
+
+  // From the SIP-Auth-Data-Item.
+  const struct avp_hdr* _sip_auth_scheme;
+  const struct avp_hdr* _sip_authenticate;
+  const struct avp_hdr* _sip_authorization;
+  const struct avp_hdr* _confidentiality_key;
+  const struct avp_hdr* _integrity_key;
+
+  // From the SIP-Digest-Authenticate. Some HSSs (in particular OpenIMSCore)
+  // use the non-3GPP Digest AVPs, which are used if the 3GPP ones are
+  // missing.
+  const struct avp_hdr* _cx_digest_ha1;
+  const struct avp_hdr* _cx_digest_realm;
+  const struct avp_hdr* _cx_digest_qop;
+  const struct avp_hdr* _digest_ha1;
+  const struct avp_hdr* _digest_realm;
+  const struct avp_hdr* _digest_qop;
+
+  // From the Charging-Information.
+  const struct avp_hdr* _primary_ccf;
+  const struct avp_hdr* _secondary_ccf;
+  const struct avp_hdr* _primary_ecf;
+  const struct avp_hdr* _secondary_ecf;
+};
+
 class UserAuthorizationRequest : public Diameter::Message
 {
 public:
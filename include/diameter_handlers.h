@@ -23,6 +23,9 @@
 #include "hss_connection.h"
 #include "hss_cache_processor.h"
 #include "implicit_reg_set.h"
+#include "flight_recorder.h"
+#include "sas_encoder.h"
+#include "utils.h"
 
 class RegistrationTerminationTask : public Diameter::Task
 {
@@ -46,23 +49,25 @@ public:
                               const Config* cfg,
                               SAS::TrailId trail):
     Diameter::Task(dict, fd_msg, trail), _cfg(cfg), _rtr(_msg)
-  {}
-
-  // We must delete all the ImplicitRegistrationSet*s in _reg_sets
-  virtual ~RegistrationTerminationTask()
   {
-    for (ImplicitRegistrationSet* irs : _reg_sets)
-    {
-      delete irs;
-    }
+    _stop_watch.start();
   }
 
+  // We must delete all the ImplicitRegistrationSet*s in _reg_sets
+  virtual ~RegistrationTerminationTask();
+
   void run();
 
 private:
   const Config* _cfg;
   Cx::RegistrationTerminationRequest _rtr;
 
+  // Times the request from when it's received until the RTA is sent.
+  Utils::StopWatch _stop_watch;
+
+  // The stages the request has been through, for the flight recorder.
+  FlightRecorder::Timeline _timeline;
+
   std::vector<ImplicitRegistrationSet*> _reg_sets;
 
   int32_t _deregistration_reason;
@@ -101,22 +106,24 @@ public:
                   const Config* cfg,
                   SAS::TrailId trail) :
     Diameter::Task(dict, fd_msg, trail), _cfg(cfg), _ppr(_msg)
-  {}
-
-  virtual ~PushProfileTask()
   {
-    if (_ims_sub)
-    {
-      delete _ims_sub; _ims_sub = NULL;
-    }
+    _stop_watch.start();
   }
 
+  virtual ~PushProfileTask();
+
   void run();
 
 private:
   const Config* _cfg;
   Cx::PushProfileRequest _ppr;
 
+  // Times the request from when it's received until the PPA is sent.
+  Utils::StopWatch _stop_watch;
+
+  // The stages the request has been through, for the flight recorder.
+  FlightRecorder::Timeline _timeline;
+
   ImsSubscription* _ims_sub = NULL;
 
   bool _ims_sub_present;
@@ -147,5 +154,8 @@ private:
 
 void configure_handler_cx_results_tables(SNMP::CxCounterTable* ppr_results_table,
                                          SNMP::CxCounterTable* rtr_results_table);
+void configure_handler_stats(StatisticsManager* stats_manager);
+void configure_handler_flight_recorder(FlightRecorder* flight_recorder);
+void configure_handler_sas_encoder(SasEncoder* sas_encoder);
 
 #endif
@@ -11,11 +11,17 @@
 #ifndef DIAMETER_HSS_CONNECTION_H__
 #define DIAMETER_HSS_CONNECTION_H__
 
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "diameterstack.h"
 #include "cx.h"
 #include "snmp_cx_counter_table.h"
 #include "hss_connection.h"
+#include "peer_latency_tracker.h"
+#include "peer_selector.h"
+#include "timer_queue.h"
 
 namespace HssConnection {
 
@@ -42,12 +48,24 @@ class DiameterHssConnection : public HssConnection
 public:
   virtual ~DiameterHssConnection() {};
 
+  // If a latency tracker is supplied, the timeout for each MAR, UAR and LIR
+  // is derived from the latency of recent requests, up to
+  // diameter_timeout_ms. SARs always use diameter_timeout_ms. If a hedge
+  // timer is supplied as well, and there's no dest_host, MARs, UARs and LIRs
+  // are resent to a second peer if they haven't been answered within the
+  // 99th percentile latency.
+  //
+  // If a peer selector is supplied and there's no dest_host, each request is
+  // sent to the peer that the selector chooses.
   DiameterHssConnection(StatisticsManager* stats_manager,
                         Cx::Dictionary* dict,
                         Diameter::Stack* diameter_stack,
                         const std::string& dest_realm,
                         const std::string& dest_host,
-                        int diameter_timeout_ms);
+                        int diameter_timeout_ms,
+                        PeerLatencyTracker* latency_tracker = NULL,
+                        TimerQueue* hedge_timer = NULL,
+                        PeerSelector* peer_selector = NULL);
 
   // Send a multimedia auth request to the HSS
   virtual void send_multimedia_auth_request(maa_cb callback,
@@ -75,6 +93,114 @@ private:
   std::string _dest_realm;
   std::string _dest_host;
   int _diameter_timeout_ms;
+  PeerLatencyTracker* _latency_tracker;
+  TimerQueue* _hedge_timer;
+  PeerSelector* _peer_selector;
+
+  // Returns the Destination-Host for a new request.
+  std::string select_dest_host();
+
+  // Send each type of request to the given Destination-Host (or just to the
+  // Destination-Realm if it's empty). If the request is one leg of a hedged
+  // request, claim decides whether its answer is used.
+  void send_mar(maa_cb callback,
+                const MultimediaAuthRequest& request,
+                SAS::TrailId trail,
+                const std::string& dest_host,
+                std::function<bool(const MultimediaAuthAnswer&)> claim);
+  void send_uar(uaa_cb callback,
+                const UserAuthRequest& request,
+                SAS::TrailId trail,
+                const std::string& dest_host,
+                std::function<bool(const UserAuthAnswer&)> claim);
+  void send_lir(lia_cb callback,
+                const LocationInfoRequest& request,
+                SAS::TrailId trail,
+                const std::string& dest_host,
+                std::function<bool(const LocationInfoAnswer&)> claim);
+
+  int timeout_ms(const std::string& dest_host);
+
+  // Sends an idempotent request, and resends it to a second peer if the
+  // first doesn't answer quickly enough. send_fn is one of send_mar,
+  // send_uar or send_lir, and claim is passed on to it.
+  //
+  // The callback and request are only copied if the request is hedged, in
+  // which case they're moved into a single HedgedRequest shared by both
+  // legs.
+  template <class AnswerType, class RequestType>
+  void send_hedged(std::function<void(const AnswerType&)>& callback,
+                   RequestType& request,
+                   SAS::TrailId trail,
+                   void (DiameterHssConnection::*send_fn)(std::function<void(const AnswerType&)>,
+                                                          const RequestType&,
+                                                          SAS::TrailId,
+                                                          const std::string&,
+                                                          std::function<bool(const AnswerType&)>));
+
+  // The state of a request that may be hedged. The first useful answer from
+  // either peer is passed to the callback, and the other is discarded. Only
+  // the leg whose answer is used updates the Cx statistics, so a hedged
+  // request is counted once.
+  template <class AnswerType, class RequestType>
+  class HedgedRequest
+  {
+  public:
+    typedef std::function<void(const AnswerType&)> callback_t;
+    typedef std::function<bool(const AnswerType&)> claim_t;
+
+    HedgedRequest(callback_t& callback,
+                  RequestType& request,
+                  SAS::TrailId trail,
+                  StatisticsManager* stats_manager) :
+      _request(std::move(request)),
+      _trail(trail),
+      _callback(std::move(callback)),
+      _stats_manager(stats_manager),
+      _outstanding(1),
+      _hedged(false),
+      _answered(false)
+    {};
+
+    // The request, which is sent to both peers.
+    const RequestType _request;
+    const SAS::TrailId _trail;
+
+    // Returns the callback for either leg, which is only called with the
+    // answer that's used.
+    static callback_t leg_callback(std::shared_ptr<HedgedRequest> request)
+    {
+      return [request](const AnswerType& answer)
+      {
+        request->_callback(answer);
+      };
+    }
+
+    // Returns the function that decides whether the answer to the original
+    // request (or the hedge) is the one that's used.
+    static claim_t leg_claim(std::shared_ptr<HedgedRequest> request,
+                             bool hedge)
+    {
+      return [request, hedge](const AnswerType& answer)
+      {
+        return request->claim(answer, hedge);
+      };
+    }
+
+    // Called when the hedge is due. Returns false if the hedge isn't needed
+    // because the request has already been answered.
+    bool start_hedge();
+
+  private:
+    bool claim(const AnswerType& answer, bool hedge);
+
+    callback_t _callback;
+    StatisticsManager* _stats_manager;
+    std::mutex _lock;
+    int _outstanding;
+    bool _hedged;
+    bool _answered;
+  };
 
   // Inner classes for the DiameterTransactions.
   template <class AnswerType>
@@ -82,6 +208,7 @@ private:
   {
   public:
     typedef std::function<void(const AnswerType&)> callback_t;
+    typedef std::function<bool(const AnswerType&)> claim_t;
 
     DiameterTransaction(Cx::Dictionary* dict,
                         SAS::TrailId trail,
@@ -90,29 +217,83 @@ private:
                         SNMP::CxCounterTable* cx_results_tbl,
                         StatisticsManager* stats_manager) :
       Diameter::Transaction(dict, trail),
+      _cx_dict(dict),
       _stat_updates(stat_updates),
-      _response_clbk(response_clbk),
+      _response_clbk(std::move(response_clbk)),
       _cx_results_tbl(cx_results_tbl),
-      _stats_manager(stats_manager)
+      _stats_manager(stats_manager),
+      _latency_tracker(NULL),
+      _peer_selector(NULL),
+      _result(0),
+      _experimental(0),
+      _vendor(0)
     {};
 
+    // Record the latency of this transaction, and whether it succeeded,
+    // against the peer it was sent to (or against the peer that answers it,
+    // if dest_host is empty).
+    void set_peer(const std::string& dest_host,
+                  PeerLatencyTracker* latency_tracker,
+                  PeerSelector* peer_selector)
+    {
+      _dest_host = dest_host;
+      _latency_tracker = latency_tracker;
+      _peer_selector = peer_selector;
+
+      if (_peer_selector != NULL)
+      {
+        _peer_selector->start(_dest_host);
+      }
+    }
+
+    // Make this transaction one leg of a hedged request. claim is called
+    // with this leg's answer, and returns whether it's the one that's used.
+    // Only that leg calls the callback and updates the Cx statistics.
+    void set_claim(claim_t claim)
+    {
+      _claim = std::move(claim);
+    }
+
   protected:
+    Cx::Dictionary* _cx_dict;
     StatsFlags _stat_updates;
     callback_t _response_clbk;
     SNMP::CxCounterTable* _cx_results_tbl;
     StatisticsManager* _stats_manager;
+    PeerLatencyTracker* _latency_tracker;
+    PeerSelector* _peer_selector;
+    std::string _dest_host;
+    claim_t _claim;
 
     // Implementations will use this to create the correct answer
     virtual AnswerType create_answer(Diameter::Message& rsp) = 0;
     void on_timeout();
     void on_response(Diameter::Message& rsp);
-    void increment_results(int32_t result, int32_t experimental, uint32_t vendor);
+
+    // Implementations call this with the result of the answer. The Cx
+    // results table is only updated once we know the answer will be used.
+    void store_results(int32_t result, int32_t experimental, uint32_t vendor);
     void sas_log_hss_failure(int event_id,
                              int32_t result_code,
                              int32_t experimental_result_code);
 
+    // Implementations log SAS events about the answer with this. If this is
+    // a leg of a hedged request, they're only logged if its answer is used,
+    // so that the trail shows one outcome.
+    void sas_log(SAS::Event& event);
+
   private:
+    int32_t _result;
+    int32_t _experimental;
+    uint32_t _vendor;
+    std::vector<SAS::Event> _sas_events;
+
+    bool claim(const AnswerType& answer);
+    void report_sas_events();
+    void increment_results();
+    void update_latency_tracker(const std::string& peer);
     void update_latency_stats();
+    void update_peer_selector(const std::string& answered_by, bool failed);
   };
 
   class MarDiameterTransaction : public DiameterTransaction<MultimediaAuthAnswer>
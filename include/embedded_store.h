@@ -0,0 +1,146 @@
+/**
+ * @file embedded_store.h In-process implementation of the Store interface
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef EMBEDDED_STORE_H_
+#define EMBEDDED_STORE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "store.h"
+
+/**
+ * A Store that holds its records in this process's memory, for single node
+ * deployments and load tests, where going to memcached costs a network hop
+ * per operation for no benefit.
+ *
+ * It behaves like memcached - records have real CAS values and expire after
+ * their TTL, and the least recently used records are evicted once the store
+ * is full. Records are spread across a number of shards, each with its own
+ * lock, so that threads working on different keys rarely contend.
+ */
+class EmbeddedStore : public Store
+{
+public:
+  static const int DEFAULT_SHARDS = 64;
+  static const int DEFAULT_SWEEP_INTERVAL_MS = 1000;
+
+  /// @param max_bytes    - The most memory that the records may use. This is
+  ///                       split evenly between the shards.
+  /// @param num_shards   - The number of shards.
+  /// @param sweep_interval_ms
+  ///                     - How often the background thread removes expired
+  ///                       records.
+  EmbeddedStore(size_t max_bytes,
+                int num_shards = DEFAULT_SHARDS,
+                int sweep_interval_ms = DEFAULT_SWEEP_INTERVAL_MS);
+  virtual ~EmbeddedStore();
+
+  /// Starts the thread that removes expired records.
+  bool start();
+  void stop();
+
+  Store::Status get_data(const std::string& table,
+                         const std::string& key,
+                         std::string& data,
+                         uint64_t& cas,
+                         SAS::TrailId trail = 0,
+                         bool log_body = true);
+
+  /// Writes a record. A CAS of 0 only succeeds if there's no record already.
+  /// Otherwise the CAS must match the record's current CAS, or this returns
+  /// DATA_CONTENTION.
+  Store::Status set_data(const std::string& table,
+                         const std::string& key,
+                         const std::string& data,
+                         uint64_t cas,
+                         int expiry,
+                         SAS::TrailId trail = 0,
+                         bool log_body = true);
+
+  Store::Status set_data_without_cas(const std::string& table,
+                                     const std::string& key,
+                                     const std::string& data,
+                                     int expiry,
+                                     SAS::TrailId trail = 0,
+                                     bool log_body = true);
+
+  Store::Status delete_data(const std::string& table,
+                            const std::string& key,
+                            SAS::TrailId trail = 0);
+
+  /// Removes all the expired records. This is done periodically by the
+  /// background thread, but expired records are never returned anyway.
+  void sweep();
+
+  /// The number of records, including any that have expired but haven't
+  /// been swept yet.
+  size_t size() const;
+
+  /// The memory that the records are using.
+  size_t bytes() const;
+
+private:
+  struct Record
+  {
+    std::string data;
+    uint64_t cas;
+    time_t expiry;
+    std::list<std::string>::iterator lru_position;
+  };
+
+  // The records in a shard, with the most recently used key at the front of
+  // the LRU list.
+  struct Shard
+  {
+    std::mutex lock;
+    std::unordered_map<std::string, Record> records;
+    std::list<std::string> lru;
+    size_t bytes = 0;
+  };
+
+  typedef std::unordered_map<std::string, Record>::iterator RecordIterator;
+
+  Shard& shard_for(const std::string& record_key);
+
+  Store::Status write(const std::string& table,
+                      const std::string& key,
+                      const std::string& data,
+                      bool check_cas,
+                      uint64_t cas,
+                      int expiry);
+
+  // These must be called with the shard's lock held.
+  static void erase(Shard& shard, RecordIterator record);
+  static size_t record_bytes(const std::string& record_key,
+                             const std::string& data);
+
+  void run_sweeper();
+
+  const size_t _max_shard_bytes;
+  const int _sweep_interval_ms;
+  std::vector<std::unique_ptr<Shard>> _shards;
+  std::atomic<uint64_t> _next_cas;
+
+  std::mutex _sweeper_lock;
+  std::condition_variable _sweeper_cond;
+  bool _terminated;
+  std::thread _sweeper;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * @file flight_recorder.h Records the stage timelines of slow requests
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+#include "sas.h"
+#include "utils.h"
+
+/**
+ * Keeps the stage timelines of the most recent requests that took longer than
+ * a threshold, so that the time taken by a slow request can be attributed to
+ * the stages it went through without turning on debug logging.
+ *
+ * Each request keeps a Timeline, marking it as it reaches each stage. When the
+ * request completes, the timeline is passed to record(), which copies it into
+ * a fixed size ring buffer if the request was slow. Recording doesn't take a
+ * lock - if a slot is being written by another thread (which only happens if
+ * the buffer wraps while a record is being copied), the record is dropped.
+ */
+class FlightRecorder
+{
+public:
+  static const int MAX_STAGES = 16;
+  static const size_t MAX_TYPE_LENGTH = 16;
+  static const size_t MAX_ID_LENGTH = 128;
+
+  struct Stage
+  {
+    // Stage names must be string literals, as only the pointer is kept.
+    const char* name;
+    unsigned long time_us;
+  };
+
+  // The stages a request has reached, and how long after the request started
+  // it reached each of them.
+  class Timeline
+  {
+  public:
+    Timeline();
+
+    /// Marks that the request has reached a stage. Stages beyond MAX_STAGES
+    /// are ignored.
+    void mark(const char* stage);
+
+    int num_stages() const { return _num_stages; }
+    const Stage& stage(int ii) const { return _stages[ii]; }
+
+  private:
+    friend class FlightRecorder;
+
+    Utils::StopWatch _stop_watch;
+    uint64_t _start_time_ms;
+    int _num_stages;
+    Stage _stages[MAX_STAGES];
+  };
+
+  /// @param threshold_ms - Requests that take at least this long are recorded.
+  /// @param capacity     - The number of requests to keep.
+  FlightRecorder(unsigned long threshold_ms, size_t capacity);
+  virtual ~FlightRecorder();
+
+  /// Returns whether a request has taken at least the threshold so far. This
+  /// lets callers skip building the request's ID for requests that won't be
+  /// recorded.
+  bool is_slow(Timeline& timeline) const;
+
+  /// Records a completed request if it took at least the threshold.
+  ///
+  /// @param type     - The type of request, e.g. "RTR".
+  /// @param id       - Identifies the request, e.g. its path or IMPI.
+  /// @param trail    - The request's SAS trail.
+  /// @param timeline - The request's timeline.
+  /// @returns whether the request was recorded.
+  bool record(const char* type,
+              const std::string& id,
+              SAS::TrailId trail,
+              Timeline& timeline);
+
+  /// Writes the recorded requests, oldest first, as a JSON object.
+  void write_json(rapidjson::Writer<rapidjson::StringBuffer>& writer) const;
+
+  uint64_t num_dropped() const { return _dropped.load(); }
+
+private:
+  struct Record
+  {
+    uint64_t sequence;
+    char type[MAX_TYPE_LENGTH];
+    char id[MAX_ID_LENGTH];
+    SAS::TrailId trail;
+    uint64_t start_time_ms;
+    unsigned long duration_us;
+    int num_stages;
+    Stage stages[MAX_STAGES];
+  };
+
+  // A slot in the ring buffer. The version is odd while the record is being
+  // written, and is bumped again once it's complete, so that a reader can
+  // tell if it has copied a record that was changing under it.
+  struct Slot
+  {
+    std::atomic<uint64_t> version;
+    Record record;
+  };
+
+  // Copies the record out of a slot. Returns false if the slot is empty or
+  // was being written.
+  bool read_slot(const Slot& slot, Record& record) const;
+
+  unsigned long _threshold_us;
+  size_t _capacity;
+  Slot* _slots;
+  std::atomic<uint64_t> _next;
+  std::atomic<uint64_t> _dropped;
+};
+
+#endif
@@ -161,4 +161,16 @@ static const PDLog2<const char*, int> CL_HOMESTEAD_DIAMETER_STOP_FAIL
   "No action required."
 );
 
+static const PDLog CL_HOMESTEAD_IMPU_STORE_LOG_SHARED
+(
+  PDLogBase::CL_HOMESTEAD_ID + 14,
+  LOG_WARNING,
+  "The IMPU store log is in use with an IMPU store shared with other nodes.",
+  "The IMPU store log only holds this node's writes. If the IMPU store loses "
+  "its data, restoring from the log may bring back records that other nodes "
+  "have since changed or deleted.",
+  "Subscriber data restored after the IMPU store loses its data may be stale.",
+  "Only use homestead_impu_store_log in deployments with a single Homestead."
+);
+
 #endif
@@ -0,0 +1,103 @@
+/**
+ * @file homestead_probes.h Static tracepoints on Homestead's hot paths
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HOMESTEAD_PROBES_H_
+#define HOMESTEAD_PROBES_H_
+
+/**
+ * USDT probes in the "homestead" provider. When the probes aren't attached
+ * they are a single nop each, so they can be left in production builds. They
+ * are compiled in if HOMESTEAD_USDT is defined (which the Makefile does if
+ * sys/sdt.h is available), and compile to nothing otherwise - in that case
+ * the arguments aren't evaluated.
+ *
+ * String arguments are NUL-terminated char pointers, trails are SAS trail
+ * IDs, statuses are Store::Status values and sizes are in bytes. The
+ * arguments are always evaluated when the probes are compiled in, so they
+ * must be cheap.
+ *
+ *   cache_op_start(op, key, trail)
+ *   cache_op_done(op, key, trail, status)
+ *     - A MemcachedCache operation, e.g. op "get_irs" keyed on the IMPU.
+ *
+ *   store_op_start(op, table, key, trail)
+ *   store_op_done(op, table, key, trail, status, size)
+ *     - A "get", "set", "cas" or "delete" of an ImpuStore record in the
+ *       "impu" or "impi_mapping" table.
+ *
+ *   impu_decode_start(impu, trail, size)
+ *   impu_decode_done(impu, trail, ok)
+ *   impu_encode_start(impu, trail)
+ *   impu_encode_done(impu, trail, status, size)
+ *     - Conversion of an IMPU record from or to its compressed form.
+ *
+ *   hss_request_sent(type, dest_host, trail)
+ *   hss_answer_received(host, trail, result)
+ *     - A Cx request to the HSS, e.g. type "MAR", and the ResultCode of its
+ *       answer. A timeout has result 0. The hosts are empty if the request
+ *       wasn't sent to, or isn't known to be answered by, a particular peer.
+ *
+ *   xml_build_start(size)
+ *   xml_build_done(size, rc)
+ *     - Building ClearwaterRegData XML from User-Data XML of the given size.
+ *       The done probe has the size of the built XML and the HTTP result.
+ *
+ *   xml_parse_start(size)
+ *   xml_parse_done(size, ids)
+ *     - Parsing identities from User-Data XML, and the number found.
+ *
+ * For example, to get the distribution of store latencies by operation:
+ *
+ *   bpftrace -e 'usdt:/usr/share/clearwater/bin/homestead:homestead:store_op_start
+ *                { @start[tid] = nsecs; }
+ *                usdt:/usr/share/clearwater/bin/homestead:homestead:store_op_done
+ *                /@start[tid]/
+ *                { @us[str(arg0)] = hist((nsecs - @start[tid]) / 1000);
+ *                  delete(@start[tid]); }'
+ */
+#ifdef HOMESTEAD_USDT
+
+#include <sys/sdt.h>
+
+#define HOMESTEAD_PROBE1(NAME, A1) \
+  DTRACE_PROBE1(homestead, NAME, A1)
+#define HOMESTEAD_PROBE2(NAME, A1, A2) \
+  DTRACE_PROBE2(homestead, NAME, A1, A2)
+#define HOMESTEAD_PROBE3(NAME, A1, A2, A3) \
+  DTRACE_PROBE3(homestead, NAME, A1, A2, A3)
+#define HOMESTEAD_PROBE4(NAME, A1, A2, A3, A4) \
+  DTRACE_PROBE4(homestead, NAME, A1, A2, A3, A4)
+#define HOMESTEAD_PROBE5(NAME, A1, A2, A3, A4, A5) \
+  DTRACE_PROBE5(homestead, NAME, A1, A2, A3, A4, A5)
+#define HOMESTEAD_PROBE6(NAME, A1, A2, A3, A4, A5, A6) \
+  DTRACE_PROBE6(homestead, NAME, A1, A2, A3, A4, A5, A6)
+
+#else
+
+// The arguments are still type checked, but the compiler drops them.
+#define HOMESTEAD_PROBE1(NAME, A1) \
+  do { if (0) { (void)(A1); } } while (0)
+#define HOMESTEAD_PROBE2(NAME, A1, A2) \
+  do { if (0) { (void)(A1); (void)(A2); } } while (0)
+#define HOMESTEAD_PROBE3(NAME, A1, A2, A3) \
+  do { if (0) { (void)(A1); (void)(A2); (void)(A3); } } while (0)
+#define HOMESTEAD_PROBE4(NAME, A1, A2, A3, A4) \
+  do { if (0) { (void)(A1); (void)(A2); (void)(A3); (void)(A4); } } while (0)
+#define HOMESTEAD_PROBE5(NAME, A1, A2, A3, A4, A5) \
+  do { if (0) { (void)(A1); (void)(A2); (void)(A3); (void)(A4); \
+                (void)(A5); } } while (0)
+#define HOMESTEAD_PROBE6(NAME, A1, A2, A3, A4, A5, A6) \
+  do { if (0) { (void)(A1); (void)(A2); (void)(A3); (void)(A4); \
+                (void)(A5); (void)(A6); } } while (0)
+
+#endif
+
+#endif
@@ -64,6 +64,7 @@ namespace SASEvent
   const int PPR_RECEIVED = HOMESTEAD_BASE + 0x230;
   const int RTR_RECEIVED = HOMESTEAD_BASE + 0x240;
   const int PPR_CHANGE_DEFAULT_IMPU = HOMESTEAD_BASE + 0x0260;
+  const int NEGATIVE_CACHE_HIT = HOMESTEAD_BASE + 0x0270;
 
 } // namespace SASEvent
 
@@ -0,0 +1,100 @@
+/**
+ * @file hsprov_cache.h Short-lived cache of data read from Homestead-prov
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HSPROV_CACHE_H_
+#define HSPROV_CACHE_H_
+
+#include <mutex>
+#include <string>
+#include <time.h>
+
+#include "authvector.h"
+#include "charging_addresses.h"
+#include "lru_map.h"
+#include "statisticsmanager.h"
+
+/**
+ * Caches the digest auth vectors and registration data that Homestead reads
+ * from Homestead-prov, so that repeated requests for the same subscriber
+ * don't each have to wait on Cassandra.
+ *
+ * This data only changes when a subscriber is reprovisioned, so each entry is
+ * kept for a short TTL, and can be invalidated explicitly. The number of
+ * entries is bounded, with the least recently used entries evicted first.
+ */
+class HsProvCache
+{
+public:
+  /// @param ttl_s         - How long each entry is kept for.
+  /// @param max_entries   - The maximum number of auth vectors, and of sets
+  ///                        of registration data, to keep.
+  /// @param stats_manager - Counts cache hits and misses.
+  HsProvCache(int ttl_s, size_t max_entries, StatisticsManager* stats_manager);
+  virtual ~HsProvCache() {};
+
+  /// Looks up the digest auth vector for a private ID (when requested along
+  /// with the given public ID).
+  ///
+  /// @returns true if the auth vector is cached.
+  virtual bool get_av(const std::string& impi,
+                      const std::string& impu,
+                      DigestAuthVector& av);
+  virtual void put_av(const std::string& impi,
+                      const std::string& impu,
+                      const DigestAuthVector& av);
+
+  /// Looks up the registration data for a public ID.
+  ///
+  /// @returns true if the registration data is cached.
+  virtual bool get_reg_data(const std::string& impu,
+                            std::string& xml,
+                            ChargingAddresses& charging_addrs);
+  virtual void put_reg_data(const std::string& impu,
+                            const std::string& xml,
+                            const ChargingAddresses& charging_addrs);
+
+  /// Discards everything cached for a private ID.
+  ///
+  /// @returns the number of entries discarded.
+  virtual size_t invalidate_impi(const std::string& impi);
+
+  /// Discards everything cached for a public ID.
+  ///
+  /// @returns the number of entries discarded.
+  virtual size_t invalidate_impu(const std::string& impu);
+
+  /// Discards everything in the cache.
+  ///
+  /// @returns the number of entries discarded.
+  virtual size_t invalidate_all();
+
+private:
+  struct RegData
+  {
+    std::string xml;
+    ChargingAddresses charging_addrs;
+  };
+
+  // Auth vectors are keyed on the private and public IDs, as the public ID
+  // determines whether the auth vector is returned at all.
+  static std::string av_key(const std::string& impi, const std::string& impu);
+
+  void record_lookup(bool hit);
+
+  int _ttl_s;
+  StatisticsManager* _stats_manager;
+
+  std::mutex _lock;
+  LruMap<DigestAuthVector> _avs;
+  LruMap<RegData> _reg_data;
+};
+
+#endif
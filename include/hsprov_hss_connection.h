@@ -13,6 +13,7 @@
 
 #include <string>
 #include "hss_connection.h"
+#include "hsprov_cache.h"
 #include "hsprov_store.h"
 
 namespace HssConnection {
@@ -22,8 +23,13 @@ class HsProvHssConnection : public HssConnection
 public:
   virtual ~HsProvHssConnection() {};
 
-  // The Store is passed in the constructor so that we can mock it out in UTs
-  HsProvHssConnection(StatisticsManager* stats, HsProvStore* store, std::string server_name);
+  // The Store is passed in the constructor so that we can mock it out in UTs.
+  // If a cache is supplied, auth vectors and registration data are read from
+  // it where possible, and added to it when read from the Store.
+  HsProvHssConnection(StatisticsManager* stats,
+                      HsProvStore* store,
+                      std::string server_name,
+                      HsProvCache* cache = NULL);
 
   // Send a multimedia auth request to the HSS
   virtual void send_multimedia_auth_request(maa_cb callback,
@@ -55,13 +61,27 @@ public:
                       callback_t callback,
                       StatisticsManager* stats_manager) :
       CassandraStore::Transaction(trail),
-      _response_clbk(callback),
-      _stats_manager(stats_manager)
+      _response_clbk(std::move(callback)),
+      _stats_manager(stats_manager),
+      _cache(NULL)
     {};
 
+    // Add the result of this transaction to the cache, if it succeeds.
+    void set_cache(HsProvCache* cache,
+                   const std::string& impi,
+                   const std::string& impu)
+    {
+      _cache = cache;
+      _impi = impi;
+      _impu = impu;
+    }
+
   protected:
     callback_t _response_clbk;
     StatisticsManager* _stats_manager;
+    HsProvCache* _cache;
+    std::string _impi;
+    std::string _impu;
 
     // Implementations will use these to create the correct answer
     virtual AnswerType create_answer(CassandraStore::Operation* op) = 0;
@@ -110,6 +130,7 @@ public:
 
 private:
   HsProvStore* _store;
+  HsProvCache* _cache;
   static std::string _configured_server_name;
 };
 }; // namespace HssConnection
@@ -0,0 +1,217 @@
+/**
+ * @file hsprov_snapshot.h Offline snapshot of the Homestead-prov keyspace
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HSPROV_SNAPSHOT_H_
+#define HSPROV_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "hsprov_store.h"
+#include "indexed_file.h"
+
+/**
+ * A snapshot of the subscriber data in the Homestead-prov keyspace, held in a
+ * local file. This allows Homestead to serve subscribers from the file,
+ * without needing Cassandra at all.
+ *
+ * The snapshot is an IndexedFile. The reader looks up records through the
+ * index and returns fields that point straight into the mapping, so opening
+ * a snapshot doesn't require reading or parsing the whole file.
+ */
+class HsProvSnapshot
+{
+public:
+  enum RecordType : uint8_t
+  {
+    IMPU = 0,
+    IMPI = 1
+  };
+
+  // The fields of an IMPU record.
+  enum ImpuField
+  {
+    IMS_SUB_XML = 0,
+    PRIMARY_CCF,
+    SECONDARY_CCF,
+    PRIMARY_ECF,
+    SECONDARY_ECF,
+    NUM_IMPU_FIELDS
+  };
+
+  // The fields of an IMPI record. These are followed by a field for each
+  // public ID associated with the private ID.
+  enum ImpiField
+  {
+    DIGEST_HA1 = 0,
+    DIGEST_REALM,
+    DIGEST_QOP,
+    FIRST_PUBLIC_ID
+  };
+
+  // A field of a record. This points into the reader's mapping of the file,
+  // so is only valid for the life of the reader.
+  struct Field
+  {
+    const char* data;
+    uint32_t length;
+
+    std::string str() const { return std::string(data, length); }
+
+    bool operator==(const std::string& other) const
+    {
+      return other.compare(0, std::string::npos, data, length) == 0;
+    }
+  };
+
+  // Each record is a RecordHeader followed by the key and the record's
+  // fields, each of which is a 32-bit length followed by the bytes of the
+  // field.
+  struct RecordHeader
+  {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t num_fields;
+  };
+
+  static const uint32_t VERSION = 1;
+
+  class Writer
+  {
+  public:
+    Writer(const std::string& path);
+    virtual ~Writer() {};
+
+    /// Opens the temporary file that the snapshot is written to.
+    bool open() { return _file.open(); }
+
+    /// Appends a record to the snapshot.
+    bool add(RecordType type,
+             const std::string& key,
+             const std::vector<std::string>& fields);
+
+    /// Writes the index and header, and renames the snapshot into place.
+    /// The writer can't be used after this is called.
+    bool commit() { return _file.commit(); }
+
+    uint64_t num_records() const { return _file.num_records(); }
+
+  private:
+    bool write_field(const std::string& field);
+
+    IndexedFile::Writer _file;
+  };
+
+  class Reader
+  {
+  public:
+    Reader(const std::string& path);
+    virtual ~Reader() {};
+
+    /// Maps the snapshot into memory and validates the header.
+    bool open() { return _file.open(); }
+
+    uint64_t num_records() const { return _file.num_records(); }
+
+    /// Looks up a record by type and key.
+    ///
+    /// @param fields - Set to the fields of the record (not including the
+    ///                 key).
+    bool get(RecordType type,
+             const std::string& key,
+             std::vector<Field>& fields) const;
+
+  private:
+    // Reads the fields of the record at the given offset, including the key.
+    bool read_fields(uint64_t offset,
+                     RecordType& type,
+                     std::vector<Field>& fields) const;
+
+    IndexedFile::Reader _file;
+  };
+};
+
+/**
+ * An HsProvStore that answers requests from a snapshot file, rather than
+ * from Cassandra. Requests are answered synchronously on the calling thread,
+ * as each one is just a lookup in the mapped file.
+ */
+class HsProvSnapshotStore : public HsProvStore
+{
+public:
+  HsProvSnapshotStore(const std::string& path);
+  virtual ~HsProvSnapshotStore();
+
+  /// Opens the snapshot file.
+  bool open();
+
+  uint64_t num_records() const { return _reader.num_records(); }
+
+  void do_async(CassandraStore::Operation*& op,
+                CassandraStore::Transaction*& trx) override;
+
+  GetRegData* create_GetRegData(const std::string& public_id) override
+  {
+    return new SnapshotGetRegData(public_id);
+  }
+
+  GetAuthVector* create_GetAuthVector(const std::string& private_id) override
+  {
+    return new SnapshotGetAuthVector(private_id);
+  }
+
+  GetAuthVector* create_GetAuthVector(const std::string& private_id,
+                                      const std::string& public_id) override
+  {
+    return new SnapshotGetAuthVector(private_id, public_id);
+  }
+
+private:
+  // Operations that can be answered from the snapshot.
+  class SnapshotOperation
+  {
+  public:
+    virtual ~SnapshotOperation() {};
+
+    /// @returns whether the operation succeeded.
+    virtual bool perform_snapshot(const HsProvSnapshot::Reader& snapshot) = 0;
+  };
+
+  class SnapshotGetRegData : public GetRegData, public SnapshotOperation
+  {
+  public:
+    SnapshotGetRegData(const std::string& public_id) :
+      GetRegData(public_id)
+    {};
+
+    bool perform_snapshot(const HsProvSnapshot::Reader& snapshot) override;
+  };
+
+  class SnapshotGetAuthVector : public GetAuthVector, public SnapshotOperation
+  {
+  public:
+    SnapshotGetAuthVector(const std::string& private_id) :
+      GetAuthVector(private_id)
+    {};
+
+    SnapshotGetAuthVector(const std::string& private_id,
+                          const std::string& public_id) :
+      GetAuthVector(private_id, public_id)
+    {};
+
+    bool perform_snapshot(const HsProvSnapshot::Reader& snapshot) override;
+  };
+
+  HsProvSnapshot::Reader _reader;
+};
+
+#endif
@@ -128,6 +128,34 @@ public:
   {
     return new GetAuthVector(private_id, public_id);
   }
+
+  class ExportSnapshot : public CassandraStore::Operation
+  {
+  public:
+    /// Export the registration data and auth vectors of every subscriber to
+    /// a snapshot file (see HsProvSnapshot).
+    ///
+    /// @param path the file to write the snapshot to.
+    ExportSnapshot(const std::string& path);
+    virtual ~ExportSnapshot();
+
+    /// @return the number of records written to the snapshot.
+    uint64_t get_records() const { return _records; }
+
+  protected:
+    // Request parameters.
+    std::string _path;
+
+    // Result.
+    uint64_t _records;
+
+    bool perform(CassandraStore::Client* client, SAS::TrailId trail);
+  };
+
+  virtual ExportSnapshot* create_ExportSnapshot(const std::string& path)
+  {
+    return new ExportSnapshot(path);
+  }
 };
 
 #endif
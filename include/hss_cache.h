@@ -28,7 +28,7 @@ public:
   {
   }
 
-  // All of these methods are synchronous, and run on a thread that is OK to block
+  // Except for the _async methods, all of these methods are synchronous, and run on a thread that is OK to block
   // They return Store::Status (from cpp-common's Store) which is used to determine which callback to use
   // If they are getting/listing data, the data is put into the supplied datastructure
 
@@ -40,6 +40,26 @@ public:
                                                                SAS::TrailId trail,
                                                                ImplicitRegistrationSet*& result) = 0;
 
+  // Whether get_implicit_registration_set_for_impu_async completes without
+  // blocking the calling thread
+  virtual bool supports_async_get() const
+  {
+    return false;
+  }
+
+  // Get the IRS for a given impu, passing the result to the callback (which
+  // takes ownership of the IRS if the status is OK). Caches that don't block
+  // override this - by default it is synchronous.
+  typedef std::function<void(Store::Status, ImplicitRegistrationSet*)> irs_result_callback;
+  virtual void get_implicit_registration_set_for_impu_async(const std::string& impu,
+                                                            SAS::TrailId trail,
+                                                            irs_result_callback callback)
+  {
+    ImplicitRegistrationSet* result = NULL;
+    Store::Status status = get_implicit_registration_set_for_impu(impu, trail, result);
+    callback(status, result);
+  }
+
   // Get the list of IRSs for the given list of impus
   // Used for RTR when we have a list of impus
   virtual Store::Status get_implicit_registration_sets_for_impis(const std::vector<std::string>& impis,
@@ -15,6 +15,8 @@
 #include "threadpool.h"
 #include "ims_subscription.h"
 #include "sas.h"
+#include "statisticsmanager.h"
+#include "utils.h"
 
 typedef std::function<void(Store::Status)> failure_callback;
 typedef std::function<void(ImplicitRegistrationSet*)> irs_success_callback;
@@ -29,7 +31,9 @@ public:
 
   // Creates the HssCacheProcessor, but not the thread pool.
   // start_threads() must be called to create and start the thread pool.
-  HssCacheProcessor(HssCache* cache);
+  // If a statistics manager is supplied, the time each request spends queued
+  // and in the cache is recorded in it.
+  HssCacheProcessor(HssCache* cache, StatisticsManager* stats_manager = NULL);
 
   // Starts the threadpool with the required number of threads
   bool start_threads(int num_threads,
@@ -136,9 +140,24 @@ private:
   {
   }
 
+  // The cache operations whose latency is recorded separately.
+  enum Operation
+  {
+    GET_IRS,
+    PUT_IRS,
+    DELETE_IRS,
+    GET_IMS_SUB,
+    PUT_IMS_SUB
+  };
+
+  void update_queue_latency_stats(Utils::StopWatch& stop_watch);
+  void update_latency_stats(Operation op, Utils::StopWatch& stop_watch);
+
   // The actual HssCache object used to store the data
   HssCache* _cache;
 
+  StatisticsManager* _stats_manager;
+
   // The threadpool on which the requests are run.
   FunctorThreadPool* _thread_pool;
 };
@@ -120,17 +120,28 @@ public:
                        AuthVector* av,
                        std::string scheme) : HssResponse(rc),
     _auth_vector(av),
-    _sip_auth_scheme(scheme)
+    _sip_auth_scheme(std::move(scheme))
   {
   }
 
+  // The answer owns its AuthVector, so it can be moved but not copied.
+  MultimediaAuthAnswer(MultimediaAuthAnswer&& other) : HssResponse(other),
+    _auth_vector(other._auth_vector),
+    _sip_auth_scheme(std::move(other._sip_auth_scheme))
+  {
+    other._auth_vector = NULL;
+  }
+
+  MultimediaAuthAnswer(const MultimediaAuthAnswer&) = delete;
+  MultimediaAuthAnswer& operator=(const MultimediaAuthAnswer&) = delete;
+
   // The pointer is only valid for the life of the MultimediaAuthAnswer
   AuthVector* get_av() const
   {
     return _auth_vector;
   }
 
-  std::string get_scheme() const
+  const std::string& get_scheme() const
   {
     return _sip_auth_scheme;
   }
@@ -143,8 +154,6 @@ private:
 class UserAuthAnswer : public HssResponse
 {
 public:
-  ~UserAuthAnswer(){}
-
   UserAuthAnswer(ResultCode rc) : HssResponse(rc),
     _json_result(0),
     _server_name(""),
@@ -157,8 +166,8 @@ public:
                  std::string server_name,
                  ServerCapabilities capabilities) : HssResponse(rc),
     _json_result(json_result),
-    _server_name(server_name),
-    _server_capabilities(capabilities)
+    _server_name(std::move(server_name)),
+    _server_capabilities(std::move(capabilities))
   {
   }
 
@@ -167,12 +176,12 @@ public:
     return _json_result;
   }
 
-  std::string get_server() const
+  const std::string& get_server() const
   {
     return _server_name;
   }
 
-  ServerCapabilities get_server_capabilities() const
+  const ServerCapabilities& get_server_capabilities() const
   {
     return _server_capabilities;
   }
@@ -187,8 +196,6 @@ private:
 class LocationInfoAnswer : public HssResponse
 {
 public:
-  ~LocationInfoAnswer(){}
-
   LocationInfoAnswer(ResultCode rc) : HssResponse(rc),
     _json_result(0),
     _server_name(""),
@@ -203,9 +210,9 @@ public:
                  ServerCapabilities capabilities,
                  std::string wildcard_impu) : HssResponse(rc),
     _json_result(json_result),
-    _server_name(server_name),
-    _server_capabilities(capabilities),
-    _wildcard_impu(wildcard_impu)
+    _server_name(std::move(server_name)),
+    _server_capabilities(std::move(capabilities)),
+    _wildcard_impu(std::move(wildcard_impu))
   {
   }
 
@@ -214,17 +221,17 @@ public:
     return _json_result;
   }
 
-  std::string get_server() const
+  const std::string& get_server() const
   {
     return _server_name;
   }
 
-  ServerCapabilities get_server_capabilities() const
+  const ServerCapabilities& get_server_capabilities() const
   {
     return _server_capabilities;
   }
 
-  std::string get_wildcard_impu() const
+  const std::string& get_wildcard_impu() const
   {
     return _wildcard_impu;
   }
@@ -240,8 +247,6 @@ private:
 class ServerAssignmentAnswer : public HssResponse
 {
 public:
-  ~ServerAssignmentAnswer(){}
-
   ServerAssignmentAnswer(ResultCode rc) : HssResponse(rc),
     _charging_addrs(),
     _service_profile("")
@@ -252,24 +257,24 @@ public:
                  ChargingAddresses charging_addrs,
                  std::string service_profile,
                  std::string wildcard_impu) : HssResponse(rc),
-    _charging_addrs(charging_addrs),
-    _service_profile(service_profile),
-    _wildcard_impu(wildcard_impu)
+    _charging_addrs(std::move(charging_addrs)),
+    _service_profile(std::move(service_profile)),
+    _wildcard_impu(std::move(wildcard_impu))
   {
   }
 
-  // The pointer is only valid for the life of the UserAuthAnswer
-  ChargingAddresses get_charging_addresses() const
+  // The references are only valid for the life of the ServerAssignmentAnswer
+  const ChargingAddresses& get_charging_addresses() const
   {
     return _charging_addrs;
   }
 
-  std::string get_service_profile() const
+  const std::string& get_service_profile() const
   {
     return _service_profile;
   }
 
-  std::string get_wildcard_impu() const
+  const std::string& get_wildcard_impu() const
   {
     return _wildcard_impu;
   }
@@ -17,10 +17,20 @@
 #include "httpstack_utils.h"
 #include "sas.h"
 #include "sproutconnection.h"
+#include "flight_recorder.h"
 #include "health_checker.h"
 #include "hss_connection.h"
 #include "hss_cache_processor.h"
+#include "hsprov_cache.h"
+#include "hsprov_store.h"
 #include "implicit_reg_set.h"
+#include "impu_store.h"
+#include "negative_cache.h"
+#include "sas_encoder.h"
+#include "statisticsmanager.h"
+
+class ReregistrationRefresher;
+class RegistrationDampener;
 
 // JSON string constants
 const std::string JSON_DIGEST_HA1 = "digest_ha1";
@@ -39,6 +49,7 @@ const std::string JSON_RC = "result-code";
 const std::string JSON_SCSCF = "scscf";
 const std::string JSON_IMPUS = "impus";
 const std::string JSON_WILDCARD = "wildcard-identity";
+const std::string JSON_RECORDS = "records";
 
 // HTTP query string field names
 const std::string AUTH_FIELD_NAME = "resync-auth";
@@ -51,10 +62,16 @@ public:
     HttpStackUtils::Task(req, trail)
   {};
 
+  virtual ~HssCacheTask() {};
+
   static void configure_hss_connection(HssConnection::HssConnection* hss,
                                        std::string server_name);
   static void configure_cache(HssCacheProcessor* cache);
   static void configure_health_checker(HealthChecker* hc);
+  static void configure_stats(StatisticsManager* stats_manager);
+  static void configure_flight_recorder(FlightRecorder* flight_recorder);
+  static void configure_sas_encoder(SasEncoder* sas_encoder);
+  static void configure_negative_cache(NegativeCache* negative_cache);
 
   inline HssCacheProcessor* cache() const
   {
@@ -64,10 +81,31 @@ public:
   void on_diameter_timeout();
 
 protected:
+  // Passes the request's timeline to the flight recorder, if there is one,
+  // and then sends the reply. The request is freed once the reply is sent,
+  // so it's recorded first.
+  void send_http_reply(int status_code);
+
+  // Whether the HSS recently said it doesn't know the subscriber, in answer
+  // to this type of request. If so, the request is answered without asking
+  // the HSS, so this logs that to SAS.
+  bool hss_recently_unknown(NegativeCache::Request request,
+                            const std::string& impi,
+                            const std::string& impu);
+
   static std::string _configured_server_name;
   static HssCacheProcessor* _cache;
   static HssConnection::HssConnection* _hss;
   static HealthChecker* _health_checker;
+  static StatisticsManager* _stats_manager;
+  static FlightRecorder* _flight_recorder;
+  static SasEncoder* _sas_encoder;
+
+  // Subscribers the HSS recently didn't know. NULL if negative caching is
+  // disabled.
+  static NegativeCache* _negative_cache;
+
+  FlightRecorder::Timeline _timeline;
 };
 
 class ImpiTask : public HssCacheTask
@@ -198,16 +236,28 @@ public:
     Config(bool _hss_configured = true,
            int _hss_reregistration_time = 3600,
            int _record_ttl = 7200,
-           bool _support_shared_ifcs = true) :
+           bool _support_shared_ifcs = true,
+           ReregistrationRefresher* _refresher = NULL,
+           RegistrationDampener* _dampener = NULL) :
       hss_configured(_hss_configured),
       hss_reregistration_time(_hss_reregistration_time),
       record_ttl(_record_ttl),
-      support_shared_ifcs(_support_shared_ifcs) {}
+      support_shared_ifcs(_support_shared_ifcs),
+      refresher(_refresher),
+      dampener(_dampener) {}
 
     bool hss_configured;
     int hss_reregistration_time;
     int record_ttl;
     bool support_shared_ifcs;
+
+    // Only set in HSS offload mode, where re-registration SARs are sent in the
+    // background.
+    ReregistrationRefresher* refresher;
+
+    // Stops subscribers that re-register too often from sending a SAR each
+    // time. NULL if dampening is disabled.
+    RegistrationDampener* dampener;
   };
 
   ImpuRegDataTask(HttpStack::Request& req, const Config* cfg, SAS::TrailId trail) :
@@ -229,6 +279,7 @@ public:
   void on_get_reg_data_failure(Store::Status rc);
   void process_received_reg_data();
   void send_server_assignment_request(Cx::ServerAssignmentType type);
+  HssConnection::ServerAssignmentRequest server_assignment_request(Cx::ServerAssignmentType type);
   void on_sar_response(const HssConnection::ServerAssignmentAnswer& saa);
   void on_put_reg_data_progress();
   void on_put_reg_data_success();
@@ -291,4 +342,112 @@ public:
   virtual ~ImpuReadRegDataTask() {}
   virtual void run();
 };
+
+// Management task to snapshot the local IMPU store to a file, or to restore
+// it from one. A POST to /impu-snapshot takes a snapshot, and a POST to
+// /impu-snapshot/restore restores the last snapshot taken.
+//
+// Snapshots can take a long time, so if a worker thread pool is configured
+// the snapshot is taken (and the request answered) on that rather than on
+// the management HTTP thread.
+class ImpuSnapshotTask : public HttpStackUtils::Task
+{
+public:
+  struct Config
+  {
+    Config(ImpuStore* _store,
+           std::string _path,
+           int _restore_threads,
+           FunctorThreadPool* _worker = NULL) :
+      store(_store),
+      path(_path),
+      restore_threads(_restore_threads),
+      worker(_worker) {}
+
+    ImpuStore* store;
+    std::string path;
+    int restore_threads;
+    FunctorThreadPool* worker;
+  };
+
+  ImpuSnapshotTask(HttpStack::Request& req, const Config* cfg, SAS::TrailId trail) :
+    HttpStackUtils::Task(req, trail), _cfg(cfg)
+  {}
+
+  void run();
+
+private:
+  void snapshot(bool restore);
+
+  const Config* _cfg;
+};
+
+// Invalidates the Homestead-prov cache, either for a single subscriber or
+// completely.
+class HsProvCacheTask : public HttpStackUtils::Task
+{
+public:
+  struct Config
+  {
+    Config(HsProvCache* _cache) : cache(_cache) {}
+
+    HsProvCache* cache;
+  };
+
+  HsProvCacheTask(HttpStack::Request& req, const Config* cfg, SAS::TrailId trail) :
+    HttpStackUtils::Task(req, trail), _cfg(cfg)
+  {}
+
+  void run();
+
+private:
+  const Config* _cfg;
+};
+
+// Exports the Homestead-prov keyspace to a snapshot file.
+class HsProvSnapshotTask : public HttpStackUtils::Task
+{
+public:
+  struct Config
+  {
+    Config(HsProvStore* _store, std::string _path) :
+      store(_store),
+      path(_path) {}
+
+    HsProvStore* store;
+    std::string path;
+  };
+
+  HsProvSnapshotTask(HttpStack::Request& req, const Config* cfg, SAS::TrailId trail) :
+    HttpStackUtils::Task(req, trail), _cfg(cfg)
+  {}
+
+  void run();
+
+private:
+  const Config* _cfg;
+};
+
+// Dumps the requests captured by the flight recorder.
+class SlowRequestsTask : public HttpStackUtils::Task
+{
+public:
+  struct Config
+  {
+    Config(FlightRecorder* _recorder) :
+      recorder(_recorder) {}
+
+    FlightRecorder* recorder;
+  };
+
+  SlowRequestsTask(HttpStack::Request& req, const Config* cfg, SAS::TrailId trail) :
+    HttpStackUtils::Task(req, trail), _cfg(cfg)
+  {}
+
+  void run();
+
+private:
+  const Config* _cfg;
+};
+
 #endif
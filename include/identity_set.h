@@ -0,0 +1,251 @@
+/**
+ * @file identity_set.h A compact set of identities, each with a state
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef IDENTITY_SET_H_
+#define IDENTITY_SET_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * The IMPUs or IMPIs of an IRS, each with the state it's in relative to the
+ * store.
+ *
+ * The identities are held in a single vector, sorted by identity, with a one
+ * byte state alongside each. This has far fewer allocations than a map, and
+ * lookups are a binary search. The identities in a given state are read
+ * through a View, which refers to the identities in the set rather than
+ * copying them - so a View is only valid until the set is next changed.
+ */
+class IdentitySet
+{
+public:
+  // The state of an identity relative to the store.
+  enum State : uint8_t
+  {
+    ADDED,
+    UNCHANGED,
+    DELETED
+  };
+
+  typedef std::pair<std::string, State> Entry;
+  typedef std::vector<Entry>::iterator iterator;
+  typedef std::vector<Entry>::const_iterator const_iterator;
+
+  /// The identities in the set that are in one of a number of states.
+  class View
+  {
+  public:
+    class const_iterator
+    {
+    public:
+      typedef std::forward_iterator_tag iterator_category;
+      typedef std::string value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const std::string* pointer;
+      typedef const std::string& reference;
+
+      const_iterator(IdentitySet::const_iterator it,
+                     IdentitySet::const_iterator end,
+                     uint8_t states) :
+        _it(it), _end(end), _states(states)
+      {
+        skip();
+      }
+
+      const std::string& operator*() const { return _it->first; }
+      const std::string* operator->() const { return &_it->first; }
+
+      const_iterator& operator++()
+      {
+        ++_it;
+        skip();
+        return *this;
+      }
+
+      bool operator==(const const_iterator& other) const { return _it == other._it; }
+      bool operator!=(const const_iterator& other) const { return _it != other._it; }
+
+    private:
+      void skip()
+      {
+        while ((_it != _end) && (!(_states & (1 << _it->second))))
+        {
+          ++_it;
+        }
+      }
+
+      IdentitySet::const_iterator _it;
+      IdentitySet::const_iterator _end;
+      uint8_t _states;
+    };
+
+    View(const IdentitySet& set, uint8_t states) :
+      _set(set), _states(states)
+    {
+    }
+
+    const_iterator begin() const
+    {
+      return const_iterator(_set._entries.begin(), _set._entries.end(), _states);
+    }
+
+    const_iterator end() const
+    {
+      return const_iterator(_set._entries.end(), _set._entries.end(), _states);
+    }
+
+    bool empty() const { return begin() == end(); }
+
+    size_t size() const
+    {
+      size_t count = 0;
+
+      for (const_iterator it = begin(); it != end(); ++it)
+      {
+        count++;
+      }
+
+      return count;
+    }
+
+    /// Copies the identities out, in order.
+    std::vector<std::string> to_vector() const
+    {
+      std::vector<std::string> v;
+      v.reserve(size());
+      v.insert(v.end(), begin(), end());
+      return v;
+    }
+
+  private:
+    const IdentitySet& _set;
+    uint8_t _states;
+  };
+
+  iterator begin() { return _entries.begin(); }
+  iterator end() { return _entries.end(); }
+  const_iterator begin() const { return _entries.begin(); }
+  const_iterator end() const { return _entries.end(); }
+  size_t size() const { return _entries.size(); }
+  bool empty() const { return _entries.empty(); }
+
+  /// Returns the entry for the identity, or end() if it isn't in the set.
+  iterator find(const std::string& id)
+  {
+    iterator it = lower_bound(id);
+    return ((it != _entries.end()) && (it->first == id)) ? it : _entries.end();
+  }
+
+  /// Sets the state of an identity, adding it if it isn't in the set.
+  void set(const std::string& id, State state)
+  {
+    iterator it = lower_bound(id);
+
+    if ((it != _entries.end()) && (it->first == id))
+    {
+      it->second = state;
+    }
+    else
+    {
+      _entries.insert(it, Entry(id, state));
+    }
+  }
+
+  /// Adds identities with the given state, leaving any that are already in
+  /// the set as they are. This sorts once, rather than inserting each
+  /// identity in turn, so is used to fill the set.
+  void add_all(const std::vector<std::string>& ids, State state)
+  {
+    size_t existing = _entries.size();
+    _entries.reserve(existing + ids.size());
+
+    for (const std::string& id : ids)
+    {
+      _entries.emplace_back(id, state);
+    }
+
+    // The existing entries are first, so a stable sort keeps them ahead of
+    // any new entries for the same identity, and unique then drops the new
+    // ones.
+    std::stable_sort(_entries.begin(), _entries.end(), compare);
+    _entries.erase(std::unique(_entries.begin(), _entries.end(), same_id),
+                   _entries.end());
+  }
+
+  /// Sets the state of every identity in the set.
+  void set_all(State state)
+  {
+    for (Entry& entry : _entries)
+    {
+      entry.second = state;
+    }
+  }
+
+  /// The identities in the given state.
+  View in_state(State state) const
+  {
+    return View(*this, 1 << state);
+  }
+
+  /// The identities that are in the set once it's written to the store, i.e.
+  /// that are added or unchanged.
+  View current() const
+  {
+    return View(*this, (1 << ADDED) | (1 << UNCHANGED));
+  }
+
+  /// Whether any identities are being added or deleted.
+  bool has_changes() const
+  {
+    for (const Entry& entry : _entries)
+    {
+      if (entry.second != UNCHANGED)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+private:
+  static bool compare(const Entry& a, const Entry& b)
+  {
+    return a.first < b.first;
+  }
+
+  static bool same_id(const Entry& a, const Entry& b)
+  {
+    return a.first == b.first;
+  }
+
+  iterator lower_bound(const std::string& id)
+  {
+    return std::lower_bound(_entries.begin(),
+                            _entries.end(),
+                            id,
+                            [](const Entry& entry, const std::string& value)
+                            {
+                              return entry.first < value;
+                            });
+  }
+
+  std::vector<Entry> _entries;
+};
+
+#endif
@@ -39,12 +39,17 @@ public:
   virtual const ChargingAddresses& get_charging_addresses() const = 0;
   virtual int32_t get_ttl() const = 0;
 
+  // The time by which a RE_REGISTRATION SAR should next be sent to the HSS for
+  // this IRS, or 0 if the IRS doesn't have a refresh deadline.
+  virtual int64_t get_refresh_deadline() const = 0;
+
   virtual void set_ims_sub_xml(const std::string& xml) = 0;
   virtual void set_reg_state(RegistrationState state) = 0;
   virtual void add_associated_impi(const std::string& impi) = 0;
   virtual void delete_associated_impi(const std::string& impi) = 0;
   virtual void set_charging_addresses(const ChargingAddresses& addresses) = 0;
   virtual void set_ttl(int32_t ttl) = 0;
+  virtual void set_refresh_deadline(int64_t deadline) = 0;
 };
 
 #endif
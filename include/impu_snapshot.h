@@ -0,0 +1,148 @@
+/**
+ * @file impu_snapshot.h Snapshot and restore of the IMPU store
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef IMPU_SNAPSHOT_H_
+#define IMPU_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "impu_store.h"
+#include "indexed_file.h"
+#include "sas.h"
+
+/**
+ * A snapshot of the IMPU store, held in a local file.
+ *
+ * The snapshot holds DefaultImpu, AssociatedImpu and ImpiMapping records, and
+ * the associated IMPU chunks that DefaultImpu records refer to, in exactly
+ * the encoding used in the store, so that restoring a record is a
+ * single write with no decoding or recompression.
+ *
+ * The snapshot is an IndexedFile, so the reader can look up a single record
+ * in the memory-mapped file without scanning it, and never sees a partially
+ * written snapshot.
+ */
+class ImpuSnapshot
+{
+public:
+  enum RecordType : uint8_t
+  {
+    IMPU = 0,
+    IMPI_MAPPING = 1,
+    ASSOC_IMPU_CHUNK = 2
+  };
+
+  struct Record
+  {
+    RecordType type;
+    std::string key;
+    std::string data;
+    int64_t expiry;
+  };
+
+  // Each record is a RecordHeader followed by the key and the data.
+  struct RecordHeader
+  {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t key_len;
+    uint32_t data_len;
+    uint32_t reserved2;
+    int64_t expiry;
+  };
+
+  // Version 2 added ASSOC_IMPU_CHUNK records.
+  static const uint32_t VERSION = 2;
+
+  class Writer
+  {
+  public:
+    Writer(const std::string& path);
+    virtual ~Writer() {};
+
+    /// Opens the temporary file that the snapshot is written to.
+    bool open() { return _file.open(); }
+
+    /// Appends a record to the snapshot.
+    bool add(RecordType type,
+             const std::string& key,
+             const std::string& data,
+             int64_t expiry);
+
+    /// Writes the index and header, and renames the snapshot into place.
+    /// The writer can't be used after this is called.
+    bool commit() { return _file.commit(); }
+
+    uint64_t num_records() const { return _file.num_records(); }
+
+  private:
+    IndexedFile::Writer _file;
+  };
+
+  class Reader
+  {
+  public:
+    Reader(const std::string& path);
+    virtual ~Reader() {};
+
+    /// Maps the snapshot into memory and validates the header.
+    bool open() { return _file.open(); }
+
+    uint64_t num_records() const { return _file.num_records(); }
+
+    /// Reads the record at the given position in the index.
+    bool read(uint64_t ii, Record& record) const;
+
+    /// Returns the file offset of the record at the given position in the
+    /// index.
+    uint64_t offset(uint64_t ii) const { return _file.offset(ii); }
+
+    /// Looks up a record by type and key.
+    bool get(RecordType type,
+             const std::string& key,
+             std::string& data,
+             int64_t& expiry) const;
+
+  private:
+    bool read_at(uint64_t offset, Record& record) const;
+
+    IndexedFile::Reader _file;
+  };
+
+  /// Dumps every record that the IMPU store knows about to a snapshot file.
+  ///
+  /// The underlying store can't enumerate its keys, so this relies on the
+  /// IMPU store having key tracking enabled. Records that have expired or been
+  /// removed since they were written are dropped from the snapshot.
+  ///
+  /// @param records - Set to the number of records written.
+  static Store::Status dump(ImpuStore* store,
+                            const std::string& path,
+                            SAS::TrailId trail,
+                            uint64_t& records);
+
+  /// Streams the records in a snapshot file back into the IMPU store.
+  ///
+  /// Records are only added if the store doesn't already hold them, so
+  /// restoring never overwrites fresher data. Expired records are skipped.
+  ///
+  /// @param threads  - The number of threads to restore with.
+  /// @param restored - Set to the number of records written to the store.
+  static Store::Status restore(ImpuStore* store,
+                               const std::string& path,
+                               int threads,
+                               SAS::TrailId trail,
+                               uint64_t& restored);
+};
+
+#endif
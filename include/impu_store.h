@@ -11,11 +11,18 @@
 #ifndef IMPU_STORE_H_
 #define IMPU_STORE_H_
 
+#include "async_store.h"
 #include "charging_addresses.h"
 #include "reg_state.h"
+#include "statisticsmanager.h"
 #include "store.h"
+#include "utils.h"
 
 #include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 #include <lz4.h>
@@ -43,6 +50,11 @@ uint64_t decode_varbyte(const std::string& data, size_t& offset);
 class ImpuStore
 {
 public:
+  // The "buckets" of an IMPI mapping's unsplit record, and of the record
+  // holding its bucket count - see ImpiMapping.
+  static const int NO_BUCKET = -1;
+  static const int BUCKET_COUNT = -2;
+
   class Impu
   {
   private:
@@ -99,13 +111,20 @@ public:
                 const std::string& service_profile,
                 uint64_t cas,
                 int64_t expiry,
-                const ImpuStore* store) :
+                const ImpuStore* store,
+                int64_t refresh_deadline = 0,
+                int64_t lookup_expiry = 0) :
       Impu(impu, cas, expiry, store),
       registration_state(registration_state),
       charging_addresses(charging_addresses),
       associated_impus(associated_impus),
       impis(impis),
-      service_profile(service_profile)
+      service_profile(service_profile),
+      refresh_deadline(refresh_deadline),
+      lookup_expiry(lookup_expiry),
+      assoc_impu_chunk_expiry(0),
+      assoc_impu_chunks_hash_tagged(false),
+      assoc_impu_chunks_lost(false)
     {
     }
 
@@ -132,6 +151,29 @@ public:
     std::vector<std::string> associated_impus;
     std::vector<std::string> impis;
     std::string service_profile;
+
+    // The time by which a RE_REGISTRATION SAR should next be sent for this
+    // IRS - 0 if there isn't one.
+    int64_t refresh_deadline;
+
+    // The time until which the associated IMPU and IMPI mapping records for
+    // this IRS are known to be kept - 0 if they expire with this record.
+    int64_t lookup_expiry;
+
+    // If the associated IMPUs are held in separate chunk records (see
+    // ImpuStore::set_associated_impu_chunk_size), the hash of each chunk's
+    // contents, and the time until which the chunks are kept. Empty if the
+    // associated IMPUs are held in this record.
+    std::vector<uint32_t> assoc_impu_chunks;
+    int64_t assoc_impu_chunk_expiry;
+
+    // Set if the chunks' keys carry a hash tag (see ImpuStore::set_hash_tags).
+    bool assoc_impu_chunks_hash_tagged;
+
+    // Set if the record's associated IMPUs are in chunks that couldn't be
+    // read, (or are in a format we don't understand). The associated IMPUs
+    // are then unknown, and the next write rewrites every chunk.
+    bool assoc_impu_chunks_lost;
   };
 
   class AssociatedImpu : public Impu
@@ -161,35 +203,57 @@ public:
                            ImpuStore* store);
   };
 
+  // The default IMPUs for an IMPI. If the store splits IMPI mappings into
+  // buckets, each default IMPU is held in one of the bucket records, and a
+  // bucket count record says how many buckets there are. Otherwise they are
+  // held in the unsplit record, keyed on the IMPI, which is the only record
+  // that older versions of Homestead know about. The unsplit record may
+  // also hold default IMPUs written before the mapping was split, or by
+  // Homesteads that don't split mappings.
   class ImpiMapping
   {
   public:
     ImpiMapping(std::string impi,
                 std::vector<std::string> default_impus,
                 uint64_t cas,
-                int64_t expiry) :
+                int64_t expiry,
+                int bucket = NO_BUCKET) :
       impi(impi),
       cas(cas),
-      _expiry(expiry),
-      _default_impus(default_impus)
+      bucket(bucket),
+      buckets(0),
+      _expiry(expiry)
     {
+      _default_impus.reserve(default_impus.size());
+
+      for (const std::string& impu : default_impus)
+      {
+        add_default_impu(impu);
+      }
     }
 
-    ImpiMapping(std::string impi, std::string impu, int64_t expiry) :
+    ImpiMapping(std::string impi,
+                std::string impu,
+                int64_t expiry,
+                int bucket = NO_BUCKET) :
       impi(impi),
       cas(0L),
-      _expiry(expiry),
-      _default_impus({ impu })
+      bucket(bucket),
+      buckets(0),
+      _expiry(expiry)
     {
+      add_default_impu(impu);
     }
 
     static ImpiMapping* from_data(const std::string& impu,
                                   const std::string&,
-                                  uint64_t cas);
+                                  uint64_t cas,
+                                  int bucket = NO_BUCKET);
 
     static ImpiMapping* from_json(const std::string& impi,
                                   rapidjson::Value& json,
-                                  uint64_t cas);
+                                  uint64_t cas,
+                                  int bucket = NO_BUCKET);
 
     virtual void write_json(rapidjson::Writer<rapidjson::StringBuffer>& writer);
 
@@ -198,24 +262,39 @@ public:
     virtual ~ImpiMapping(){
     }
 
+    // Adds a default IMPU, if it isn't already in the mapping.
     void add_default_impu(const std::string& impu)
     {
-      _default_impus.push_back(impu);
+      if (_positions.emplace(impu, _default_impus.size()).second)
+      {
+        _default_impus.push_back(impu);
+      }
     }
 
-    bool has_default_impu(const std::string& impu)
+    bool has_default_impu(const std::string& impu) const
     {
-      return std::find(_default_impus.begin(),
-                       _default_impus.end(),
-                       impu) != _default_impus.end();
+      return _positions.find(impu) != _positions.end();
     }
 
+    // Removes a default IMPU. The last default IMPU takes its place, so the
+    // order of the remaining default IMPUs isn't preserved.
     void remove_default_impu(const std::string& impu)
     {
-      _default_impus.erase(std::remove(_default_impus.begin(),
-                                       _default_impus.end(),
-                                       impu),
-                           _default_impus.end());
+      std::unordered_map<std::string, size_t>::iterator it = _positions.find(impu);
+
+      if (it != _positions.end())
+      {
+        size_t position = it->second;
+        _positions.erase(it);
+
+        if (position != _default_impus.size() - 1)
+        {
+          _default_impus[position] = std::move(_default_impus.back());
+          _positions[_default_impus[position]] = position;
+        }
+
+        _default_impus.pop_back();
+      }
     }
 
     bool is_empty()
@@ -238,34 +317,317 @@ public:
       return _default_impus;
     }
 
+    // The key of this record in the store.
+    std::string key() const
+    {
+      return ImpuStore::impi_mapping_key(impi, bucket);
+    }
+
     const std::string impi;
     const uint64_t cas;
 
+    // The bucket this record is for, or NO_BUCKET for the unsplit record,
+    // or BUCKET_COUNT for the bucket count record.
+    const int bucket;
+
+    // In the bucket count record, the number of buckets the mapping is split
+    // into.
+    int buckets;
+
   private:
     int64_t _expiry;
     std::vector<std::string> _default_impus;
+
+    // The position of each default IMPU in _default_impus. An IMPI may have
+    // thousands of IRSs, so membership isn't checked by searching the list.
+    std::unordered_map<std::string, size_t> _positions;
   };
 
-  ImpuStore(Store* store) : _store(store)
+  // If a statistics manager is supplied, the latency of each request to the
+  // underlying store is recorded against the local or remote site.
+  ImpuStore(Store* store,
+            StatisticsManager* stats_manager = NULL,
+            bool remote = false) :
+    _store(store),
+    _stats_manager(stats_manager),
+    _remote(remote),
+    _async_store(nullptr),
+    _impi_mapping_buckets(0),
+    _assoc_impu_chunk_size(0),
+    _hash_tags(false),
+    _async_chunk_writes(false),
+    _track_keys(false),
+    _max_tracked_keys(0),
+    _tracked_keys_full(false)
+  {
+
+  }
+
+  typedef std::function<void(Impu*)> impu_callback;
+
+  // The key of an IMPI mapping record. Bucket records are keyed on the IMPI
+  // with a ";bucket=<n>" suffix, and the bucket count record with a
+  // ";buckets" suffix - ';' isn't valid in an NAI, so these can't clash with
+  // another IMPI.
+  static std::string impi_mapping_key(const std::string& impi, int bucket);
+
+  // Split IMPI mappings into the given number of buckets, so that an IMPI
+  // with many IRSs doesn't have one large record that every IRS write must
+  // CAS. 0 keeps each IMPI mapping in a single record.
+  void set_impi_mapping_buckets(int buckets)
+  {
+    _impi_mapping_buckets = buckets;
+  }
+
+  int impi_mapping_buckets() const
+  {
+    return _impi_mapping_buckets;
+  }
+
+  // The bucket that holds the given default IMPU in IMPI mappings, or
+  // NO_BUCKET if mappings aren't split. This must be the same on every
+  // Homestead, so doesn't use std::hash.
+  int impi_mapping_bucket(const std::string& default_impu) const;
+
+  // IRSs with more than this many associated IMPUs hold them in separate
+  // chunk records, rather than in the default IMPU record. Each associated
+  // IMPU is in the chunk picked by its hash, and only the chunks that have
+  // changed are rewritten. 0 keeps them all in the default IMPU record.
+  //
+  // Homesteads that don't support chunks read a chunked IRS as having no
+  // associated IMPUs, so this must only be set once every Homestead in the
+  // deployment supports them.
+  void set_associated_impu_chunk_size(size_t chunk_size)
+  {
+    _assoc_impu_chunk_size = chunk_size;
+  }
+
+  // Key associated IMPU chunk records with a hash tag - the memcached key of
+  // their default IMPU record in braces - so that a proxy that hashes on
+  // tags (e.g. twemproxy with hash_tag "{}") puts an IRS's chunks on the
+  // same server as its default IMPU record, and they can all be read in one
+  // multi-get. Stores that don't hash on tags are unaffected. The default
+  // IMPU record's own key doesn't change, and associated IMPU and IMPI
+  // mapping records are still keyed on their own identities, so they can't
+  // be placed with the IRS.
+  //
+  // Existing chunks keep their keys until the IRS is next written, when
+  // every chunk is rewritten under its new key and the old ones expire, so
+  // this can be turned on (or off) without migrating the store. Homesteads
+  // that don't support hash tags read a tagged IRS as having lost its
+  // chunks, so this must only be set once every Homestead in the deployment
+  // supports them.
+  void set_hash_tags(bool hash_tags)
+  {
+    _hash_tags = hash_tags;
+  }
+
+  // The key of an associated IMPU chunk record. This includes the hash of
+  // the chunk's contents, so a write never changes a chunk that the current
+  // default IMPU record refers to - the default IMPU record only refers to
+  // the new chunks once it's written, after them.
+  static std::string associated_impu_chunk_key(const std::string& impu,
+                                               int chunk,
+                                               uint32_t hash,
+                                               bool hash_tagged = false);
+
+  // The key of one of a default IMPU's associated IMPU chunk records.
+  static std::string associated_impu_chunk_key(const DefaultImpu* impu,
+                                               size_t chunk);
+
+  // Reads IMPU records through the given store, which must hold the same
+  // records as the underlying store, so that get_impu_async doesn't block.
+  // A default IMPU's chunks are read with a single multi-get.
+  void set_async_store(AsyncStore* async_store)
+  {
+    _async_store = async_store;
+  }
+
+  // Writes associated IMPU chunks with a single multi-set through the async
+  // store, rather than one at a time through the underlying store. Only set
+  // this if the underlying store doesn't need to see the writes, (e.g. it
+  // isn't logging them).
+  void set_async_chunk_writes(bool async_chunk_writes)
   {
+    _async_chunk_writes = async_chunk_writes;
+  }
 
+  bool is_async() const
+  {
+    return (_async_store != nullptr);
   }
 
   Store::Status set_impu_without_cas(Impu* impu, SAS::TrailId trail);
   Store::Status set_impu(Impu* impu, SAS::TrailId trail);
 
-  Impu* get_impu(const std::string& impu, SAS::TrailId trail);
+  // Get an IMPU record. If it's a default IMPU whose associated IMPU chunks
+  // can't be read, this returns nullptr unless allow_lost_chunks is set, in
+  // which case the record is returned with assoc_impu_chunks_lost set, so
+  // that it can be overwritten.
+  Impu* get_impu(const std::string& impu,
+                 SAS::TrailId trail,
+                 bool allow_lost_chunks = false);
+
+  // Asynchronous version of get_impu. The callback is passed the record (or
+  // nullptr if it wasn't found), and takes ownership of it. With an async
+  // store, the callback is run on one of its threads once the record and
+  // its chunks have been read, so it mustn't block. Otherwise, this is
+  // get_impu, and the callback is run before this returns.
+  void get_impu_async(const std::string& impu,
+                      SAS::TrailId trail,
+                      impu_callback callback,
+                      bool allow_lost_chunks = false);
 
   Store::Status delete_impu(Impu* impu, SAS::TrailId trail);
 
   Store::Status set_impi_mapping(ImpiMapping* mapping, SAS::TrailId trail);
 
+  // Get the whole mapping for an IMPI. If the store splits mappings, this
+  // merges the unsplit record with all of its buckets, and the result can't
+  // be written back to the store. Otherwise only the unsplit record is read,
+  // so a store that doesn't split mappings doesn't see IRSs that other
+  // Homesteads have moved into buckets.
   ImpiMapping* get_impi_mapping(const std::string impi, SAS::TrailId trail);
 
+  // Get a single IMPI mapping record - the unsplit record, the bucket count
+  // record, or one of the buckets.
+  ImpiMapping* get_impi_mapping_record(const std::string& impi,
+                                       int bucket,
+                                       SAS::TrailId trail);
+
   Store::Status delete_impi_mapping(ImpiMapping* mapping, SAS::TrailId trail);
 
+  // Raw access to records in their stored encoding. These are used to
+  // snapshot and restore the store, and avoid decoding and re-encoding
+  // each record. IMPI mappings are accessed by their key in the store, (see
+  // impi_mapping_key), so this covers bucket records too.
+  Store::Status get_impu_data(const std::string& impu,
+                              std::string& data,
+                              SAS::TrailId trail);
+
+  Store::Status get_impi_mapping_data(const std::string& impi,
+                                      std::string& data,
+                                      SAS::TrailId trail);
+
+  // Adds a record only if the store doesn't already hold it - returns
+  // DATA_CONTENTION if it does.
+  Store::Status add_impu_data(const std::string& impu,
+                              const std::string& data,
+                              int64_t expiry,
+                              SAS::TrailId trail);
+
+  Store::Status add_impi_mapping_data(const std::string& impi,
+                                      const std::string& data,
+                                      int64_t expiry,
+                                      SAS::TrailId trail);
+
+  // Associated IMPU chunk records are accessed by their key in the store,
+  // (see associated_impu_chunk_key). They aren't tracked - they're found from
+  // the default IMPU records that refer to them.
+  Store::Status get_associated_impu_chunk_data(const std::string& key,
+                                               std::string& data,
+                                               SAS::TrailId trail);
+
+  Store::Status add_associated_impu_chunk_data(const std::string& key,
+                                               const std::string& data,
+                                               int64_t expiry,
+                                               SAS::TrailId trail);
+
+  // The underlying store can't list the keys it holds, so to take a snapshot
+  // we remember the keys written through this ImpuStore. This costs a string
+  // per record, so is off unless a snapshot file is configured, and stops
+  // once max_keys keys are tracked.
+  //
+  // Only keys written by this node since it started are tracked, so a
+  // snapshot only covers the records this node has written.
+  void enable_key_tracking(size_t max_keys)
+  {
+    _track_keys = true;
+    _max_tracked_keys = max_keys;
+  }
+
+  bool key_tracking_enabled() const
+  {
+    return _track_keys;
+  }
+
+  void get_tracked_keys(std::vector<std::string>& impus,
+                        std::vector<std::string>& impis);
+
+  void untrack_keys(const std::vector<std::string>& impus,
+                    const std::vector<std::string>& impis);
+
 private:
+  void update_latency_stats(Utils::StopWatch& stop_watch);
+
+  // Encodes an IMPU to write to the store. If it's a default IMPU whose
+  // associated IMPUs are held in chunks, this writes the chunks that have
+  // changed.
+  Store::Status encode_impu(Impu* impu, std::string& data, SAS::TrailId trail);
+
+  // Splits the associated IMPUs of a default IMPU into chunks if there are
+  // too many, returning the chunks that need writing.
+  void chunk_associated_impus(DefaultImpu* impu,
+                              std::vector<std::pair<int, std::string>>& chunks);
+
+  // Decodes an IMPU record that's been read from the store.
+  Impu* decode_impu(const std::string& impu,
+                    const std::string& data,
+                    uint64_t cas,
+                    SAS::TrailId trail);
+
+  // Reads the associated IMPUs of a default IMPU from its chunks. Returns
+  // false if any chunk is missing or doesn't match the default IMPU record.
+  bool read_associated_impu_chunks(DefaultImpu* impu, SAS::TrailId trail);
+
+  // Asynchronous version of read_associated_impu_chunks. The chunks are all
+  // read at once, and the callback is run once they've all been read.
+  void read_associated_impu_chunks_async(DefaultImpu* impu,
+                                         SAS::TrailId trail,
+                                         std::function<void(bool)> callback);
+
+  // Adds the chunks got by a multi-get to the default IMPU, returning
+  // whether they were all there and matched the record.
+  bool add_associated_impu_chunks(DefaultImpu* impu,
+                                  std::vector<AsyncStore::Result>& results);
+
+  // Writes the given chunks of a default IMPU.
+  Store::Status write_associated_impu_chunks(DefaultImpu* impu,
+                                             const std::vector<std::pair<int, std::string>>& chunks,
+                                             SAS::TrailId trail);
+
+  // Checks and decodes a chunk of associated IMPUs, adding them to the
+  // default IMPU. Returns false if the chunk doesn't match the record.
+  bool add_associated_impu_chunk(DefaultImpu* impu,
+                                 size_t chunk,
+                                 const std::string& data);
+
+  // Called once a default IMPU's chunks have been read (successfully or
+  // not). Returns the record, or nullptr if it's incomplete and lost chunks
+  // aren't allowed, in which case the record is deleted.
+  Impu* check_associated_impu_chunks(DefaultImpu* impu,
+                                     bool chunks_read,
+                                     bool allow_lost_chunks);
+
+  void track_key(std::unordered_set<std::string>& keys,
+                 const std::string& key,
+                 bool present);
+
   Store* _store;
+  StatisticsManager* _stats_manager;
+  bool _remote;
+  AsyncStore* _async_store;
+  int _impi_mapping_buckets;
+  size_t _assoc_impu_chunk_size;
+  bool _hash_tags;
+  bool _async_chunk_writes;
+
+  bool _track_keys;
+  size_t _max_tracked_keys;
+  std::mutex _tracked_keys_lock;
+  bool _tracked_keys_full;
+  std::unordered_set<std::string> _tracked_impus;
+  std::unordered_set<std::string> _tracked_impis;
 };
 
 #endif
@@ -0,0 +1,159 @@
+/**
+ * @file indexed_file.h Memory-mapped files of records with a hash index
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef INDEXED_FILE_H_
+#define INDEXED_FILE_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A file of records with an index sorted by key hash, which is memory-mapped
+ * by the reader so that a single record can be looked up without reading or
+ * parsing the whole file. This is the format of the IMPU and Homestead-prov
+ * snapshots - each of those defines what goes in a record.
+ *
+ * The file is laid out as:
+ *
+ *   [Header][Record]*[Index]
+ *
+ * Records are padded to ALIGNMENT bytes so that the index can be used in
+ * place in the mapping. The file is written to a temporary path and renamed
+ * into place once complete, so a reader never sees a partially written file.
+ *
+ * Everything is written in host byte order - a file is only intended to be
+ * read on the same platform that wrote it.
+ */
+class IndexedFile
+{
+public:
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_records;
+    uint64_t index_offset;
+  };
+
+  struct IndexEntry
+  {
+    uint64_t hash;
+    uint64_t offset;
+  };
+
+  static const uint64_t ALIGNMENT = 8;
+
+  static const uint32_t FNV1A_32_BASIS = 2166136261U;
+  static const uint64_t FNV1A_64_BASIS = 14695981039346656037ULL;
+
+  /// FNV-1a hashes. These need to be stable across builds and the same on
+  /// every Homestead, so we can't use std::hash. Pass the result of a
+  /// previous call as the basis to hash data in several pieces.
+  static uint32_t fnv1a_32(const char* data,
+                           size_t len,
+                           uint32_t basis = FNV1A_32_BASIS);
+  static uint64_t fnv1a_64(const char* data,
+                           size_t len,
+                           uint64_t basis = FNV1A_64_BASIS);
+
+  /// The hash that a record of the given type and key is indexed under.
+  static uint64_t hash(uint8_t type, const std::string& key);
+
+  /// Writes the whole buffer to the file, retrying on EINTR.
+  static bool write_all(int fd, const void* buf, size_t len);
+
+  class Writer
+  {
+  public:
+    /// @param description - What the file is, for logs.
+    Writer(const std::string& path,
+           const char (&magic)[8],
+           uint32_t version,
+           const std::string& description);
+    virtual ~Writer();
+
+    /// Opens the temporary file that the records are written to.
+    bool open();
+
+    /// Starts a record, indexed under the given hash. The record is written
+    /// with append, and finished with end_record.
+    void start_record(uint64_t hash);
+    bool append(const void* buf, size_t len);
+    bool end_record();
+
+    /// Writes the index and header, and renames the file into place.
+    /// The writer can't be used after this is called.
+    bool commit();
+
+    uint64_t num_records() const { return _index.size(); }
+
+  private:
+    std::string _path;
+    std::string _tmp_path;
+    char _magic[8];
+    uint32_t _version;
+    std::string _description;
+    int _fd;
+    uint64_t _offset;
+    std::vector<IndexEntry> _index;
+  };
+
+  class Reader
+  {
+  public:
+    /// @param advice - Passed to madvise for the mapping, depending on how
+    ///                 the records will be read.
+    Reader(const std::string& path,
+           const char (&magic)[8],
+           uint32_t version,
+           const std::string& description,
+           int advice);
+    virtual ~Reader();
+
+    /// Maps the file into memory and validates the header and index.
+    bool open();
+
+    uint64_t num_records() const;
+
+    /// Returns the file offset of the record at the given position in the
+    /// index, or 0 if there isn't one.
+    uint64_t offset(uint64_t ii) const;
+
+    /// Returns the index entries with the given hash. Several keys can share
+    /// a hash, so the caller must check the key of each record.
+    std::pair<const IndexEntry*, const IndexEntry*> find(uint64_t hash) const;
+
+    /// The mapped file, and the offset that the records end at. Records
+    /// must be bounds-checked against the end before they're read.
+    const char* data() const { return _map; }
+    uint64_t data_end() const;
+
+    const std::string& description() const { return _description; }
+
+  private:
+    std::string _path;
+    char _magic[8];
+    uint32_t _version;
+    std::string _description;
+    int _advice;
+    int _fd;
+    const char* _map;
+    size_t _map_len;
+    const Header* _header;
+    const IndexEntry* _index;
+  };
+};
+
+#endif
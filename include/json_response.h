@@ -0,0 +1,113 @@
+/**
+ * @file json_response.h Renders JSON response bodies into per-thread buffers
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef JSON_RESPONSE_H_
+#define JSON_RESPONSE_H_
+
+#include <string>
+
+#include <rapidjson/allocators.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+#include "httpstack.h"
+
+/**
+ * Renders the JSON body of an HTTP response.
+ *
+ * A new rapidjson StringBuffer and Writer allocate their buffer and their
+ * nesting stack on every response. Here the buffer, writer and body string
+ * belong to the thread, and are cleared rather than freed between responses,
+ * so once they've grown to fit the responses a thread renders, rendering
+ * makes no allocations. The only copy is the one into the HTTP stack's
+ * output buffer, which add_content makes anyway.
+ *
+ * This is meant for the small responses on the registration and call paths.
+ * Only one response can be in use on a thread at a time.
+ *
+ * The buffer and writer allocate through the given rapidjson allocator.
+ * Homestead uses JsonResponse, which allocates with rapidjson's default
+ * CrtAllocator.
+ */
+template <class Allocator>
+class BasicJsonResponse
+{
+public:
+  typedef rapidjson::GenericStringBuffer<rapidjson::UTF8<>, Allocator> Buffer;
+  typedef rapidjson::Writer<Buffer,
+                            rapidjson::UTF8<>,
+                            rapidjson::UTF8<>,
+                            Allocator> Writer;
+
+  BasicJsonResponse();
+
+  Writer& writer() { return _buffers->writer; }
+
+  /// The rendered JSON. Valid until the next response on this thread.
+  const char* body() const { return _buffers->buffer.GetString(); }
+  size_t size() const { return _buffers->buffer.GetSize(); }
+
+  /// Adds the rendered JSON to the body of the response to the request.
+  void add_to(HttpStack::Request& req);
+
+private:
+  struct Buffers
+  {
+    Buffers() : buffer(), writer(buffer) {}
+
+    Buffer buffer;
+    Writer writer;
+
+    // HttpStack::Request::add_content takes a string, so the body is copied
+    // into one whose capacity is also kept.
+    std::string body;
+  };
+
+  Buffers* _buffers;
+
+  static thread_local Buffers* _thrd_buffers;
+};
+
+// The buffers live as long as the thread. Homestead's HTTP and Diameter
+// threads live as long as the process.
+template <class Allocator>
+thread_local typename BasicJsonResponse<Allocator>::Buffers*
+  BasicJsonResponse<Allocator>::_thrd_buffers = NULL;
+
+template <class Allocator>
+BasicJsonResponse<Allocator>::BasicJsonResponse()
+{
+  if (_thrd_buffers == NULL)
+  {
+    _thrd_buffers = new Buffers();
+  }
+
+  _buffers = _thrd_buffers;
+
+  // Clearing keeps the capacity of the buffer and of the writer's stack.
+  _buffers->buffer.Clear();
+  _buffers->writer.Reset(_buffers->buffer);
+}
+
+template <class Allocator>
+void BasicJsonResponse<Allocator>::add_to(HttpStack::Request& req)
+{
+  _buffers->body.assign(_buffers->buffer.GetString(),
+                        _buffers->buffer.GetSize());
+  req.add_content(_buffers->body);
+}
+
+typedef BasicJsonResponse<rapidjson::CrtAllocator> JsonResponse;
+
+// JsonResponse is instantiated once, in json_response.cpp.
+extern template class BasicJsonResponse<rapidjson::CrtAllocator>;
+
+#endif
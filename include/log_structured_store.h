@@ -0,0 +1,199 @@
+/**
+ * @file log_structured_store.h Store held in an append-only file on local disk
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef LOG_STRUCTURED_STORE_H_
+#define LOG_STRUCTURED_STORE_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "store.h"
+
+/**
+ * A Store whose records are kept in an append-only log on local disk, so
+ * that they survive Homestead (or memcached) restarting.
+ *
+ * The file is laid out as:
+ *
+ *   [Header][Record]*
+ *
+ * Each record is a RecordHeader followed by the key and data. Every write
+ * appends a record, and a delete appends a record with an expiry of 0. The
+ * file is memory-mapped, and an in-memory index maps each key to its latest
+ * record, so reads don't touch the disk.
+ *
+ * When the log is opened, it's replayed to rebuild the index. Each record
+ * has a checksum, and replay stops at the first torn or corrupt record, so a
+ * crash part way through a write loses only that write.
+ *
+ * Once most of the log is overwritten or expired records, it's compacted by
+ * writing the live records to a new file and renaming that into place. The
+ * live records are copied without holding the lock, as records aren't
+ * changed once they're written - only the records written while copying are
+ * copied with the lock held, as the new file is swapped in.
+ *
+ * Writes go to the page cache, so survive the process crashing. They get to
+ * disk when the kernel writes back dirty pages, or when the store is
+ * destroyed.
+ */
+class LogStructuredStore : public Store
+{
+public:
+  static const int DEFAULT_COMPACT_INTERVAL_MS = 10000;
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t unused;
+  };
+
+  struct RecordHeader
+  {
+    uint32_t magic;
+
+    // 32-bit FNV-1a hash of the rest of the record, including the padding.
+    uint32_t checksum;
+    uint64_t cas;
+
+    // In seconds since the epoch. 0 means the record has been deleted.
+    int64_t expiry;
+    uint32_t key_len;
+    uint32_t data_len;
+  };
+
+  static const uint32_t VERSION = 1;
+
+  LogStructuredStore(const std::string& path,
+                     int compact_interval_ms = DEFAULT_COMPACT_INTERVAL_MS);
+  virtual ~LogStructuredStore();
+
+  /// Opens the log, creating it if it doesn't exist, and rebuilds the index
+  /// from it.
+  bool open();
+
+  /// Starts the thread that compacts the log when needed.
+  bool start();
+  void stop();
+
+  Store::Status get_data(const std::string& table,
+                         const std::string& key,
+                         std::string& data,
+                         uint64_t& cas,
+                         SAS::TrailId trail = 0,
+                         bool log_body = true);
+
+  /// As get_data, but also returns the number of seconds until the record
+  /// expires.
+  Store::Status get_record(const std::string& table,
+                           const std::string& key,
+                           std::string& data,
+                           uint64_t& cas,
+                           int& expiry);
+
+  /// Writes a record, with the same CAS semantics as memcached.
+  Store::Status set_data(const std::string& table,
+                         const std::string& key,
+                         const std::string& data,
+                         uint64_t cas,
+                         int expiry,
+                         SAS::TrailId trail = 0,
+                         bool log_body = true);
+
+  Store::Status set_data_without_cas(const std::string& table,
+                                     const std::string& key,
+                                     const std::string& data,
+                                     int expiry,
+                                     SAS::TrailId trail = 0,
+                                     bool log_body = true);
+
+  Store::Status delete_data(const std::string& table,
+                            const std::string& key,
+                            SAS::TrailId trail = 0);
+
+  /// Lists the table and key of every live record.
+  void get_keys(std::vector<std::pair<std::string, std::string>>& keys) const;
+
+  /// Rewrites the log with just the live records. This is done by the
+  /// background thread once the log is mostly dead records.
+  bool compact();
+
+  /// The number of records in the index.
+  size_t size() const;
+
+  /// The length of the log, and how much of it is live records.
+  uint64_t log_bytes() const;
+  uint64_t live_bytes() const;
+
+private:
+  struct Entry
+  {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t cas;
+    int64_t expiry;
+  };
+
+  typedef std::unordered_map<std::string, Entry> Index;
+
+  // These must be called with the lock held.
+  Store::Status write(const std::string& table,
+                      const std::string& key,
+                      const std::string& data,
+                      bool check_cas,
+                      uint64_t cas,
+                      int expiry);
+  bool append(const std::string& record_key,
+              const std::string& data,
+              uint64_t cas,
+              int64_t expiry,
+              Entry& entry);
+  bool reserve(uint64_t length);
+  bool map(int fd, uint64_t capacity);
+  void unmap();
+  bool replay();
+  void remove(Index::iterator entry);
+  void remove_expired();
+
+  void run_compactor();
+
+  const std::string _path;
+  const int _compact_interval_ms;
+
+  mutable std::mutex _lock;
+
+  // Held while compacting, so only one compaction runs at once. This is
+  // taken before _lock. Only compaction changes _fd once the log is open, so
+  // _fd can be read with just this held.
+  std::mutex _compact_lock;
+
+  int _fd;
+  char* _map;
+  uint64_t _capacity;
+  uint64_t _tail;
+  uint64_t _live_bytes;
+  uint64_t _next_cas;
+  Index _index;
+
+  std::mutex _compactor_lock;
+  std::condition_variable _compactor_cond;
+  bool _terminated;
+  std::thread _compactor;
+};
+
+#endif
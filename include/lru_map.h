@@ -0,0 +1,145 @@
+/**
+ * @file lru_map.h Bounded map whose entries expire
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef LRU_MAP_H_
+#define LRU_MAP_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+/**
+ * A map from key to value, where each value expires at a given time, and
+ * the least recently used values are evicted once the map is full. Times are
+ * in whatever units the caller chooses, as long as they're consistent.
+ *
+ * Not thread safe - callers must hold their own lock to use it.
+ */
+template <class ValueType>
+class LruMap
+{
+public:
+  LruMap(size_t max_entries) : _max_entries(max_entries) {};
+
+  /// Returns the value for the key, or NULL if it isn't present or has
+  /// expired. The value can be updated in place, and is valid until the map
+  /// is next changed.
+  ValueType* get(const std::string& key, int64_t now);
+
+  void put(const std::string& key, const ValueType& value, int64_t expiry);
+
+  /// Removes all entries matching the predicate, and returns how many there
+  /// were.
+  template <class Predicate>
+  size_t erase_if(Predicate pred);
+
+  /// The number of entries, including any that have expired but haven't
+  /// been looked up since.
+  size_t size() const { return _entries.size(); }
+
+private:
+  struct Entry
+  {
+    ValueType value;
+    int64_t expiry;
+    std::list<std::string>::iterator lru_it;
+  };
+
+  size_t _max_entries;
+
+  // Keys in order of use, most recently used first.
+  std::list<std::string> _lru;
+  std::unordered_map<std::string, Entry> _entries;
+};
+
+template <class ValueType>
+ValueType* LruMap<ValueType>::get(const std::string& key, int64_t now)
+{
+  typename std::unordered_map<std::string, Entry>::iterator it = _entries.find(key);
+
+  if (it == _entries.end())
+  {
+    return NULL;
+  }
+
+  if (it->second.expiry <= now)
+  {
+    _lru.erase(it->second.lru_it);
+    _entries.erase(it);
+    return NULL;
+  }
+
+  // Move the key to the front of the LRU list.
+  _lru.splice(_lru.begin(), _lru, it->second.lru_it);
+
+  return &it->second.value;
+}
+
+template <class ValueType>
+void LruMap<ValueType>::put(const std::string& key,
+                            const ValueType& value,
+                            int64_t expiry)
+{
+  typename std::unordered_map<std::string, Entry>::iterator it = _entries.find(key);
+
+  if (it != _entries.end())
+  {
+    it->second.value = value;
+    it->second.expiry = expiry;
+    _lru.splice(_lru.begin(), _lru, it->second.lru_it);
+    return;
+  }
+
+  if (_max_entries == 0)
+  {
+    return;
+  }
+
+  while (_entries.size() >= _max_entries)
+  {
+    _entries.erase(_lru.back());
+    _lru.pop_back();
+  }
+
+  _lru.push_front(key);
+  Entry& entry = _entries[key];
+  entry.value = value;
+  entry.expiry = expiry;
+  entry.lru_it = _lru.begin();
+}
+
+template <class ValueType>
+template <class Predicate>
+size_t LruMap<ValueType>::erase_if(Predicate pred)
+{
+  size_t erased = 0;
+
+  for (typename std::unordered_map<std::string, Entry>::iterator it = _entries.begin();
+       it != _entries.end();)
+  {
+    if (pred(it->first))
+    {
+      _lru.erase(it->second.lru_it);
+      it = _entries.erase(it);
+      erased++;
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  return erased;
+}
+
+#endif
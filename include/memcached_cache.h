@@ -14,9 +14,11 @@
 #include "base_hss_cache.h"
 #include "base_ims_subscription.h"
 #include "hss_cache.h"
+#include "identity_set.h"
 #include "impu_store.h"
+#include "wildcard_index.h"
 
-#include <map>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -41,17 +43,18 @@ public:
     _charging_addresses(default_impu->charging_addresses),
     _charging_addresses_set(false),
     _registration_state(default_impu->registration_state),
-    _registration_state_set(false)
+    _registration_state_set(false),
+    _refresh_deadline(default_impu->refresh_deadline),
+    _refresh_deadline_set(false),
+    _lookup_expiry(default_impu->lookup_expiry),
+    _lookup_lifetime(1),
+    _refresh_lookups(true),
+    _assoc_impu_chunks(default_impu->assoc_impu_chunks),
+    _assoc_impu_chunk_expiry(default_impu->assoc_impu_chunk_expiry),
+    _assoc_impu_chunks_hash_tagged(default_impu->assoc_impu_chunks_hash_tagged)
   {
-    for (const std::string& impu : default_impu->associated_impus)
-    {
-      _associated_impus[impu] = State::UNCHANGED;
-    }
-
-    for (const std::string& impi : default_impu->impis)
-    {
-      _impis[impi] = State::UNCHANGED;
-    }
+    _associated_impus.add_all(default_impu->associated_impus, State::UNCHANGED);
+    _impis.add_all(default_impu->impis, State::UNCHANGED);
 
     _ttl = default_impu->expiry - time(0);
   }
@@ -70,7 +73,14 @@ public:
     _existing(false),
     _ims_sub_xml_set(false),
     _charging_addresses_set(false),
-    _registration_state_set(false)
+    _registration_state_set(false),
+    _refresh_deadline(0),
+    _refresh_deadline_set(false),
+    _lookup_expiry(0),
+    _lookup_lifetime(1),
+    _refresh_lookups(true),
+    _assoc_impu_chunk_expiry(0),
+    _assoc_impu_chunks_hash_tagged(false)
   {
   }
 
@@ -93,18 +103,7 @@ public:
 
   virtual std::vector<std::string> get_associated_impis() const override
   {
-    std::vector<std::string> impis;
-
-    for (const std::pair<std::string, State>& entry : _impis)
-    {
-      if (entry.second == State::UNCHANGED ||
-          entry.second == State::ADDED)
-      {
-        impis.push_back(entry.first);
-      }
-    }
-
-    return impis;
+    return _impis.current().to_vector();
   }
 
   virtual const ChargingAddresses& get_charging_addresses() const override
@@ -117,6 +116,11 @@ public:
     return _ttl;
   }
 
+  virtual int64_t get_refresh_deadline() const override
+  {
+    return _refresh_deadline;
+  }
+
   virtual void set_ims_sub_xml(const std::string& xml) override;
 
   virtual void set_reg_state(RegistrationState state) override
@@ -140,6 +144,12 @@ public:
     _ttl = ttl;
   }
 
+  virtual void set_refresh_deadline(int64_t deadline) override
+  {
+    _refresh_deadline_set = true;
+    _refresh_deadline = deadline;
+  }
+
   // Functions for MemcachedCache
 
   bool is_existing() const { return _existing; }
@@ -150,38 +160,63 @@ public:
             _ims_sub_xml_set ||
             _charging_addresses_set ||
             _registration_state_set ||
+            _refresh_deadline_set ||
             has_changed_impus() ||
             has_changed_impis();
   }
 
   bool has_changed_impis() const
   {
-    return has_changed_data(_impis);
+    return _impis.has_changes();
   }
 
   bool has_changed_impus() const
   {
-    return has_changed_data(_associated_impus);
+    return _associated_impus.has_changes();
   }
 
   bool is_refreshed() const { return _refreshed; }
 
   void mark_as_refreshed(){ _refreshed = true; }
 
-  std::vector<std::string> get_associated_impus() const
+  // The associated IMPU and IMPI mapping records ("lookup records") only
+  // point at the default IMPU, so they can be kept for a number of IRS
+  // lifetimes, and then needn't be rewritten on each refresh. A lifetime of
+  // 1 keeps them for as long as the IRS.
+  void set_lookup_lifetime(int lifetime) { _lookup_lifetime = lifetime; }
+
+  // Whether the unchanged lookup records need rewriting when the IRS is
+  // refreshed. This is decided when the default IMPU record is built.
+  bool refresh_lookups() const { return _refresh_lookups; }
+
+  // Forget what we know about the records for this IRS in the store, other
+  // than the default IMPU record, e.g. because the store doesn't have this
+  // IRS.
+  void clear_store_state()
+  {
+    _lookup_expiry = 0;
+    _assoc_impu_chunks.clear();
+    _assoc_impu_chunk_expiry = 0;
+    _assoc_impu_chunks_hash_tagged = false;
+  }
+
+  // The expiry to write a lookup record with, given its current expiry.
+  int64_t get_lookup_expiry(int64_t current_expiry = 0) const
   {
-    std::vector<std::string> impus;
+    int64_t expiry = time(0) + _ttl;
 
-    for (const std::pair<std::string, State>& entry : _associated_impus)
+    if (_lookup_lifetime > 1)
     {
-      if (entry.second == State::UNCHANGED ||
-          entry.second == State::ADDED)
-      {
-        impus.push_back(entry.first);
-      }
+      // IMPI mappings may be shared with other IRSs, so never shorten them.
+      expiry = std::max(expiry, std::max(_lookup_expiry, current_expiry));
     }
 
-    return impus;
+    return expiry;
+  }
+
+  std::vector<std::string> get_associated_impus() const
+  {
+    return _associated_impus.current().to_vector();
   }
 
   // Get an IMPU representing this IRS without any CAS
@@ -203,18 +238,12 @@ public:
   // Delete all of the IMPIs
   void delete_impis();
 
-  // Enumerate the different states a piece of data (an IMPU or IMPI)
-  // can be in.
-  enum State
-  {
-    ADDED,
-    UNCHANGED,
-    DELETED
-  };
+  // The different states a piece of data (an IMPU or IMPI) can be in.
+  typedef IdentitySet::State State;
 
-  // This stores a map of all of the IMPUs and IMPIs we have seen while
-  // performing conflict resolution, and the state that they are in
-  typedef std::map<std::string, State> Data;
+  // This stores all of the IMPUs and IMPIs we have seen while performing
+  // conflict resolution, and the state that they are in
+  typedef IdentitySet Data;
 
 private:
   std::string _default_impu;
@@ -222,23 +251,6 @@ private:
   const ImpuStore* _store;
   const uint64_t _cas;
 
-  // Get all the elements in the given Data object in the given state,
-  // (e.g. all of the unchanged elements, or all of the deleted elements).
-  static std::vector<std::string> get_elements_in_state(const Data& data,
-                                                        State status)
-  {
-    std::vector<std::string> v;
-    for (const std::pair<const std::string, State>& entry : data)
-    {
-      if (entry.second == status)
-      {
-        v.push_back(entry.first);
-      }
-    }
-
-    return v;
-  }
-
   int32_t _ttl;
 
   bool _changed;
@@ -257,32 +269,34 @@ private:
   RegistrationState _registration_state;
   bool _registration_state_set;
 
-  ImpuStore::DefaultImpu* create_impu(uint64_t cas,
-                                      const ImpuStore* store);
+  int64_t _refresh_deadline;
+  bool _refresh_deadline_set;
 
-  static bool has_changed_data(const Data& data)
-  {
-    for (Data::value_type pair : data)
-    {
-      if (pair.second == State::ADDED ||
-          pair.second == State::DELETED)
-      {
-        return true;
-      }
-    }
+  int64_t _lookup_expiry;
+  int _lookup_lifetime;
+  bool _refresh_lookups;
 
-    return false;
-  }
+  // The chunks of associated IMPUs in the store, so that only the chunks
+  // that change are rewritten.
+  std::vector<uint32_t> _assoc_impu_chunks;
+  int64_t _assoc_impu_chunk_expiry;
+  bool _assoc_impu_chunks_hash_tagged;
+
+  ImpuStore::DefaultImpu* create_impu(uint64_t cas,
+                                      const ImpuStore* store);
 
 public:
-  std::vector<std::string> impis(State status)
+  // All the elements in the given state (e.g. all of the unchanged
+  // elements, or all of the deleted elements). These refer to the IRS's
+  // data, so are only valid until it is next changed.
+  Data::View impis(State status) const
   {
-    return get_elements_in_state(_impis, status);
+    return _impis.in_state(status);
   }
 
-  std::vector<std::string> impus(State status)
+  Data::View impus(State status) const
   {
-    return get_elements_in_state(_associated_impus, status);
+    return _associated_impus.in_state(status);
   }
 
 };
@@ -290,11 +304,17 @@ public:
 class MemcachedCache : public BaseHssCache
 {
 public:
+  // The lookup lifetime is the number of IRS lifetimes that associated IMPU
+  // and IMPI mapping records are kept for - see
+  // MemcachedImplicitRegistrationSet::set_lookup_lifetime.
   MemcachedCache(ImpuStore* local_store,
-                 const std::vector<ImpuStore*>& remote_stores) :
+                 const std::vector<ImpuStore*>& remote_stores,
+                 int lookup_lifetime = 1) :
     BaseHssCache(),
     _local_store(local_store),
-    _remote_stores(remote_stores)
+    _remote_stores(remote_stores),
+    _lookup_lifetime(lookup_lifetime),
+    _wildcard_index(nullptr)
   {
   }
 
@@ -302,6 +322,14 @@ public:
   {
   }
 
+  // Indexes the wildcarded IMPUs of the IRSs that pass through the cache,
+  // so that a concrete IMPU that isn't cached can be found in the IRS of a
+  // wildcard it matches. The cache doesn't own the index.
+  void set_wildcard_index(WildcardIndex* wildcard_index)
+  {
+    _wildcard_index = wildcard_index;
+  }
+
   // Create an IRS for the given IMPU
   virtual ImplicitRegistrationSet* create_implicit_registration_set()
   {
@@ -313,6 +341,19 @@ public:
                                                                SAS::TrailId trail,
                                                                ImplicitRegistrationSet*& result) override;
 
+  // The IRS can be got without blocking if the local store has an async
+  // store to read from.
+  virtual bool supports_async_get() const override
+  {
+    return _local_store->is_async();
+  }
+
+  // Get the IRS for a given IMPU, continuing on the async stores' threads as
+  // each record is read
+  virtual void get_implicit_registration_set_for_impu_async(const std::string& impu,
+                                                            SAS::TrailId trail,
+                                                            irs_result_callback callback) override;
+
   // Save the IRS in the cache
   // Must include updating the impi mapping table if impis have been added
   virtual Store::Status put_implicit_registration_set(ImplicitRegistrationSet* irs,
@@ -350,13 +391,41 @@ protected:
 private:
   ImpuStore* _local_store;
   std::vector<ImpuStore*> _remote_stores;
+  int _lookup_lifetime;
+  WildcardIndex* _wildcard_index;
 
   ImpuStore::Impu* get_impu_for_impu_gr(const std::string& impu,
                                         SAS::TrailId trail);
 
+  // Asynchronous version of get_impu_for_impu_gr. The remote stores are
+  // tried in turn, starting from the given one.
+  void get_impu_for_impu_gr_async(const std::string& impu,
+                                  SAS::TrailId trail,
+                                  ImpuStore::impu_callback callback);
+  void get_impu_from_remote_async(const std::string& impu,
+                                  SAS::TrailId trail,
+                                  size_t remote_idx,
+                                  ImpuStore::impu_callback callback);
+
+  // Builds the IRS for an IMPU from its default IMPU record, which is found
+  // either directly or via an associated IMPU record. Takes ownership of the
+  // record, and checks that it's consistent with the associated IMPU.
+  Store::Status irs_from_default_impu(const std::string& impu,
+                                      ImpuStore::Impu* data,
+                                      bool via_associated_impu,
+                                      ImplicitRegistrationSet*& result);
+
   ImpuStore::ImpiMapping* get_impi_mapping_gr(const std::string& impi,
                                               SAS::TrailId trail);
 
+  // Finds the indexed wildcard that a concrete IMPU matches, if any.
+  bool wildcard_for_impu(const std::string& impu, std::string& wildcard);
+
+  // Updates the wildcard index with the wildcarded IMPUs in the IRS. If the
+  // IRS has been deleted, they're all removed from the index.
+  void update_wildcard_index(MemcachedImplicitRegistrationSet* irs,
+                             bool deleted);
+
   // Per Store IRS methods
 
   typedef std::function<Store::Status(ImpuStore*)> store_action;
@@ -407,6 +476,15 @@ private:
   Store::Status update_irs_impi_mappings(MemcachedImplicitRegistrationSet* irs,
                                               SAS::TrailId trail,
                                               ImpuStore* store);
+
+  // Keeps the rest of a split IMPI mapping up to date after the IRS's bucket
+  // has been written, with the given expiry (or 0 if the IRS has been
+  // removed from the bucket).
+  Store::Status update_split_impi_mapping(MemcachedImplicitRegistrationSet* irs,
+                                          const std::string& impi,
+                                          int64_t bucket_expiry,
+                                          SAS::TrailId trail,
+                                          ImpuStore* store);
 };
 
 #endif
@@ -0,0 +1,73 @@
+/**
+ * @file negative_cache.h Caches the HSS not knowing a subscriber
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef NEGATIVE_CACHE_H_
+#define NEGATIVE_CACHE_H_
+
+#include <mutex>
+#include <string>
+
+#include "lru_map.h"
+#include "statisticsmanager.h"
+
+/**
+ * Remembers which subscribers the HSS has recently said it doesn't know, so
+ * that repeated requests for them (e.g. from scanners, or misconfigured
+ * devices) can be rejected without another round trip to the HSS.
+ *
+ * Answers are remembered separately for each type of request, as the HSS
+ * checks different things for each. Each answer is kept for a short TTL from
+ * when the HSS gave it - later requests that are rejected from the cache
+ * don't extend it, so a newly provisioned subscriber is never locked out for
+ * longer than the TTL. The number of answers is bounded, with the least
+ * recently used evicted first.
+ */
+class NegativeCache
+{
+public:
+  enum Request
+  {
+    MAR,
+    UAR,
+    LIR,
+    SAR
+  };
+
+  /// @param ttl_s         - How long each answer is kept for.
+  /// @param max_entries   - The maximum number of answers to keep.
+  /// @param stats_manager - Counts the requests rejected from the cache.
+  NegativeCache(int ttl_s, size_t max_entries, StatisticsManager* stats_manager);
+  virtual ~NegativeCache() {};
+
+  /// Whether the HSS recently said it doesn't know the subscriber, in answer
+  /// to this type of request.
+  virtual bool is_unknown(Request request,
+                          const std::string& impi,
+                          const std::string& impu);
+
+  /// Records that the HSS said it doesn't know the subscriber.
+  virtual void add_unknown(Request request,
+                           const std::string& impi,
+                           const std::string& impu);
+
+private:
+  static std::string key(Request request,
+                         const std::string& impi,
+                         const std::string& impu);
+
+  const int _ttl_s;
+  StatisticsManager* _stats_manager;
+
+  std::mutex _lock;
+  LruMap<bool> _unknown;
+};
+
+#endif
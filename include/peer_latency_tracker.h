@@ -0,0 +1,124 @@
+/**
+ * @file peer_latency_tracker.h Tracks the latency of requests to each peer
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef PEER_LATENCY_TRACKER_H_
+#define PEER_LATENCY_TRACKER_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <time.h>
+
+/**
+ * Tracks the latency of requests to each peer over a sliding window of recent
+ * requests, and uses it to derive request timeouts and to pick peers.
+ *
+ * Peers are identified by name (for Diameter, the Origin-Host of the
+ * answers). The empty name refers to all peers together, and is used for
+ * requests that aren't sent to a particular peer.
+ */
+class PeerLatencyTracker
+{
+public:
+  /// @param min_timeout_ms - The smallest timeout that will be returned.
+  /// @param max_timeout_ms - The largest timeout that will be returned. This
+  ///                         is also the timeout used for peers we don't have
+  ///                         enough samples for.
+  PeerLatencyTracker(int min_timeout_ms, int max_timeout_ms);
+  virtual ~PeerLatencyTracker() {};
+
+  /// Records the latency of a request. Requests that time out should be
+  /// recorded with the latency at which they timed out.
+  ///
+  /// @param peer       - The peer that the request was sent to, or empty if
+  ///                     this isn't known.
+  /// @param latency_us - The latency of the request.
+  void record(const std::string& peer, unsigned long latency_us);
+
+  /// Gets the 99th percentile latency of requests to the given peer.
+  ///
+  /// @returns false if we don't have enough samples for the peer.
+  bool p99_us(const std::string& peer, unsigned long& latency_us);
+
+  /// Returns the timeout to use for a request to the given peer. This is a
+  /// multiple of the peer's 99th percentile latency, within the configured
+  /// bounds.
+  int timeout_ms(const std::string& peer);
+
+  /// Chooses the peers for a request that may be hedged.
+  ///
+  /// @param dest_host - The peer already chosen for the request (e.g. by a
+  ///                    PeerSelector), if any. If set, this is always used
+  ///                    as the primary.
+  /// @param primary   - Set to the peer to send the request to. Unless a
+  ///                    peer was already chosen, this is chosen at random,
+  ///                    to spread the load across the peers.
+  /// @param alternate - Set to the fastest other peer.
+  ///
+  /// @returns false if we don't know of two peers that are currently
+  ///          answering requests.
+  bool choose_peers(const std::string& dest_host,
+                    std::string& primary,
+                    std::string& alternate);
+
+  // The number of samples kept for each peer.
+  static const size_t WINDOW_SIZE = 1000;
+
+  // The number of samples needed before we trust the percentiles.
+  static const size_t MIN_SAMPLES = 100;
+
+  // Percentiles are recalculated after this many new samples, rather than on
+  // every request.
+  static const size_t RECALC_INTERVAL = 50;
+
+  // Peers we haven't had an answer from for this long are not chosen.
+  static const int PEER_EXPIRY_S = 60;
+
+  // Timeouts are this multiple of the 99th percentile latency.
+  static const int TIMEOUT_MULTIPLIER = 2;
+
+private:
+  struct Samples
+  {
+    Samples() :
+      samples(WINDOW_SIZE, 0),
+      next(0),
+      count(0),
+      since_recalc(0),
+      p50_us(0),
+      p99_us(0),
+      last_sample(0)
+    {}
+
+    std::vector<unsigned long> samples;
+    size_t next;
+    size_t count;
+    size_t since_recalc;
+    unsigned long p50_us;
+    unsigned long p99_us;
+    time_t last_sample;
+  };
+
+  static void add_sample(Samples& samples, unsigned long latency_us);
+  static void recalculate(Samples& samples);
+
+  // Whether this peer has enough recent samples to be used.
+  static bool is_live(const Samples& samples, time_t now);
+
+  int _min_timeout_ms;
+  int _max_timeout_ms;
+
+  std::mutex _lock;
+  std::map<std::string, Samples> _peers;
+};
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file peer_selector.h Chooses the least loaded peer for each request
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef PEER_SELECTOR_H_
+#define PEER_SELECTOR_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <time.h>
+
+/**
+ * Chooses which peer to send each request to, preferring the peer with the
+ * fewest requests in flight, weighted by how quickly it has been answering
+ * them.
+ *
+ * The selector learns which peers exist from the peers that answer requests.
+ * When it doesn't know of any peers (and for a small proportion of requests
+ * otherwise), it doesn't choose a peer, so that the request is routed by
+ * realm and new peers are discovered. Peers that stop answering requests are
+ * forgotten.
+ */
+class PeerSelector
+{
+public:
+  /// @param failure_penalty_ms - A request that fails or times out counts as
+  ///                             taking at least this long.
+  PeerSelector(int failure_penalty_ms);
+  virtual ~PeerSelector() {};
+
+  /// Chooses the peer for a new request.
+  ///
+  /// @returns the chosen peer, or empty if the request should be routed by
+  ///          realm.
+  virtual std::string select();
+
+  /// Records that a request has been sent.
+  ///
+  /// @param peer - The peer it was sent to, or empty if it was routed by
+  ///               realm.
+  virtual void start(const std::string& peer);
+
+  /// Records that a request has completed.
+  ///
+  /// @param peer        - The peer passed to start().
+  /// @param answered_by - The peer that answered the request, or empty if it
+  ///                      timed out.
+  /// @param latency_us  - How long the request took.
+  /// @param failed      - Whether the peer failed to handle the request.
+  virtual void complete(const std::string& peer,
+                        const std::string& answered_by,
+                        unsigned long latency_us,
+                        bool failed);
+
+  // One in this many requests is routed by realm to discover new peers.
+  static const int DISCOVERY_INTERVAL = 100;
+
+  // Peers that haven't answered a request for this long are forgotten.
+  static const int PEER_EXPIRY_S = 60;
+
+  // The weight of each new latency sample in the moving average is
+  // 1 / EWMA_WEIGHT.
+  static const int EWMA_WEIGHT = 8;
+
+private:
+  struct Peer
+  {
+    Peer() : in_flight(0), ewma_latency_us(0), last_answer(0) {}
+
+    int in_flight;
+    unsigned long ewma_latency_us;
+    time_t last_answer;
+  };
+
+  unsigned long _failure_penalty_us;
+
+  std::mutex _lock;
+  std::map<std::string, Peer> _peers;
+  int _selections;
+};
+
+#endif
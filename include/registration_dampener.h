@@ -0,0 +1,75 @@
+/**
+ * @file registration_dampener.h Dampens repeated re-registrations
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef REGISTRATION_DAMPENER_H_
+#define REGISTRATION_DAMPENER_H_
+
+#include <mutex>
+#include <string>
+
+#include "lru_map.h"
+#include "statisticsmanager.h"
+
+/**
+ * Stops a subscriber that re-registers over and over (e.g. a faulty UE, or a
+ * proxy retransmitting a REGISTER) from costing a SAR and a cache write each
+ * time.
+ *
+ * Each registration that is sent to the HSS and written to the cache is
+ * counted against its public and private IDs. Once a public and private ID
+ * have had the maximum number of these in the window, any more
+ * re-registrations for them in the window are answered from the IRS in the
+ * cache, which was written moments before.
+ */
+class RegistrationDampener
+{
+public:
+  /// @param window_ms      - How long registrations are counted for, from
+  ///                         the first one.
+  /// @param max_per_window - How many registrations in the window are sent
+  ///                         to the HSS.
+  /// @param max_entries    - The maximum number of public and private IDs to
+  ///                         track. The least recently used are forgotten.
+  /// @param stats_manager  - Counts the dampened re-registrations.
+  RegistrationDampener(int window_ms,
+                       int max_per_window,
+                       size_t max_entries,
+                       StatisticsManager* stats_manager);
+  virtual ~RegistrationDampener() {};
+
+  /// Whether a re-registration should be answered from the cache, rather
+  /// than sent to the HSS.
+  virtual bool dampen(const std::string& impu, const std::string& impi);
+
+  /// Records that a registration has been sent to the HSS and written to the
+  /// cache.
+  virtual void record(const std::string& impu, const std::string& impi);
+
+private:
+  // The registrations counted in a window. The window ends when the entry
+  // expires.
+  struct Window
+  {
+    int count;
+  };
+
+  static std::string key(const std::string& impu, const std::string& impi);
+  static int64_t now_ms();
+
+  const int _window_ms;
+  const int _max_per_window;
+  StatisticsManager* _stats_manager;
+
+  std::mutex _lock;
+  LruMap<Window> _windows;
+};
+
+#endif
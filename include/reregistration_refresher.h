@@ -0,0 +1,131 @@
+/**
+ * @file reregistration_refresher.h Background re-registration refresher
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef REREGISTRATION_REFRESHER_H_
+#define REREGISTRATION_REFRESHER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "hss_cache_processor.h"
+#include "hss_connection.h"
+#include "implicit_reg_set.h"
+#include "sas.h"
+
+/**
+ * Sends RE_REGISTRATION SARs to the HSS in the background, so that a
+ * re-registering subscriber can be answered from the cache.
+ *
+ * Each IRS stores a refresh deadline, by which time a RE_REGISTRATION SAR
+ * must have been sent to the HSS. The deadline is jittered so that
+ * subscribers who registered together (e.g. after an outage) don't all need
+ * refreshing together.
+ *
+ * When a re-registration arrives within the refresh window before the
+ * deadline, the request is answered from the cache and the refresher is
+ * asked to send the SAR. The refresher sends SARs no faster than a
+ * configured rate, and updates the IRS in the cache with the answer. If the
+ * refresher doesn't get there in time (e.g. because it's rate limited), the
+ * re-registration that arrives after the deadline sends the SAR itself, as
+ * it would without the refresher.
+ */
+class ReregistrationRefresher
+{
+public:
+  ReregistrationRefresher(HssConnection::HssConnection* hss,
+                          HssCacheProcessor* cache,
+                          int hss_reregistration_time,
+                          int record_ttl,
+                          int jitter_percent,
+                          int max_rate,
+                          unsigned int max_queue);
+
+  virtual ~ReregistrationRefresher();
+
+  /// Starts the thread that sends the SARs.
+  bool start();
+
+  /// Stops the thread. Any refreshes still queued are dropped, and this
+  /// waits for the refreshes that have already sent their SAR to complete,
+  /// so the HSS connection and cache must still be running.
+  void stop();
+
+  /// Returns a new refresh deadline for an IRS that has just been refreshed.
+  ///
+  /// The deadline is between (1 - jitter) and 1 times the HSS
+  /// re-registration time from now.
+  virtual int64_t next_deadline(int64_t now);
+
+  /// Whether a refresh should be started for an IRS with the given deadline.
+  virtual bool in_refresh_window(int64_t deadline, int64_t now);
+
+  /// Queues a RE_REGISTRATION SAR for the given request. The SAR is logged
+  /// on the trail of the re-registration that triggered it.
+  ///
+  /// @returns false if the refresh couldn't be queued, either because the
+  ///          queue is full or because this IRS is already being refreshed.
+  virtual bool refresh(const HssConnection::ServerAssignmentRequest& request,
+                       const std::string& default_impu,
+                       SAS::TrailId trail);
+
+private:
+  // The state for a single refresh, which lives from being queued until the
+  // IRS has been written back to the cache (or the refresh has failed).
+  struct Refresh
+  {
+    HssConnection::ServerAssignmentRequest request;
+    std::string default_impu;
+    SAS::TrailId trail;
+    ChargingAddresses charging_addresses;
+    std::string service_profile;
+    ImplicitRegistrationSet* irs;
+  };
+
+  void run();
+  void send_sar(Refresh* refresh);
+  void on_sar_response(Refresh* refresh,
+                       const HssConnection::ServerAssignmentAnswer& saa);
+  void on_get_irs_success(Refresh* refresh, ImplicitRegistrationSet* irs);
+  void on_put_irs_success(Refresh* refresh);
+  void on_failure(Refresh* refresh, Store::Status rc);
+  void complete(Refresh* refresh);
+
+  HssConnection::HssConnection* _hss;
+  HssCacheProcessor* _cache;
+  int _hss_reregistration_time;
+  int _record_ttl;
+  int _jitter;
+  int _refresh_window;
+  int _max_rate;
+  unsigned int _max_queue;
+
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::deque<Refresh*> _queue;
+
+  // Default IMPUs of the IRSs that are queued or being refreshed, so that we
+  // don't refresh an IRS more than once.
+  std::set<std::string> _in_progress;
+
+  // The number of refreshes that have been taken off the queue but not yet
+  // completed. Their callbacks refer to this object, so stop() waits for
+  // this to drop to zero.
+  int _in_flight;
+
+  bool _terminated;
+  std::thread _thread;
+};
+
+#endif
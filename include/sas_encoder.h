@@ -0,0 +1,137 @@
+/**
+ * @file sas_encoder.h Builds SAS events with large payloads in the background
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SAS_ENCODER_H_
+#define SAS_ENCODER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sas.h"
+#include "statisticsmanager.h"
+
+/**
+ * Builds and reports SAS events that carry compressed parameters (i.e. the
+ * service profile XML) on a background thread, so that the compression isn't
+ * done on the thread handling the request.
+ *
+ * An event's parameters are copied into a SasEncoder::Event, which is queued
+ * and turned into a SAS::Event on the encoder's thread. The event keeps the
+ * time it was created, so it's ordered correctly on its trail. If the queue
+ * is full, the event is dropped.
+ *
+ * To limit the cost of logging profiles, profiles can also be sampled (by
+ * trail, so that all the profiles on a trail are logged or none are), and
+ * truncated to a maximum size.
+ */
+class SasEncoder
+{
+public:
+  /// An event to be built on the encoder's thread. This has the same methods
+  /// for adding parameters as SAS::Event.
+  class Event
+  {
+  public:
+    Event(SAS::TrailId trail, uint32_t id, uint32_t instance);
+
+    Event& add_static_param(uint32_t param);
+    Event& add_var_param(const std::string& param);
+    Event& add_compressed_param(const std::string& param,
+                                const SAS::Profile* profile);
+
+    /// Builds the SAS event and reports it.
+    void report() const;
+
+  private:
+    friend class SasEncoder;
+
+    enum ParamType { STATIC, VAR, COMPRESSED };
+
+    struct Param
+    {
+      ParamType type;
+      uint32_t static_value;
+      std::string value;
+      const SAS::Profile* profile;
+    };
+
+    SAS::TrailId _trail;
+    uint32_t _id;
+    uint32_t _instance;
+    SAS::Timestamp _timestamp;
+    std::vector<Param> _params;
+  };
+
+  /// @param max_queue          - The maximum number of events waiting to be
+  ///                             built. Further events are dropped.
+  /// @param sample_percent     - The percentage of trails on which compressed
+  ///                             parameters are logged in full.
+  /// @param max_compressed_len - Compressed parameters are truncated to this
+  ///                             many bytes before compression (0 for no
+  ///                             limit).
+  /// @param stats_manager      - Counts dropped events and omitted
+  ///                             parameters (may be NULL).
+  SasEncoder(unsigned int max_queue,
+             int sample_percent,
+             size_t max_compressed_len,
+             StatisticsManager* stats_manager = NULL);
+
+  virtual ~SasEncoder();
+
+  /// Starts the thread that builds the events.
+  bool start();
+
+  /// Stops the thread, once it has built the events already queued.
+  void stop();
+
+  /// Queues an event to be built and reported. The event's parameters are
+  /// moved out of it. Returns false if the queue is full and the event has
+  /// been dropped.
+  virtual bool report_event(Event& event);
+
+  /// Reports an event on the encoder's thread, or builds and reports it
+  /// immediately if there's no encoder.
+  static void report_event(SasEncoder* encoder, Event& event);
+
+  /// Applies the sampling and size limits to a compressed parameter on the
+  /// given trail.
+  void limit_compressed_param(std::string& param, SAS::TrailId trail);
+
+  uint64_t num_dropped() const { return _dropped.load(); }
+  uint64_t num_omitted() const { return _omitted.load(); }
+
+  static const char* const OMITTED_PARAM;
+  static const char* const TRUNCATED_SUFFIX;
+
+private:
+  void run();
+
+  unsigned int _max_queue;
+  int _sample_percent;
+  size_t _max_compressed_len;
+  StatisticsManager* _stats_manager;
+
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::deque<Event> _queue;
+  bool _terminated;
+  std::thread _thread;
+
+  std::atomic<uint64_t> _dropped;
+  std::atomic<uint64_t> _omitted;
+};
+
+#endif
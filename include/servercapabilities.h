@@ -38,7 +38,7 @@ struct ServerCapabilities
   // Write the server capabilities contained in this structure into a JSON object.
   // The 2 sets of capabilities are added in 2 arrays. If either set of capabilities
   // is empty, write an empty array.
-  void write_capabilities(rapidjson::Writer<rapidjson::StringBuffer>* writer)
+  void write_capabilities(rapidjson::Writer<rapidjson::StringBuffer>* writer) const
   {
     // Mandatory capabilities.
     (*writer).String(JSON_MAN_CAP.c_str());
@@ -34,9 +34,29 @@ public:
   ACCUMULATOR_UPDATE_METHOD(H_hss_digest_latency_us);
   ACCUMULATOR_UPDATE_METHOD(H_hss_subscription_latency_us);
   ACCUMULATOR_UPDATE_METHOD(H_hsprov_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_cache_queue_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_cache_get_irs_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_cache_put_irs_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_cache_delete_irs_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_cache_get_ims_sub_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_cache_put_ims_sub_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_local_store_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_remote_store_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_xml_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_ppr_latency_us);
+  ACCUMULATOR_UPDATE_METHOD(H_rtr_latency_us);
 
   COUNTER_INCR_METHOD(H_incoming_requests);
   COUNTER_INCR_METHOD(H_rejected_overload);
+  COUNTER_INCR_METHOD(H_hss_hedged_requests);
+  COUNTER_INCR_METHOD(H_hss_hedge_wins);
+  COUNTER_INCR_METHOD(H_hss_hedge_losses);
+  COUNTER_INCR_METHOD(H_hsprov_cache_hits);
+  COUNTER_INCR_METHOD(H_hsprov_cache_misses);
+  COUNTER_INCR_METHOD(H_sas_events_dropped);
+  COUNTER_INCR_METHOD(H_sas_params_omitted);
+  COUNTER_INCR_METHOD(H_reg_dampened);
+  COUNTER_INCR_METHOD(H_negative_cache_hits);
 
   // Methods required to implement the HTTP stack stats interface.
   void update_http_latency_us(unsigned long latency_us)
@@ -52,9 +72,29 @@ private:
   SNMP::EventAccumulatorTable* H_hss_digest_latency_us;
   SNMP::EventAccumulatorTable* H_hss_subscription_latency_us;
   SNMP::EventAccumulatorTable* H_hsprov_latency_us;
+  SNMP::EventAccumulatorTable* H_cache_queue_latency_us;
+  SNMP::EventAccumulatorTable* H_cache_get_irs_latency_us;
+  SNMP::EventAccumulatorTable* H_cache_put_irs_latency_us;
+  SNMP::EventAccumulatorTable* H_cache_delete_irs_latency_us;
+  SNMP::EventAccumulatorTable* H_cache_get_ims_sub_latency_us;
+  SNMP::EventAccumulatorTable* H_cache_put_ims_sub_latency_us;
+  SNMP::EventAccumulatorTable* H_local_store_latency_us;
+  SNMP::EventAccumulatorTable* H_remote_store_latency_us;
+  SNMP::EventAccumulatorTable* H_xml_latency_us;
+  SNMP::EventAccumulatorTable* H_ppr_latency_us;
+  SNMP::EventAccumulatorTable* H_rtr_latency_us;
 
   SNMP::CounterTable* H_incoming_requests;
   SNMP::CounterTable* H_rejected_overload;
+  SNMP::CounterTable* H_hss_hedged_requests;
+  SNMP::CounterTable* H_hss_hedge_wins;
+  SNMP::CounterTable* H_hss_hedge_losses;
+  SNMP::CounterTable* H_hsprov_cache_hits;
+  SNMP::CounterTable* H_hsprov_cache_misses;
+  SNMP::CounterTable* H_sas_events_dropped;
+  SNMP::CounterTable* H_sas_params_omitted;
+  SNMP::CounterTable* H_reg_dampened;
+  SNMP::CounterTable* H_negative_cache_hits;
 };
 
 #endif
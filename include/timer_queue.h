@@ -0,0 +1,52 @@
+/**
+ * @file timer_queue.h Runs tasks after a delay on a background thread
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TIMER_QUEUE_H_
+#define TIMER_QUEUE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+/**
+ * Runs tasks on a single background thread once their delay has passed. Tasks
+ * should be quick, as they hold up any other tasks that are due.
+ */
+class TimerQueue
+{
+public:
+  typedef std::function<void()> task_t;
+
+  TimerQueue();
+  virtual ~TimerQueue();
+
+  bool start();
+
+  /// Stops the thread. Tasks that haven't run yet are dropped.
+  void stop();
+
+  /// Runs the task once the delay has passed.
+  virtual void schedule(int delay_ms, task_t task);
+
+private:
+  void run();
+
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::multimap<std::chrono::steady_clock::time_point, task_t> _tasks;
+  bool _terminated;
+  std::thread _thread;
+};
+
+#endif
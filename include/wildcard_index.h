@@ -0,0 +1,85 @@
+/**
+ * @file wildcard_index.h Index of the wildcarded IMPUs in the cache
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef WILDCARD_INDEX_H_
+#define WILDCARD_INDEX_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/regex.hpp>
+
+/**
+ * The wildcarded IMPUs (e.g. sip:chat!.*!@example.com, see TS 23.003) of
+ * the IRSs that this Homestead has seen in the cache, so that a concrete
+ * IMPU that isn't in the cache can be looked up by the wildcard it matches.
+ *
+ * This is only a hint. It's local to this process, and isn't kept in step
+ * with the cache, so a wildcard it returns may no longer be cached. The
+ * wildcards are grouped by the part of the IMPU after the wildcard's '@',
+ * so a concrete IMPU is only matched against the wildcards in its domain.
+ *
+ * Lookups take a reference to the current index, and match against it
+ * without holding the lock. Adding or removing a wildcard builds a new
+ * index, but that's rare.
+ */
+class WildcardIndex
+{
+public:
+  /// @param max_size - The maximum number of wildcards to index. Further
+  ///                   wildcards are ignored until some are removed.
+  WildcardIndex(size_t max_size);
+  virtual ~WildcardIndex() {}
+
+  /// Whether the IMPU is wildcarded, i.e. has a regular expression between
+  /// a pair of '!'s.
+  static bool is_wildcard(const std::string& impu);
+
+  /// Adds a wildcarded IMPU to the index. Does nothing if it's already
+  /// indexed, or isn't a valid wildcard.
+  void add(const std::string& wildcard);
+
+  /// Removes a wildcarded IMPU from the index.
+  void remove(const std::string& wildcard);
+
+  /// Finds the wildcard that matches a concrete IMPU. Returns false if no
+  /// wildcard matches, or if more than one does - in that case the HSS has
+  /// to decide.
+  bool match(const std::string& impu, std::string& wildcard) const;
+
+  size_t size() const;
+
+private:
+  struct Pattern
+  {
+    std::string wildcard;
+    boost::regex regex;
+  };
+
+  typedef std::map<std::string, std::vector<std::shared_ptr<const Pattern>>> Index;
+
+  // The key to group an IMPU under - the part after the last '@' that
+  // isn't in the wildcard's regular expression.
+  static std::string domain(const std::string& impu);
+
+  std::shared_ptr<const Index> current() const;
+
+  size_t _max_size;
+
+  mutable std::mutex _lock;
+  std::shared_ptr<const Index> _index;
+  size_t _size;
+};
+
+#endif
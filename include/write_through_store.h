@@ -0,0 +1,95 @@
+/**
+ * @file write_through_store.h Store that writes through to a local log
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef WRITE_THROUGH_STORE_H_
+#define WRITE_THROUGH_STORE_H_
+
+#include <atomic>
+#include <string>
+
+#include "log_structured_store.h"
+#include "store.h"
+
+/**
+ * A Store that sits in front of another store (normally memcached), and
+ * copies every successful write to a LogStructuredStore. If the other store
+ * has lost its data, e.g. because memcached has restarted, the records in
+ * the log are put back in it when we start.
+ *
+ * Records are only restored at start of day, and only if the other store
+ * has lost its data. Otherwise the other store's view is current - it may
+ * have had records deleted or replaced by other nodes, that this node's log
+ * doesn't know about. Whether the other store has lost its data is tracked
+ * with a marker record that's kept in it.
+ *
+ * The other store is in charge of CAS values - the log just holds a copy of
+ * the latest data.
+ *
+ * The log only holds this node's writes, and doesn't record deletes or
+ * changes made by other nodes, so restoring it to a store that other nodes
+ * also write to can bring back stale records. It's only for stores that
+ * this node alone writes to.
+ */
+class WriteThroughStore : public Store
+{
+public:
+  /// Takes ownership of the store and the log.
+  ///
+  /// @param node_id - Identifies this node's marker record in the store.
+  WriteThroughStore(Store* store,
+                    LogStructuredStore* log,
+                    const std::string& node_id);
+  virtual ~WriteThroughStore();
+
+  /// Puts the records in the log back in the store, if the store has lost
+  /// them since the marker record was last written. This must be called
+  /// before the store is used.
+  ///
+  /// @param restored - Set to the number of records restored.
+  Store::Status restore(uint64_t& restored);
+
+  Store::Status get_data(const std::string& table,
+                         const std::string& key,
+                         std::string& data,
+                         uint64_t& cas,
+                         SAS::TrailId trail = 0,
+                         bool log_body = true);
+
+  Store::Status set_data(const std::string& table,
+                         const std::string& key,
+                         const std::string& data,
+                         uint64_t cas,
+                         int expiry,
+                         SAS::TrailId trail = 0,
+                         bool log_body = true);
+
+  Store::Status set_data_without_cas(const std::string& table,
+                                     const std::string& key,
+                                     const std::string& data,
+                                     int expiry,
+                                     SAS::TrailId trail = 0,
+                                     bool log_body = true);
+
+  Store::Status delete_data(const std::string& table,
+                            const std::string& key,
+                            SAS::TrailId trail = 0);
+
+private:
+  // Rewrites the marker record if it's due to be refreshed.
+  void refresh_marker(SAS::TrailId trail);
+
+  Store* _store;
+  LogStructuredStore* _log;
+  const std::string _node_id;
+  std::atomic<int64_t> _marker_refresh_time;
+};
+
+#endif
@@ -0,0 +1,969 @@
+/**
+ * @file async_memcached_store.cpp Non-blocking memcached client
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "async_memcached_store.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "log.h"
+
+// The parts of the memcached binary protocol that we use.
+static const uint8_t REQUEST_MAGIC = 0x80;
+static const uint8_t RESPONSE_MAGIC = 0x81;
+static const uint8_t OPCODE_GET = 0x00;
+static const uint8_t OPCODE_SET = 0x01;
+static const uint16_t STATUS_OK = 0x0000;
+static const uint16_t STATUS_KEY_NOT_FOUND = 0x0001;
+static const size_t HEADER_LEN = 24;
+
+// Memcached treats expiries longer than this as absolute times.
+static const int MAX_RELATIVE_EXPIRY = 60 * 60 * 24 * 30;
+
+// How much is read from a connection at once.
+static const size_t READ_BUFFER_LEN = 65536;
+
+// The epoll tags of an event loop's file descriptors. The connection is
+// tagged rather than identified by its file descriptor, as it changes each
+// time the loop reconnects.
+static const uint32_t WAKE_TAG = 0;
+static const uint32_t CONNECTION_TAG = 1;
+
+typedef std::chrono::steady_clock Clock;
+
+static uint16_t read_uint16(const uint8_t* data)
+{
+  return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static uint32_t read_uint32(const uint8_t* data)
+{
+  return (((uint32_t)data[0] << 24) |
+          ((uint32_t)data[1] << 16) |
+          ((uint32_t)data[2] << 8) |
+          (uint32_t)data[3]);
+}
+
+static uint64_t read_uint64(const uint8_t* data)
+{
+  return (((uint64_t)read_uint32(data) << 32) | read_uint32(data + 4));
+}
+
+static void write_uint16(std::string& buffer, uint16_t value)
+{
+  buffer.push_back((char)(value >> 8));
+  buffer.push_back((char)value);
+}
+
+static void write_uint32(std::string& buffer, uint32_t value)
+{
+  write_uint16(buffer, (uint16_t)(value >> 16));
+  write_uint16(buffer, (uint16_t)value);
+}
+
+/// An event loop, running on its own thread, with one connection to the
+/// server. Requests are handed to the loop through a queue, and its thread
+/// does all the I/O and runs the callbacks.
+class AsyncMemcachedStore::EventLoop
+{
+public:
+  /// A GET or a SET. A SET completes with OK and no data if it succeeds.
+  struct Request
+  {
+    uint8_t opcode;
+    std::string fq_key;
+    std::string data;
+    uint32_t expiry;
+    get_callback callback;
+    Clock::time_point deadline;
+  };
+
+  EventLoop(const std::string& server,
+            const std::vector<Address>& addresses,
+            int timeout_ms);
+  ~EventLoop();
+
+  bool start();
+  void stop();
+
+  /// Queues the requests, which are sent together. If the loop has stopped,
+  /// they fail (in order) before this returns.
+  void submit(std::vector<Request>& requests);
+
+private:
+  static void write_request(std::string& buffer,
+                            const Request& request,
+                            uint32_t opaque);
+
+  void wake();
+  void run();
+
+  // These are only called on the loop's thread.
+  void send_requests(std::vector<Request>& requests);
+  bool connect_to_server();
+  void connected();
+  void flush();
+  void read();
+  void process_responses();
+  void expire_requests();
+  int next_timeout_ms();
+  void watch_for_writes(bool watch);
+  void disconnect();
+
+  const std::string _server;
+  const std::vector<Address> _addresses;
+  const std::chrono::milliseconds _timeout;
+
+  int _epoll_fd;
+  int _wake_fd;
+  std::thread _thread;
+
+  // Requests waiting to be picked up by the loop, protected by the lock.
+  std::mutex _lock;
+  std::vector<Request> _queued;
+  bool _terminated;
+
+  // The connection, and the requests that have been sent on it, by the
+  // opaque value that the server echoes back in its response. The deadlines
+  // are in the order the requests were sent, so the first is the soonest.
+  int _fd;
+  bool _connecting;
+  bool _watching_writes;
+  size_t _next_address;
+  uint32_t _next_opaque;
+  std::string _send_buffer;
+  size_t _send_offset;
+  std::string _recv_buffer;
+  std::vector<char> _read_buffer;
+  std::unordered_map<uint32_t, Request> _outstanding;
+  std::deque<std::pair<Clock::time_point, uint32_t>> _deadlines;
+};
+
+// Appends a request. A GET is just its key. A SET has the data, and its
+// extras are the flags (which we don't use) and the expiry.
+void AsyncMemcachedStore::EventLoop::write_request(std::string& buffer,
+                                                   const Request& request,
+                                                   uint32_t opaque)
+{
+  uint8_t extras_len = (request.opcode == OPCODE_SET) ? 8 : 0;
+
+  buffer.push_back((char)REQUEST_MAGIC);
+  buffer.push_back((char)request.opcode);
+  write_uint16(buffer, (uint16_t)request.fq_key.size());
+  buffer.push_back((char)extras_len);
+  buffer.push_back(0);                     // Data type
+  write_uint16(buffer, 0);                 // VBucket
+  write_uint32(buffer, (uint32_t)(extras_len +
+                                  request.fq_key.size() +
+                                  request.data.size()));
+  write_uint32(buffer, opaque);
+  buffer.append(8, '\0');                  // CAS
+
+  if (request.opcode == OPCODE_SET)
+  {
+    write_uint32(buffer, 0);               // Flags
+    write_uint32(buffer, request.expiry);
+  }
+
+  buffer.append(request.fq_key);
+  buffer.append(request.data);
+}
+
+AsyncMemcachedStore::EventLoop::EventLoop(const std::string& server,
+                                          const std::vector<Address>& addresses,
+                                          int timeout_ms) :
+  _server(server),
+  _addresses(addresses),
+  _timeout(timeout_ms),
+  _epoll_fd(-1),
+  _wake_fd(-1),
+  _terminated(false),
+  _fd(-1),
+  _connecting(false),
+  _watching_writes(false),
+  _next_address(0),
+  _next_opaque(0),
+  _send_offset(0),
+  _read_buffer(READ_BUFFER_LEN)
+{
+}
+
+AsyncMemcachedStore::EventLoop::~EventLoop()
+{
+  stop();
+
+  if (_wake_fd >= 0)
+  {
+    close(_wake_fd);
+  }
+
+  if (_epoll_fd >= 0)
+  {
+    close(_epoll_fd);
+  }
+}
+
+bool AsyncMemcachedStore::EventLoop::start()
+{
+  _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if ((_epoll_fd < 0) || (_wake_fd < 0))
+  {
+    TRC_ERROR("Failed to create event loop for memcached server %s: %s",
+              _server.c_str(), strerror(errno));
+    return false;
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u32 = WAKE_TAG;
+
+  if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &event) < 0)
+  {
+    TRC_ERROR("Failed to create event loop for memcached server %s: %s",
+              _server.c_str(), strerror(errno));
+    return false;
+  }
+
+  _thread = std::thread(&AsyncMemcachedStore::EventLoop::run, this);
+
+  return true;
+}
+
+void AsyncMemcachedStore::EventLoop::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _terminated = true;
+  }
+
+  if (_thread.joinable())
+  {
+    wake();
+    _thread.join();
+  }
+}
+
+void AsyncMemcachedStore::EventLoop::submit(std::vector<Request>& requests)
+{
+  bool need_wake = false;
+  bool queued = false;
+  Clock::time_point deadline = Clock::now() + _timeout;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if (!_terminated)
+    {
+      // The loop takes the whole queue each time it wakes, so it only needs
+      // waking for the first requests queued since then.
+      need_wake = _queued.empty();
+
+      for (Request& request : requests)
+      {
+        request.deadline = deadline;
+        _queued.push_back(std::move(request));
+      }
+
+      queued = true;
+    }
+  }
+
+  if (!queued)
+  {
+    for (Request& request : requests)
+    {
+      TRC_DEBUG("Memcached event loop has stopped - failing request for %s",
+                request.fq_key.c_str());
+      request.callback(Store::Status::ERROR, std::string(), 0);
+    }
+
+    return;
+  }
+
+  if (need_wake)
+  {
+    wake();
+  }
+}
+
+void AsyncMemcachedStore::EventLoop::wake()
+{
+  uint64_t wakes = 1;
+
+  if (write(_wake_fd, &wakes, sizeof(wakes)) < 0)
+  {
+    TRC_WARNING("Failed to wake event loop for memcached server %s: %s",
+                _server.c_str(), strerror(errno));
+  }
+}
+
+void AsyncMemcachedStore::EventLoop::run()
+{
+  struct epoll_event events[2];
+  std::vector<Request> requests;
+
+  while (true)
+  {
+    int num_events = epoll_wait(_epoll_fd, events, 2, next_timeout_ms());
+
+    for (int ii = 0; ii < num_events; ii++)
+    {
+      if (events[ii].data.u32 == WAKE_TAG)
+      {
+        // The wake count doesn't matter - the loop checks its queue anyway.
+        uint64_t wakes;
+        ssize_t rc = ::read(_wake_fd, &wakes, sizeof(wakes));
+        (void)rc;
+      }
+      else if (_fd >= 0)
+      {
+        if (_connecting)
+        {
+          connected();
+        }
+        else
+        {
+          if (events[ii].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+          {
+            read();
+          }
+
+          if ((_fd >= 0) && (events[ii].events & EPOLLOUT))
+          {
+            flush();
+          }
+        }
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      if (_terminated)
+      {
+        requests.swap(_queued);
+        break;
+      }
+
+      requests.swap(_queued);
+    }
+
+    send_requests(requests);
+    expire_requests();
+  }
+
+  // Fail everything that hasn't completed.
+  disconnect();
+
+  for (Request& request : requests)
+  {
+    request.callback(Store::Status::ERROR, std::string(), 0);
+  }
+}
+
+void AsyncMemcachedStore::EventLoop::send_requests(std::vector<Request>& requests)
+{
+  for (Request& request : requests)
+  {
+    if ((_fd < 0) && (!connect_to_server()))
+    {
+      request.callback(Store::Status::ERROR, std::string(), 0);
+      continue;
+    }
+
+    uint32_t opaque = _next_opaque++;
+    write_request(_send_buffer, request, opaque);
+    _deadlines.emplace_back(request.deadline, opaque);
+    _outstanding.emplace(opaque, std::move(request));
+  }
+
+  requests.clear();
+
+  if ((_fd >= 0) && (!_connecting))
+  {
+    flush();
+  }
+}
+
+bool AsyncMemcachedStore::EventLoop::connect_to_server()
+{
+  for (size_t attempt = 0; attempt < _addresses.size(); attempt++)
+  {
+    const Address& address = _addresses[_next_address];
+    int fd = socket(address.addr.ss_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0);
+
+    if (fd >= 0)
+    {
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      int rc = connect(fd, (const struct sockaddr*)&address.addr, address.addr_len);
+
+      if ((rc == 0) || (errno == EINPROGRESS))
+      {
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.u32 = CONNECTION_TAG;
+
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0)
+        {
+          _fd = fd;
+          _connecting = (rc != 0);
+          _watching_writes = true;
+          return true;
+        }
+      }
+    }
+
+    TRC_WARNING("Failed to connect to memcached server %s: %s",
+                _server.c_str(), strerror(errno));
+
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+
+    _next_address = (_next_address + 1) % _addresses.size();
+  }
+
+  return false;
+}
+
+void AsyncMemcachedStore::EventLoop::connected()
+{
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+
+  if ((getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0) ||
+      (error != 0))
+  {
+    TRC_WARNING("Failed to connect to memcached server %s: %s",
+                _server.c_str(), strerror(error != 0 ? error : errno));
+    disconnect();
+    return;
+  }
+
+  TRC_DEBUG("Connected to memcached server %s", _server.c_str());
+  _connecting = false;
+  flush();
+}
+
+void AsyncMemcachedStore::EventLoop::flush()
+{
+  while (_send_offset < _send_buffer.size())
+  {
+    ssize_t sent = send(_fd,
+                        _send_buffer.data() + _send_offset,
+                        _send_buffer.size() - _send_offset,
+                        MSG_NOSIGNAL);
+
+    if (sent > 0)
+    {
+      _send_offset += sent;
+    }
+    else if ((sent < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    else if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+    {
+      break;
+    }
+    else
+    {
+      TRC_WARNING("Failed to send to memcached server %s: %s",
+                  _server.c_str(), strerror(errno));
+      disconnect();
+      return;
+    }
+  }
+
+  if (_send_offset == _send_buffer.size())
+  {
+    _send_buffer.clear();
+    _send_offset = 0;
+  }
+
+  // Only wait for the connection to be writable while there's something
+  // left to send.
+  watch_for_writes(!_send_buffer.empty());
+}
+
+void AsyncMemcachedStore::EventLoop::read()
+{
+  while (true)
+  {
+    ssize_t received = recv(_fd, _read_buffer.data(), _read_buffer.size(), 0);
+
+    if (received > 0)
+    {
+      _recv_buffer.append(_read_buffer.data(), received);
+    }
+    else if (received == 0)
+    {
+      TRC_WARNING("Memcached server %s closed the connection", _server.c_str());
+      disconnect();
+      return;
+    }
+    else if (errno == EINTR)
+    {
+      continue;
+    }
+    else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+    {
+      break;
+    }
+    else
+    {
+      TRC_WARNING("Failed to receive from memcached server %s: %s",
+                  _server.c_str(), strerror(errno));
+      disconnect();
+      return;
+    }
+  }
+
+  process_responses();
+}
+
+void AsyncMemcachedStore::EventLoop::process_responses()
+{
+  size_t offset = 0;
+
+  while (_recv_buffer.size() - offset >= HEADER_LEN)
+  {
+    const uint8_t* header = (const uint8_t*)_recv_buffer.data() + offset;
+    uint16_t key_len = read_uint16(header + 2);
+    uint8_t extras_len = header[4];
+    uint16_t status = read_uint16(header + 6);
+    uint32_t body_len = read_uint32(header + 8);
+    uint32_t opaque = read_uint32(header + 12);
+    uint64_t cas = read_uint64(header + 16);
+
+    if ((header[0] != RESPONSE_MAGIC) ||
+        ((size_t)extras_len + key_len > body_len))
+    {
+      TRC_ERROR("Invalid response from memcached server %s", _server.c_str());
+      disconnect();
+      return;
+    }
+
+    if (_recv_buffer.size() - offset < HEADER_LEN + body_len)
+    {
+      // Wait for the rest of the response.
+      break;
+    }
+
+    size_t value_offset = offset + HEADER_LEN + extras_len + key_len;
+    size_t value_len = body_len - extras_len - key_len;
+    offset += HEADER_LEN + body_len;
+
+    std::unordered_map<uint32_t, Request>::iterator it = _outstanding.find(opaque);
+
+    if (it == _outstanding.end())
+    {
+      TRC_DEBUG("Ignoring response to unknown request %u", opaque);
+      continue;
+    }
+
+    Request request = std::move(it->second);
+    _outstanding.erase(it);
+
+    if (request.opcode == OPCODE_SET)
+    {
+      if (status == STATUS_OK)
+      {
+        request.callback(Store::Status::OK, std::string(), cas);
+      }
+      else
+      {
+        TRC_DEBUG("Failed to set key %s on memcached server %s: status %u",
+                  request.fq_key.c_str(), _server.c_str(), status);
+        request.callback(Store::Status::ERROR, std::string(), 0);
+      }
+    }
+    // Records are deleted from memcached by writing them with no data, so
+    // an empty record counts as not found.
+    else if ((status == STATUS_OK) && (value_len > 0))
+    {
+      request.callback(Store::Status::OK,
+                       _recv_buffer.substr(value_offset, value_len),
+                       cas);
+    }
+    else if ((status == STATUS_OK) || (status == STATUS_KEY_NOT_FOUND))
+    {
+      TRC_DEBUG("Key %s not found", request.fq_key.c_str());
+      request.callback(Store::Status::NOT_FOUND, std::string(), 0);
+    }
+    else
+    {
+      TRC_DEBUG("Failed to get key %s from memcached server %s: status %u",
+                request.fq_key.c_str(), _server.c_str(), status);
+      request.callback(Store::Status::ERROR, std::string(), 0);
+    }
+  }
+
+  _recv_buffer.erase(0, offset);
+}
+
+void AsyncMemcachedStore::EventLoop::expire_requests()
+{
+  // Drop the deadlines of requests that have completed.
+  while ((!_deadlines.empty()) &&
+         (_outstanding.find(_deadlines.front().second) == _outstanding.end()))
+  {
+    _deadlines.pop_front();
+  }
+
+  if ((!_deadlines.empty()) && (_deadlines.front().first <= Clock::now()))
+  {
+    // The server isn't responding, so give up on the connection, and the
+    // requests on it.
+    TRC_WARNING("Request to memcached server %s timed out", _server.c_str());
+    disconnect();
+  }
+}
+
+int AsyncMemcachedStore::EventLoop::next_timeout_ms()
+{
+  if (_deadlines.empty())
+  {
+    return -1;
+  }
+
+  Clock::duration remaining = _deadlines.front().first - Clock::now();
+
+  if (remaining <= Clock::duration::zero())
+  {
+    return 0;
+  }
+
+  // Round up, so we don't wake just before the deadline.
+  return std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+}
+
+void AsyncMemcachedStore::EventLoop::watch_for_writes(bool watch)
+{
+  if (watch == _watching_writes)
+  {
+    return;
+  }
+
+  struct epoll_event event = {};
+  event.events = watch ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+  event.data.u32 = CONNECTION_TAG;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, _fd, &event);
+  _watching_writes = watch;
+}
+
+void AsyncMemcachedStore::EventLoop::disconnect()
+{
+  if (_fd >= 0)
+  {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _fd, NULL);
+    close(_fd);
+    _fd = -1;
+
+    // Try the next address when we reconnect, in case this one has failed.
+    _next_address = (_next_address + 1) % _addresses.size();
+  }
+
+  _connecting = false;
+  _watching_writes = false;
+  _send_buffer.clear();
+  _send_offset = 0;
+  _recv_buffer.clear();
+  _deadlines.clear();
+
+  std::unordered_map<uint32_t, Request> failed;
+  failed.swap(_outstanding);
+
+  for (std::pair<const uint32_t, Request>& request : failed)
+  {
+    request.second.callback(Store::Status::ERROR, std::string(), 0);
+  }
+}
+
+AsyncMemcachedStore::AsyncMemcachedStore(const std::string& server,
+                                         int event_loops,
+                                         int timeout_ms) :
+  _server(server),
+  _num_loops((event_loops > 0) ? event_loops : 1),
+  _timeout_ms(timeout_ms),
+  _next_loop(0)
+{
+}
+
+AsyncMemcachedStore::~AsyncMemcachedStore()
+{
+  stop();
+}
+
+bool AsyncMemcachedStore::start()
+{
+  std::vector<Address> addresses;
+
+  if (!resolve(addresses))
+  {
+    return false;
+  }
+
+  for (int ii = 0; ii < _num_loops; ii++)
+  {
+    EventLoop* loop = new EventLoop(_server, addresses, _timeout_ms);
+
+    if (!loop->start())
+    {
+      delete loop;
+      return false;
+    }
+
+    _loops.push_back(std::unique_ptr<EventLoop>(loop));
+  }
+
+  return true;
+}
+
+void AsyncMemcachedStore::stop()
+{
+  for (std::unique_ptr<EventLoop>& loop : _loops)
+  {
+    loop->stop();
+  }
+}
+
+void AsyncMemcachedStore::get_data_async(const std::string& table,
+                                         const std::string& key,
+                                         SAS::TrailId trail,
+                                         get_callback callback)
+{
+  if (_loops.empty())
+  {
+    callback(Store::Status::ERROR, std::string(), 0);
+    return;
+  }
+
+  std::vector<EventLoop::Request> requests(1);
+  requests[0].opcode = OPCODE_GET;
+  requests[0].fq_key = fq_key(table, key);
+  requests[0].callback = callback;
+
+  _loops[_next_loop++ % _loops.size()]->submit(requests);
+}
+
+// The state of a multi-get or multi-set. All of its requests go to the same
+// loop, so their callbacks all run on the same thread, and the count doesn't
+// need to be atomic.
+template <class T>
+struct Batch
+{
+  Batch(size_t size) : results(size), remaining(size) {}
+
+  std::vector<T> results;
+  size_t remaining;
+};
+
+void AsyncMemcachedStore::get_multi_data_async(const std::string& table,
+                                               const std::vector<std::string>& keys,
+                                               SAS::TrailId trail,
+                                               multi_get_callback callback)
+{
+  if (keys.empty())
+  {
+    std::vector<Result> results;
+    callback(results);
+    return;
+  }
+
+  std::shared_ptr<Batch<Result>> batch = std::make_shared<Batch<Result>>(keys.size());
+  std::vector<EventLoop::Request> requests(keys.size());
+
+  for (size_t ii = 0; ii < keys.size(); ii++)
+  {
+    requests[ii].opcode = OPCODE_GET;
+    requests[ii].fq_key = fq_key(table, keys[ii]);
+    requests[ii].callback = [batch, ii, callback](Store::Status status,
+                                                  const std::string& data,
+                                                  uint64_t cas)
+    {
+      batch->results[ii] = Result{status, data, cas};
+
+      if (--batch->remaining == 0)
+      {
+        callback(batch->results);
+      }
+    };
+  }
+
+  if (_loops.empty())
+  {
+    for (EventLoop::Request& request : requests)
+    {
+      request.callback(Store::Status::ERROR, std::string(), 0);
+    }
+
+    return;
+  }
+
+  _loops[_next_loop++ % _loops.size()]->submit(requests);
+}
+
+void AsyncMemcachedStore::set_multi_data_async(const std::string& table,
+                                               const std::vector<std::pair<std::string, std::string>>& records,
+                                               int expiry,
+                                               SAS::TrailId trail,
+                                               multi_set_callback callback)
+{
+  if (records.empty())
+  {
+    std::vector<Store::Status> statuses;
+    callback(statuses);
+    return;
+  }
+
+  // A zero expiry means the record never expires, so a record that has
+  // (only just) expired is written to expire as soon as possible instead.
+  uint32_t memcached_expiry = (expiry > 0) ? expiry : 1;
+
+  if (expiry > MAX_RELATIVE_EXPIRY)
+  {
+    memcached_expiry = (uint32_t)(time(NULL) + expiry);
+  }
+
+  std::shared_ptr<Batch<Store::Status>> batch =
+    std::make_shared<Batch<Store::Status>>(records.size());
+  std::vector<EventLoop::Request> requests(records.size());
+
+  for (size_t ii = 0; ii < records.size(); ii++)
+  {
+    requests[ii].opcode = OPCODE_SET;
+    requests[ii].fq_key = fq_key(table, records[ii].first);
+    requests[ii].data = records[ii].second;
+    requests[ii].expiry = memcached_expiry;
+    requests[ii].callback = [batch, ii, callback](Store::Status status,
+                                                  const std::string& data,
+                                                  uint64_t cas)
+    {
+      batch->results[ii] = status;
+
+      if (--batch->remaining == 0)
+      {
+        callback(batch->results);
+      }
+    };
+  }
+
+  if (_loops.empty())
+  {
+    for (EventLoop::Request& request : requests)
+    {
+      request.callback(Store::Status::ERROR, std::string(), 0);
+    }
+
+    return;
+  }
+
+  _loops[_next_loop++ % _loops.size()]->submit(requests);
+}
+
+std::string AsyncMemcachedStore::fq_key(const std::string& table,
+                                        const std::string& key)
+{
+  return table + "\\\\" + key;
+}
+
+bool AsyncMemcachedStore::resolve(std::vector<Address>& addresses)
+{
+  // The server is "host", "host:port" or "[IPv6 address]:port".
+  std::string host = _server;
+  std::string port = std::to_string(DEFAULT_PORT);
+
+  if ((!host.empty()) && (host[0] == '['))
+  {
+    size_t close_bracket = host.find(']');
+
+    if (close_bracket == std::string::npos)
+    {
+      TRC_ERROR("Invalid memcached server %s", _server.c_str());
+      return false;
+    }
+
+    if ((close_bracket + 1 < host.size()) && (host[close_bracket + 1] == ':'))
+    {
+      port = host.substr(close_bracket + 2);
+    }
+
+    host = host.substr(1, close_bracket - 1);
+  }
+  else
+  {
+    size_t colon = host.find(':');
+
+    if ((colon != std::string::npos) &&
+        (host.find(':', colon + 1) == std::string::npos))
+    {
+      port = host.substr(colon + 1);
+      host = host.substr(0, colon);
+    }
+  }
+
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* results = NULL;
+
+  int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &results);
+
+  if (rc != 0)
+  {
+    TRC_ERROR("Failed to resolve memcached server %s: %s",
+              _server.c_str(), gai_strerror(rc));
+    return false;
+  }
+
+  for (struct addrinfo* result = results; result != NULL; result = result->ai_next)
+  {
+    Address address;
+    memcpy(&address.addr, result->ai_addr, result->ai_addrlen);
+    address.addr_len = result->ai_addrlen;
+    addresses.push_back(address);
+  }
+
+  freeaddrinfo(results);
+
+  if (addresses.empty())
+  {
+    TRC_ERROR("Memcached server %s has no addresses", _server.c_str());
+    return false;
+  }
+
+  TRC_DEBUG("Memcached server %s has %zu addresses",
+            _server.c_str(), addresses.size());
+
+  return true;
+}
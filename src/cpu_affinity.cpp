@@ -0,0 +1,162 @@
+/**
+ * @file cpu_affinity.cpp Pinning Homestead's thread pools to sets of CPUs
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "cpu_affinity.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "log.h"
+
+static const std::string NODE_PREFIX = "node";
+static const std::string NODE_CPULIST_PATH = "/sys/devices/system/node/node";
+
+// Parses a non-negative number, which must be the whole string.
+static bool parse_number(const std::string& str, int& value)
+{
+  if (str.empty() || (str.find_first_not_of("0123456789") != std::string::npos))
+  {
+    return false;
+  }
+
+  value = atoi(str.c_str());
+  return true;
+}
+
+// Adds the CPUs in a single item of a set - "N", "N-M" or "nodeN" - to the
+// set.
+static bool parse_item(const std::string& item, cpu_set_t& cpus)
+{
+  if (item.compare(0, NODE_PREFIX.length(), NODE_PREFIX) == 0)
+  {
+    int node;
+
+    if (!parse_number(item.substr(NODE_PREFIX.length()), node))
+    {
+      return false;
+    }
+
+    // The kernel lists each node's CPUs in the same format.
+    std::ifstream file(NODE_CPULIST_PATH + std::to_string(node) + "/cpulist");
+    std::string node_cpus;
+
+    if (!std::getline(file, node_cpus))
+    {
+      TRC_ERROR("NUMA node %d not found", node);
+      return false;
+    }
+
+    std::stringstream ss(node_cpus);
+    std::string node_item;
+
+    while (std::getline(ss, node_item, ','))
+    {
+      if (!parse_item(node_item, cpus))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  size_t dash = item.find('-');
+  int first;
+  int last;
+
+  if (dash == std::string::npos)
+  {
+    if (!parse_number(item, first))
+    {
+      return false;
+    }
+
+    last = first;
+  }
+  else if ((!parse_number(item.substr(0, dash), first)) ||
+           (!parse_number(item.substr(dash + 1), last)))
+  {
+    return false;
+  }
+
+  if ((first > last) || (last >= CPU_SETSIZE))
+  {
+    return false;
+  }
+
+  for (int cpu = first; cpu <= last; cpu++)
+  {
+    CPU_SET(cpu, &cpus);
+  }
+
+  return true;
+}
+
+bool CpuAffinity::parse(const std::string& spec, cpu_set_t& cpus)
+{
+  CPU_ZERO(&cpus);
+
+  // A trailing comma would otherwise be ignored.
+  if ((spec.empty()) || (spec[spec.length() - 1] == ','))
+  {
+    return false;
+  }
+
+  std::stringstream ss(spec);
+  std::string item;
+
+  while (std::getline(ss, item, ','))
+  {
+    if (!parse_item(item, cpus))
+    {
+      return false;
+    }
+  }
+
+  return (CPU_COUNT(&cpus) > 0);
+}
+
+CpuAffinity::Scope::Scope(const std::string& spec) :
+  _changed(false)
+{
+  cpu_set_t cpus;
+
+  if ((spec.empty()) || (!parse(spec, cpus)))
+  {
+    return;
+  }
+
+  if (pthread_getaffinity_np(pthread_self(), sizeof(_saved), &_saved) != 0)
+  {
+    TRC_WARNING("Failed to get CPU affinity - not pinning to %s", spec.c_str());
+    return;
+  }
+
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+  {
+    TRC_WARNING("Failed to pin to CPUs %s", spec.c_str());
+    return;
+  }
+
+  TRC_DEBUG("Pinned to CPUs %s", spec.c_str());
+  _changed = true;
+}
+
+CpuAffinity::Scope::~Scope()
+{
+  if (_changed)
+  {
+    pthread_setaffinity_np(pthread_self(), sizeof(_saved), &_saved);
+  }
+}
@@ -492,145 +492,225 @@ std::string MultimediaAuthAnswer::sip_auth_scheme() const
   return sip_auth_scheme;
 }
 
-DigestAuthVector* MultimediaAuthAnswer::digest_auth_vector() const
+// The decoding of the AVPs that are read both by the message accessors, which
+// look up just the AVPs they need, and by the AnswerAvps index. Each takes
+// the headers of the AVPs, any of which may be NULL if the AVP is missing.
+
+// Sets the string to a view of the AVP's value, if it is present.
+static bool avp_view(const struct avp_hdr* hdr, boost::string_ref& str)
+{
+  if ((hdr == NULL) || (hdr->avp_value == NULL))
+  {
+    return false;
+  }
+
+  str = boost::string_ref((const char*)hdr->avp_value->os.data,
+                          hdr->avp_value->os.len);
+  return true;
+}
+
+// Returns the first child AVP of the given type of a message or grouped AVP,
+// or NULL if it has none (or the parent is NULL).
+static struct avp* find_avp(msg_or_avp* parent,
+                            const Diameter::Dictionary::AVP& type)
+{
+  struct avp* avp = NULL;
+
+  if ((parent != NULL) &&
+      (fd_msg_search_avp(parent, type.dict(), &avp) != 0))
+  {
+    avp = NULL;
+  }
+
+  return avp;
+}
+
+// As find_avp, but returns the AVP's header.
+static const struct avp_hdr* find_avp_hdr(msg_or_avp* parent,
+                                          const Diameter::Dictionary::AVP& type)
+{
+  struct avp* avp = find_avp(parent, type);
+  struct avp_hdr* hdr = NULL;
+
+  if ((avp != NULL) && (fd_msg_avp_hdr(avp, &hdr) != 0))
+  {
+    hdr = NULL;
+  }
+
+  return hdr;
+}
+
+// Decodes the digest from a SIP-Digest-Authenticate. Some HSSs (in particular
+// OpenIMSCore) use the non-3GPP Digest AVPs, so they're used if the 3GPP ones
+// are missing.
+static DigestAuthVector* decode_digest_auth_vector(const struct avp_hdr* cx_digest_ha1,
+                                                   const struct avp_hdr* digest_ha1,
+                                                   const struct avp_hdr* cx_digest_realm,
+                                                   const struct avp_hdr* digest_realm,
+                                                   const struct avp_hdr* cx_digest_qop,
+                                                   const struct avp_hdr* digest_qop)
 {
   TRC_DEBUG("Getting digest authentication vector from Multimedia-Auth answer");
   DigestAuthVector* digest_auth_vector = new DigestAuthVector();
-  Diameter::AVP::iterator sip_auth_data_item_avp =
-                           begin(((Cx::Dictionary*)dict())->SIP_AUTH_DATA_ITEM);
-  if (sip_auth_data_item_avp != end())
+  boost::string_ref value;
+
+  if (avp_view(cx_digest_ha1, value) || avp_view(digest_ha1, value))
   {
-    Diameter::AVP::iterator sip_digest_authenticate_avp =
-      sip_auth_data_item_avp->begin(((Cx::Dictionary*)dict())->SIP_DIGEST_AUTHENTICATE);
-    if (sip_digest_authenticate_avp != sip_auth_data_item_avp->end())
-    {
-      // Look for the digest.
-      Diameter::AVP::iterator digest_ha1_avp =
-        sip_digest_authenticate_avp->begin(((Cx::Dictionary*)dict())->CX_DIGEST_HA1);
-      if (digest_ha1_avp != sip_digest_authenticate_avp->end())
-      {
-        digest_auth_vector->ha1 = digest_ha1_avp->val_str();
-        TRC_DEBUG("Found Digest-HA1 %s", digest_auth_vector->ha1.c_str());
-      }
-      else
-      {
-        // Some HSSs (in particular OpenIMSCore), use non-3GPP Digest-HA1.
-        // Check for this too.
-        digest_ha1_avp =
-          sip_digest_authenticate_avp->begin(((Cx::Dictionary*)dict())->DIGEST_HA1);
-        if (digest_ha1_avp != sip_digest_authenticate_avp->end())
-        {
-          digest_auth_vector->ha1 = digest_ha1_avp->val_str();
-          TRC_DEBUG("Found (non-3GPP) Digest-HA1 %s",
-                    digest_auth_vector->ha1.c_str());
-        }
-      }
-      // Look for the realm.
-      Diameter::AVP::iterator digest_realm_avp =
-        sip_digest_authenticate_avp->begin(((Cx::Dictionary*)dict())->CX_DIGEST_REALM);
-      if (digest_realm_avp != sip_digest_authenticate_avp->end())
-      {
-        digest_auth_vector->realm = digest_realm_avp->val_str();
-        TRC_DEBUG("Found Digest-Realm %s", digest_auth_vector->realm.c_str());
-      }
-      else
-      {
-        // Some HSSs (in particular OpenIMSCore), use non-3GPP Digest-Realm.
-        // Check for this too.
-        digest_realm_avp =
-          sip_digest_authenticate_avp->begin(((Cx::Dictionary*)dict())->DIGEST_REALM);
-        if (digest_realm_avp != sip_digest_authenticate_avp->end())
-        {
-          digest_auth_vector->realm = digest_realm_avp->val_str();
-          TRC_DEBUG("Found (non-3GPP) Digest-Realm %s",
-                    digest_auth_vector->realm.c_str());
-        }
-      }
-      // Look for the QoP.
-      Diameter::AVP::iterator digest_qop_avp =
-        sip_digest_authenticate_avp->begin(((Cx::Dictionary*)dict())->CX_DIGEST_QOP);
-      if (digest_qop_avp != sip_digest_authenticate_avp->end())
-      {
-        digest_auth_vector->qop = digest_qop_avp->val_str();
-        TRC_DEBUG("Found Digest-QoP %s", digest_auth_vector->qop.c_str());
-      }
-      else
-      {
-        // Some HSSs (in particular OpenIMSCore), use non-3GPP Digest-QoP.
-        // Check for this too.
-        digest_qop_avp =
-          sip_digest_authenticate_avp->begin(((Cx::Dictionary*)dict())->DIGEST_QOP);
-        if (digest_qop_avp != sip_digest_authenticate_avp->end())
-        {
-          digest_auth_vector->qop = digest_qop_avp->val_str();
-          TRC_DEBUG("Found (non-3GPP) Digest-QoP %s",
-                    digest_auth_vector->qop.c_str());
-        }
-      }
-    }
+    digest_auth_vector->ha1.assign(value.data(), value.size());
+    TRC_DEBUG("Found Digest-HA1 %s", digest_auth_vector->ha1.c_str());
+  }
+
+  if (avp_view(cx_digest_realm, value) || avp_view(digest_realm, value))
+  {
+    digest_auth_vector->realm.assign(value.data(), value.size());
+    TRC_DEBUG("Found Digest-Realm %s", digest_auth_vector->realm.c_str());
+  }
+
+  if (avp_view(cx_digest_qop, value) || avp_view(digest_qop, value))
+  {
+    digest_auth_vector->qop.assign(value.data(), value.size());
+    TRC_DEBUG("Found Digest-QoP %s", digest_auth_vector->qop.c_str());
   }
+
   return digest_auth_vector;
 }
 
-AKAAuthVector* MultimediaAuthAnswer::aka_auth_vector() const
+// Decodes the AKA vector from a SIP-Auth-Data-Item. The challenge is base64
+// encoded, and the response and keys are hex encoded.
+static AKAAuthVector* decode_aka_auth_vector(const struct avp_hdr* sip_authenticate,
+                                             const struct avp_hdr* sip_authorization,
+                                             const struct avp_hdr* confidentiality_key,
+                                             const struct avp_hdr* integrity_key)
 {
   TRC_DEBUG("Getting AKA authentication vector from Multimedia-Auth answer");
   AKAAuthVector* aka_auth_vector = new AKAAuthVector();
-  Diameter::AVP::iterator sip_auth_data_item_avp =
-                           begin(((Cx::Dictionary*)dict())->SIP_AUTH_DATA_ITEM);
-  if (sip_auth_data_item_avp != end())
+  boost::string_ref value;
+
+  if (avp_view(sip_authenticate, value))
   {
-    // Look for the challenge.
-    Diameter::AVP::iterator sip_authenticate_avp =
-      sip_auth_data_item_avp->begin(((Cx::Dictionary*)dict())->SIP_AUTHENTICATE);
-    if (sip_authenticate_avp != sip_auth_data_item_avp->end())
-    {
-      size_t len;
-      const uint8_t* data = sip_authenticate_avp->val_os(len);
-      aka_auth_vector->challenge = base64_encode(data, len);
-      TRC_DEBUG("Found SIP-Authenticate (challenge) %s",
-                aka_auth_vector->challenge.c_str());
-    }
+    aka_auth_vector->challenge =
+      base64_encode((const uint8_t*)value.data(), value.size());
+    TRC_DEBUG("Found SIP-Authenticate (challenge) %s",
+              aka_auth_vector->challenge.c_str());
+  }
 
-    // Look for the response.
-    Diameter::AVP::iterator sip_authorization_avp =
-      sip_auth_data_item_avp->begin(((Cx::Dictionary*)dict())->SIP_AUTHORIZATION);
-    if (sip_authorization_avp != sip_auth_data_item_avp->end())
-    {
-      size_t len;
-      const uint8_t* data = sip_authorization_avp->val_os(len);
-      aka_auth_vector->response = Utils::hex(data, len);
-      TRC_DEBUG("Found SIP-Authorization (response) %s",
-                aka_auth_vector->response.c_str());
-    }
+  if (avp_view(sip_authorization, value))
+  {
+    aka_auth_vector->response =
+      Utils::hex((const uint8_t*)value.data(), value.size());
+    TRC_DEBUG("Found SIP-Authorization (response) %s",
+              aka_auth_vector->response.c_str());
+  }
 
-    // Look for the encryption key.
-    Diameter::AVP::iterator confidentiality_key_avp =
-      sip_auth_data_item_avp->begin(((Cx::Dictionary*)dict())->CONFIDENTIALITY_KEY);
-    if (confidentiality_key_avp != sip_auth_data_item_avp->end())
-    {
-      size_t len;
-      const uint8_t* data = confidentiality_key_avp->val_os(len);
-      aka_auth_vector->crypt_key = Utils::hex(data, len);
-      TRC_DEBUG("Found Confidentiality-Key %s",
-                aka_auth_vector->crypt_key.c_str());
-    }
+  if (avp_view(confidentiality_key, value))
+  {
+    aka_auth_vector->crypt_key =
+      Utils::hex((const uint8_t*)value.data(), value.size());
+    TRC_DEBUG("Found Confidentiality-Key %s",
+              aka_auth_vector->crypt_key.c_str());
+  }
 
-    // Look for the integrity key.
-    Diameter::AVP::iterator integrity_key_avp =
-      sip_auth_data_item_avp->begin(((Cx::Dictionary*)dict())->INTEGRITY_KEY);
-    if (integrity_key_avp != sip_auth_data_item_avp->end())
-    {
-      size_t len;
-      const uint8_t* data = integrity_key_avp->val_os(len);
-      aka_auth_vector->integrity_key = Utils::hex(data, len);
-      TRC_DEBUG("Found Integrity-Key %s",
-                aka_auth_vector->integrity_key.c_str());
-    }
+  if (avp_view(integrity_key, value))
+  {
+    aka_auth_vector->integrity_key =
+      Utils::hex((const uint8_t*)value.data(), value.size());
+    TRC_DEBUG("Found Integrity-Key %s",
+              aka_auth_vector->integrity_key.c_str());
   }
+
   return aka_auth_vector;
 }
 
+// Decodes the charging addresses from a Charging-Information.
+static void decode_charging_addrs(const struct avp_hdr* primary_ccf,
+                                  const struct avp_hdr* secondary_ccf,
+                                  const struct avp_hdr* primary_ecf,
+                                  const struct avp_hdr* secondary_ecf,
+                                  ChargingAddresses& charging_addrs)
+{
+  // charging_addrs is going to be pushed back to populate it, so need to make sure it is empty
+  // first, to avoid populating it incorrectly and duplicating charging addresses.
+  charging_addrs.ccfs.clear();
+  charging_addrs.ecfs.clear();
+
+  boost::string_ref name;
+
+  if (avp_view(primary_ccf, name))
+  {
+    charging_addrs.ccfs.push_back(name.to_string());
+    TRC_DEBUG("Found Primary-Charging-Collection-Function-Name %s",
+              charging_addrs.ccfs.back().c_str());
+  }
+
+  if (avp_view(secondary_ccf, name))
+  {
+    charging_addrs.ccfs.push_back(name.to_string());
+    TRC_DEBUG("Found Secondary-Charging-Collection-Function-Name %s",
+              charging_addrs.ccfs.back().c_str());
+  }
+
+  if (avp_view(primary_ecf, name))
+  {
+    charging_addrs.ecfs.push_back(name.to_string());
+    TRC_DEBUG("Found Primary-Event-Charging-Function-Name %s",
+              charging_addrs.ecfs.back().c_str());
+  }
+
+  if (avp_view(secondary_ecf, name))
+  {
+    charging_addrs.ecfs.push_back(name.to_string());
+    TRC_DEBUG("Found Secondary-Event-Charging-Function-Name %s",
+              charging_addrs.ecfs.back().c_str());
+  }
+}
+
+// Decodes the charging addresses from the Charging-Information AVP of a
+// message. Returns false if it has none.
+static bool find_charging_addrs(const Diameter::Message& msg,
+                                ChargingAddresses& charging_addrs)
+{
+  const Cx::Dictionary* dict = (Cx::Dictionary*)msg.dict();
+  struct avp* charging_information =
+    find_avp(msg.fd_msg(), dict->CHARGING_INFORMATION);
+
+  decode_charging_addrs(
+    find_avp_hdr(charging_information, dict->PRIMARY_CHARGING_COLLECTION_FUNCTION_NAME),
+    find_avp_hdr(charging_information, dict->SECONDARY_CHARGING_COLLECTION_FUNCTION_NAME),
+    find_avp_hdr(charging_information, dict->PRIMARY_EVENT_CHARGING_FUNCTION_NAME),
+    find_avp_hdr(charging_information, dict->SECONDARY_EVENT_CHARGING_FUNCTION_NAME),
+    charging_addrs);
+
+  return (charging_information != NULL);
+}
+
+DigestAuthVector* MultimediaAuthAnswer::digest_auth_vector() const
+{
+  const Cx::Dictionary* dict = (Cx::Dictionary*)this->dict();
+  struct avp* sip_digest_authenticate =
+    find_avp(find_avp(fd_msg(), dict->SIP_AUTH_DATA_ITEM),
+             dict->SIP_DIGEST_AUTHENTICATE);
+
+  return decode_digest_auth_vector(
+    find_avp_hdr(sip_digest_authenticate, dict->CX_DIGEST_HA1),
+    find_avp_hdr(sip_digest_authenticate, dict->DIGEST_HA1),
+    find_avp_hdr(sip_digest_authenticate, dict->CX_DIGEST_REALM),
+    find_avp_hdr(sip_digest_authenticate, dict->DIGEST_REALM),
+    find_avp_hdr(sip_digest_authenticate, dict->CX_DIGEST_QOP),
+    find_avp_hdr(sip_digest_authenticate, dict->DIGEST_QOP));
+}
+
+AKAAuthVector* MultimediaAuthAnswer::aka_auth_vector() const
+{
+  const Cx::Dictionary* dict = (Cx::Dictionary*)this->dict();
+  struct avp* sip_auth_data_item = find_avp(fd_msg(), dict->SIP_AUTH_DATA_ITEM);
+
+  return decode_aka_auth_vector(
+    find_avp_hdr(sip_auth_data_item, dict->SIP_AUTHENTICATE),
+    find_avp_hdr(sip_auth_data_item, dict->SIP_AUTHORIZATION),
+    find_avp_hdr(sip_auth_data_item, dict->CONFIDENTIALITY_KEY),
+    find_avp_hdr(sip_auth_data_item, dict->INTEGRITY_KEY));
+}
+
 AKAAuthVector* MultimediaAuthAnswer::akav2_auth_vector() const
 {
   AKAAuthVector* av = aka_auth_vector();
@@ -775,51 +855,7 @@ ServerAssignmentAnswer::ServerAssignmentAnswer(const Dictionary* dict,
 
 void ServerAssignmentAnswer::charging_addrs(ChargingAddresses& charging_addrs) const
 {
-  Diameter::AVP::iterator charging_information_avp =
-                         begin(((Cx::Dictionary*)dict())->CHARGING_INFORMATION);
-  // charging_addrs is going to be pushed back to populate it, so need to make sure it is empty
-  // first, to avoid populating it incorrectly and duplicating charging addresses.
-  charging_addrs.ccfs.clear();
-  charging_addrs.ecfs.clear();
-
-  if (charging_information_avp != end())
-  {
-    Diameter::AVP::iterator primary_ccf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->PRIMARY_CHARGING_COLLECTION_FUNCTION_NAME);
-    if (primary_ccf_name_avp != charging_information_avp->end())
-    {
-      charging_addrs.ccfs.push_back(primary_ccf_name_avp->val_str());
-      TRC_DEBUG("Found Primary-Charging-Collection-Function-Name %s",
-                primary_ccf_name_avp->val_str().c_str());
-    }
-
-    Diameter::AVP::iterator secondary_ccf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->SECONDARY_CHARGING_COLLECTION_FUNCTION_NAME);
-    if (secondary_ccf_name_avp != charging_information_avp->end())
-    {
-      charging_addrs.ccfs.push_back(secondary_ccf_name_avp->val_str());
-      TRC_DEBUG("Found Secondary-Charging-Collection-Function-Name %s",
-                secondary_ccf_name_avp->val_str().c_str());
-    }
-
-    Diameter::AVP::iterator primary_ecf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->PRIMARY_EVENT_CHARGING_FUNCTION_NAME);
-    if (primary_ecf_name_avp != charging_information_avp->end())
-    {
-      charging_addrs.ecfs.push_back(primary_ecf_name_avp->val_str());
-      TRC_DEBUG("Found Primary-Event-Charging-Function-Name %s",
-                primary_ecf_name_avp->val_str().c_str());
-    }
-
-    Diameter::AVP::iterator secondary_ecf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->SECONDARY_EVENT_CHARGING_FUNCTION_NAME);
-    if (secondary_ecf_name_avp != charging_information_avp->end())
-    {
-      charging_addrs.ecfs.push_back(secondary_ecf_name_avp->val_str());
-      TRC_DEBUG("Found Secondary-Event-Charging-Function-Name %s",
-                secondary_ecf_name_avp->val_str().c_str());
-    }
-  }
+  find_charging_addrs(*this, charging_addrs);
 }
 
 RegistrationTerminationRequest::RegistrationTerminationRequest(const Dictionary* dict,
@@ -1020,69 +1056,257 @@ PushProfileRequest::PushProfileRequest(const Dictionary* dict,
 // otherwise.
 bool PushProfileRequest::charging_addrs(ChargingAddresses& charging_addrs) const
 {
-  bool found_charging_info = false;
+  return find_charging_addrs(*this, charging_addrs);
+}
+
+PushProfileAnswer::PushProfileAnswer(Cx::PushProfileRequest& ppr,
+                                     Dictionary* dict,
+                                     const std::string result_code,
+                                     int32_t auth_session_state) :
+                                     Diameter::Message(ppr)
+
+{
+  TRC_DEBUG("Building Push-Profile answer");
+  build_response(ppr);
+  add_app_id(Diameter::Dictionary::Application::AUTH, dict->TGPP, dict->CX);
+  set_result_code(result_code);
+  add(Diameter::AVP(dict->AUTH_SESSION_STATE).val_i32(auth_session_state));
+}
 
-  Diameter::AVP::iterator charging_information_avp =
-                         begin(((Cx::Dictionary*)dict())->CHARGING_INFORMATION);
+// Returns the first child of a message or grouped AVP, or NULL if it has none.
+static struct avp* first_child_avp(msg_or_avp* parent)
+{
+  msg_or_avp* child = NULL;
+  fd_msg_browse(parent, MSG_BRW_FIRST_CHILD, &child, NULL);
+  return (struct avp*)child;
+}
 
-  // charging_addrs is going to be pushed back to populate it, so need to make sure it is empty
-  // first, to avoid populating it incorrectly and duplicating charging addresses.
-  charging_addrs.ccfs.clear();
-  charging_addrs.ecfs.clear();
+// Returns the next AVP alongside this one, or NULL if it is the last.
+static struct avp* next_avp(struct avp* avp)
+{
+  msg_or_avp* next = NULL;
+  fd_msg_browse(avp, MSG_BRW_NEXT, &next, NULL);
+  return (struct avp*)next;
+}
+
+// Returns the dictionary object for the AVP's type, or NULL if it's not in
+// the dictionary.
+static struct dict_object* avp_model(struct avp* avp)
+{
+  struct dict_object* model = NULL;
+  fd_msg_model(avp, &model);
+  return model;
+}
+
+// Records the AVP's header in the index, unless we've already found one.
+static void index_avp(const struct avp_hdr*& slot, struct avp* avp)
+{
+  if (slot == NULL)
+  {
+    struct avp_hdr* hdr = NULL;
+    if (fd_msg_avp_hdr(avp, &hdr) == 0)
+    {
+      slot = hdr;
+    }
+  }
+}
+
+AnswerAvps::AnswerAvps(const Diameter::Message& msg) :
+  _server_name(NULL),
+  _user_data(NULL),
+  _wildcarded_public_identity(NULL),
+  _sip_auth_scheme(NULL),
+  _sip_authenticate(NULL),
+  _sip_authorization(NULL),
+  _confidentiality_key(NULL),
+  _integrity_key(NULL),
+  _cx_digest_ha1(NULL),
+  _cx_digest_realm(NULL),
+  _cx_digest_qop(NULL),
+  _digest_ha1(NULL),
+  _digest_realm(NULL),
+  _digest_qop(NULL),
+  _primary_ccf(NULL),
+  _secondary_ccf(NULL),
+  _primary_ecf(NULL),
+  _secondary_ecf(NULL)
+{
+  const Cx::Dictionary* dict = (Cx::Dictionary*)msg.dict();
+  bool found_sip_auth_data_item = false;
+  bool found_charging_information = false;
 
-  if (charging_information_avp != end())
+  for (struct avp* avp = first_child_avp(msg.fd_msg());
+       avp != NULL;
+       avp = next_avp(avp))
   {
-    found_charging_info = true;
+    struct dict_object* model = avp_model(avp);
 
-    Diameter::AVP::iterator primary_ccf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->PRIMARY_CHARGING_COLLECTION_FUNCTION_NAME);
-    if (primary_ccf_name_avp != charging_information_avp->end())
+    if (model == dict->SERVER_NAME.dict())
     {
-      charging_addrs.ccfs.push_back(primary_ccf_name_avp->val_str());
-      TRC_DEBUG("Found Primary-Charging-Collection-Function-Name %s",
-                primary_ccf_name_avp->val_str().c_str());
+      index_avp(_server_name, avp);
     }
+    else if (model == dict->USER_DATA.dict())
+    {
+      index_avp(_user_data, avp);
+    }
+    else if (model == dict->WILDCARDED_PUBLIC_IDENTITY.dict())
+    {
+      index_avp(_wildcarded_public_identity, avp);
+    }
+    else if ((model == dict->SIP_AUTH_DATA_ITEM.dict()) &&
+             (!found_sip_auth_data_item))
+    {
+      index_sip_auth_data_item(avp, dict);
+      found_sip_auth_data_item = true;
+    }
+    else if ((model == dict->CHARGING_INFORMATION.dict()) &&
+             (!found_charging_information))
+    {
+      index_charging_information(avp, dict);
+      found_charging_information = true;
+    }
+  }
+}
+
+void AnswerAvps::index_sip_auth_data_item(struct avp* item,
+                                          const Dictionary* dict)
+{
+  bool found_sip_digest_authenticate = false;
+
+  for (struct avp* avp = first_child_avp(item);
+       avp != NULL;
+       avp = next_avp(avp))
+  {
+    struct dict_object* model = avp_model(avp);
 
-    Diameter::AVP::iterator secondary_ccf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->SECONDARY_CHARGING_COLLECTION_FUNCTION_NAME);
-    if (secondary_ccf_name_avp != charging_information_avp->end())
+    if (model == dict->SIP_AUTH_SCHEME.dict())
+    {
+      index_avp(_sip_auth_scheme, avp);
+    }
+    else if (model == dict->SIP_AUTHENTICATE.dict())
+    {
+      index_avp(_sip_authenticate, avp);
+    }
+    else if (model == dict->SIP_AUTHORIZATION.dict())
+    {
+      index_avp(_sip_authorization, avp);
+    }
+    else if (model == dict->CONFIDENTIALITY_KEY.dict())
     {
-      charging_addrs.ccfs.push_back(secondary_ccf_name_avp->val_str());
-      TRC_DEBUG("Found Secondary-Charging-Collection-Function-Name %s",
-                secondary_ccf_name_avp->val_str().c_str());
+      index_avp(_confidentiality_key, avp);
     }
+    else if (model == dict->INTEGRITY_KEY.dict())
+    {
+      index_avp(_integrity_key, avp);
+    }
+    else if ((model == dict->SIP_DIGEST_AUTHENTICATE.dict()) &&
+             (!found_sip_digest_authenticate))
+    {
+      index_sip_digest_authenticate(avp, dict);
+      found_sip_digest_authenticate = true;
+    }
+  }
+}
+
+void AnswerAvps::index_sip_digest_authenticate(struct avp* digest,
+                                               const Dictionary* dict)
+{
+  for (struct avp* avp = first_child_avp(digest);
+       avp != NULL;
+       avp = next_avp(avp))
+  {
+    struct dict_object* model = avp_model(avp);
 
-    Diameter::AVP::iterator primary_ecf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->PRIMARY_EVENT_CHARGING_FUNCTION_NAME);
-    if (primary_ecf_name_avp != charging_information_avp->end())
+    if (model == dict->CX_DIGEST_HA1.dict())
+    {
+      index_avp(_cx_digest_ha1, avp);
+    }
+    else if (model == dict->CX_DIGEST_REALM.dict())
     {
-      charging_addrs.ecfs.push_back(primary_ecf_name_avp->val_str());
-      TRC_DEBUG("Found Primary-Event-Charging-Function-Name %s",
-                primary_ecf_name_avp->val_str().c_str());
+      index_avp(_cx_digest_realm, avp);
     }
+    else if (model == dict->CX_DIGEST_QOP.dict())
+    {
+      index_avp(_cx_digest_qop, avp);
+    }
+    else if (model == dict->DIGEST_HA1.dict())
+    {
+      index_avp(_digest_ha1, avp);
+    }
+    else if (model == dict->DIGEST_REALM.dict())
+    {
+      index_avp(_digest_realm, avp);
+    }
+    else if (model == dict->DIGEST_QOP.dict())
+    {
+      index_avp(_digest_qop, avp);
+    }
+  }
+}
 
-    Diameter::AVP::iterator secondary_ecf_name_avp =
-      charging_information_avp->begin(((Cx::Dictionary*)dict())->SECONDARY_EVENT_CHARGING_FUNCTION_NAME);
-    if (secondary_ecf_name_avp != charging_information_avp->end())
+void AnswerAvps::index_charging_information(struct avp* info,
+                                            const Dictionary* dict)
+{
+  for (struct avp* avp = first_child_avp(info);
+       avp != NULL;
+       avp = next_avp(avp))
+  {
+    struct dict_object* model = avp_model(avp);
+
+    if (model == dict->PRIMARY_CHARGING_COLLECTION_FUNCTION_NAME.dict())
+    {
+      index_avp(_primary_ccf, avp);
+    }
+    else if (model == dict->SECONDARY_CHARGING_COLLECTION_FUNCTION_NAME.dict())
+    {
+      index_avp(_secondary_ccf, avp);
+    }
+    else if (model == dict->PRIMARY_EVENT_CHARGING_FUNCTION_NAME.dict())
+    {
+      index_avp(_primary_ecf, avp);
+    }
+    else if (model == dict->SECONDARY_EVENT_CHARGING_FUNCTION_NAME.dict())
     {
-      charging_addrs.ecfs.push_back(secondary_ecf_name_avp->val_str());
-      TRC_DEBUG("Found Secondary-Event-Charging-Function-Name %s",
-                secondary_ecf_name_avp->val_str().c_str());
+      index_avp(_secondary_ecf, avp);
     }
   }
-  return found_charging_info;
 }
 
-PushProfileAnswer::PushProfileAnswer(Cx::PushProfileRequest& ppr,
-                                     Dictionary* dict,
-                                     const std::string result_code,
-                                     int32_t auth_session_state) :
-                                     Diameter::Message(ppr)
+bool AnswerAvps::view(const struct avp_hdr* hdr, boost::string_ref& str)
+{
+  return avp_view(hdr, str);
+}
 
+void AnswerAvps::charging_addrs(ChargingAddresses& charging_addrs) const
 {
-  TRC_DEBUG("Building Push-Profile answer");
-  build_response(ppr);
-  add_app_id(Diameter::Dictionary::Application::AUTH, dict->TGPP, dict->CX);
-  set_result_code(result_code);
-  add(Diameter::AVP(dict->AUTH_SESSION_STATE).val_i32(auth_session_state));
+  decode_charging_addrs(_primary_ccf,
+                        _secondary_ccf,
+                        _primary_ecf,
+                        _secondary_ecf,
+                        charging_addrs);
+}
+
+DigestAuthVector* AnswerAvps::digest_auth_vector() const
+{
+  return decode_digest_auth_vector(_cx_digest_ha1,
+                                   _digest_ha1,
+                                   _cx_digest_realm,
+                                   _digest_realm,
+                                   _cx_digest_qop,
+                                   _digest_qop);
+}
+
+AKAAuthVector* AnswerAvps::aka_auth_vector() const
+{
+  return decode_aka_auth_vector(_sip_authenticate,
+                                _sip_authorization,
+                                _confidentiality_key,
+                                _integrity_key);
+}
+
+AKAAuthVector* AnswerAvps::akav2_auth_vector() const
+{
+  AKAAuthVector* av = aka_auth_vector();
+  av->version = 2;
+  return av;
 }
@@ -21,6 +21,9 @@ using std::placeholders::_1;
 
 static SNMP::CxCounterTable* ppr_results_tbl;
 static SNMP::CxCounterTable* rtr_results_tbl;
+static StatisticsManager* handler_stats_manager = NULL;
+static FlightRecorder* handler_flight_recorder = NULL;
+static SasEncoder* handler_sas_encoder = NULL;
 
 const std::string SIP_URI_PRE = "sip:";
 
@@ -56,6 +59,22 @@ void log_sip_all_register_marker(SAS::TrailId trail, const std::string uri)
   SAS::report_marker(sip_all_register);
 }
 
+RegistrationTerminationTask::~RegistrationTerminationTask()
+{
+  for (ImplicitRegistrationSet* irs : _reg_sets)
+  {
+    delete irs;
+  }
+
+  if (handler_flight_recorder != NULL)
+  {
+    handler_flight_recorder->record("RTR",
+                                    _impis.empty() ? "" : _impis.front(),
+                                    trail(),
+                                    _timeline);
+  }
+}
+
 void RegistrationTerminationTask::run()
 {
   // Save off the deregistration reason and all private and public
@@ -110,6 +129,7 @@ void RegistrationTerminationTask::run()
     event.add_var_param(impis_str);
     SAS::report_event(event);
 
+    _timeline.mark("cache_get_sent");
     _cfg->cache->get_implicit_registration_sets_for_impis(success_cb,
                                                           failure_cb,
                                                           _impis,
@@ -127,6 +147,7 @@ void RegistrationTerminationTask::run()
     event.add_var_param(impus_str);
     SAS::report_event(event);
 
+    _timeline.mark("cache_get_sent");
     _cfg->cache->get_implicit_registration_sets_for_impus(success_cb,
                                                           failure_cb,
                                                           _impus,
@@ -146,6 +167,8 @@ void RegistrationTerminationTask::run()
 
 void RegistrationTerminationTask::get_registration_sets_success(std::vector<ImplicitRegistrationSet*> reg_sets)
 {
+  _timeline.mark("cache_get_done");
+
   // Save the vector of IRSs, which we are now responsible for deleting
   _reg_sets = reg_sets;
 
@@ -178,6 +201,8 @@ void RegistrationTerminationTask::get_registration_sets_success(std::vector<Impl
 
     // We need to notify sprout of the deregistrations. What we send to sprout
     // depends on the deregistration reason.
+    _timeline.mark("sprout_sent");
+
     switch (_deregistration_reason)
     {
     case PERMANENT_TERMINATION:
@@ -209,6 +234,8 @@ void RegistrationTerminationTask::get_registration_sets_success(std::vector<Impl
       // LCOV_EXCL_STOP
     }
 
+    _timeline.mark("sprout_done");
+
     switch (ret_code)
     {
       case HTTP_OK:
@@ -256,12 +283,15 @@ void RegistrationTerminationTask::get_registration_sets_success(std::vector<Impl
     failure_callback failure_cb =
       std::bind(&RegistrationTerminationTask::delete_reg_sets_failure, this, _1);
 
+    _timeline.mark("cache_delete_sent");
     _cfg->cache->delete_implicit_registration_sets(success_cb, progress_cb, failure_cb, _reg_sets, this->trail());
   }
 }
 
 void RegistrationTerminationTask::get_registration_sets_failure(Store::Status rc)
 {
+  _timeline.mark("cache_get_done");
+
   TRC_DEBUG("Failed to get a registration set - report failure to HSS");
   SAS::Event event(this->trail(), SASEvent::DEREG_FAIL, 0);
   SAS::report_event(event);
@@ -280,6 +310,8 @@ void RegistrationTerminationTask::delete_reg_sets_progress()
 
 void RegistrationTerminationTask::delete_reg_sets_success()
 {
+  _timeline.mark("cache_delete_done");
+
   // Just tidy up
   delete this;
 }
@@ -287,6 +319,8 @@ void RegistrationTerminationTask::delete_reg_sets_success()
 // LCOV_EXCL_START - nothing interesting to UT.
 void RegistrationTerminationTask::delete_reg_sets_failure(Store::Status rc)
 {
+  _timeline.mark("cache_delete_done");
+
   // We have already sent the reponse, so we do nothing here
   delete this;
 }
@@ -313,7 +347,27 @@ void RegistrationTerminationTask::send_rta(const std::string result_code)
 
   // Send the RTA back to the HSS.
   TRC_INFO("Ready to send RTA");
+  _timeline.mark("rta_sent");
   rta.send(this->trail());
+
+  unsigned long latency = 0;
+  if ((handler_stats_manager != NULL) && (_stop_watch.read(latency)))
+  {
+    handler_stats_manager->update_H_rtr_latency_us(latency);
+  }
+}
+
+PushProfileTask::~PushProfileTask()
+{
+  if (_ims_sub)
+  {
+    delete _ims_sub; _ims_sub = NULL;
+  }
+
+  if (handler_flight_recorder != NULL)
+  {
+    handler_flight_recorder->record("PPR", _impi, trail(), _timeline);
+  }
 }
 
 void PushProfileTask::run()
@@ -354,18 +408,21 @@ void PushProfileTask::run()
     failure_callback failure_cb =
       std::bind(&PushProfileTask::on_get_ims_sub_failure, this, _1);
 
+    _timeline.mark("cache_get_sent");
     _cfg->cache->get_ims_subscription(success_cb, failure_cb, _impi, this->trail());
   }
 }
 
 void PushProfileTask::on_get_ims_sub_success(ImsSubscription* ims_sub)
 {
+  _timeline.mark("cache_get_done");
+
   // Take ownership of the ImsSubscription*
   _ims_sub = ims_sub;
 
   // Build up a SAS log as we go, that we'll only send if we decide we can
   // process the PPR correctly
-  SAS::Event put_cache_event(this->trail(), SASEvent::CACHE_PUT_REG_DATA_IMPI, 0);
+  SasEncoder::Event put_cache_event(this->trail(), SASEvent::CACHE_PUT_REG_DATA_IMPI, 0);
   put_cache_event.add_var_param(_impi);
 
   std::string new_default_id;
@@ -411,9 +468,9 @@ void PushProfileTask::on_get_ims_sub_success(ImsSubscription* ims_sub)
     if (!found_sip_uri)
     {
       TRC_ERROR("No SIP URI in Implicit Registration Set");
-      SAS::Event event(this->trail(), SASEvent::NO_SIP_URI_IN_IRS, 0);
+      SasEncoder::Event event(this->trail(), SASEvent::NO_SIP_URI_IN_IRS, 0);
       event.add_compressed_param(_ims_subscription, &SASEvent::PROFILE_SERVICE_PROFILE);
-      SAS::report_event(event);
+      SasEncoder::report_event(handler_sas_encoder, event);
     }
 
     // Log a SIP_ALL_REGISTER marker to SAS for all IMPUs found.
@@ -431,9 +488,11 @@ void PushProfileTask::on_get_ims_sub_success(ImsSubscription* ims_sub)
     irs->set_ims_sub_xml(_ims_subscription);
 
     // Notify Sprout of the change
+    _timeline.mark("sprout_sent");
     HTTPCode rc = _cfg->sprout_conn->change_associated_identities(new_default_id,
                                                                   _ims_subscription,
                                                                   trail());
+    _timeline.mark("sprout_done");
 
     if (rc != HTTP_OK)
     {
@@ -468,7 +527,7 @@ void PushProfileTask::on_get_ims_sub_success(ImsSubscription* ims_sub)
     put_cache_event.add_var_param("Charging addresses unchanged");
   }
 
-  SAS::report_event(put_cache_event);
+  SasEncoder::report_event(handler_sas_encoder, put_cache_event);
 
   // Now, save the updated ImsSubscription in the cache.
   // The cache is smart enough to not write any IRSs which haven't been touched
@@ -482,11 +541,14 @@ void PushProfileTask::on_get_ims_sub_success(ImsSubscription* ims_sub)
   failure_callback failure_cb =
     std::bind(&PushProfileTask::on_save_ims_sub_failure, this, _1);
 
+  _timeline.mark("cache_put_sent");
   _cfg->cache->put_ims_subscription(success_cb, progress_cb, failure_cb, _ims_sub, this->trail());
 }
 
 void PushProfileTask::on_get_ims_sub_failure(Store::Status rc)
 {
+  _timeline.mark("cache_get_done");
+
   SAS::Event event(this->trail(), SASEvent::CACHE_GET_REG_DATA_FAIL, 0);
   SAS::report_event(event);
   TRC_DEBUG("Failed to get IMS subscription from cache - report to HSS");
@@ -496,6 +558,8 @@ void PushProfileTask::on_get_ims_sub_failure(Store::Status rc)
 
 void PushProfileTask::on_save_ims_sub_progress()
 {
+  _timeline.mark("cache_put_progress");
+
   SAS::Event event(this->trail(), SASEvent::CACHE_PUT_REG_DATA_SUCCESS, 0);
   SAS::report_event(event);
   send_ppa(DIAMETER_REQ_SUCCESS);
@@ -503,12 +567,16 @@ void PushProfileTask::on_save_ims_sub_progress()
 
 void PushProfileTask::on_save_ims_sub_success()
 {
+  _timeline.mark("cache_put_done");
+
   // Just tidy up
   delete this;
 }
 
 void PushProfileTask::on_save_ims_sub_failure(Store::Status rc)
 {
+  _timeline.mark("cache_put_done");
+
   TRC_DEBUG("Failed to update registration data - report failure to HSS");
   SAS::Event event(this->trail(), SASEvent::CACHE_PUT_REG_DATA_FAIL, 0);
   event.add_static_param(rc);
@@ -537,7 +605,14 @@ void PushProfileTask::send_ppa(const std::string result_code)
 
   // Send the PPA back to the HSS.
   TRC_INFO("Ready to send PPA");
+  _timeline.mark("ppa_sent");
   ppa.send(this->trail());
+
+  unsigned long latency = 0;
+  if ((handler_stats_manager != NULL) && (_stop_watch.read(latency)))
+  {
+    handler_stats_manager->update_H_ppr_latency_us(latency);
+  }
 }
 
 void configure_handler_cx_results_tables(SNMP::CxCounterTable* ppr_results_table,
@@ -546,3 +621,18 @@ void configure_handler_cx_results_tables(SNMP::CxCounterTable* ppr_results_table
   ppr_results_tbl = ppr_results_table;
   rtr_results_tbl = rtr_results_table;
 }
+
+void configure_handler_stats(StatisticsManager* stats_manager)
+{
+  handler_stats_manager = stats_manager;
+}
+
+void configure_handler_flight_recorder(FlightRecorder* flight_recorder)
+{
+  handler_flight_recorder = flight_recorder;
+}
+
+void configure_handler_sas_encoder(SasEncoder* sas_encoder)
+{
+  handler_sas_encoder = sas_encoder;
+}
@@ -9,8 +9,11 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include <algorithm>
+
 #include "charging_addresses.h"
 #include "diameter_hss_connection.h"
+#include "homestead_probes.h"
 #include "homesteadsasevent.h"
 #include "servercapabilities.h"
 
@@ -24,50 +27,136 @@ static SNMP::CxCounterTable* lir_results_tbl;
 template <class AnswerType>
 void DiameterHssConnection::DiameterTransaction<AnswerType>::on_response(Diameter::Message& rsp)
 {
-  update_latency_stats();
+  // If we didn't send this to a particular peer, record the latency against
+  // the peer that answered.
+  std::string origin_host;
+
+  if ((_latency_tracker != NULL) || (_peer_selector != NULL))
+  {
+    rsp.get_str_from_avp(_cx_dict->ORIGIN_HOST, origin_host);
+  }
+
+  update_latency_tracker(_dest_host.empty() ? origin_host : _dest_host);
   AnswerType answer = create_answer(rsp);
-  _response_clbk(answer);
+
+  HOMESTEAD_PROBE3(hss_answer_received,
+                   origin_host.c_str(),
+                   this->trail(),
+                   (int)answer.get_result());
+
+  // A peer that can't deliver the request, or is too busy to handle it,
+  // shouldn't be chosen for more requests.
+  update_peer_selector(origin_host,
+                       ((answer.get_result() == ResultCode::SERVER_UNAVAILABLE) ||
+                        (answer.get_result() == ResultCode::TIMEOUT)));
+
+  if (claim(answer))
+  {
+    report_sas_events();
+    increment_results();
+    update_latency_stats();
+    _response_clbk(answer);
+  }
 }
 
 template <class T>
-void DiameterHssConnection::DiameterTransaction<T>::increment_results(int32_t result,
-                                                                      int32_t experimental,
-                                                                      uint32_t vendor)
+void DiameterHssConnection::DiameterTransaction<T>::store_results(int32_t result,
+                                                                  int32_t experimental,
+                                                                  uint32_t vendor)
+{
+  _result = result;
+  _experimental = experimental;
+  _vendor = vendor;
+}
+
+template <class T>
+void DiameterHssConnection::DiameterTransaction<T>::increment_results()
 {
   // IMS mandates that exactly one of result code or experimental result code
   // will be set, so we can unambiguously assume that, if one is set, then the
   // other one won't be.
-  if (result != 0)
+  if (_result != 0)
+  {
+    _cx_results_tbl->increment(SNMP::DiameterAppId::BASE, _result);
+  }
+  else if (_experimental != 0 && _vendor == VENDOR_ID_3GPP)
+  {
+    _cx_results_tbl->increment(SNMP::DiameterAppId::_3GPP, _experimental);
+  }
+}
+
+template <class AnswerType>
+bool DiameterHssConnection::DiameterTransaction<AnswerType>::claim(const AnswerType& answer)
+{
+  return (!_claim) || (_claim(answer));
+}
+
+template <class T>
+void DiameterHssConnection::DiameterTransaction<T>::sas_log(SAS::Event& event)
+{
+  if (!_claim)
   {
-    _cx_results_tbl->increment(SNMP::DiameterAppId::BASE, result);
+    SAS::report_event(event);
   }
-  else if (experimental != 0 && vendor == VENDOR_ID_3GPP)
+  else
   {
-    _cx_results_tbl->increment(SNMP::DiameterAppId::_3GPP, experimental);
+    // This is one leg of a hedged request. Hold on to the event until we
+    // know whether this leg's answer is the one that's used.
+    _sas_events.push_back(event);
   }
 }
 
+template <class T>
+void DiameterHssConnection::DiameterTransaction<T>::report_sas_events()
+{
+  for (SAS::Event& event : _sas_events)
+  {
+    SAS::report_event(event);
+  }
+
+  _sas_events.clear();
+}
+
 template <class AnswerType>
 void DiameterHssConnection::DiameterTransaction<AnswerType>::on_timeout()
 {
   TRC_WARNING("Diameter timeout");
 
-  update_latency_stats();
+  update_latency_tracker(_dest_host);
+  update_peer_selector("", true);
 
-  // No result-code returned on timeout, so use 0.
-  _cx_results_tbl->increment(SNMP::DiameterAppId::TIMEOUT, 0);
+  HOMESTEAD_PROBE3(hss_answer_received, _dest_host.c_str(), this->trail(), 0);
 
   // Call the callback with SERVER_UNAVAILABLE
   AnswerType answer = AnswerType(ResultCode::SERVER_UNAVAILABLE);
-  _response_clbk(answer);
+
+  if (claim(answer))
+  {
+    // No result-code returned on timeout, so use 0.
+    _cx_results_tbl->increment(SNMP::DiameterAppId::TIMEOUT, 0);
+    update_latency_stats();
+    _response_clbk(answer);
+  }
+}
+
+template <class T>
+void DiameterHssConnection::DiameterTransaction<T>::update_latency_tracker(const std::string& peer)
+{
+  unsigned long latency = 0;
+
+  if ((_latency_tracker != NULL) && (get_duration(latency)))
+  {
+    _latency_tracker->record(peer, latency);
+  }
 }
 
 template <class T>
 void DiameterHssConnection::DiameterTransaction<T>::update_latency_stats()
 {
+  unsigned long latency = 0;
+
   if (_stats_manager != NULL)
   {
-    unsigned long latency = 0;
     if (get_duration(latency))
     {
       if (_stat_updates & STAT_HSS_LATENCY)
@@ -86,6 +175,18 @@ void DiameterHssConnection::DiameterTransaction<T>::update_latency_stats()
   }
 }
 
+template <class T>
+void DiameterHssConnection::DiameterTransaction<T>::update_peer_selector(const std::string& answered_by,
+                                                                         bool failed)
+{
+  if (_peer_selector != NULL)
+  {
+    unsigned long latency = 0;
+    get_duration(latency);
+    _peer_selector->complete(_dest_host, answered_by, latency, failed);
+  }
+}
+
 template <class T>
 void DiameterHssConnection::DiameterTransaction<T>::sas_log_hss_failure(int event_id,
                                                                         int32_t result_code,
@@ -94,7 +195,7 @@ void DiameterHssConnection::DiameterTransaction<T>::sas_log_hss_failure(int even
   SAS::Event event(trail(), event_id, 0);
   event.add_static_param(result_code);
   event.add_static_param(experimental_result_code);
-  SAS::report_event(event);
+  sas_log(event);
 }
 
 MultimediaAuthAnswer DiameterHssConnection::MarDiameterTransaction::create_answer(Diameter::Message& rsp)
@@ -113,7 +214,7 @@ MultimediaAuthAnswer DiameterHssConnection::MarDiameterTransaction::create_answe
   uint32_t vendor_id = 0;
   diameter_maa.experimental_result(experimental_result, vendor_id);
 
-  increment_results(result_code, experimental_result, vendor_id);
+  store_results(result_code, experimental_result, vendor_id);
 
   TRC_DEBUG("Recieved MAA from HSS with result code %d, experimental result code %d",
             result_code,
@@ -121,20 +222,25 @@ MultimediaAuthAnswer DiameterHssConnection::MarDiameterTransaction::create_answe
 
   if (result_code == DIAMETER_SUCCESS)
   {
-    auth_scheme = diameter_maa.sip_auth_scheme();
+    // Read everything we need from the answer in one pass over it.
+    Cx::AnswerAvps avps(diameter_maa);
+    boost::string_ref scheme;
+    avps.sip_auth_scheme(scheme);
+    TRC_DEBUG("Got SIP-Auth-Scheme %.*s", (int)scheme.size(), scheme.data());
+    auth_scheme.assign(scheme.data(), scheme.size());
     av = NULL;
 
     if (auth_scheme == HssConnection::_scheme_digest)
     {
-      av = diameter_maa.digest_auth_vector();
+      av = avps.digest_auth_vector();
     }
     else if (auth_scheme == HssConnection::_scheme_akav1)
     {
-      av = diameter_maa.aka_auth_vector();
+      av = avps.aka_auth_vector();
     }
     else if (auth_scheme == HssConnection::_scheme_akav2)
     {
-      av = diameter_maa.akav2_auth_vector();
+      av = avps.akav2_auth_vector();
     }
     else
     {
@@ -150,7 +256,7 @@ MultimediaAuthAnswer DiameterHssConnection::MarDiameterTransaction::create_answe
   {
     TRC_INFO("Multimedia-Auth answer - user unknown");
     SAS::Event event(this->trail(), SASEvent::NO_AV_HSS, 0);
-    SAS::report_event(event);
+    sas_log(event);
     rc = NOT_FOUND;
   }
   else
@@ -158,13 +264,13 @@ MultimediaAuthAnswer DiameterHssConnection::MarDiameterTransaction::create_answe
     TRC_INFO("Multimedia-Auth answer with result code %d and experimental result code %d and vendor id %d",
              result_code, experimental_result, vendor_id);
     SAS::Event event(this->trail(), SASEvent::NO_AV_HSS, 0);
-    SAS::report_event(event);
+    sas_log(event);
     rc = UNKNOWN;
   }
 
   return MultimediaAuthAnswer(rc,
                               av,
-                              auth_scheme);
+                              std::move(auth_scheme));
 }
 
 UserAuthAnswer DiameterHssConnection::UarDiameterTransaction::create_answer(Diameter::Message& rsp)
@@ -184,7 +290,7 @@ UserAuthAnswer DiameterHssConnection::UarDiameterTransaction::create_answer(Diam
   uint32_t vendor_id = 0;
   diameter_uaa.experimental_result(experimental_result, vendor_id);
 
-  increment_results(result_code, experimental_result, vendor_id);
+  store_results(result_code, experimental_result, vendor_id);
 
   TRC_DEBUG("Recieved UAA from HSS with result code %d, experimental result code %d",
             result_code,
@@ -195,7 +301,14 @@ UserAuthAnswer DiameterHssConnection::UarDiameterTransaction::create_answer(Diam
       (experimental_result == DIAMETER_SUBSEQUENT_REGISTRATION))
   {
     json_result = result_code ? result_code : experimental_result;
-    if (!diameter_uaa.server_name(server_name))
+    Cx::AnswerAvps avps(diameter_uaa);
+    boost::string_ref server_name_view;
+
+    if (avps.server_name(server_name_view))
+    {
+      server_name.assign(server_name_view.data(), server_name_view.size());
+    }
+    else
     {
       // If we don't have a server name, create the ServerCapabilities
       server_capabilities = diameter_uaa.server_capabilities();
@@ -228,7 +341,10 @@ UserAuthAnswer DiameterHssConnection::UarDiameterTransaction::create_answer(Diam
     rc = ResultCode::UNKNOWN;
   }
 
-  return UserAuthAnswer(rc, json_result, server_name, server_capabilities);
+  return UserAuthAnswer(rc,
+                        json_result,
+                        std::move(server_name),
+                        std::move(server_capabilities));
 }
 
 LocationInfoAnswer DiameterHssConnection::LirDiameterTransaction::create_answer(Diameter::Message& rsp)
@@ -249,7 +365,7 @@ LocationInfoAnswer DiameterHssConnection::LirDiameterTransaction::create_answer(
   uint32_t vendor_id = 0;
   diameter_lia.experimental_result(experimental_result, vendor_id);
 
-  increment_results(result_code, experimental_result, vendor_id);
+  store_results(result_code, experimental_result, vendor_id);
 
   TRC_DEBUG("Recieved LIA from HSS with result code %d, experimental result code %d",
             result_code,
@@ -262,15 +378,25 @@ LocationInfoAnswer DiameterHssConnection::LirDiameterTransaction::create_answer(
   {
     json_result = result_code ? result_code : experimental_result;
 
+    Cx::AnswerAvps avps(diameter_lia);
+    boost::string_ref value;
+
     // Get the server name
-    if (!diameter_lia.server_name(server_name))
+    if (avps.server_name(value))
+    {
+      server_name.assign(value.data(), value.size());
+    }
+    else
     {
       // If we don't have a server name, create the ServerCapabilities
       server_capabilities = diameter_lia.server_capabilities();
     }
 
     // Get the wildcard impu
-    diameter_lia.wildcarded_public_identity(wildcard_impu);
+    if (avps.wildcarded_public_identity(value))
+    {
+      wildcard_impu.assign(value.data(), value.size());
+    }
   }
   else if ((vendor_id == VENDOR_ID_3GPP) &&
            (experimental_result == DIAMETER_ERROR_USER_UNKNOWN))
@@ -295,9 +421,9 @@ LocationInfoAnswer DiameterHssConnection::LirDiameterTransaction::create_answer(
 
   return LocationInfoAnswer(rc,
                             json_result,
-                            server_name,
-                            server_capabilities,
-                            wildcard_impu);
+                            std::move(server_name),
+                            std::move(server_capabilities),
+                            std::move(wildcard_impu));
 }
 
 ServerAssignmentAnswer DiameterHssConnection::SarDiameterTransaction::create_answer(Diameter::Message& rsp)
@@ -317,7 +443,7 @@ ServerAssignmentAnswer DiameterHssConnection::SarDiameterTransaction::create_ans
   uint32_t vendor_id = 0;
   diameter_saa.experimental_result(experimental_result, vendor_id);
 
-  increment_results(result_code, experimental_result, vendor_id);
+  store_results(result_code, experimental_result, vendor_id);
 
   TRC_DEBUG("Recieved SAA from HSS with result code %d, experimental result code %d",
             result_code,
@@ -326,9 +452,17 @@ ServerAssignmentAnswer DiameterHssConnection::SarDiameterTransaction::create_ans
   if (result_code == DIAMETER_SUCCESS)
   {
     SAS::Event event(this->trail(), SASEvent::REG_DATA_HSS_SUCCESS, 0);
-    SAS::report_event(event);
-    diameter_saa.charging_addrs(charging_addresses);
-    diameter_saa.user_data(service_profile);
+    sas_log(event);
+
+    // Read everything we need from the answer in one pass over it.
+    Cx::AnswerAvps avps(diameter_saa);
+    avps.charging_addrs(charging_addresses);
+
+    boost::string_ref user_data;
+    if (avps.user_data(user_data))
+    {
+      service_profile.assign(user_data.data(), user_data.size());
+    }
   }
   else if (result_code == DIAMETER_UNABLE_TO_DELIVER)
   {
@@ -341,12 +475,17 @@ ServerAssignmentAnswer DiameterHssConnection::SarDiameterTransaction::create_ans
     SAS::Event event(this->trail(), SASEvent::REG_DATA_HSS_FAIL, 0);
     event.add_static_param(result_code);
     event.add_static_param(experimental_result);
-    SAS::report_event(event);
+    sas_log(event);
     rc = ResultCode::NOT_FOUND;
   }
   else if (experimental_result == DIAMETER_ERROR_IN_ASSIGNMENT_TYPE)
   {
-    diameter_saa.wildcarded_public_identity(wildcard_impu);
+    boost::string_ref wildcard;
+    if (Cx::AnswerAvps(diameter_saa).wildcarded_public_identity(wildcard))
+    {
+      wildcard_impu.assign(wildcard.data(), wildcard.size());
+    }
+
     if (!wildcard_impu.empty())
     {
       // The callback will handle tracking whether the wildcard has actually changed
@@ -374,14 +513,75 @@ ServerAssignmentAnswer DiameterHssConnection::SarDiameterTransaction::create_ans
     SAS::Event event(this->trail(), SASEvent::REG_DATA_HSS_FAIL, 0);
     event.add_static_param(result_code);
     event.add_static_param(experimental_result);
-    SAS::report_event(event);
+    sas_log(event);
     rc = ResultCode::UNKNOWN;
   }
 
   return ServerAssignmentAnswer(rc,
-                                charging_addresses,
-                                service_profile,
-                                wildcard_impu);
+                                std::move(charging_addresses),
+                                std::move(service_profile),
+                                std::move(wildcard_impu));
+}
+
+template <class AnswerType, class RequestType>
+bool DiameterHssConnection::HedgedRequest<AnswerType, RequestType>::start_hedge()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  if (_answered)
+  {
+    return false;
+  }
+
+  _hedged = true;
+  _outstanding++;
+
+  if (_stats_manager != NULL)
+  {
+    _stats_manager->incr_H_hss_hedged_requests();
+  }
+
+  return true;
+}
+
+template <class AnswerType, class RequestType>
+bool DiameterHssConnection::HedgedRequest<AnswerType, RequestType>::claim(const AnswerType& answer,
+                                                                          bool hedge)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  _outstanding--;
+
+  if (_answered)
+  {
+    // We've already passed on the other peer's answer.
+    return false;
+  }
+
+  if ((_outstanding > 0) &&
+      ((answer.get_result() == ResultCode::SERVER_UNAVAILABLE) ||
+       (answer.get_result() == ResultCode::TIMEOUT)))
+  {
+    // This peer couldn't handle the request, but the other one still
+    // might, so wait for its answer instead.
+    return false;
+  }
+
+  _answered = true;
+
+  if ((_hedged) && (_stats_manager != NULL))
+  {
+    if (hedge)
+    {
+      _stats_manager->incr_H_hss_hedge_wins();
+    }
+    else
+    {
+      _stats_manager->incr_H_hss_hedge_losses();
+    }
+  }
+
+  return true;
 }
 
 DiameterHssConnection::DiameterHssConnection(StatisticsManager* stats_manager,
@@ -389,52 +589,168 @@ DiameterHssConnection::DiameterHssConnection(StatisticsManager* stats_manager,
                                              Diameter::Stack* diameter_stack,
                                              const std::string& dest_realm,
                                              const std::string& dest_host,
-                                             int diameter_timeout_ms) :
+                                             int diameter_timeout_ms,
+                                             PeerLatencyTracker* latency_tracker,
+                                             TimerQueue* hedge_timer,
+                                             PeerSelector* peer_selector) :
   HssConnection(stats_manager),
   _dict(dict),
   _diameter_stack(diameter_stack),
   _dest_realm(dest_realm),
   _dest_host(dest_host),
-  _diameter_timeout_ms(diameter_timeout_ms)
+  _diameter_timeout_ms(diameter_timeout_ms),
+  _latency_tracker(latency_tracker),
+  _hedge_timer((latency_tracker != NULL) ? hedge_timer : NULL),
+  _peer_selector(peer_selector)
+{
+}
+
+std::string DiameterHssConnection::select_dest_host()
 {
+  // A configured Destination-Host always takes precedence.
+  if ((_peer_selector == NULL) || (!_dest_host.empty()))
+  {
+    return _dest_host;
+  }
+
+  return _peer_selector->select();
+}
+
+int DiameterHssConnection::timeout_ms(const std::string& dest_host)
+{
+  if (_latency_tracker == NULL)
+  {
+    return _diameter_timeout_ms;
+  }
+
+  return _latency_tracker->timeout_ms(dest_host);
+}
+
+template <class AnswerType, class RequestType>
+void DiameterHssConnection::send_hedged(std::function<void(const AnswerType&)>& callback,
+                                        RequestType& request,
+                                        SAS::TrailId trail,
+                                        void (DiameterHssConnection::*send_fn)(std::function<void(const AnswerType&)>,
+                                                                               const RequestType&,
+                                                                               SAS::TrailId,
+                                                                               const std::string&,
+                                                                               std::function<bool(const AnswerType&)>))
+{
+  std::string dest_host = select_dest_host();
+  std::string primary;
+  std::string alternate;
+  unsigned long hedge_delay_us = 0;
+
+  // We can only hedge once we know of two peers that are answering requests,
+  // and how quickly the first one normally answers. A configured
+  // Destination-Host pins every request to that peer, so is never hedged.
+  if ((_hedge_timer == NULL) ||
+      (!_dest_host.empty()) ||
+      (!_latency_tracker->choose_peers(dest_host, primary, alternate)) ||
+      (!_latency_tracker->p99_us(primary, hedge_delay_us)))
+  {
+    (this->*send_fn)(std::move(callback), request, trail, dest_host, nullptr);
+    return;
+  }
+
+  typedef HedgedRequest<AnswerType, RequestType> hedged_request_t;
+  std::shared_ptr<hedged_request_t> hedged =
+    std::make_shared<hedged_request_t>(callback, request, trail, _stats_manager);
+
+  (this->*send_fn)(hedged_request_t::leg_callback(hedged),
+                   hedged->_request,
+                   hedged->_trail,
+                   primary,
+                   hedged_request_t::leg_claim(hedged, false));
+
+  int hedge_delay_ms = std::max((int)(hedge_delay_us / 1000), 1);
+
+  _hedge_timer->schedule(hedge_delay_ms, [this, hedged, send_fn, alternate]()
+  {
+    if (hedged->start_hedge())
+    {
+      TRC_DEBUG("No answer within 99th percentile latency - resending to %s",
+                alternate.c_str());
+      (this->*send_fn)(hedged_request_t::leg_callback(hedged),
+                       hedged->_request,
+                       hedged->_trail,
+                       alternate,
+                       hedged_request_t::leg_claim(hedged, true));
+    }
+  });
 }
 
 // Send a multimedia auth request to the HSS
 void DiameterHssConnection::send_multimedia_auth_request(maa_cb callback,
                                                          MultimediaAuthRequest request,
                                                          SAS::TrailId trail)
+{
+  // Only digest MARs can be hedged. For AKA, the HSS generates a new vector
+  // and advances the SQN for every MAR, and a MAR with an authorization
+  // resynchronises the SQN, so it isn't safe to send them twice. If the
+  // scheme is unknown, the HSS may choose AKA.
+  if ((request.scheme == _scheme_digest) && (request.authorization.empty()))
+  {
+    send_hedged(callback, request, trail, &DiameterHssConnection::send_mar);
+  }
+  else
+  {
+    send_mar(std::move(callback), request, trail, select_dest_host(), nullptr);
+  }
+}
+
+void DiameterHssConnection::send_mar(maa_cb callback,
+                                     const MultimediaAuthRequest& request,
+                                     SAS::TrailId trail,
+                                     const std::string& dest_host,
+                                     std::function<bool(const MultimediaAuthAnswer&)> claim)
 {
   // Transactions are deleted in the DiameterStack's on_response or or_timeout,
   // so we don't have to delete this after sending
   MarDiameterTransaction* tsx =
-    new MarDiameterTransaction(_dict, trail, DIGEST_STATS, callback, mar_results_tbl, _stats_manager);
+    new MarDiameterTransaction(_dict, trail, DIGEST_STATS, std::move(callback), mar_results_tbl, _stats_manager);
+  tsx->set_peer(dest_host, _latency_tracker, _peer_selector);
+  tsx->set_claim(std::move(claim));
 
   Cx::MultimediaAuthRequest mar(_dict,
                                 _diameter_stack,
                                 _dest_realm,
-                                _dest_host,
+                                dest_host,
                                 request.impi,
                                 request.impu,
                                 request.server_name,
                                 request.scheme,
                                 request.authorization);
 
-  mar.send(tsx, _diameter_timeout_ms);
+  HOMESTEAD_PROBE3(hss_request_sent, "MAR", dest_host.c_str(), trail);
+  mar.send(tsx, timeout_ms(dest_host));
 }
 
 // Send a user auth request to the HSS
 void DiameterHssConnection::send_user_auth_request(uaa_cb callback,
                                                    UserAuthRequest request,
                                                    SAS::TrailId trail)
+{
+  // UARs don't change any state in the HSS, so can always be hedged.
+  send_hedged(callback, request, trail, &DiameterHssConnection::send_uar);
+}
+
+void DiameterHssConnection::send_uar(uaa_cb callback,
+                                     const UserAuthRequest& request,
+                                     SAS::TrailId trail,
+                                     const std::string& dest_host,
+                                     std::function<bool(const UserAuthAnswer&)> claim)
 {
   // Transactions are deleted in the DiameterStack's on_response or or_timeout,
   // so we don't have to delete this after sending
   UarDiameterTransaction* tsx =
-    new UarDiameterTransaction(_dict, trail, SUBSCRIPTION_STATS, callback, uar_results_tbl, _stats_manager);
+    new UarDiameterTransaction(_dict, trail, SUBSCRIPTION_STATS, std::move(callback), uar_results_tbl, _stats_manager);
+  tsx->set_peer(dest_host, _latency_tracker, _peer_selector);
+  tsx->set_claim(std::move(claim));
 
   Cx::UserAuthorizationRequest uar(_dict,
                                    _diameter_stack,
-                                   _dest_host,
+                                   dest_host,
                                    _dest_realm,
                                    request.impi,
                                    request.impu,
@@ -442,26 +758,40 @@ void DiameterHssConnection::send_user_auth_request(uaa_cb callback,
                                    request.authorization_type,
                                    request.emergency);
 
-  uar.send(tsx, _diameter_timeout_ms);
+  HOMESTEAD_PROBE3(hss_request_sent, "UAR", dest_host.c_str(), trail);
+  uar.send(tsx, timeout_ms(dest_host));
 }
 
 // Send a location info request to the HSS
 void DiameterHssConnection::send_location_info_request(lia_cb callback,
                                                        LocationInfoRequest request,
                                                        SAS::TrailId trail)
+{
+  // LIRs don't change any state in the HSS, so can always be hedged.
+  send_hedged(callback, request, trail, &DiameterHssConnection::send_lir);
+}
+
+void DiameterHssConnection::send_lir(lia_cb callback,
+                                     const LocationInfoRequest& request,
+                                     SAS::TrailId trail,
+                                     const std::string& dest_host,
+                                     std::function<bool(const LocationInfoAnswer&)> claim)
 {
   LirDiameterTransaction* tsx =
-    new LirDiameterTransaction(_dict, trail, SUBSCRIPTION_STATS, callback, lir_results_tbl, _stats_manager);
+    new LirDiameterTransaction(_dict, trail, SUBSCRIPTION_STATS, std::move(callback), lir_results_tbl, _stats_manager);
+  tsx->set_peer(dest_host, _latency_tracker, _peer_selector);
+  tsx->set_claim(std::move(claim));
 
   Cx::LocationInfoRequest lir(_dict,
                               _diameter_stack,
-                              _dest_host,
+                              dest_host,
                               _dest_realm,
                               request.originating,
                               request.impu,
                               request.authorization_type);
 
-  lir.send(tsx, _diameter_timeout_ms);
+  HOMESTEAD_PROBE3(hss_request_sent, "LIR", dest_host.c_str(), trail);
+  lir.send(tsx, timeout_ms(dest_host));
 }
 
 // Send a server assignment request to the HSS
@@ -469,14 +799,22 @@ void DiameterHssConnection::send_server_assignment_request(saa_cb callback,
                                                            ServerAssignmentRequest request,
                                                            SAS::TrailId trail)
 {
+  // SARs change the registration state in the HSS, so are never hedged.
+  std::string dest_host = select_dest_host();
+
   // Transactions are deleted in the DiameterStack's on_response or or_timeout,
   // so we don't have to delete this after sending
   SarDiameterTransaction* tsx =
-    new SarDiameterTransaction(_dict, trail, SUBSCRIPTION_STATS, callback, sar_results_tbl, _stats_manager);
+    new SarDiameterTransaction(_dict, trail, SUBSCRIPTION_STATS, std::move(callback), sar_results_tbl, _stats_manager);
+
+  // SARs can be slower than the other requests, as the HSS may need to
+  // update its state, and timing one out early isn't safe to recover from
+  // by retrying. So they don't use (or feed) the adaptive timeout.
+  tsx->set_peer(dest_host, NULL, _peer_selector);
 
   Cx::ServerAssignmentRequest sar(_dict,
                                   _diameter_stack,
-                                  _dest_host,
+                                  dest_host,
                                   _dest_realm,
                                   request.impi,
                                   request.impu,
@@ -485,6 +823,7 @@ void DiameterHssConnection::send_server_assignment_request(saa_cb callback,
                                   request.support_shared_ifcs,
                                   request.wildcard_impu);
 
+  HOMESTEAD_PROBE3(hss_request_sent, "SAR", dest_host.c_str(), trail);
   sar.send(tsx, _diameter_timeout_ms);
 }
 
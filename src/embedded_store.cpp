@@ -0,0 +1,324 @@
+/**
+ * @file embedded_store.cpp In-process implementation of the Store interface
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "embedded_store.h"
+
+#include <time.h>
+
+#include <chrono>
+#include <functional>
+
+#include "log.h"
+
+// A rough allowance for the hash table node, the LRU list entry and the
+// record's other fields, on top of the key (held twice) and the data.
+static const size_t RECORD_OVERHEAD_BYTES = 128;
+
+// Keys are formed in the same way as in memcached.
+static std::string record_key_for(const std::string& table,
+                                  const std::string& key)
+{
+  return table + "\\\\" + key;
+}
+
+EmbeddedStore::EmbeddedStore(size_t max_bytes,
+                             int num_shards,
+                             int sweep_interval_ms) :
+  _max_shard_bytes(max_bytes / ((num_shards > 0) ? num_shards : 1)),
+  _sweep_interval_ms(sweep_interval_ms),
+  _next_cas(1),
+  _terminated(false)
+{
+  for (int ii = 0; ii < ((num_shards > 0) ? num_shards : 1); ii++)
+  {
+    _shards.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+}
+
+EmbeddedStore::~EmbeddedStore()
+{
+  stop();
+}
+
+bool EmbeddedStore::start()
+{
+  _sweeper = std::thread(&EmbeddedStore::run_sweeper, this);
+
+  return true;
+}
+
+void EmbeddedStore::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_sweeper_lock);
+    _terminated = true;
+  }
+
+  _sweeper_cond.notify_all();
+
+  if (_sweeper.joinable())
+  {
+    _sweeper.join();
+  }
+}
+
+Store::Status EmbeddedStore::get_data(const std::string& table,
+                                      const std::string& key,
+                                      std::string& data,
+                                      uint64_t& cas,
+                                      SAS::TrailId trail,
+                                      bool log_body)
+{
+  std::string record_key = record_key_for(table, key);
+  Shard& shard = shard_for(record_key);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  RecordIterator record = shard.records.find(record_key);
+
+  if (record == shard.records.end())
+  {
+    TRC_DEBUG("No record for %s", record_key.c_str());
+    return Store::Status::NOT_FOUND;
+  }
+
+  if (record->second.expiry <= time(NULL))
+  {
+    TRC_DEBUG("Record for %s has expired", record_key.c_str());
+    erase(shard, record);
+    return Store::Status::NOT_FOUND;
+  }
+
+  data = record->second.data;
+  cas = record->second.cas;
+
+  shard.lru.splice(shard.lru.begin(), shard.lru, record->second.lru_position);
+
+  return Store::Status::OK;
+}
+
+Store::Status EmbeddedStore::set_data(const std::string& table,
+                                      const std::string& key,
+                                      const std::string& data,
+                                      uint64_t cas,
+                                      int expiry,
+                                      SAS::TrailId trail,
+                                      bool log_body)
+{
+  return write(table, key, data, true, cas, expiry);
+}
+
+Store::Status EmbeddedStore::set_data_without_cas(const std::string& table,
+                                                  const std::string& key,
+                                                  const std::string& data,
+                                                  int expiry,
+                                                  SAS::TrailId trail,
+                                                  bool log_body)
+{
+  return write(table, key, data, false, 0, expiry);
+}
+
+Store::Status EmbeddedStore::delete_data(const std::string& table,
+                                         const std::string& key,
+                                         SAS::TrailId trail)
+{
+  std::string record_key = record_key_for(table, key);
+  Shard& shard = shard_for(record_key);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  RecordIterator record = shard.records.find(record_key);
+
+  if (record != shard.records.end())
+  {
+    erase(shard, record);
+  }
+
+  return Store::Status::OK;
+}
+
+void EmbeddedStore::sweep()
+{
+  time_t now = time(NULL);
+  size_t swept = 0;
+
+  for (std::unique_ptr<Shard>& shard : _shards)
+  {
+    std::lock_guard<std::mutex> lock(shard->lock);
+
+    RecordIterator record = shard->records.begin();
+
+    while (record != shard->records.end())
+    {
+      RecordIterator next = std::next(record);
+
+      if (record->second.expiry <= now)
+      {
+        erase(*shard, record);
+        swept++;
+      }
+
+      record = next;
+    }
+  }
+
+  if (swept > 0)
+  {
+    TRC_DEBUG("Swept %lu expired records", swept);
+  }
+}
+
+size_t EmbeddedStore::size() const
+{
+  size_t size = 0;
+
+  for (const std::unique_ptr<Shard>& shard : _shards)
+  {
+    std::lock_guard<std::mutex> lock(shard->lock);
+    size += shard->records.size();
+  }
+
+  return size;
+}
+
+size_t EmbeddedStore::bytes() const
+{
+  size_t bytes = 0;
+
+  for (const std::unique_ptr<Shard>& shard : _shards)
+  {
+    std::lock_guard<std::mutex> lock(shard->lock);
+    bytes += shard->bytes;
+  }
+
+  return bytes;
+}
+
+EmbeddedStore::Shard& EmbeddedStore::shard_for(const std::string& record_key)
+{
+  return *_shards[std::hash<std::string>()(record_key) % _shards.size()];
+}
+
+Store::Status EmbeddedStore::write(const std::string& table,
+                                   const std::string& key,
+                                   const std::string& data,
+                                   bool check_cas,
+                                   uint64_t cas,
+                                   int expiry)
+{
+  std::string record_key = record_key_for(table, key);
+  Shard& shard = shard_for(record_key);
+  size_t new_bytes = record_bytes(record_key, data);
+
+  if (new_bytes > _max_shard_bytes)
+  {
+    TRC_WARNING("Record for %s is too big to store (%lu bytes)",
+                record_key.c_str(), new_bytes);
+    return Store::Status::ERROR;
+  }
+
+  time_t now = time(NULL);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  RecordIterator record = shard.records.find(record_key);
+
+  if ((record != shard.records.end()) && (record->second.expiry <= now))
+  {
+    erase(shard, record);
+    record = shard.records.end();
+  }
+
+  if (check_cas)
+  {
+    // As in memcached, a CAS of 0 means the record mustn't exist yet.
+    uint64_t current_cas =
+      (record != shard.records.end()) ? record->second.cas : 0;
+
+    if (cas != current_cas)
+    {
+      TRC_DEBUG("CAS mismatch for %s (%lu, expected %lu)",
+                record_key.c_str(), cas, current_cas);
+      return Store::Status::DATA_CONTENTION;
+    }
+  }
+
+  if (expiry <= 0)
+  {
+    // The record has already expired, so there's nothing to keep.
+    if (record != shard.records.end())
+    {
+      erase(shard, record);
+    }
+
+    return Store::Status::OK;
+  }
+
+  if (record != shard.records.end())
+  {
+    shard.bytes -= record_bytes(record_key, record->second.data);
+    shard.bytes += new_bytes;
+    record->second.data = data;
+    shard.lru.splice(shard.lru.begin(), shard.lru, record->second.lru_position);
+  }
+  else
+  {
+    shard.lru.push_front(record_key);
+    record = shard.records.emplace(record_key, Record()).first;
+    record->second.data = data;
+    record->second.lru_position = shard.lru.begin();
+    shard.bytes += new_bytes;
+  }
+
+  record->second.cas = _next_cas++;
+  record->second.expiry = now + expiry;
+
+  // Make room by evicting the least recently used records. This never
+  // evicts the record we've just written, as it's the most recently used
+  // and fits in the shard on its own.
+  while (shard.bytes > _max_shard_bytes)
+  {
+    TRC_DEBUG("Evicting %s to make room", shard.lru.back().c_str());
+    erase(shard, shard.records.find(shard.lru.back()));
+  }
+
+  return Store::Status::OK;
+}
+
+void EmbeddedStore::erase(Shard& shard, RecordIterator record)
+{
+  shard.bytes -= record_bytes(record->first, record->second.data);
+  shard.lru.erase(record->second.lru_position);
+  shard.records.erase(record);
+}
+
+size_t EmbeddedStore::record_bytes(const std::string& record_key,
+                                   const std::string& data)
+{
+  return (2 * record_key.length()) + data.length() + RECORD_OVERHEAD_BYTES;
+}
+
+void EmbeddedStore::run_sweeper()
+{
+  std::unique_lock<std::mutex> lock(_sweeper_lock);
+
+  while (!_terminated)
+  {
+    _sweeper_cond.wait_for(lock, std::chrono::milliseconds(_sweep_interval_ms));
+
+    if (!_terminated)
+    {
+      lock.unlock();
+      sweep();
+      lock.lock();
+    }
+  }
+}
@@ -0,0 +1,214 @@
+/**
+ * @file flight_recorder.cpp Records the stage timelines of slow requests
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "flight_recorder.h"
+#include "log.h"
+
+// JSON field names for the recorded requests.
+static const char* const JSON_DROPPED = "dropped";
+static const char* const JSON_REQUESTS = "requests";
+static const char* const JSON_TYPE = "type";
+static const char* const JSON_ID = "id";
+static const char* const JSON_TRAIL = "trail";
+static const char* const JSON_START_TIME_MS = "start-time-ms";
+static const char* const JSON_DURATION_US = "duration-us";
+static const char* const JSON_STAGES = "stages";
+static const char* const JSON_STAGE = "stage";
+static const char* const JSON_TIME_US = "time-us";
+
+// Copies a string into a fixed size buffer, truncating it if necessary.
+static void copy_truncated(char* dest, size_t dest_len, const char* src, size_t src_len)
+{
+  size_t len = std::min(src_len, dest_len - 1);
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+}
+
+FlightRecorder::Timeline::Timeline() :
+  _num_stages(0)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  _start_time_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+  _stop_watch.start();
+}
+
+void FlightRecorder::Timeline::mark(const char* stage)
+{
+  if (_num_stages < MAX_STAGES)
+  {
+    unsigned long time_us = 0;
+    _stop_watch.read(time_us);
+    _stages[_num_stages].name = stage;
+    _stages[_num_stages].time_us = time_us;
+    _num_stages++;
+  }
+}
+
+FlightRecorder::FlightRecorder(unsigned long threshold_ms, size_t capacity) :
+  _threshold_us(threshold_ms * 1000),
+  _capacity(std::max(capacity, (size_t)1)),
+  _slots(new Slot[_capacity]),
+  _next(0),
+  _dropped(0)
+{
+  for (size_t ii = 0; ii < _capacity; ii++)
+  {
+    _slots[ii].version.store(0);
+  }
+}
+
+FlightRecorder::~FlightRecorder()
+{
+  delete[] _slots; _slots = NULL;
+}
+
+bool FlightRecorder::is_slow(Timeline& timeline) const
+{
+  unsigned long duration_us = 0;
+  return ((timeline._stop_watch.read(duration_us)) &&
+          (duration_us >= _threshold_us));
+}
+
+bool FlightRecorder::record(const char* type,
+                            const std::string& id,
+                            SAS::TrailId trail,
+                            Timeline& timeline)
+{
+  unsigned long duration_us = 0;
+
+  if ((!timeline._stop_watch.read(duration_us)) ||
+      (duration_us < _threshold_us))
+  {
+    return false;
+  }
+
+  uint64_t sequence = _next.fetch_add(1);
+  Slot& slot = _slots[sequence % _capacity];
+
+  // Claim the slot by making its version odd. If another thread is part way
+  // through writing to it, drop this record rather than waiting.
+  uint64_t version = slot.version.load(std::memory_order_relaxed);
+
+  if ((version & 1) ||
+      (!slot.version.compare_exchange_strong(version,
+                                             version + 1,
+                                             std::memory_order_acquire)))
+  {
+    _dropped++;
+    return false;
+  }
+
+  Record& record = slot.record;
+  record.sequence = sequence;
+  copy_truncated(record.type, sizeof(record.type), type, strlen(type));
+  copy_truncated(record.id, sizeof(record.id), id.data(), id.length());
+  record.trail = trail;
+  record.start_time_ms = timeline._start_time_ms;
+  record.duration_us = duration_us;
+  record.num_stages = timeline._num_stages;
+  memcpy(record.stages, timeline._stages, sizeof(Stage) * timeline._num_stages);
+
+  slot.version.store(version + 2, std::memory_order_release);
+
+  TRC_DEBUG("Recorded slow %s request %s (%lu us)", type, id.c_str(), duration_us);
+
+  return true;
+}
+
+bool FlightRecorder::read_slot(const Slot& slot, Record& record) const
+{
+  uint64_t version = slot.version.load(std::memory_order_acquire);
+
+  if ((version == 0) || (version & 1))
+  {
+    return false;
+  }
+
+  memcpy(&record, &slot.record, sizeof(Record));
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  return (slot.version.load(std::memory_order_relaxed) == version);
+}
+
+void FlightRecorder::write_json(rapidjson::Writer<rapidjson::StringBuffer>& writer) const
+{
+  std::vector<Record> records;
+  records.reserve(_capacity);
+
+  for (size_t ii = 0; ii < _capacity; ii++)
+  {
+    Record record;
+
+    if (read_slot(_slots[ii], record))
+    {
+      records.push_back(record);
+    }
+  }
+
+  std::sort(records.begin(),
+            records.end(),
+            [](const Record& a, const Record& b)
+            {
+              return a.sequence < b.sequence;
+            });
+
+  writer.StartObject();
+  {
+    writer.String(JSON_DROPPED);
+    writer.Uint64(_dropped.load());
+
+    writer.String(JSON_REQUESTS);
+    writer.StartArray();
+
+    for (const Record& record : records)
+    {
+      writer.StartObject();
+      {
+        writer.String(JSON_TYPE);
+        writer.String(record.type);
+        writer.String(JSON_ID);
+        writer.String(record.id);
+        writer.String(JSON_TRAIL);
+        writer.Uint64(record.trail);
+        writer.String(JSON_START_TIME_MS);
+        writer.Uint64(record.start_time_ms);
+        writer.String(JSON_DURATION_US);
+        writer.Uint64(record.duration_us);
+
+        writer.String(JSON_STAGES);
+        writer.StartArray();
+
+        for (int jj = 0; jj < record.num_stages; jj++)
+        {
+          writer.StartObject();
+          writer.String(JSON_STAGE);
+          writer.String(record.stages[jj].name);
+          writer.String(JSON_TIME_US);
+          writer.Uint64(record.stages[jj].time_us);
+          writer.EndObject();
+        }
+
+        writer.EndArray();
+      }
+      writer.EndObject();
+    }
+
+    writer.EndArray();
+  }
+  writer.EndObject();
+}
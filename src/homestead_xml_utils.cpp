@@ -11,6 +11,7 @@
 
 #include <algorithm>
 
+#include "homestead_probes.h"
 #include "homestead_xml_utils.h"
 #include "xml_utils.h"
 #include "httpclient.h"
@@ -37,6 +38,8 @@ int build_ClearwaterRegData_xml(ImplicitRegistrationSet* irs,
   add_reg_state_node(irs->get_reg_state(), doc, root, regtype);
 
   std::string xml = irs->get_ims_sub_xml();
+  HOMESTEAD_PROBE1(xml_build_start, xml.size());
+
   if (xml != "")
   {
     // Parse the XML document - note we need to pass in the prev_doc here to
@@ -46,6 +49,7 @@ int build_ClearwaterRegData_xml(ImplicitRegistrationSet* irs,
 
     if (rc == HTTP_SERVER_ERROR)
     {
+      HOMESTEAD_PROBE2(xml_build_done, xml_str.size(), HTTP_SERVER_ERROR);
       return HTTP_SERVER_ERROR;
     }
   }
@@ -59,6 +63,8 @@ int build_ClearwaterRegData_xml(ImplicitRegistrationSet* irs,
   doc.append_node(root);
   rapidxml::print(std::back_inserter(xml_str), doc, 0);
 
+  HOMESTEAD_PROBE2(xml_build_done, xml_str.size(), HTTP_OK);
+
   return HTTP_OK;
 }
 
@@ -214,6 +220,8 @@ std::vector<std::string> get_public_and_default_ids(const std::string &user_data
   std::vector<std::string> public_ids;
   std::vector<std::string> unbarred_public_ids;
 
+  HOMESTEAD_PROBE1(xml_parse_start, user_data.size());
+
   // Parse the XML document, saving off the passed-in string first (as parsing
   // is destructive).
   rapidxml::xml_document<> doc;
@@ -292,6 +300,8 @@ std::vector<std::string> get_public_and_default_ids(const std::string &user_data
     default_id = unbarred_public_ids.front();
   }
 
+  HOMESTEAD_PROBE2(xml_parse_done, user_data.size(), public_ids.size());
+
   return public_ids;
 }
 
@@ -300,6 +310,8 @@ std::string get_private_id(const std::string& user_data)
 {
   std::string impi;
 
+  HOMESTEAD_PROBE1(xml_parse_start, user_data.size());
+
   // Parse the XML document, saving off the passed-in string first (as parsing
   // is destructive).
   rapidxml::xml_document<> doc;
@@ -337,6 +349,8 @@ std::string get_private_id(const std::string& user_data)
     impi = ""; // LCOV_EXCL_LINE
   }
 
+  HOMESTEAD_PROBE2(xml_parse_done, user_data.size(), (impi.empty() ? 0 : 1));
+
   return impi;
 }
 
@@ -0,0 +1,158 @@
+/**
+ * @file hsprov_cache.cpp Short-lived cache of data read from Homestead-prov
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "hsprov_cache.h"
+
+#include "log.h"
+
+// Separates the private and public IDs in the key of an auth vector. Neither
+// can contain a NUL.
+static const char AV_KEY_SEPARATOR = '\0';
+
+HsProvCache::HsProvCache(int ttl_s,
+                         size_t max_entries,
+                         StatisticsManager* stats_manager) :
+  _ttl_s(ttl_s),
+  _stats_manager(stats_manager),
+  _avs(max_entries),
+  _reg_data(max_entries)
+{
+}
+
+std::string HsProvCache::av_key(const std::string& impi,
+                                const std::string& impu)
+{
+  std::string key;
+  key.reserve(impi.length() + 1 + impu.length());
+  key.append(impi);
+  key.push_back(AV_KEY_SEPARATOR);
+  key.append(impu);
+  return key;
+}
+
+void HsProvCache::record_lookup(bool hit)
+{
+  if (_stats_manager != NULL)
+  {
+    if (hit)
+    {
+      _stats_manager->incr_H_hsprov_cache_hits();
+    }
+    else
+    {
+      _stats_manager->incr_H_hsprov_cache_misses();
+    }
+  }
+}
+
+bool HsProvCache::get_av(const std::string& impi,
+                         const std::string& impu,
+                         DigestAuthVector& av)
+{
+  bool hit = false;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    const DigestAuthVector* cached = _avs.get(av_key(impi, impu), time(NULL));
+
+    if (cached != NULL)
+    {
+      av = *cached;
+      hit = true;
+    }
+  }
+
+  TRC_DEBUG("Auth vector for %s %s in cache", impi.c_str(), hit ? "found" : "not found");
+  record_lookup(hit);
+
+  return hit;
+}
+
+void HsProvCache::put_av(const std::string& impi,
+                         const std::string& impu,
+                         const DigestAuthVector& av)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _avs.put(av_key(impi, impu), av, time(NULL) + _ttl_s);
+}
+
+bool HsProvCache::get_reg_data(const std::string& impu,
+                               std::string& xml,
+                               ChargingAddresses& charging_addrs)
+{
+  bool hit = false;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    const RegData* cached = _reg_data.get(impu, time(NULL));
+
+    if (cached != NULL)
+    {
+      xml = cached->xml;
+      charging_addrs = cached->charging_addrs;
+      hit = true;
+    }
+  }
+
+  TRC_DEBUG("Registration data for %s %s in cache", impu.c_str(), hit ? "found" : "not found");
+  record_lookup(hit);
+
+  return hit;
+}
+
+void HsProvCache::put_reg_data(const std::string& impu,
+                               const std::string& xml,
+                               const ChargingAddresses& charging_addrs)
+{
+  RegData reg_data;
+  reg_data.xml = xml;
+  reg_data.charging_addrs = charging_addrs;
+
+  std::lock_guard<std::mutex> lock(_lock);
+  _reg_data.put(impu, reg_data, time(NULL) + _ttl_s);
+}
+
+size_t HsProvCache::invalidate_impi(const std::string& impi)
+{
+  std::string prefix = impi + AV_KEY_SEPARATOR;
+
+  std::lock_guard<std::mutex> lock(_lock);
+  return _avs.erase_if([&prefix](const std::string& key)
+  {
+    return key.compare(0, prefix.length(), prefix) == 0;
+  });
+}
+
+size_t HsProvCache::invalidate_impu(const std::string& impu)
+{
+  std::string suffix = AV_KEY_SEPARATOR + impu;
+
+  std::lock_guard<std::mutex> lock(_lock);
+  size_t erased = _avs.erase_if([&suffix](const std::string& key)
+  {
+    return (key.length() >= suffix.length()) &&
+           (key.compare(key.length() - suffix.length(), suffix.length(), suffix) == 0);
+  });
+
+  erased += _reg_data.erase_if([&impu](const std::string& key)
+  {
+    return key == impu;
+  });
+
+  return erased;
+}
+
+size_t HsProvCache::invalidate_all()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _avs.erase_if([](const std::string&) { return true; }) +
+         _reg_data.erase_if([](const std::string&) { return true; });
+}
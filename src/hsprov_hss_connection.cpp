@@ -76,9 +76,14 @@ MultimediaAuthAnswer HsProvHssConnection::MarHsProvTransaction::create_answer(Ca
     SAS::report_event(event);
 
     // HsProv uses DigestAuthVectors only
-    DigestAuthVector temp_av;
-    get_av->get_result(temp_av);
-    av = new DigestAuthVector(temp_av);
+    DigestAuthVector* digest_av = new DigestAuthVector();
+    get_av->get_result(*digest_av);
+    av = digest_av;
+
+    if (_cache != NULL)
+    {
+      _cache->put_av(_impi, _impu, *digest_av);
+    }
   }
   else
   {
@@ -122,6 +127,13 @@ LocationInfoAnswer HsProvHssConnection::LirHsProvTransaction::create_answer(Cass
     get_reg_data->get_xml(xml);
     json_result = DIAMETER_SUCCESS;
     server_name = _configured_server_name;
+
+    if (_cache != NULL)
+    {
+      ChargingAddresses charging_addrs;
+      get_reg_data->get_charging_addrs(charging_addrs);
+      _cache->put_reg_data(_impu, xml, charging_addrs);
+    }
   }
   else
   {
@@ -145,8 +157,8 @@ LocationInfoAnswer HsProvHssConnection::LirHsProvTransaction::create_answer(Cass
 
   return LocationInfoAnswer(rc,
                             json_result,
-                            server_name,
-                            capabilities,
+                            std::move(server_name),
+                            std::move(capabilities),
                             "");
 }
 
@@ -166,6 +178,11 @@ ServerAssignmentAnswer HsProvHssConnection::SarHsProvTransaction::create_answer(
     SAS::report_event(event);
     get_reg_data->get_xml(service_profile);
     get_reg_data->get_charging_addrs(charging_addresses);
+
+    if (_cache != NULL)
+    {
+      _cache->put_reg_data(_impu, service_profile, charging_addresses);
+    }
   }
   else
   {
@@ -188,16 +205,18 @@ ServerAssignmentAnswer HsProvHssConnection::SarHsProvTransaction::create_answer(
 
 
   return ServerAssignmentAnswer(rc,
-                                charging_addresses,
-                                service_profile,
+                                std::move(charging_addresses),
+                                std::move(service_profile),
                                 "");
 }
 
 HsProvHssConnection::HsProvHssConnection(StatisticsManager* stats_manager,
                                          HsProvStore* store,
-                                         std::string server_name) :
+                                         std::string server_name,
+                                         HsProvCache* cache) :
   HssConnection(stats_manager),
-  _store(store)
+  _store(store),
+  _cache(cache)
 {
   _configured_server_name = server_name;
 }
@@ -212,8 +231,24 @@ void HsProvHssConnection::send_multimedia_auth_request(maa_cb callback,
   event.add_var_param(request.impu);
   SAS::report_event(event);
 
+  DigestAuthVector cached_av;
+
+  if ((_cache != NULL) && (_cache->get_av(request.impi, request.impu, cached_av)))
+  {
+    SAS::Event hit_event(trail, SASEvent::HSPROV_GET_AV_SUCCESS, 0);
+    SAS::report_event(hit_event);
+
+    MultimediaAuthAnswer maa(ResultCode::SUCCESS,
+                             new DigestAuthVector(cached_av),
+                             HssConnection::_scheme_digest);
+    callback(maa);
+    return;
+  }
+
   // Create the CassandraTransaction that we'll use to send the request
-  CassandraStore::Transaction* tsx = new MarHsProvTransaction(trail, callback, _stats_manager);
+  MarHsProvTransaction* mar_tsx = new MarHsProvTransaction(trail, std::move(callback), _stats_manager);
+  mar_tsx->set_cache(_cache, request.impi, request.impu);
+  CassandraStore::Transaction* tsx = mar_tsx;
 
   // Create the CassandraStore::Operation that will actually get the info.
   CassandraStore::Operation* op = _store->create_GetAuthVector(request.impi, request.impu);
@@ -249,8 +284,28 @@ void HsProvHssConnection::send_location_info_request(lia_cb callback,
   SAS::Event event(trail, SASEvent::ICSCF_NO_HSS_CHECK_CASSANDRA, 0);
   SAS::report_event(event);
 
+  std::string xml;
+  ChargingAddresses charging_addrs;
+
+  if ((_cache != NULL) && (_cache->get_reg_data(request.impu, xml, charging_addrs)))
+  {
+    // The subscriber exists, so we can answer with the configured S-CSCF.
+    SAS::Event hit_event(trail, SASEvent::ICSCF_NO_HSS_CASSANDRA_SUCCESS, 0);
+    SAS::report_event(hit_event);
+
+    LocationInfoAnswer lia(ResultCode::SUCCESS,
+                           DIAMETER_SUCCESS,
+                           _configured_server_name,
+                           ServerCapabilities(),
+                           "");
+    callback(lia);
+    return;
+  }
+
   // Create the CassandraTransaction that we'll use to send the request
-  CassandraStore::Transaction* tsx = new LirHsProvTransaction(trail, callback, _stats_manager);
+  LirHsProvTransaction* lir_tsx = new LirHsProvTransaction(trail, std::move(callback), _stats_manager);
+  lir_tsx->set_cache(_cache, "", request.impu);
+  CassandraStore::Transaction* tsx = lir_tsx;
 
   // Create the CassandraStore::Operation that will actually get the info.
   CassandraStore::Operation* op = _store->create_GetRegData(request.impu);
@@ -274,8 +329,26 @@ void HsProvHssConnection::send_server_assignment_request(saa_cb callback,
     SAS::Event event(trail, SASEvent::HSPROV_GET_REG_DATA, 0);
     SAS::report_event(event);
 
+    std::string xml;
+    ChargingAddresses charging_addrs;
+
+    if ((_cache != NULL) && (_cache->get_reg_data(request.impu, xml, charging_addrs)))
+    {
+      SAS::Event hit_event(trail, SASEvent::HSPROV_GET_REG_DATA_SUCCESS, 0);
+      SAS::report_event(hit_event);
+
+      ServerAssignmentAnswer saa(ResultCode::SUCCESS,
+                                 std::move(charging_addrs),
+                                 std::move(xml),
+                                 "");
+      callback(saa);
+      return;
+    }
+
     // Create the CassandraTransaction that we'll use to send the request
-    CassandraStore::Transaction* tsx = new SarHsProvTransaction(trail, callback, _stats_manager);
+    SarHsProvTransaction* sar_tsx = new SarHsProvTransaction(trail, std::move(callback), _stats_manager);
+    sar_tsx->set_cache(_cache, "", request.impu);
+    CassandraStore::Transaction* tsx = sar_tsx;
 
     // Create the CassandraStore::Operation that will actually get the info.
     CassandraStore::Operation* op = _store->create_GetRegData(request.impu);
@@ -0,0 +1,267 @@
+/**
+ * @file hsprov_snapshot.cpp Offline snapshot of the Homestead-prov keyspace
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "hsprov_snapshot.h"
+
+#include <cstring>
+#include <sys/mman.h>
+
+#include "log.h"
+
+static const char SNAPSHOT_MAGIC[8] = { 'H', 'S', 'P', 'R', 'O', 'V', 'S', '\0' };
+
+HsProvSnapshot::Writer::Writer(const std::string& path) :
+  _file(path, SNAPSHOT_MAGIC, VERSION, "Homestead-prov snapshot")
+{
+}
+
+bool HsProvSnapshot::Writer::write_field(const std::string& field)
+{
+  uint32_t length = field.size();
+  return _file.append(&length, sizeof(length)) &&
+         _file.append(field.data(), field.size());
+}
+
+bool HsProvSnapshot::Writer::add(RecordType type,
+                                 const std::string& key,
+                                 const std::vector<std::string>& fields)
+{
+  RecordHeader rh;
+  memset(&rh, 0, sizeof(rh));
+  rh.type = type;
+  rh.num_fields = fields.size() + 1;
+
+  _file.start_record(IndexedFile::hash(type, key));
+
+  if (!_file.append(&rh, sizeof(rh)) || !write_field(key))
+  {
+    return false;
+  }
+
+  for (const std::string& field : fields)
+  {
+    if (!write_field(field))
+    {
+      return false;
+    }
+  }
+
+  return _file.end_record();
+}
+
+// Lookups are spread evenly across the file.
+HsProvSnapshot::Reader::Reader(const std::string& path) :
+  _file(path, SNAPSHOT_MAGIC, VERSION, "Homestead-prov snapshot", MADV_RANDOM)
+{
+}
+
+bool HsProvSnapshot::Reader::read_fields(uint64_t offset,
+                                         RecordType& type,
+                                         std::vector<Field>& fields) const
+{
+  const char* map = _file.data();
+  uint64_t end = _file.data_end();
+
+  if (offset + sizeof(RecordHeader) > end)
+  {
+    return false;
+  }
+
+  RecordHeader rh;
+  memcpy(&rh, map + offset, sizeof(rh));
+  offset += sizeof(rh);
+
+  type = (RecordType)rh.type;
+  fields.clear();
+  fields.reserve(rh.num_fields);
+
+  for (uint32_t ii = 0; ii < rh.num_fields; ii++)
+  {
+    Field field;
+
+    if (offset + sizeof(field.length) > end)
+    {
+      TRC_WARNING("Record in Homestead-prov snapshot runs off the end of the data");
+      return false;
+    }
+
+    memcpy(&field.length, map + offset, sizeof(field.length));
+    offset += sizeof(field.length);
+
+    if (offset + field.length > end)
+    {
+      TRC_WARNING("Record in Homestead-prov snapshot runs off the end of the data");
+      return false;
+    }
+
+    field.data = map + offset;
+    offset += field.length;
+    fields.push_back(field);
+  }
+
+  return (rh.num_fields > 0);
+}
+
+bool HsProvSnapshot::Reader::get(RecordType type,
+                                 const std::string& key,
+                                 std::vector<Field>& fields) const
+{
+  std::pair<const IndexedFile::IndexEntry*, const IndexedFile::IndexEntry*> range =
+    _file.find(IndexedFile::hash(type, key));
+
+  // Check each record with a matching hash, in case of collisions.
+  for (const IndexedFile::IndexEntry* entry = range.first;
+       entry != range.second;
+       ++entry)
+  {
+    RecordType record_type;
+
+    if ((read_fields(entry->offset, record_type, fields)) &&
+        (record_type == type) &&
+        (fields[0] == key))
+    {
+      fields.erase(fields.begin());
+      return true;
+    }
+  }
+
+  return false;
+}
+
+HsProvSnapshotStore::HsProvSnapshotStore(const std::string& path) :
+  HsProvStore(),
+  _reader(path)
+{
+}
+
+HsProvSnapshotStore::~HsProvSnapshotStore()
+{
+}
+
+bool HsProvSnapshotStore::open()
+{
+  return _reader.open();
+}
+
+void HsProvSnapshotStore::do_async(CassandraStore::Operation*& op,
+                                   CassandraStore::Transaction*& trx)
+{
+  SnapshotOperation* snapshot_op = dynamic_cast<SnapshotOperation*>(op);
+
+  trx->start_timer();
+  bool success = ((snapshot_op != NULL) && (snapshot_op->perform_snapshot(_reader)));
+  trx->stop_timer();
+
+  if (success)
+  {
+    trx->on_success(op);
+  }
+  else
+  {
+    trx->on_failure(op);
+  }
+
+  // We own the operation and transaction once they've been passed to us.
+  delete trx; trx = NULL;
+  delete op; op = NULL;
+}
+
+bool HsProvSnapshotStore::SnapshotGetRegData::perform_snapshot(const HsProvSnapshot::Reader& snapshot)
+{
+  std::vector<HsProvSnapshot::Field> fields;
+
+  if ((!snapshot.get(HsProvSnapshot::IMPU, _public_id, fields)) ||
+      (fields.size() < HsProvSnapshot::NUM_IMPU_FIELDS))
+  {
+    _cass_status = CassandraStore::NOT_FOUND;
+    _cass_error_text = "Row not found in snapshot";
+    TRC_DEBUG("No registration data for %s in snapshot", _public_id.c_str());
+    return false;
+  }
+
+  _xml = fields[HsProvSnapshot::IMS_SUB_XML].str();
+
+  // Empty charging addresses are skipped, as they are when reading them from
+  // Cassandra.
+  if (fields[HsProvSnapshot::PRIMARY_CCF].length > 0)
+  {
+    _charging_addrs.ccfs.push_back(fields[HsProvSnapshot::PRIMARY_CCF].str());
+  }
+
+  if (fields[HsProvSnapshot::SECONDARY_CCF].length > 0)
+  {
+    _charging_addrs.ccfs.push_back(fields[HsProvSnapshot::SECONDARY_CCF].str());
+  }
+
+  if (fields[HsProvSnapshot::PRIMARY_ECF].length > 0)
+  {
+    _charging_addrs.ecfs.push_back(fields[HsProvSnapshot::PRIMARY_ECF].str());
+  }
+
+  if (fields[HsProvSnapshot::SECONDARY_ECF].length > 0)
+  {
+    _charging_addrs.ecfs.push_back(fields[HsProvSnapshot::SECONDARY_ECF].str());
+  }
+
+  return true;
+}
+
+bool HsProvSnapshotStore::SnapshotGetAuthVector::perform_snapshot(const HsProvSnapshot::Reader& snapshot)
+{
+  std::vector<HsProvSnapshot::Field> fields;
+
+  if ((!snapshot.get(HsProvSnapshot::IMPI, _private_id, fields)) ||
+      (fields.size() < HsProvSnapshot::FIRST_PUBLIC_ID))
+  {
+    _cass_status = CassandraStore::NOT_FOUND;
+    _cass_error_text = "Row not found in snapshot";
+    TRC_DEBUG("No authentication vector for %s in snapshot", _private_id.c_str());
+    return false;
+  }
+
+  if (!_public_id.empty())
+  {
+    bool public_id_found = false;
+
+    for (size_t ii = HsProvSnapshot::FIRST_PUBLIC_ID; ii < fields.size(); ii++)
+    {
+      if (fields[ii] == _public_id)
+      {
+        public_id_found = true;
+        break;
+      }
+    }
+
+    if (!public_id_found)
+    {
+      _cass_status = CassandraStore::NOT_FOUND;
+      _cass_error_text = "Private ID '" + _private_id +
+                         "' exists but does not have associated public ID '" +
+                         _public_id + "'";
+      TRC_DEBUG("HsProvStore query failed: %s", _cass_error_text.c_str());
+      return false;
+    }
+  }
+
+  if (fields[HsProvSnapshot::DIGEST_HA1].length == 0)
+  {
+    _cass_status = CassandraStore::NOT_FOUND;
+    _cass_error_text = "HA1 column not found";
+    TRC_DEBUG("HsProvStore query failed: %s", _cass_error_text.c_str());
+    return false;
+  }
+
+  _auth_vector.ha1 = fields[HsProvSnapshot::DIGEST_HA1].str();
+  _auth_vector.realm = fields[HsProvSnapshot::DIGEST_REALM].str();
+  _auth_vector.qop = fields[HsProvSnapshot::DIGEST_QOP].str();
+
+  return true;
+}
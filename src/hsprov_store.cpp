@@ -9,9 +9,11 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include <inttypes.h>
 #include <boost/format.hpp>
 
 #include "hsprov_store.h"
+#include "hsprov_snapshot.h"
 
 using namespace apache::thrift;
 using namespace apache::thrift::transport;
@@ -39,6 +41,11 @@ const static std::string DIGEST_QOP_COLUMN_NAME        = "digest_qop";
 // Column name marking rows created by homestead-prov
 const static std::string EXISTS_COLUMN_NAME = "_exists";
 
+// When exporting a snapshot, rows are read from Cassandra in pages of this
+// many rows, with up to this many columns in each.
+const static int32_t EXPORT_PAGE_SIZE = 1000;
+const static int32_t EXPORT_MAX_COLUMNS = 10000;
+
 // Variables to store the singleton cache object.
 //
 // Must create this after the constants above so that they have been
@@ -253,4 +260,190 @@ bool HsProvStore::GetAuthVector::perform(CassandraStore::Client* client,
 void HsProvStore::GetAuthVector::get_result(DigestAuthVector& av)
 {
   av = _auth_vector;
-}
\ No newline at end of file
+}
+
+//
+// ExportSnapshot methods.
+//
+
+HsProvStore::ExportSnapshot::
+ExportSnapshot(const std::string& path) :
+  CassandraStore::Operation(),
+  _path(path),
+  _records(0)
+{}
+
+
+HsProvStore::ExportSnapshot::
+~ExportSnapshot()
+{}
+
+
+// Calls the function with every row in a column family, stopping early if it
+// returns false.
+static bool for_each_row(CassandraStore::Client* client,
+                         const std::string& column_family,
+                         std::function<bool(const KeySlice&)> fn)
+{
+  ColumnParent cparent;
+  cparent.column_family = column_family;
+
+  SliceRange slice_range;
+  slice_range.start = "";
+  slice_range.finish = "";
+  slice_range.count = EXPORT_MAX_COLUMNS;
+
+  SlicePredicate predicate;
+  predicate.__set_slice_range(slice_range);
+
+  std::string start_key = "";
+  bool first_page = true;
+
+  while (true)
+  {
+    KeyRange range;
+    range.__set_start_key(start_key);
+    range.__set_end_key("");
+    range.__set_count(EXPORT_PAGE_SIZE);
+
+    std::vector<KeySlice> rows;
+    client->get_range_slices(rows, cparent, predicate, range, ConsistencyLevel::ONE);
+
+    for (std::vector<KeySlice>::const_iterator it = rows.begin(); it != rows.end(); ++it)
+    {
+      // Each page after the first starts with the last row of the previous
+      // page, and rows without any columns have been deleted.
+      if (((!first_page) && (it == rows.begin())) || (it->columns.empty()))
+      {
+        continue;
+      }
+
+      if (!fn(*it))
+      {
+        return false;
+      }
+    }
+
+    if (rows.size() < (size_t)EXPORT_PAGE_SIZE)
+    {
+      return true;
+    }
+
+    start_key = rows.back().key;
+    first_page = false;
+  }
+}
+
+bool HsProvStore::ExportSnapshot::perform(CassandraStore::Client* client,
+                                          SAS::TrailId trail)
+{
+  TRC_DEBUG("Exporting Homestead-prov snapshot to %s", _path.c_str());
+
+  HsProvSnapshot::Writer writer(_path);
+
+  if (!writer.open())
+  {
+    _cass_status = CassandraStore::UNKNOWN_ERROR;
+    _cass_error_text = "Failed to open snapshot file";
+    return false;
+  }
+
+  bool ok = for_each_row(client, IMPU, [&writer](const KeySlice& row)
+  {
+    std::vector<std::string> fields(HsProvSnapshot::NUM_IMPU_FIELDS);
+    bool found = false;
+
+    for (std::vector<ColumnOrSuperColumn>::const_iterator it = row.columns.begin();
+         it != row.columns.end();
+         ++it)
+    {
+      const Column* col = &it->column;
+      int field = -1;
+
+      if (col->name == IMS_SUB_XML_COLUMN_NAME)
+      {
+        field = HsProvSnapshot::IMS_SUB_XML;
+      }
+      else if (col->name == PRIMARY_CCF_COLUMN_NAME)
+      {
+        field = HsProvSnapshot::PRIMARY_CCF;
+      }
+      else if (col->name == SECONDARY_CCF_COLUMN_NAME)
+      {
+        field = HsProvSnapshot::SECONDARY_CCF;
+      }
+      else if (col->name == PRIMARY_ECF_COLUMN_NAME)
+      {
+        field = HsProvSnapshot::PRIMARY_ECF;
+      }
+      else if (col->name == SECONDARY_ECF_COLUMN_NAME)
+      {
+        field = HsProvSnapshot::SECONDARY_ECF;
+      }
+
+      if (field != -1)
+      {
+        fields[field] = col->value;
+        found = true;
+      }
+    }
+
+    // Rows without any registration data aren't returned by GetRegData, so
+    // don't need to be in the snapshot.
+    return (!found) || writer.add(HsProvSnapshot::IMPU, row.key, fields);
+  });
+
+  ok = ok && for_each_row(client, IMPI, [&writer](const KeySlice& row)
+  {
+    std::vector<std::string> fields(HsProvSnapshot::FIRST_PUBLIC_ID);
+    bool found = false;
+
+    for (std::vector<ColumnOrSuperColumn>::const_iterator it = row.columns.begin();
+         it != row.columns.end();
+         ++it)
+    {
+      const Column* col = &it->column;
+
+      if (col->name == DIGEST_HA1_COLUMN_NAME)
+      {
+        fields[HsProvSnapshot::DIGEST_HA1] = col->value;
+        found = true;
+      }
+      else if (col->name == DIGEST_REALM_COLUMN_NAME)
+      {
+        fields[HsProvSnapshot::DIGEST_REALM] = col->value;
+        found = true;
+      }
+      else if (col->name == DIGEST_QOP_COLUMN_NAME)
+      {
+        fields[HsProvSnapshot::DIGEST_QOP] = col->value;
+        found = true;
+      }
+      else if (col->name.compare(0,
+                                 ASSOC_PUBLIC_ID_COLUMN_PREFIX.length(),
+                                 ASSOC_PUBLIC_ID_COLUMN_PREFIX) == 0)
+      {
+        fields.push_back(col->name.substr(ASSOC_PUBLIC_ID_COLUMN_PREFIX.length()));
+        found = true;
+      }
+    }
+
+    return (!found) || writer.add(HsProvSnapshot::IMPI, row.key, fields);
+  });
+
+  if ((!ok) || (!writer.commit()))
+  {
+    _cass_status = CassandraStore::UNKNOWN_ERROR;
+    _cass_error_text = "Failed to write snapshot file";
+    return false;
+  }
+
+  _records = writer.num_records();
+  TRC_STATUS("Exported %" PRIu64 " records to Homestead-prov snapshot %s",
+             _records, _path.c_str());
+
+  // All exceptions will rise up to the calling function, where the return code
+  // will be set as unsuccessful.
+
+  return true;
+}
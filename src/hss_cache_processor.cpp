@@ -17,8 +17,10 @@
 //
 // LCOV_EXCL_START
 
-HssCacheProcessor::HssCacheProcessor(HssCache* cache) :
+HssCacheProcessor::HssCacheProcessor(HssCache* cache,
+                                     StatisticsManager* stats_manager) :
   _cache(cache),
+  _stats_manager(stats_manager),
   _thread_pool(NULL)
 {
 }
@@ -55,6 +57,50 @@ void HssCacheProcessor::wait_stopped()
   }
 }
 
+void HssCacheProcessor::update_queue_latency_stats(Utils::StopWatch& stop_watch)
+{
+  unsigned long latency = 0;
+
+  if ((_stats_manager != NULL) && (stop_watch.read(latency)))
+  {
+    _stats_manager->update_H_cache_queue_latency_us(latency);
+  }
+}
+
+void HssCacheProcessor::update_latency_stats(Operation op,
+                                             Utils::StopWatch& stop_watch)
+{
+  unsigned long latency = 0;
+
+  if ((_stats_manager == NULL) || (!stop_watch.read(latency)))
+  {
+    return;
+  }
+
+  switch (op)
+  {
+  case GET_IRS:
+    _stats_manager->update_H_cache_get_irs_latency_us(latency);
+    break;
+
+  case PUT_IRS:
+    _stats_manager->update_H_cache_put_irs_latency_us(latency);
+    break;
+
+  case DELETE_IRS:
+    _stats_manager->update_H_cache_delete_irs_latency_us(latency);
+    break;
+
+  case GET_IMS_SUB:
+    _stats_manager->update_H_cache_get_ims_sub_latency_us(latency);
+    break;
+
+  case PUT_IMS_SUB:
+    _stats_manager->update_H_cache_put_ims_sub_latency_us(latency);
+    break;
+  }
+}
+
 ImplicitRegistrationSet* HssCacheProcessor::create_implicit_registration_set()
 {
   return _cache->create_implicit_registration_set();
@@ -65,15 +111,53 @@ void HssCacheProcessor::get_implicit_registration_set_for_impu(irs_success_callb
                                                                 std::string impu,
                                                                 SAS::TrailId trail)
 {
+  // If the cache can get the IRS without blocking, there's no need to tie up
+  // a thread in the pool - the callbacks are run when the get completes.
+  if (_cache->supports_async_get())
+  {
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
+    _cache->get_implicit_registration_set_for_impu_async(impu,
+                                                         trail,
+                                                         [this, success_cb, failure_cb, stop_watch](Store::Status rc,
+                                                                                                   ImplicitRegistrationSet* result) mutable -> void
+    {
+      update_latency_stats(GET_IRS, stop_watch);
+
+      if (rc == Store::Status::OK)
+      {
+        success_cb(result);
+      }
+      else
+      {
+        failure_cb(rc);
+      }
+    });
+
+    return;
+  }
+
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, impu, trail, success_cb, failure_cb]()->void
+  std::function<void()> work = [this, impu, trail, success_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     ImplicitRegistrationSet* result = NULL;
     Store::Status rc = _cache->get_implicit_registration_set_for_impu(impu,
                                                                       trail,
                                                                       result);
 
+    update_latency_stats(GET_IRS, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb(result);
@@ -93,15 +177,26 @@ void HssCacheProcessor::get_implicit_registration_sets_for_impis(irs_vector_succ
                                                                  std::vector<std::string> impis,
                                                                  SAS::TrailId trail)
 {
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, impis, trail, success_cb, failure_cb]()->void
+  std::function<void()> work = [this, impis, trail, success_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     std::vector<ImplicitRegistrationSet*> result;
     Store::Status rc = _cache->get_implicit_registration_sets_for_impis(impis,
                                                                         trail,
                                                                         result);
 
+    update_latency_stats(GET_IRS, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb(result);
@@ -121,15 +216,26 @@ void HssCacheProcessor::get_implicit_registration_sets_for_impus(irs_vector_succ
                                                                  std::vector<std::string> impus,
                                                                  SAS::TrailId trail)
 {
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, impus, trail, success_cb, failure_cb]()->void
+  std::function<void()> work = [this, impus, trail, success_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     std::vector<ImplicitRegistrationSet*> result;
     Store::Status rc = _cache->get_implicit_registration_sets_for_impus(impus,
                                                                         trail,
                                                                         result);
 
+    update_latency_stats(GET_IRS, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb(result);
@@ -150,12 +256,22 @@ void HssCacheProcessor::put_implicit_registration_set(void_success_cb success_cb
                                                       ImplicitRegistrationSet* irs,
                                                       SAS::TrailId trail)
 {
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, irs, trail, success_cb, progress_cb, failure_cb]()->void
+  std::function<void()> work = [this, irs, trail, success_cb, progress_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
     Store::Status rc = _cache->put_implicit_registration_set(irs, progress_cb, trail);
 
+    update_latency_stats(PUT_IRS, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb();
@@ -176,12 +292,22 @@ void HssCacheProcessor::delete_implicit_registration_set(void_success_cb success
                                                          ImplicitRegistrationSet* irs,
                                                          SAS::TrailId trail)
 {
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, irs, trail, success_cb, progress_cb, failure_cb]()->void
+  std::function<void()> work = [this, irs, trail, success_cb, progress_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
     Store::Status rc = _cache->delete_implicit_registration_set(irs, progress_cb, trail);
 
+    update_latency_stats(DELETE_IRS, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb();
@@ -202,12 +328,22 @@ void HssCacheProcessor::delete_implicit_registration_sets(void_success_cb succes
                                                           std::vector<ImplicitRegistrationSet*> irss,
                                                           SAS::TrailId trail)
 {
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, irss, trail, success_cb, progress_cb, failure_cb]()->void
+  std::function<void()> work = [this, irss, trail, success_cb, progress_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
     Store::Status rc = _cache->delete_implicit_registration_sets(irss, progress_cb, trail);
 
+    update_latency_stats(DELETE_IRS, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb();
@@ -227,13 +363,24 @@ void HssCacheProcessor::get_ims_subscription(ims_sub_success_cb success_cb,
                                              std::string impi,
                                              SAS::TrailId trail)
 {
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, impi, trail, success_cb, failure_cb]()->void
+  std::function<void()> work = [this, impi, trail, success_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     ImsSubscription* result = NULL;
     Store::Status rc = _cache->get_ims_subscription(impi, trail, result);
 
+    update_latency_stats(GET_IMS_SUB, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb(result);
@@ -254,12 +401,22 @@ void HssCacheProcessor::put_ims_subscription(void_success_cb success_cb,
                                              ImsSubscription* subscription,
                                              SAS::TrailId trail)
 {
+  // Time how long the work waits to be picked up by the thread pool.
+  Utils::StopWatch queue_stop_watch;
+  queue_stop_watch.start();
+
   // Create a work item that can run on the thread pool, capturing required
   // variables to complete the work
-  std::function<void()> work = [this, subscription, trail, success_cb, progress_cb, failure_cb]()->void
+  std::function<void()> work = [this, subscription, trail, success_cb, progress_cb, failure_cb, queue_stop_watch]() mutable -> void
   {
+    update_queue_latency_stats(queue_stop_watch);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
     Store::Status rc = _cache->put_ims_subscription(subscription, progress_cb, trail);
 
+    update_latency_stats(PUT_IMS_SUB, stop_watch);
+
     if (rc == Store::Status::OK)
     {
       success_cb();
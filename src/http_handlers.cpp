@@ -13,6 +13,10 @@
 #include "homestead_xml_utils.h"
 #include "servercapabilities.h"
 #include "homesteadsasevent.h"
+#include "impu_snapshot.h"
+#include "reregistration_refresher.h"
+#include "registration_dampener.h"
+#include "json_response.h"
 
 #include "log.h"
 
@@ -30,6 +34,21 @@ std::string HssCacheTask::_configured_server_name;
 HssConnection::HssConnection* HssCacheTask::_hss = NULL;
 HssCacheProcessor* HssCacheTask::_cache = NULL;
 HealthChecker* HssCacheTask::_health_checker = NULL;
+StatisticsManager* HssCacheTask::_stats_manager = NULL;
+FlightRecorder* HssCacheTask::_flight_recorder = NULL;
+SasEncoder* HssCacheTask::_sas_encoder = NULL;
+NegativeCache* HssCacheTask::_negative_cache = NULL;
+
+void HssCacheTask::send_http_reply(int status_code)
+{
+  // Only slow requests are recorded, so check that before copying the path.
+  if ((_flight_recorder != NULL) && (_flight_recorder->is_slow(_timeline)))
+  {
+    _flight_recorder->record("HTTP", _req.full_path(), trail(), _timeline);
+  }
+
+  HttpStackUtils::Task::send_http_reply(status_code);
+}
 
 void HssCacheTask::configure_hss_connection(HssConnection::HssConnection* hss,
                                             std::string configured_server_name)
@@ -48,6 +67,50 @@ void HssCacheTask::configure_health_checker(HealthChecker* hc)
   _health_checker = hc;
 }
 
+void HssCacheTask::configure_stats(StatisticsManager* stats_manager)
+{
+  _stats_manager = stats_manager;
+}
+
+void HssCacheTask::configure_flight_recorder(FlightRecorder* flight_recorder)
+{
+  _flight_recorder = flight_recorder;
+}
+
+void HssCacheTask::configure_sas_encoder(SasEncoder* sas_encoder)
+{
+  _sas_encoder = sas_encoder;
+}
+
+void HssCacheTask::configure_negative_cache(NegativeCache* negative_cache)
+{
+  _negative_cache = negative_cache;
+}
+
+bool HssCacheTask::hss_recently_unknown(NegativeCache::Request request,
+                                        const std::string& impi,
+                                        const std::string& impu)
+{
+  // The negative cache counts its own hits.
+  if ((_negative_cache == NULL) ||
+      (!_negative_cache->is_unknown(request, impi, impu)))
+  {
+    return false;
+  }
+
+  TRC_DEBUG("HSS recently didn't know %s/%s - not asking it again",
+            impi.c_str(), impu.c_str());
+  _timeline.mark("negative_cache_hit");
+
+  SAS::Event event(this->trail(), SASEvent::NEGATIVE_CACHE_HIT, 0);
+  event.add_static_param(request);
+  event.add_var_param(impi);
+  event.add_var_param(impu);
+  SAS::report_event(event);
+
+  return true;
+}
+
 // General IMPI handling.
 
 void ImpiTask::run()
@@ -98,18 +161,28 @@ void ImpiTask::send_mar()
   HssConnection::maa_cb callback =
     std::bind(&ImpiTask::on_mar_response, this, _1);
 
+  // If the HSS recently didn't know this subscriber, don't ask it again.
+  if (hss_recently_unknown(NegativeCache::MAR, _impi, _impu))
+  {
+    callback(HssConnection::MultimediaAuthAnswer(HssConnection::ResultCode::NOT_FOUND));
+    return;
+  }
+
   // Send the request
+  _timeline.mark("mar_sent");
   _hss->send_multimedia_auth_request(callback, request, this->trail());
 }
 
 void ImpiTask::on_mar_response(const HssConnection::MultimediaAuthAnswer& maa)
 {
+  _timeline.mark("maa_received");
+
   HssConnection::ResultCode rc = maa.get_result();
   TRC_DEBUG("Received Multimedia-Authorization answer with result code %d", rc);
 
   if (rc == HssConnection::ResultCode::SUCCESS)
   {
-    std::string sip_auth_scheme = maa.get_scheme();
+    const std::string& sip_auth_scheme = maa.get_scheme();
     if (sip_auth_scheme == _cfg->scheme_digest)
     {
       DigestAuthVector* av = (DigestAuthVector*)(maa.get_av());
@@ -150,6 +223,11 @@ void ImpiTask::on_mar_response(const HssConnection::MultimediaAuthAnswer& maa)
   }
   else if (rc == HssConnection::ResultCode::NOT_FOUND)
   {
+    if (_negative_cache != NULL)
+    {
+      _negative_cache->add_unknown(NegativeCache::MAR, _impi, _impu);
+    }
+
     // SAS logging for the errors is the responsibility of the HssConnection
     send_http_reply(HTTP_NOT_FOUND);
   }
@@ -192,13 +270,13 @@ bool ImpiDigestTask::parse_request()
 
 void ImpiDigestTask::send_reply(const DigestAuthVector& av)
 {
-  rapidjson::StringBuffer sb;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  JsonResponse response;
+  JsonResponse::Writer& writer = response.writer();
   writer.StartObject();
   writer.String(JSON_DIGEST_HA1.c_str());
   writer.String(av.ha1.c_str());
   writer.EndObject();
-  _req.add_content(sb.GetString());
+  response.add_to(_req);
   send_http_reply(HTTP_OK);
 }
 
@@ -253,12 +331,12 @@ bool ImpiAvTask::parse_request()
 
 void ImpiAvTask::send_reply(const DigestAuthVector& av)
 {
-  rapidjson::StringBuffer sb;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  JsonResponse response;
+  JsonResponse::Writer& writer = response.writer();
 
   // The qop value can be empty - in this case it should be replaced
   // with 'auth'.
-  std::string qop_value = (!av.qop.empty()) ? av.qop : JSON_AUTH;
+  const std::string& qop_value = (!av.qop.empty()) ? av.qop : JSON_AUTH;
 
   writer.StartObject();
   {
@@ -276,14 +354,14 @@ void ImpiAvTask::send_reply(const DigestAuthVector& av)
   }
   writer.EndObject();
 
-  _req.add_content(sb.GetString());
+  response.add_to(_req);
   send_http_reply(HTTP_OK);
 }
 
 void ImpiAvTask::send_reply(const AKAAuthVector& av)
 {
-  rapidjson::StringBuffer sb;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  JsonResponse response;
+  JsonResponse::Writer& writer = response.writer();
 
   writer.StartObject();
   {
@@ -304,7 +382,7 @@ void ImpiAvTask::send_reply(const AKAAuthVector& av)
     writer.EndObject();
   }
   writer.EndObject();
-  _req.add_content(sb.GetString());
+  response.add_to(_req);
   send_http_reply(HTTP_OK);
 }
 
@@ -344,24 +422,34 @@ void ImpiRegistrationStatusTask::run()
   HssConnection::uaa_cb callback =
     std::bind(&ImpiRegistrationStatusTask::on_uar_response, this, _1);
 
+  // If the HSS recently didn't know this subscriber, don't ask it again.
+  if (hss_recently_unknown(NegativeCache::UAR, _impi, _impu))
+  {
+    callback(HssConnection::UserAuthAnswer(HssConnection::ResultCode::NOT_FOUND));
+    return;
+  }
+
   // Send the request
+  _timeline.mark("uar_sent");
   _hss->send_user_auth_request(callback, request, this->trail());
 }
 
 void ImpiRegistrationStatusTask::on_uar_response(const HssConnection::UserAuthAnswer& uaa)
 {
+  _timeline.mark("uaa_received");
+
   HssConnection::ResultCode rc = uaa.get_result();
   TRC_DEBUG("Received User-Authorization answer with result %d", rc);
 
   if (rc == HssConnection::ResultCode::SUCCESS)
   {
-    rapidjson::StringBuffer sb;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    JsonResponse response;
+    JsonResponse::Writer& writer = response.writer();
     writer.StartObject();
     writer.String(JSON_RC.c_str());
     writer.Int(uaa.get_json_result());
 
-    std::string server_name = uaa.get_server();
+    const std::string& server_name = uaa.get_server();
     if (!server_name.empty())
     {
       // If we have a server name, use that
@@ -372,7 +460,7 @@ void ImpiRegistrationStatusTask::on_uar_response(const HssConnection::UserAuthAn
     else
     {
       TRC_DEBUG("Got Server-Capabilities");
-      ServerCapabilities capabilities = uaa.get_server_capabilities();
+      const ServerCapabilities& capabilities = uaa.get_server_capabilities();
 
       if (!capabilities.server_name.empty())
       {
@@ -386,7 +474,7 @@ void ImpiRegistrationStatusTask::on_uar_response(const HssConnection::UserAuthAn
 
     writer.EndObject();
 
-    _req.add_content(sb.GetString());
+    response.add_to(_req);
     send_http_reply(HTTP_OK);
 
     if (_health_checker)
@@ -398,6 +486,11 @@ void ImpiRegistrationStatusTask::on_uar_response(const HssConnection::UserAuthAn
   {
     TRC_INFO("User unknown or public/private ID conflict - reject");
 
+    if (_negative_cache != NULL)
+    {
+      _negative_cache->add_unknown(NegativeCache::UAR, _impi, _impu);
+    }
+
     // SAS logging for the errors is the responsibility of the HssConnection
     send_http_reply(HTTP_NOT_FOUND);
   }
@@ -464,24 +557,34 @@ void ImpuLocationInfoTask::run()
   HssConnection::lia_cb callback =
     std::bind(&ImpuLocationInfoTask::on_lir_response, this, _1);
 
+  // If the HSS recently didn't know this subscriber, don't ask it again.
+  if (hss_recently_unknown(NegativeCache::LIR, "", _impu))
+  {
+    callback(HssConnection::LocationInfoAnswer(HssConnection::ResultCode::NOT_FOUND));
+    return;
+  }
+
   // Send the request
+  _timeline.mark("lir_sent");
   _hss->send_location_info_request(callback, request, this->trail());
 }
 
 void ImpuLocationInfoTask::on_lir_response(const HssConnection::LocationInfoAnswer& lia)
 {
+  _timeline.mark("lia_received");
+
   HssConnection::ResultCode rc = lia.get_result();
   TRC_DEBUG("Received Server-Assignment answer with result code %d", rc);
 
   if (rc == HssConnection::ResultCode::SUCCESS)
   {
-    rapidjson::StringBuffer sb;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    JsonResponse response;
+    JsonResponse::Writer& writer = response.writer();
     writer.StartObject();
     writer.String(JSON_RC.c_str());
     writer.Int(lia.get_json_result());
 
-    std::string server_name = lia.get_server();
+    const std::string& server_name = lia.get_server();
     if (!server_name.empty())
     {
       // If we have a server name, use that
@@ -492,7 +595,7 @@ void ImpuLocationInfoTask::on_lir_response(const HssConnection::LocationInfoAnsw
     else
     {
       TRC_DEBUG("Got Server-Capabilities");
-      ServerCapabilities capabilities = lia.get_server_capabilities();
+      const ServerCapabilities& capabilities = lia.get_server_capabilities();
       if (!capabilities.server_name.empty())
       {
         TRC_DEBUG("Got Server-Name %s from Capabilities AVP", capabilities.server_name.c_str());
@@ -505,7 +608,7 @@ void ImpuLocationInfoTask::on_lir_response(const HssConnection::LocationInfoAnsw
 
     // If the HSS returned a wildcarded public user identity, add this to
     // the response.
-    std::string wildcard_impu = lia.get_wildcard_impu();
+    const std::string& wildcard_impu = lia.get_wildcard_impu();
     if (!wildcard_impu.empty())
     {
       TRC_DEBUG("Got Wildcarded-Public-Identity %s", wildcard_impu.c_str());
@@ -514,13 +617,18 @@ void ImpuLocationInfoTask::on_lir_response(const HssConnection::LocationInfoAnsw
     }
 
     writer.EndObject();
-    _req.add_content(sb.GetString());
+    response.add_to(_req);
     send_http_reply(HTTP_OK);
   }
   else if (rc == HssConnection::ResultCode::NOT_FOUND)
   {
     TRC_INFO("User unknown or public/private ID conflict - reject");
 
+    if (_negative_cache != NULL)
+    {
+      _negative_cache->add_unknown(NegativeCache::LIR, "", _impu);
+    }
+
     // SAS logging for the errors is the responsibility of the HssConnection
     send_http_reply(HTTP_NOT_FOUND);
   }
@@ -767,6 +875,7 @@ void ImpuRegDataTask::get_reg_data()
     std::bind(&ImpuRegDataTask::on_get_reg_data_failure, this, _1);
 
   // Request the IRS from the cache
+  _timeline.mark("cache_get_sent");
   _cache->get_implicit_registration_set_for_impu(success_cb,
                                                  failure_cb,
                                                  public_id(),
@@ -790,6 +899,8 @@ std::string regstate_to_str(RegistrationState state)
 
 void ImpuRegDataTask::on_get_reg_data_success(ImplicitRegistrationSet* irs)
 {
+  _timeline.mark("cache_get_done");
+
   TRC_DEBUG("Got IMS subscription from cache");
 
   // We take ownership of the ImplicitRegistrationSet that the Cache has created
@@ -801,13 +912,13 @@ void ImpuRegDataTask::on_get_reg_data_success(ImplicitRegistrationSet* irs)
   std::vector<std::string> associated_impis = _irs->get_associated_impis();
   ChargingAddresses charging_addrs = _irs->get_charging_addresses();
 
-  SAS::Event event(this->trail(), SASEvent::CACHE_GET_REG_DATA_SUCCESS, 0);
+  SasEncoder::Event event(this->trail(), SASEvent::CACHE_GET_REG_DATA_SUCCESS, 0);
   event.add_compressed_param(service_profile, &SASEvent::PROFILE_SERVICE_PROFILE);
   event.add_static_param(reg_state);
   std::string associated_impis_str = boost::algorithm::join(associated_impis, ", ");
   event.add_var_param(associated_impis_str);
   event.add_var_param(charging_addrs.log_string());
-  SAS::report_event(event);
+  SasEncoder::report_event(_sas_encoder, event);
 
   TRC_DEBUG("TTL for this database record is %d, IMS Subscription XML is %s, registration state is %s, and the charging addresses are %s",
             ttl,
@@ -820,6 +931,8 @@ void ImpuRegDataTask::on_get_reg_data_success(ImplicitRegistrationSet* irs)
 
 void ImpuRegDataTask::on_get_reg_data_failure(Store::Status rc)
 {
+  _timeline.mark("cache_get_done");
+
   TRC_DEBUG("IMS subscription cache query failed: %d", rc);
 
   if (rc == Store::Status::NOT_FOUND)
@@ -907,16 +1020,37 @@ void ImpuRegDataTask::process_received_reg_data()
     if ((reg_state == RegistrationState::REGISTERED) && (!new_binding))
     {
       int record_age = _cfg->record_ttl - ttl;
+      int64_t refresh_deadline = _irs->get_refresh_deadline();
+      int64_t now = time(0);
       TRC_DEBUG("Handling re-registration with binding age of %d", record_age);
       _irs->set_reg_state(RegistrationState::REGISTERED);
 
       // We refresh the record's TTL everytime we receive an SAA from
       // the HSS. As such once the record is older than the HSS Reregistration
-      // time, we need to send a new SAR to the HSS.
+      // time, we need to send a new SAR to the HSS. In HSS offload mode the
+      // record instead holds a jittered deadline by which we must have sent
+      // the SAR.
       //
       // Alternatively we need to notify the HSS if the HTTP request does not
       // allow cached responses.
-      if (record_age >= _cfg->hss_reregistration_time)
+      bool refresh_due = (refresh_deadline != 0) ?
+                           (now >= refresh_deadline) :
+                           (record_age >= _cfg->hss_reregistration_time);
+
+      // If this subscriber has re-registered with the HSS too often recently,
+      // don't tell it again. The cached record was written moments ago.
+      bool dampened = (refresh_due || cache_not_allowed) &&
+                      (_cfg->dampener != NULL) &&
+                      (_cfg->dampener->dampen(_impu, _impi));
+
+      if (dampened)
+      {
+        TRC_DEBUG("Not sending re-registration to HSS as it is being dampened");
+        send_reply();
+        delete this;
+        return;
+      }
+      else if (refresh_due)
       {
         TRC_DEBUG("Sending re-registration to HSS as %d seconds have passed",
                   record_age, _cfg->hss_reregistration_time);
@@ -929,6 +1063,19 @@ void ImpuRegDataTask::process_received_reg_data()
       }
       else
       {
+        // If the deadline is close, ask the refresher to send the SAR in the
+        // background, so that later re-registrations don't have to wait for
+        // the HSS.
+        if ((_cfg->refresher != NULL) &&
+            (_cfg->refresher->in_refresh_window(refresh_deadline, now)))
+        {
+          TRC_DEBUG("Requesting background re-registration for %s",
+                    _irs->get_default_impu().c_str());
+          _cfg->refresher->refresh(server_assignment_request(Cx::ServerAssignmentType::RE_REGISTRATION),
+                                   _irs->get_default_impu(),
+                                   this->trail());
+        }
+
         // No state changes are required for a re-register if we're not
         // notifying a HSS - just respond.
         send_reply();
@@ -1028,27 +1175,36 @@ void ImpuRegDataTask::send_reply()
   }
   else
   {
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     rc = XmlUtils::build_ClearwaterRegData_xml(_irs, xml_str);
 
+    unsigned long latency = 0;
+    if ((_stats_manager != NULL) && (stop_watch.read(latency)))
+    {
+      _stats_manager->update_H_xml_latency_us(latency);
+    }
+
     if (rc == HTTP_OK)
     {
       _req.add_content(xml_str);
     }
     else
     {
-      SAS::Event event(this->trail(), SASEvent::REG_DATA_HSS_INVALID, 0);
+      SasEncoder::Event event(this->trail(), SASEvent::REG_DATA_HSS_INVALID, 0);
       event.add_compressed_param(_irs->get_ims_sub_xml(), &SASEvent::PROFILE_SERVICE_PROFILE);
-      SAS::report_event(event);
+      SasEncoder::report_event(_sas_encoder, event);
     }
   }
 
   TRC_DEBUG("Sending %d response (body was %s)", rc, _req.get_rx_body().c_str());
+  _timeline.mark("reply_sent");
   send_http_reply(rc);
 }
 
-void ImpuRegDataTask::send_server_assignment_request(Cx::ServerAssignmentType type)
+HssConnection::ServerAssignmentRequest ImpuRegDataTask::server_assignment_request(Cx::ServerAssignmentType type)
 {
-  // Create the SAR to send to the hss
   HssConnection::ServerAssignmentRequest request = {
     _impi,
     _impu,
@@ -1059,11 +1215,27 @@ void ImpuRegDataTask::send_server_assignment_request(Cx::ServerAssignmentType ty
     (_hss_wildcard.empty() ? _sprout_wildcard : _hss_wildcard)
   };
 
+  return request;
+}
+
+void ImpuRegDataTask::send_server_assignment_request(Cx::ServerAssignmentType type)
+{
+  // Create the SAR to send to the hss
+  HssConnection::ServerAssignmentRequest request = server_assignment_request(type);
+
   // Create the callback
   HssConnection::saa_cb callback =
     std::bind(&ImpuRegDataTask::on_sar_response, this, _1);
 
+  // If the HSS recently didn't know this subscriber, don't ask it again.
+  if (hss_recently_unknown(NegativeCache::SAR, _impi, _impu))
+  {
+    callback(HssConnection::ServerAssignmentAnswer(HssConnection::ResultCode::NOT_FOUND));
+    return;
+  }
+
   // Send the request
+  _timeline.mark("sar_sent");
   _hss->send_server_assignment_request(callback, request, this->trail());
 }
 
@@ -1099,15 +1271,15 @@ void ImpuRegDataTask::put_in_cache()
       {
         // LCOV_EXCL_START - This is essentially tested in the PPR UTs
         TRC_ERROR("No SIP URI in Implicit Registration Set");
-        SAS::Event event(this->trail(), SASEvent::NO_SIP_URI_IN_IRS, 0);
+        SasEncoder::Event event(this->trail(), SASEvent::NO_SIP_URI_IN_IRS, 0);
         event.add_compressed_param(_irs->get_ims_sub_xml(), &SASEvent::PROFILE_SERVICE_PROFILE);
-        SAS::report_event(event);
+        SasEncoder::report_event(_sas_encoder, event);
         // LCOV_EXCL_STOP
       }
     }
 
     {
-      SAS::Event event(this->trail(), SASEvent::CACHE_PUT_REG_DATA, 0);
+      SasEncoder::Event event(this->trail(), SASEvent::CACHE_PUT_REG_DATA, 0);
       std::string public_ids_str = boost::algorithm::join(public_ids, ", ");
       event.add_var_param(public_ids_str);
       event.add_compressed_param(_irs->get_ims_sub_xml(), &SASEvent::PROFILE_SERVICE_PROFILE);
@@ -1115,7 +1287,7 @@ void ImpuRegDataTask::put_in_cache()
       std::string associated_private_ids_str = boost::algorithm::join(_irs->get_associated_impis(), ", ");
       event.add_var_param(associated_private_ids_str);
       event.add_var_param(_irs->get_charging_addresses().log_string());
-      SAS::report_event(event);
+      SasEncoder::report_event(_sas_encoder, event);
     }
 
     // Create the callbacks
@@ -1129,6 +1301,7 @@ void ImpuRegDataTask::put_in_cache()
       std::bind(&ImpuRegDataTask::on_put_reg_data_failure, this, _1);
 
     // Cache the IRS
+    _timeline.mark("cache_put_sent");
     _cache->put_implicit_registration_set(success_cb, progress_cb, failure_cb, _irs, this->trail());
   }
   else
@@ -1141,6 +1314,13 @@ void ImpuRegDataTask::put_in_cache()
 
 void ImpuRegDataTask::on_put_reg_data_progress()
 {
+  _timeline.mark("cache_put_progress");
+
+  if ((_type == RequestType::REG) && (_cfg->dampener != NULL))
+  {
+    _cfg->dampener->record(_impu, _impi);
+  }
+
   SAS::Event event(this->trail(), SASEvent::CACHE_PUT_REG_DATA_SUCCESS, 0);
   SAS::report_event(event);
 
@@ -1149,12 +1329,16 @@ void ImpuRegDataTask::on_put_reg_data_progress()
 
 void ImpuRegDataTask::on_put_reg_data_success()
 {
+  _timeline.mark("cache_put_done");
+
   // Just tidy up
   delete this;
 }
 
 void ImpuRegDataTask::on_put_reg_data_failure(Store::Status rc)
 {
+  _timeline.mark("cache_put_done");
+
   SAS::Event event(this->trail(), SASEvent::CACHE_PUT_REG_DATA_FAIL, 0);
   event.add_static_param(rc);
   SAS::report_event(event);
@@ -1167,6 +1351,8 @@ void ImpuRegDataTask::on_put_reg_data_failure(Store::Status rc)
 
 void ImpuRegDataTask::on_sar_response(const HssConnection::ServerAssignmentAnswer& saa)
 {
+  _timeline.mark("saa_received");
+
   HssConnection::ResultCode rc = saa.get_result();
   TRC_DEBUG("Received Server-Assignment answer with result code %d", rc);
 
@@ -1188,6 +1374,11 @@ void ImpuRegDataTask::on_sar_response(const HssConnection::ServerAssignmentAnswe
   {
     TRC_INFO("Server-Assignment answer - not found");
 
+    if (_negative_cache != NULL)
+    {
+      _negative_cache->add_unknown(NegativeCache::SAR, _impi, _impu);
+    }
+
     // SAS logging for the errors is the responsibility of the HssConnection
     _http_rc = HTTP_NOT_FOUND;
   }
@@ -1258,6 +1449,13 @@ void ImpuRegDataTask::on_sar_response(const HssConnection::ServerAssignmentAnswe
     // We need to update the TTL on receiving an SAA
     _irs->set_ttl(_cfg->record_ttl);
 
+    // In HSS offload mode, a registration also gets a new (jittered)
+    // deadline for the next re-registration SAR.
+    if ((_cfg->refresher != NULL) && (_type == RequestType::REG))
+    {
+      _irs->set_refresh_deadline(_cfg->refresher->next_deadline(time(0)));
+    }
+
     put_in_cache();
     pending_cache_op = true;
   }
@@ -1286,6 +1484,7 @@ void ImpuRegDataTask::on_sar_response(const HssConnection::ServerAssignmentAnswe
     failure_callback failure_cb =
       std::bind(&ImpuRegDataTask::on_del_impu_failure, this, _1);
 
+    _timeline.mark("cache_delete_sent");
     _cache->delete_implicit_registration_set(success_cb, progress_cb, failure_cb, _irs, this->trail());
     pending_cache_op = true;
   }
@@ -1324,17 +1523,23 @@ void ImpuRegDataTask::on_del_impu_benign(bool not_found)
 
 void ImpuRegDataTask::on_del_impu_progress()
 {
+  _timeline.mark("cache_delete_progress");
+
   on_del_impu_benign(false);
 }
 
 void ImpuRegDataTask::on_del_impu_success()
 {
+  _timeline.mark("cache_delete_done");
+
   // Just tidy up
   delete this;
 }
 
 void ImpuRegDataTask::on_del_impu_failure(Store::Status status)
 {
+  _timeline.mark("cache_delete_done");
+
   // Failed to delete IMPUs. If the error was "Not Found", just pass back the
   // stored error code.  "Not Found" errors are benign on deletion
   if (status == Store::Status::NOT_FOUND)
@@ -1370,3 +1575,190 @@ void ImpuReadRegDataTask::run()
 
   ImpuRegDataTask::run();
 }
+
+//
+// IMPU store snapshot handling.
+//
+
+void ImpuSnapshotTask::run()
+{
+  if (_req.method() != htp_method_POST)
+  {
+    TRC_DEBUG("Reject non-POST for ImpuSnapshotTask");
+    send_http_reply(HTTP_BADMETHOD);
+    delete this;
+    return;
+  }
+
+  std::string path = _req.path();
+  bool restore = (path == "/impu-snapshot/restore");
+
+  std::function<void()> work = [this, restore]()
+  {
+    snapshot(restore);
+  };
+
+  if (_cfg->worker != NULL)
+  {
+    _cfg->worker->add_work(work);
+  }
+  else
+  {
+    work();
+  }
+}
+
+void ImpuSnapshotTask::snapshot(bool restore)
+{
+  uint64_t records = 0;
+  Store::Status status;
+
+  if (restore)
+  {
+    TRC_STATUS("Restoring IMPU store from %s", _cfg->path.c_str());
+    status = ImpuSnapshot::restore(_cfg->store,
+                                   _cfg->path,
+                                   _cfg->restore_threads,
+                                   trail(),
+                                   records);
+  }
+  else
+  {
+    TRC_STATUS("Snapshotting IMPU store to %s", _cfg->path.c_str());
+    status = ImpuSnapshot::dump(_cfg->store, _cfg->path, trail(), records);
+  }
+
+  if (status == Store::Status::OK)
+  {
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    writer.StartObject();
+    writer.String(JSON_RECORDS.c_str());
+    writer.Uint64(records);
+    writer.EndObject();
+    _req.add_content(sb.GetString());
+    send_http_reply(HTTP_OK);
+  }
+  else
+  {
+    send_http_reply(HTTP_SERVER_ERROR);
+  }
+
+  delete this;
+}
+
+//
+// Homestead-prov cache handling.
+//
+
+void HsProvCacheTask::run()
+{
+  if (_req.method() != htp_method_DELETE)
+  {
+    TRC_DEBUG("Reject non-DELETE for HsProvCacheTask");
+    send_http_reply(HTTP_BADMETHOD);
+    delete this;
+    return;
+  }
+
+  const std::string impi_prefix = "/hsprov-cache/impi/";
+  const std::string impu_prefix = "/hsprov-cache/impu/";
+  std::string path = _req.full_path();
+  size_t records = 0;
+
+  if (path.compare(0, impi_prefix.length(), impi_prefix) == 0)
+  {
+    std::string impi = Utils::url_unescape(
+      path.substr(impi_prefix.length(),
+                  path.find_first_of("/", impi_prefix.length()) - impi_prefix.length()));
+    TRC_INFO("Invalidating Homestead-prov cache for %s", impi.c_str());
+    records = _cfg->cache->invalidate_impi(impi);
+  }
+  else if (path.compare(0, impu_prefix.length(), impu_prefix) == 0)
+  {
+    std::string impu = Utils::url_unescape(
+      path.substr(impu_prefix.length(),
+                  path.find_first_of("/", impu_prefix.length()) - impu_prefix.length()));
+    TRC_INFO("Invalidating Homestead-prov cache for %s", impu.c_str());
+    records = _cfg->cache->invalidate_impu(impu);
+  }
+  else
+  {
+    TRC_STATUS("Invalidating Homestead-prov cache");
+    records = _cfg->cache->invalidate_all();
+  }
+
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  writer.StartObject();
+  writer.String(JSON_RECORDS.c_str());
+  writer.Uint64(records);
+  writer.EndObject();
+  _req.add_content(sb.GetString());
+  send_http_reply(HTTP_OK);
+
+  delete this;
+}
+
+//
+// Homestead-prov snapshot handling.
+//
+
+void HsProvSnapshotTask::run()
+{
+  if (_req.method() != htp_method_POST)
+  {
+    TRC_DEBUG("Reject non-POST for HsProvSnapshotTask");
+    send_http_reply(HTTP_BADMETHOD);
+    delete this;
+    return;
+  }
+
+  TRC_STATUS("Exporting Homestead-prov keyspace to %s", _cfg->path.c_str());
+
+  HsProvStore::ExportSnapshot* op = _cfg->store->create_ExportSnapshot(_cfg->path);
+
+  if (_cfg->store->do_sync(op, trail()))
+  {
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    writer.StartObject();
+    writer.String(JSON_RECORDS.c_str());
+    writer.Uint64(op->get_records());
+    writer.EndObject();
+    _req.add_content(sb.GetString());
+    send_http_reply(HTTP_OK);
+  }
+  else
+  {
+    TRC_ERROR("Failed to export Homestead-prov keyspace: %s",
+              op->get_error_text().c_str());
+    send_http_reply(HTTP_SERVER_ERROR);
+  }
+
+  delete op;
+  delete this;
+}
+
+//
+// Slow request handling.
+//
+
+void SlowRequestsTask::run()
+{
+  if (_req.method() != htp_method_GET)
+  {
+    TRC_DEBUG("Reject non-GET for SlowRequestsTask");
+    send_http_reply(HTTP_BADMETHOD);
+    delete this;
+    return;
+  }
+
+  rapidjson::StringBuffer sb;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+  _cfg->recorder->write_json(writer);
+  _req.add_content(sb.GetString());
+  send_http_reply(HTTP_OK);
+
+  delete this;
+}
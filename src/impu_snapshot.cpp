@@ -0,0 +1,393 @@
+/**
+ * @file impu_snapshot.cpp Snapshot and restore of the IMPU store
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "impu_snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "log.h"
+
+static const char SNAPSHOT_MAGIC[8] = { 'H', 'S', 'I', 'M', 'P', 'U', 'S', '\0' };
+
+ImpuSnapshot::Writer::Writer(const std::string& path) :
+  _file(path, SNAPSHOT_MAGIC, VERSION, "IMPU snapshot")
+{
+}
+
+bool ImpuSnapshot::Writer::add(RecordType type,
+                               const std::string& key,
+                               const std::string& data,
+                               int64_t expiry)
+{
+  RecordHeader rh;
+  memset(&rh, 0, sizeof(rh));
+  rh.type = type;
+  rh.key_len = key.size();
+  rh.data_len = data.size();
+  rh.expiry = expiry;
+
+  _file.start_record(IndexedFile::hash(type, key));
+
+  return _file.append(&rh, sizeof(rh)) &&
+         _file.append(key.data(), key.size()) &&
+         _file.append(data.data(), data.size()) &&
+         _file.end_record();
+}
+
+// We read the records in order when restoring.
+ImpuSnapshot::Reader::Reader(const std::string& path) :
+  _file(path, SNAPSHOT_MAGIC, VERSION, "IMPU snapshot", MADV_SEQUENTIAL)
+{
+}
+
+bool ImpuSnapshot::Reader::read_at(uint64_t offset, Record& record) const
+{
+  const char* map = _file.data();
+  uint64_t end = _file.data_end();
+
+  if (offset + sizeof(RecordHeader) > end)
+  {
+    return false;
+  }
+
+  RecordHeader rh;
+  memcpy(&rh, map + offset, sizeof(rh));
+  offset += sizeof(rh);
+
+  if (offset + rh.key_len + rh.data_len > end)
+  {
+    TRC_WARNING("Record in IMPU snapshot runs off the end of the data");
+    return false;
+  }
+
+  record.type = (RecordType)rh.type;
+  record.key.assign(map + offset, rh.key_len);
+  record.data.assign(map + offset + rh.key_len, rh.data_len);
+  record.expiry = rh.expiry;
+
+  return true;
+}
+
+bool ImpuSnapshot::Reader::read(uint64_t ii, Record& record) const
+{
+  if (ii >= num_records())
+  {
+    return false;
+  }
+
+  return read_at(_file.offset(ii), record);
+}
+
+bool ImpuSnapshot::Reader::get(RecordType type,
+                               const std::string& key,
+                               std::string& data,
+                               int64_t& expiry) const
+{
+  std::pair<const IndexedFile::IndexEntry*, const IndexedFile::IndexEntry*> range =
+    _file.find(IndexedFile::hash(type, key));
+
+  // Multiple keys can share a hash, so check each candidate in turn.
+  for (const IndexedFile::IndexEntry* it = range.first; it != range.second; ++it)
+  {
+    Record record;
+
+    if (read_at(it->offset, record) &&
+        (record.type == type) &&
+        (record.key == key))
+    {
+      data.swap(record.data);
+      expiry = record.expiry;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+Store::Status ImpuSnapshot::dump(ImpuStore* store,
+                                 const std::string& path,
+                                 SAS::TrailId trail,
+                                 uint64_t& records)
+{
+  records = 0;
+
+  if (!store->key_tracking_enabled())
+  {
+    TRC_ERROR("Can't snapshot the IMPU store without key tracking");
+    return Store::Status::ERROR;
+  }
+
+  std::vector<std::string> impus;
+  std::vector<std::string> impis;
+  std::vector<std::string> gone_impus;
+  std::vector<std::string> gone_impis;
+  store->get_tracked_keys(impus, impis);
+
+  TRC_STATUS("Snapshotting up to %zu IMPUs and %zu IMPI mappings to %s",
+             impus.size(), impis.size(), path.c_str());
+
+  Writer writer(path);
+
+  if (!writer.open())
+  {
+    return Store::Status::ERROR;
+  }
+
+  for (const std::string& key : impus)
+  {
+    std::string data;
+    Store::Status status = store->get_impu_data(key, data, trail);
+
+    if (status == Store::Status::NOT_FOUND)
+    {
+      gone_impus.push_back(key);
+      continue;
+    }
+    else if (status != Store::Status::OK)
+    {
+      TRC_ERROR("Failed to read IMPU %s for snapshot", key.c_str());
+      return status;
+    }
+
+    // The expiry is only held in the encoded record, so we need to decode it
+    // to find out. The record itself is written out as we read it.
+    std::string copy = data;
+    ImpuStore::Impu* impu = ImpuStore::Impu::from_data(key, copy, 0, store);
+
+    if (impu == nullptr)
+    {
+      TRC_WARNING("Skipping corrupt IMPU %s in snapshot", key.c_str());
+      continue;
+    }
+
+    int64_t expiry = impu->expiry;
+    std::vector<std::string> chunk_keys;
+    int64_t chunk_expiry = 0;
+
+    if (impu->is_default_impu())
+    {
+      ImpuStore::DefaultImpu* default_impu = (ImpuStore::DefaultImpu*)impu;
+      chunk_expiry = default_impu->assoc_impu_chunk_expiry;
+
+      for (size_t chunk = 0; chunk < default_impu->assoc_impu_chunks.size(); chunk++)
+      {
+        chunk_keys.push_back(
+          ImpuStore::associated_impu_chunk_key(default_impu, chunk));
+      }
+    }
+
+    delete impu;
+
+    // The associated IMPU chunks that the record refers to go before it, so
+    // that they're restored first. If one has gone, the record is still
+    // snapshotted - it's no less complete than the one in the store.
+    for (const std::string& chunk_key : chunk_keys)
+    {
+      std::string chunk_data;
+      status = store->get_associated_impu_chunk_data(chunk_key, chunk_data, trail);
+
+      if (status == Store::Status::NOT_FOUND)
+      {
+        continue;
+      }
+      else if (status != Store::Status::OK)
+      {
+        TRC_ERROR("Failed to read IMPU chunk %s for snapshot", chunk_key.c_str());
+        return status;
+      }
+
+      if (!writer.add(ASSOC_IMPU_CHUNK, chunk_key, chunk_data, chunk_expiry))
+      {
+        return Store::Status::ERROR;
+      }
+    }
+
+    if (!writer.add(IMPU, key, data, expiry))
+    {
+      return Store::Status::ERROR;
+    }
+  }
+
+  for (const std::string& key : impis)
+  {
+    std::string data;
+    Store::Status status = store->get_impi_mapping_data(key, data, trail);
+
+    if (status == Store::Status::NOT_FOUND)
+    {
+      gone_impis.push_back(key);
+      continue;
+    }
+    else if (status != Store::Status::OK)
+    {
+      TRC_ERROR("Failed to read IMPI mapping %s for snapshot", key.c_str());
+      return status;
+    }
+
+    ImpuStore::ImpiMapping* mapping =
+      ImpuStore::ImpiMapping::from_data(key, data, 0);
+
+    if (mapping == nullptr)
+    {
+      TRC_WARNING("Skipping corrupt IMPI mapping %s in snapshot", key.c_str());
+      continue;
+    }
+
+    int64_t expiry = mapping->get_expiry();
+    delete mapping;
+
+    if (!writer.add(IMPI_MAPPING, key, data, expiry))
+    {
+      return Store::Status::ERROR;
+    }
+  }
+
+  // Records that have expired out of the store don't need tracking any more.
+  store->untrack_keys(gone_impus, gone_impis);
+
+  records = writer.num_records();
+
+  if (!writer.commit())
+  {
+    return Store::Status::ERROR;
+  }
+
+  TRC_STATUS("Wrote %" PRIu64 " records to IMPU snapshot %s",
+             records, path.c_str());
+
+  return Store::Status::OK;
+}
+
+Store::Status ImpuSnapshot::restore(ImpuStore* store,
+                                    const std::string& path,
+                                    int threads,
+                                    SAS::TrailId trail,
+                                    uint64_t& restored)
+{
+  restored = 0;
+
+  Reader reader(path);
+
+  if (!reader.open())
+  {
+    return Store::Status::ERROR;
+  }
+
+  uint64_t num_records = reader.num_records();
+  threads = std::max(1, threads);
+
+  std::atomic<uint64_t> next(0);
+  std::atomic<uint64_t> added(0);
+  std::atomic<uint64_t> skipped(0);
+  std::atomic<bool> failed(false);
+  int64_t now = time(0);
+
+  // Each thread claims the next record in turn. The index is sorted by hash
+  // rather than by offset, so we walk the records in file order to keep the
+  // reads sequential.
+  std::vector<uint64_t> order(num_records);
+  for (uint64_t ii = 0; ii < num_records; ii++)
+  {
+    order[ii] = ii;
+  }
+
+  std::sort(order.begin(),
+            order.end(),
+            [&reader](uint64_t a, uint64_t b)
+            {
+              return reader.offset(a) < reader.offset(b);
+            });
+
+  auto worker = [&]()
+  {
+    Record record;
+    uint64_t ii;
+
+    while (!failed && ((ii = next++) < num_records))
+    {
+      if (!reader.read(order[ii], record))
+      {
+        failed = true;
+        break;
+      }
+
+      if (record.expiry <= now)
+      {
+        skipped++;
+        continue;
+      }
+
+      Store::Status status;
+
+      if (record.type == IMPU)
+      {
+        status = store->add_impu_data(record.key,
+                                      record.data,
+                                      record.expiry,
+                                      trail);
+      }
+      else if (record.type == ASSOC_IMPU_CHUNK)
+      {
+        status = store->add_associated_impu_chunk_data(record.key,
+                                                       record.data,
+                                                       record.expiry,
+                                                       trail);
+      }
+      else
+      {
+        status = store->add_impi_mapping_data(record.key,
+                                              record.data,
+                                              record.expiry,
+                                              trail);
+      }
+
+      if (status == Store::Status::OK)
+      {
+        added++;
+      }
+      else if (status == Store::Status::DATA_CONTENTION)
+      {
+        // The store already has this record, which must be at least as
+        // fresh as the one in the snapshot.
+        skipped++;
+      }
+      else
+      {
+        TRC_ERROR("Failed to restore %s from IMPU snapshot", record.key.c_str());
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+
+  for (int ii = 0; ii < threads; ii++)
+  {
+    pool.push_back(std::thread(worker));
+  }
+
+  for (std::thread& t : pool)
+  {
+    t.join();
+  }
+
+  restored = added;
+
+  TRC_STATUS("Restored %" PRIu64 " records from IMPU snapshot %s (%" PRIu64 " skipped)",
+             restored, path.c_str(), (uint64_t)skipped);
+
+  return failed ? Store::Status::ERROR : Store::Status::OK;
+}
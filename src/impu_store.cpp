@@ -12,7 +12,11 @@
 #include "impu_store.h"
 
 #include <climits>
+#include <future>
+#include <inttypes.h>
 
+#include "homestead_probes.h"
+#include "indexed_file.h"
 #include "json_parse_utils.h"
 #include "log.h"
 
@@ -44,9 +48,37 @@ static const char * const JSON_REGISTRATION_STATE = "registration_state";
 static const char * const JSON_IMPIS = "impis";
 static const char * const JSON_CCFS = "ccfs";
 static const char * const JSON_ECFS = "ecfs";
+static const char * const JSON_REFRESH_DEADLINE = "refresh_deadline";
+static const char * const JSON_LOOKUP_EXPIRY = "lookup_expiry";
+static const char * const JSON_ASSOC_IMPU_CHUNKS = "assoc_impu_chunks";
+static const char * const JSON_ASSOC_IMPU_CHUNK_EXPIRY = "assoc_impu_chunk_expiry";
+static const char * const JSON_ASSOC_IMPU_CHUNK_FORMAT = "assoc_impu_chunk_format";
+
+// The formats of associated IMPU chunks that this Homestead reads and writes.
+// Format 2 chunks have hash-tagged keys. A record with chunks in any other
+// format is treated as having lost them.
+static const int ASSOC_IMPU_CHUNK_FORMAT = 1;
+static const int ASSOC_IMPU_CHUNK_FORMAT_HASH_TAGGED = 2;
+
+static const char * const ASSOC_IMPU_CHUNK_TABLE = "impu_chunk";
+static const char * const ASSOC_IMPU_CHUNK_SUFFIX = ";chunk=";
 
 // IMPI -> Default IMPU
 static const char * const JSON_DEFAULT_IMPUS = "default_impus";
+static const char * const JSON_BUCKETS = "buckets";
+
+static const char * const IMPI_MAPPING_BUCKET_SUFFIX = ";bucket=";
+static const char * const IMPI_MAPPING_BUCKET_COUNT_SUFFIX = ";buckets";
+
+const int ImpuStore::NO_BUCKET;
+const int ImpuStore::BUCKET_COUNT;
+
+// This is used to place records, and to check that records are consistent
+// with each other, so must be the same on every Homestead.
+static uint32_t fnv1a_hash(const std::string& data)
+{
+  return IndexedFile::fnv1a_32(data.data(), data.size());
+}
 
 // The default acceleration (1) is sufficient for us and gives best
 // compression.
@@ -239,6 +271,8 @@ ImpuStore::Impu* ImpuStore::DefaultImpu::from_json(std::string const& impu,
   std::deque<std::string> ecfs;
   std::string service_profile;
   int64_t expiry = 0L;
+  int64_t refresh_deadline = 0L;
+  int64_t lookup_expiry = 0L;
 
   bool state;
 
@@ -249,6 +283,8 @@ ImpuStore::Impu* ImpuStore::DefaultImpu::from_json(std::string const& impu,
     RegistrationState::UNREGISTERED;
 
   JSON_SAFE_GET_INT_64_MEMBER(json, JSON_EXPIRY, expiry);
+  JSON_SAFE_GET_INT_64_MEMBER(json, JSON_REFRESH_DEADLINE, refresh_deadline);
+  JSON_SAFE_GET_INT_64_MEMBER(json, JSON_LOOKUP_EXPIRY, lookup_expiry);
   JSON_SAFE_GET_STRING_MEMBER(json, JSON_SERVICE_PROFILE, service_profile);
 
   extract_json_string_array(json, JSON_ASSOCIATED_IMPUS, assoc_impus);
@@ -258,15 +294,54 @@ ImpuStore::Impu* ImpuStore::DefaultImpu::from_json(std::string const& impu,
 
   ChargingAddresses charging_addresses = ChargingAddresses(ccfs, ecfs);
 
-  return new DefaultImpu(impu,
-                         assoc_impus,
-                         impis,
-                         reg_state,
-                         charging_addresses,
-                         service_profile,
-                         cas,
-                         expiry,
-                         store);
+  DefaultImpu* default_impu = new DefaultImpu(impu,
+                                              assoc_impus,
+                                              impis,
+                                              reg_state,
+                                              charging_addresses,
+                                              service_profile,
+                                              cas,
+                                              expiry,
+                                              store,
+                                              refresh_deadline,
+                                              lookup_expiry);
+
+  // If the associated IMPUs are in chunks, the store reads them in.
+  if ((json.HasMember(JSON_ASSOC_IMPU_CHUNKS)) &&
+      (json[JSON_ASSOC_IMPU_CHUNKS].IsArray()))
+  {
+    for (rapidjson::Value::ConstValueIterator it = json[JSON_ASSOC_IMPU_CHUNKS].Begin();
+         it != json[JSON_ASSOC_IMPU_CHUNKS].End();
+         ++it)
+    {
+      if (it->IsUint())
+      {
+        default_impu->assoc_impu_chunks.push_back(it->GetUint());
+      }
+    }
+
+    JSON_SAFE_GET_INT_64_MEMBER(json,
+                                JSON_ASSOC_IMPU_CHUNK_EXPIRY,
+                                default_impu->assoc_impu_chunk_expiry);
+
+    int64_t format = 0;
+    JSON_SAFE_GET_INT_64_MEMBER(json, JSON_ASSOC_IMPU_CHUNK_FORMAT, format);
+
+    if (format == ASSOC_IMPU_CHUNK_FORMAT_HASH_TAGGED)
+    {
+      default_impu->assoc_impu_chunks_hash_tagged = true;
+    }
+    else if (format != ASSOC_IMPU_CHUNK_FORMAT)
+    {
+      TRC_INFO("Associated IMPUs for %s are in unknown chunk format %" PRId64,
+               impu.c_str(), format);
+      default_impu->assoc_impu_chunks.clear();
+      default_impu->assoc_impu_chunk_expiry = 0;
+      default_impu->assoc_impu_chunks_lost = true;
+    }
+  }
+
+  return default_impu;
 }
 
 void ImpuStore::Impu::compress_data_v0(const std::string& data,
@@ -436,7 +511,45 @@ void ImpuStore::DefaultImpu::write_json(rapidjson::Writer<rapidjson::StringBuffe
   writer.String(JSON_EXPIRY);
   writer.Int64(expiry);
 
-  write_json_string_array(writer, JSON_ASSOCIATED_IMPUS, associated_impus);
+  // Only IRSs in HSS offload mode have a refresh deadline, so we leave it out
+  // otherwise to save space.
+  if (refresh_deadline != 0)
+  {
+    writer.String(JSON_REFRESH_DEADLINE);
+    writer.Int64(refresh_deadline);
+  }
+
+  // Likewise, this is only set if the lookup records are kept for longer
+  // than the IRS.
+  if (lookup_expiry != 0)
+  {
+    writer.String(JSON_LOOKUP_EXPIRY);
+    writer.Int64(lookup_expiry);
+  }
+
+  if (assoc_impu_chunks.empty())
+  {
+    write_json_string_array(writer, JSON_ASSOCIATED_IMPUS, associated_impus);
+  }
+  else
+  {
+    writer.String(JSON_ASSOC_IMPU_CHUNKS);
+    writer.StartArray();
+
+    for (uint32_t chunk : assoc_impu_chunks)
+    {
+      writer.Uint(chunk);
+    }
+
+    writer.EndArray();
+    writer.String(JSON_ASSOC_IMPU_CHUNK_EXPIRY);
+    writer.Int64(assoc_impu_chunk_expiry);
+    writer.String(JSON_ASSOC_IMPU_CHUNK_FORMAT);
+    writer.Int(assoc_impu_chunks_hash_tagged ?
+               ASSOC_IMPU_CHUNK_FORMAT_HASH_TAGGED :
+               ASSOC_IMPU_CHUNK_FORMAT);
+  }
+
   write_json_string_array(writer, JSON_IMPIS, impis);
   write_json_string_array(writer, JSON_ECFS, charging_addresses.ecfs);
   write_json_string_array(writer, JSON_CCFS, charging_addresses.ccfs);
@@ -452,7 +565,8 @@ void ImpuStore::AssociatedImpu::write_json(rapidjson::Writer<rapidjson::StringBu
 
 ImpuStore::ImpiMapping* ImpuStore::ImpiMapping::from_data(const std::string& impi,
                                                           const std::string& data,
-                                                          unsigned long cas)
+                                                          unsigned long cas,
+                                                          int bucket)
 {
   // Unlike IMPUs, we don't compress IMPI mappings, we just store a JSON
   // dictionary, as the overhead of compression is likely to be worse than
@@ -476,7 +590,7 @@ ImpuStore::ImpiMapping* ImpuStore::ImpiMapping::from_data(const std::string& imp
   }
   else
   {
-    return ImpuStore::ImpiMapping::from_json(impi, doc, cas);
+    return ImpuStore::ImpiMapping::from_json(impi, doc, cas, bucket);
   }
 }
 
@@ -495,11 +609,17 @@ Store::Status ImpuStore::ImpiMapping::to_data(std::string& data)
 }
 
 ImpuStore::Impu* ImpuStore::get_impu(const std::string& impu,
-                                     SAS::TrailId trail)
+                                     SAS::TrailId trail,
+                                     bool allow_lost_chunks)
 {
   std::string data;
   uint64_t cas;
 
+  HOMESTEAD_PROBE4(store_op_start, "get", "impu", impu.c_str(), trail);
+
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
+
   Store::Status status = _store->get_data("impu",
                                           impu,
                                           data,
@@ -507,9 +627,26 @@ ImpuStore::Impu* ImpuStore::get_impu(const std::string& impu,
                                           trail,
                                           false);
 
+  update_latency_stats(stop_watch);
+
+  HOMESTEAD_PROBE6(store_op_done, "get", "impu", impu.c_str(), trail, status, data.size());
+
   if (status == Store::Status::OK)
   {
-    return ImpuStore::Impu::from_data(impu, data, cas, this);
+    ImpuStore::Impu* result = decode_impu(impu, data, cas, trail);
+
+    if ((result != nullptr) && (result->is_default_impu()))
+    {
+      DefaultImpu* default_impu = (DefaultImpu*)result;
+      bool chunks_read = ((default_impu->assoc_impu_chunks.empty()) ||
+                          (read_associated_impu_chunks(default_impu, trail)));
+
+      result = check_associated_impu_chunks(default_impu,
+                                            chunks_read,
+                                            allow_lost_chunks);
+    }
+
+    return result;
   }
   else
   {
@@ -517,23 +654,131 @@ ImpuStore::Impu* ImpuStore::get_impu(const std::string& impu,
   }
 }
 
+void ImpuStore::get_impu_async(const std::string& impu,
+                               SAS::TrailId trail,
+                               impu_callback callback,
+                               bool allow_lost_chunks)
+{
+  if (_async_store == nullptr)
+  {
+    callback(get_impu(impu, trail, allow_lost_chunks));
+    return;
+  }
+
+  HOMESTEAD_PROBE4(store_op_start, "get", "impu", impu.c_str(), trail);
+
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
+
+  _async_store->get_data_async("impu",
+                               impu,
+                               trail,
+                               [this, impu, trail, callback, allow_lost_chunks, stop_watch](Store::Status status,
+                                                                                           const std::string& data,
+                                                                                           uint64_t cas) mutable
+  {
+    update_latency_stats(stop_watch);
+
+    HOMESTEAD_PROBE6(store_op_done, "get", "impu", impu.c_str(), trail, status, data.size());
+
+    ImpuStore::Impu* result = nullptr;
+
+    if (status == Store::Status::OK)
+    {
+      result = decode_impu(impu, data, cas, trail);
+    }
+
+    if ((result == nullptr) || (!result->is_default_impu()))
+    {
+      callback(result);
+      return;
+    }
+
+    DefaultImpu* default_impu = (DefaultImpu*)result;
+
+    if (default_impu->assoc_impu_chunks.empty())
+    {
+      callback(check_associated_impu_chunks(default_impu, true, allow_lost_chunks));
+      return;
+    }
+
+    read_associated_impu_chunks_async(default_impu,
+                                      trail,
+                                      [this, default_impu, callback, allow_lost_chunks](bool chunks_read)
+    {
+      callback(check_associated_impu_chunks(default_impu,
+                                            chunks_read,
+                                            allow_lost_chunks));
+    });
+  });
+}
+
+ImpuStore::Impu* ImpuStore::decode_impu(const std::string& impu,
+                                        const std::string& data,
+                                        uint64_t cas,
+                                        SAS::TrailId trail)
+{
+  HOMESTEAD_PROBE3(impu_decode_start, impu.c_str(), trail, data.size());
+  ImpuStore::Impu* result = ImpuStore::Impu::from_data(impu, data, cas, this);
+  HOMESTEAD_PROBE3(impu_decode_done, impu.c_str(), trail, (result != nullptr));
+
+  return result;
+}
+
+ImpuStore::Impu* ImpuStore::check_associated_impu_chunks(DefaultImpu* impu,
+                                                         bool chunks_read,
+                                                         bool allow_lost_chunks)
+{
+  if (!chunks_read)
+  {
+    impu->associated_impus.clear();
+    impu->assoc_impu_chunks.clear();
+    impu->assoc_impu_chunk_expiry = 0;
+    impu->assoc_impu_chunks_hash_tagged = false;
+    impu->assoc_impu_chunks_lost = true;
+  }
+
+  if ((impu->assoc_impu_chunks_lost) && (!allow_lost_chunks))
+  {
+    // The IRS is incomplete, so treat it as not found. It'll be
+    // rewritten, with all of its chunks, once it's been got from the HSS.
+    delete impu; impu = nullptr;
+  }
+
+  return impu;
+}
+
 Store::Status ImpuStore::set_impu_without_cas(ImpuStore::Impu* impu,
                                               SAS::TrailId trail)
 {
   std::string data;
 
-  Store::Status status = impu->to_data(data);
+  Store::Status status = encode_impu(impu, data, trail);
 
   if (status == Store::Status::OK)
   {
     int now = time(0);
 
+    HOMESTEAD_PROBE4(store_op_start, "set", "impu", impu->impu.c_str(), trail);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     status = _store->set_data_without_cas("impu",
                                           impu->impu,
                                           data,
                                           impu->expiry - now,
                                           trail,
                                           false);
+
+    update_latency_stats(stop_watch);
+
+    HOMESTEAD_PROBE6(store_op_done, "set", "impu", impu->impu.c_str(), trail, status, data.size());
+  }
+
+  if (status == Store::Status::OK)
+  {
+    track_key(_tracked_impus, impu->impu, true);
   }
 
   return status;
@@ -547,12 +792,17 @@ Store::Status ImpuStore::set_impu(ImpuStore::Impu* impu,
 
   std::string data;
 
-  Store::Status status = impu->to_data(data);
+  Store::Status status = encode_impu(impu, data, trail);
 
   if (status == Store::Status::OK)
   {
     int now = time(0);
 
+    HOMESTEAD_PROBE4(store_op_start, "cas", "impu", impu->impu.c_str(), trail);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     status = _store->set_data("impu",
                               impu->impu,
                               data,
@@ -560,35 +810,106 @@ Store::Status ImpuStore::set_impu(ImpuStore::Impu* impu,
                               impu->expiry - now,
                               trail,
                               false);
+
+    update_latency_stats(stop_watch);
+
+    HOMESTEAD_PROBE6(store_op_done, "cas", "impu", impu->impu.c_str(), trail, status, data.size());
   }
 
   TRC_DEBUG("Wrote %s to store (SAS Trail: %lu) with result: %u",
             impu->impu.c_str(), trail, status);
 
+  if (status == Store::Status::OK)
+  {
+    track_key(_tracked_impus, impu->impu, true);
+  }
+
   return status;
 }
 
 Store::Status ImpuStore::delete_impu(ImpuStore::Impu* impu,
                                      SAS::TrailId trail)
 {
-  return _store->delete_data("impu", impu->impu, trail);
+  track_key(_tracked_impus, impu->impu, false);
+
+  HOMESTEAD_PROBE4(store_op_start, "delete", "impu", impu->impu.c_str(), trail);
+
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
+
+  Store::Status status = _store->delete_data("impu", impu->impu, trail);
+
+  update_latency_stats(stop_watch);
+
+  HOMESTEAD_PROBE6(store_op_done, "delete", "impu", impu->impu.c_str(), trail, status, 0);
+
+  // Delete any chunks of associated IMPUs too. They'd expire anyway, so we
+  // don't fail the delete if this doesn't work.
+  if ((status == Store::Status::OK) && (impu->is_default_impu()))
+  {
+    DefaultImpu* default_impu = (DefaultImpu*)impu;
+
+    for (size_t chunk = 0; chunk < default_impu->assoc_impu_chunks.size(); chunk++)
+    {
+      _store->delete_data(ASSOC_IMPU_CHUNK_TABLE,
+                          associated_impu_chunk_key(default_impu, chunk),
+                          trail);
+    }
+  }
+
+  return status;
 }
 
-ImpuStore::ImpiMapping* ImpuStore::get_impi_mapping(const std::string impi,
-                                                    SAS::TrailId trail)
+std::string ImpuStore::impi_mapping_key(const std::string& impi, int bucket)
+{
+  if (bucket == NO_BUCKET)
+  {
+    return impi;
+  }
+  else if (bucket == BUCKET_COUNT)
+  {
+    return impi + IMPI_MAPPING_BUCKET_COUNT_SUFFIX;
+  }
+
+  return impi + IMPI_MAPPING_BUCKET_SUFFIX + std::to_string(bucket);
+}
+
+int ImpuStore::impi_mapping_bucket(const std::string& default_impu) const
+{
+  if (_impi_mapping_buckets <= 0)
+  {
+    return NO_BUCKET;
+  }
+
+  return fnv1a_hash(default_impu) % _impi_mapping_buckets;
+}
+
+ImpuStore::ImpiMapping* ImpuStore::get_impi_mapping_record(const std::string& impi,
+                                                           int bucket,
+                                                           SAS::TrailId trail)
 {
   std::string data;
   uint64_t cas;
+  std::string key = impi_mapping_key(impi, bucket);
+
+  HOMESTEAD_PROBE4(store_op_start, "get", "impi_mapping", key.c_str(), trail);
+
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
 
   Store::Status status = _store->get_data("impi_mapping",
-                                          impi,
+                                          key,
                                           data,
                                           cas,
                                           trail);
 
+  update_latency_stats(stop_watch);
+
+  HOMESTEAD_PROBE6(store_op_done, "get", "impi_mapping", key.c_str(), trail, status, data.size());
+
   if (status == Store::Status::OK)
   {
-    return ImpuStore::ImpiMapping::from_data(impi, data, cas);
+    return ImpuStore::ImpiMapping::from_data(impi, data, cas, bucket);
   }
   else
   {
@@ -596,10 +917,66 @@ ImpuStore::ImpiMapping* ImpuStore::get_impi_mapping(const std::string impi,
   }
 }
 
+ImpuStore::ImpiMapping* ImpuStore::get_impi_mapping(const std::string impi,
+                                                    SAS::TrailId trail)
+{
+  ImpiMapping* unsplit = get_impi_mapping_record(impi, NO_BUCKET, trail);
+
+  // If we don't split mappings, the unsplit record is the whole mapping, as
+  // it was before mappings could be split.
+  if (_impi_mapping_buckets <= 0)
+  {
+    return unsplit;
+  }
+
+  // If another Homestead has split the mapping into more buckets than we
+  // would, read the rest of them too. The bucket count record is only a
+  // hint - if it's been evicted, we still read the buckets we'd write to.
+  int bucket_count = _impi_mapping_buckets;
+  ImpiMapping* count = get_impi_mapping_record(impi, BUCKET_COUNT, trail);
+
+  if (count != nullptr)
+  {
+    bucket_count = std::max(bucket_count, count->buckets);
+    delete count; count = nullptr;
+  }
+
+  // The store has no multi-get, so the records are read one at a time.
+  ImpiMapping* mapping = nullptr;
+
+  for (int bucket = NO_BUCKET; bucket < bucket_count; bucket++)
+  {
+    ImpiMapping* record = (bucket == NO_BUCKET) ?
+                            unsplit :
+                            get_impi_mapping_record(impi, bucket, trail);
+
+    if (record != nullptr)
+    {
+      if (mapping == nullptr)
+      {
+        mapping = new ImpiMapping(impi, std::vector<std::string>(), 0L, 0L);
+      }
+
+      for (const std::string& impu : record->get_default_impus())
+      {
+        mapping->add_default_impu(impu);
+      }
+
+      mapping->set_expiry(std::max(mapping->get_expiry(),
+                                   record->get_expiry()));
+
+      delete record; record = nullptr;
+    }
+  }
+
+  return mapping;
+}
+
 Store::Status ImpuStore::set_impi_mapping(ImpiMapping* mapping,
                                           SAS::TrailId trail)
 {
   std::string data;
+  std::string key = mapping->key();
 
   Store::Status status = mapping->to_data(data);
 
@@ -607,12 +984,26 @@ Store::Status ImpuStore::set_impi_mapping(ImpiMapping* mapping,
   {
     int now = time(0);
 
+    HOMESTEAD_PROBE4(store_op_start, "cas", "impi_mapping", key.c_str(), trail);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
     status = _store->set_data("impi_mapping",
-                              mapping->impi,
+                              key,
                               data,
                               mapping->cas,
                               mapping->get_expiry() - now,
                               trail);
+
+    update_latency_stats(stop_watch);
+
+    HOMESTEAD_PROBE6(store_op_done, "cas", "impi_mapping", key.c_str(), trail, status, data.size());
+  }
+
+  if (status == Store::Status::OK)
+  {
+    track_key(_tracked_impis, key, true);
   }
 
   return status;
@@ -621,25 +1012,579 @@ Store::Status ImpuStore::set_impi_mapping(ImpiMapping* mapping,
 Store::Status ImpuStore::delete_impi_mapping(ImpiMapping* mapping,
                                              SAS::TrailId trail)
 {
-  return _store->delete_data("impi_mapping", mapping->impi, trail);
+  std::string key = mapping->key();
+
+  track_key(_tracked_impis, key, false);
+
+  HOMESTEAD_PROBE4(store_op_start, "delete", "impi_mapping", key.c_str(), trail);
+
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
+
+  Store::Status status = _store->delete_data("impi_mapping", key, trail);
+
+  update_latency_stats(stop_watch);
+
+  HOMESTEAD_PROBE6(store_op_done, "delete", "impi_mapping", key.c_str(), trail, status, 0);
+
+  return status;
+}
+
+Store::Status ImpuStore::get_impu_data(const std::string& impu,
+                                       std::string& data,
+                                       SAS::TrailId trail)
+{
+  uint64_t cas;
+
+  return _store->get_data("impu", impu, data, cas, trail, false);
+}
+
+Store::Status ImpuStore::get_impi_mapping_data(const std::string& impi,
+                                               std::string& data,
+                                               SAS::TrailId trail)
+{
+  uint64_t cas;
+
+  return _store->get_data("impi_mapping", impi, data, cas, trail);
+}
+
+Store::Status ImpuStore::add_impu_data(const std::string& impu,
+                                       const std::string& data,
+                                       int64_t expiry,
+                                       SAS::TrailId trail)
+{
+  int now = time(0);
+
+  // A CAS of 0 means that the write only succeeds if there's no existing
+  // record.
+  Store::Status status = _store->set_data("impu",
+                                          impu,
+                                          data,
+                                          0,
+                                          expiry - now,
+                                          trail,
+                                          false);
+
+  if (status == Store::Status::OK)
+  {
+    track_key(_tracked_impus, impu, true);
+  }
+
+  return status;
+}
+
+Store::Status ImpuStore::add_impi_mapping_data(const std::string& impi,
+                                               const std::string& data,
+                                               int64_t expiry,
+                                               SAS::TrailId trail)
+{
+  int now = time(0);
+
+  Store::Status status = _store->set_data("impi_mapping",
+                                          impi,
+                                          data,
+                                          0,
+                                          expiry - now,
+                                          trail);
+
+  if (status == Store::Status::OK)
+  {
+    track_key(_tracked_impis, impi, true);
+  }
+
+  return status;
+}
+
+Store::Status ImpuStore::get_associated_impu_chunk_data(const std::string& key,
+                                                        std::string& data,
+                                                        SAS::TrailId trail)
+{
+  uint64_t cas;
+
+  return _store->get_data(ASSOC_IMPU_CHUNK_TABLE, key, data, cas, trail);
+}
+
+Store::Status ImpuStore::add_associated_impu_chunk_data(const std::string& key,
+                                                        const std::string& data,
+                                                        int64_t expiry,
+                                                        SAS::TrailId trail)
+{
+  int now = time(0);
+
+  return _store->set_data(ASSOC_IMPU_CHUNK_TABLE,
+                          key,
+                          data,
+                          0,
+                          expiry - now,
+                          trail);
+}
+
+std::string ImpuStore::associated_impu_chunk_key(const std::string& impu,
+                                                 int chunk,
+                                                 uint32_t hash,
+                                                 bool hash_tagged)
+{
+  char hash_str[9];
+  snprintf(hash_str, sizeof(hash_str), "%08x", hash);
+
+  // The tag is the key that memcached stores use for the default IMPU
+  // record, so that the chunks hash to the same server as it.
+  std::string prefix = hash_tagged ? ("{impu\\\\" + impu + "}") : impu;
+
+  return prefix + ASSOC_IMPU_CHUNK_SUFFIX + std::to_string(chunk) + ";" + hash_str;
+}
+
+std::string ImpuStore::associated_impu_chunk_key(const DefaultImpu* impu,
+                                                 size_t chunk)
+{
+  return associated_impu_chunk_key(impu->impu,
+                                   chunk,
+                                   impu->assoc_impu_chunks[chunk],
+                                   impu->assoc_impu_chunks_hash_tagged);
+}
+
+Store::Status ImpuStore::encode_impu(Impu* impu,
+                                     std::string& data,
+                                     SAS::TrailId trail)
+{
+  std::vector<std::pair<int, std::string>> chunks;
+
+  if (impu->is_default_impu())
+  {
+    chunk_associated_impus((DefaultImpu*)impu, chunks);
+  }
+
+  // Write the chunks first, so that once the default IMPU record is written
+  // they match it. The chunks are keyed on their contents, so until then
+  // the current default IMPU record still refers to its own chunks, and if
+  // this write fails (e.g. on contention) the new chunks just expire.
+  if (!chunks.empty())
+  {
+    Store::Status status =
+      write_associated_impu_chunks((DefaultImpu*)impu, chunks, trail);
+
+    if (status != Store::Status::OK)
+    {
+      return status;
+    }
+  }
+
+  HOMESTEAD_PROBE2(impu_encode_start, impu->impu.c_str(), trail);
+  Store::Status status = impu->to_data(data);
+  HOMESTEAD_PROBE4(impu_encode_done, impu->impu.c_str(), trail, status, data.size());
+
+  return status;
+}
+
+Store::Status ImpuStore::write_associated_impu_chunks(DefaultImpu* impu,
+                                                      const std::vector<std::pair<int, std::string>>& chunks,
+                                                      SAS::TrailId trail)
+{
+  int64_t now = time(0);
+
+  if ((_async_store != nullptr) && (_async_chunk_writes))
+  {
+    std::vector<std::pair<std::string, std::string>> records;
+
+    for (const std::pair<int, std::string>& chunk : chunks)
+    {
+      records.emplace_back(associated_impu_chunk_key(impu, chunk.first),
+                           chunk.second);
+      HOMESTEAD_PROBE4(store_op_start, "set", ASSOC_IMPU_CHUNK_TABLE, records.back().first.c_str(), trail);
+    }
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
+    std::promise<std::vector<Store::Status>> promise;
+    std::future<std::vector<Store::Status>> future = promise.get_future();
+    _async_store->set_multi_data_async(ASSOC_IMPU_CHUNK_TABLE,
+                                       records,
+                                       impu->assoc_impu_chunk_expiry - now,
+                                       trail,
+                                       [&promise](std::vector<Store::Status>& statuses)
+    {
+      promise.set_value(statuses);
+    });
+    std::vector<Store::Status> statuses = future.get();
+
+    update_latency_stats(stop_watch);
+
+    for (size_t ii = 0; ii < chunks.size(); ii++)
+    {
+      HOMESTEAD_PROBE6(store_op_done, "set", ASSOC_IMPU_CHUNK_TABLE, records[ii].first.c_str(), trail, statuses[ii], chunks[ii].second.size());
+
+      if (statuses[ii] != Store::Status::OK)
+      {
+        TRC_DEBUG("Failed to write chunk %d of associated IMPUs for %s",
+                  chunks[ii].first, impu->impu.c_str());
+        return statuses[ii];
+      }
+    }
+
+    return Store::Status::OK;
+  }
+
+  for (const std::pair<int, std::string>& chunk : chunks)
+  {
+    std::string key = associated_impu_chunk_key(impu, chunk.first);
+
+    HOMESTEAD_PROBE4(store_op_start, "set", ASSOC_IMPU_CHUNK_TABLE, key.c_str(), trail);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
+    Store::Status status =
+      _store->set_data_without_cas(ASSOC_IMPU_CHUNK_TABLE,
+                                   key,
+                                   chunk.second,
+                                   impu->assoc_impu_chunk_expiry - now,
+                                   trail);
+
+    update_latency_stats(stop_watch);
+
+    HOMESTEAD_PROBE6(store_op_done, "set", ASSOC_IMPU_CHUNK_TABLE, key.c_str(), trail, status, chunk.second.size());
+
+    if (status != Store::Status::OK)
+    {
+      TRC_DEBUG("Failed to write chunk %d of associated IMPUs for %s",
+                chunk.first, impu->impu.c_str());
+      return status;
+    }
+  }
+
+  return Store::Status::OK;
+}
+
+void ImpuStore::chunk_associated_impus(DefaultImpu* impu,
+                                       std::vector<std::pair<int, std::string>>& chunks)
+{
+  size_t count = impu->associated_impus.size();
+
+  if ((_assoc_impu_chunk_size == 0) || (count <= _assoc_impu_chunk_size))
+  {
+    // Few enough to keep in the default IMPU record.
+    impu->assoc_impu_chunks.clear();
+    impu->assoc_impu_chunk_expiry = 0;
+    impu->assoc_impu_chunks_hash_tagged = false;
+    impu->assoc_impu_chunks_lost = false;
+    return;
+  }
+
+  // Keep the existing number of chunks unless they're over full, or mostly
+  // empty, as changing it means rewriting every chunk. Otherwise pick a
+  // power of two that leaves them around half full.
+  size_t min_chunks = (count + _assoc_impu_chunk_size - 1) / _assoc_impu_chunk_size;
+  size_t num_chunks = impu->assoc_impu_chunks.size();
+
+  if ((num_chunks < min_chunks) || (num_chunks > 4 * min_chunks))
+  {
+    num_chunks = 1;
+
+    while (num_chunks < 2 * min_chunks)
+    {
+      num_chunks <<= 1;
+    }
+  }
+
+  std::vector<std::vector<std::string>> chunk_impus(num_chunks);
+
+  for (const std::string& assoc_impu : impu->associated_impus)
+  {
+    chunk_impus[fnv1a_hash(assoc_impu) % num_chunks].push_back(assoc_impu);
+  }
+
+  // A tag can't contain braces, so an IMPU that does keeps untagged keys.
+  bool hash_tagged = ((_hash_tags) &&
+                      (impu->impu.find_first_of("{}") == std::string::npos));
+
+  // The chunks only need rewriting when they change, or when they'd expire
+  // before the default IMPU record. When they are rewritten for that, keep
+  // them for twice as long as they need to be, so that they aren't rewritten
+  // on every refresh. If the record's chunks were lost (e.g. evicted), they
+  // are all rewritten, as we don't know which of them are still there, and
+  // likewise if their keys change because hash tags have been turned on or
+  // off - that's how existing records move to the new keys.
+  bool rewrite_all = ((num_chunks != impu->assoc_impu_chunks.size()) ||
+                      (impu->assoc_impu_chunk_expiry < impu->expiry) ||
+                      (impu->assoc_impu_chunks_lost) ||
+                      (impu->assoc_impu_chunks_hash_tagged != hash_tagged));
+
+  if (rewrite_all)
+  {
+    int64_t now = time(0);
+    impu->assoc_impu_chunk_expiry = std::max(impu->expiry + (impu->expiry - now),
+                                             impu->lookup_expiry);
+  }
+
+  std::vector<uint32_t> hashes;
+
+  for (size_t chunk = 0; chunk < num_chunks; chunk++)
+  {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    write_json_string_array(writer, JSON_ASSOCIATED_IMPUS, chunk_impus[chunk]);
+    writer.EndObject();
+
+    std::string data = buffer.GetString();
+    uint32_t hash = fnv1a_hash(data);
+    hashes.push_back(hash);
+
+    if ((rewrite_all) || (impu->assoc_impu_chunks[chunk] != hash))
+    {
+      chunks.emplace_back(chunk, data);
+    }
+  }
+
+  impu->assoc_impu_chunks = hashes;
+  impu->assoc_impu_chunks_hash_tagged = hash_tagged;
+  impu->assoc_impu_chunks_lost = false;
+}
+
+bool ImpuStore::read_associated_impu_chunks(DefaultImpu* impu,
+                                            SAS::TrailId trail)
+{
+  impu->associated_impus.clear();
+
+  // With an async store, the chunks are read with one multi-get, and we just
+  // wait for it.
+  if (_async_store != nullptr)
+  {
+    std::promise<bool> promise;
+    std::future<bool> future = promise.get_future();
+    read_associated_impu_chunks_async(impu, trail, [&promise](bool chunks_read)
+    {
+      promise.set_value(chunks_read);
+    });
+
+    return future.get();
+  }
+
+  for (size_t chunk = 0; chunk < impu->assoc_impu_chunks.size(); chunk++)
+  {
+    std::string data;
+    uint64_t cas;
+    std::string key = associated_impu_chunk_key(impu, chunk);
+
+    HOMESTEAD_PROBE4(store_op_start, "get", ASSOC_IMPU_CHUNK_TABLE, key.c_str(), trail);
+
+    Utils::StopWatch stop_watch;
+    stop_watch.start();
+
+    Store::Status status = _store->get_data(ASSOC_IMPU_CHUNK_TABLE,
+                                            key,
+                                            data,
+                                            cas,
+                                            trail);
+
+    update_latency_stats(stop_watch);
+
+    HOMESTEAD_PROBE6(store_op_done, "get", ASSOC_IMPU_CHUNK_TABLE, key.c_str(), trail, status, data.size());
+
+    if (status != Store::Status::OK)
+    {
+      TRC_INFO("Chunk %zu of associated IMPUs for %s not found",
+               chunk, impu->impu.c_str());
+      return false;
+    }
+
+    if (!add_associated_impu_chunk(impu, chunk, data))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void ImpuStore::read_associated_impu_chunks_async(DefaultImpu* impu,
+                                                  SAS::TrailId trail,
+                                                  std::function<void(bool)> callback)
+{
+  std::vector<std::string> keys;
+
+  for (size_t chunk = 0; chunk < impu->assoc_impu_chunks.size(); chunk++)
+  {
+    keys.push_back(associated_impu_chunk_key(impu, chunk));
+    HOMESTEAD_PROBE4(store_op_start, "get", ASSOC_IMPU_CHUNK_TABLE, keys.back().c_str(), trail);
+  }
+
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
+
+  _async_store->get_multi_data_async(ASSOC_IMPU_CHUNK_TABLE,
+                                     keys,
+                                     trail,
+                                     [this, impu, trail, callback, keys, stop_watch](std::vector<AsyncStore::Result>& results) mutable
+  {
+    update_latency_stats(stop_watch);
+
+    for (size_t chunk = 0; chunk < results.size(); chunk++)
+    {
+      HOMESTEAD_PROBE6(store_op_done, "get", ASSOC_IMPU_CHUNK_TABLE, keys[chunk].c_str(), trail, results[chunk].status, results[chunk].data.size());
+    }
+
+    callback(add_associated_impu_chunks(impu, results));
+  });
+}
+
+bool ImpuStore::add_associated_impu_chunks(DefaultImpu* impu,
+                                           std::vector<AsyncStore::Result>& results)
+{
+  impu->associated_impus.clear();
+
+  for (size_t chunk = 0; chunk < results.size(); chunk++)
+  {
+    if (results[chunk].status != Store::Status::OK)
+    {
+      TRC_INFO("Chunk %zu of associated IMPUs for %s not found",
+               chunk, impu->impu.c_str());
+      return false;
+    }
+
+    if (!add_associated_impu_chunk(impu, chunk, results[chunk].data))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ImpuStore::add_associated_impu_chunk(DefaultImpu* impu,
+                                          size_t chunk,
+                                          const std::string& data)
+{
+  // The key includes the hash, so this only fails if the chunk is
+  // corrupt.
+  if (fnv1a_hash(data) != impu->assoc_impu_chunks[chunk])
+  {
+    TRC_WARNING("Chunk %zu of associated IMPUs for %s is corrupt",
+                chunk, impu->impu.c_str());
+    return false;
+  }
+
+  rapidjson::Document doc;
+  doc.Parse<0>(data.c_str());
+
+  if ((doc.HasParseError()) || (!doc.IsObject()))
+  {
+    TRC_WARNING("Failed to parse chunk %zu of associated IMPUs for %s",
+                chunk, impu->impu.c_str());
+    return false;
+  }
+
+  std::vector<std::string> assoc_impus;
+  extract_json_string_array(doc, JSON_ASSOCIATED_IMPUS, assoc_impus);
+  impu->associated_impus.insert(impu->associated_impus.end(),
+                                assoc_impus.begin(),
+                                assoc_impus.end());
+
+  return true;
+}
+
+void ImpuStore::update_latency_stats(Utils::StopWatch& stop_watch)
+{
+  unsigned long latency = 0;
+
+  if ((_stats_manager == NULL) || (!stop_watch.read(latency)))
+  {
+    return;
+  }
+
+  if (_remote)
+  {
+    _stats_manager->update_H_remote_store_latency_us(latency);
+  }
+  else
+  {
+    _stats_manager->update_H_local_store_latency_us(latency);
+  }
+}
+
+void ImpuStore::track_key(std::unordered_set<std::string>& keys,
+                          const std::string& key,
+                          bool present)
+{
+  if (!_track_keys)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_tracked_keys_lock);
+
+  if (present)
+  {
+    if (_tracked_impus.size() + _tracked_impis.size() < _max_tracked_keys)
+    {
+      keys.insert(key);
+    }
+    else if ((keys.find(key) == keys.end()) && (!_tracked_keys_full))
+    {
+      // Only warn the first time - snapshots will be incomplete until
+      // enough records are removed to bring us back under the limit.
+      TRC_WARNING("Tracking %zu IMPU store keys - new records won't be snapshotted",
+                  _max_tracked_keys);
+      _tracked_keys_full = true;
+    }
+  }
+  else
+  {
+    keys.erase(key);
+  }
+}
+
+void ImpuStore::get_tracked_keys(std::vector<std::string>& impus,
+                                 std::vector<std::string>& impis)
+{
+  std::lock_guard<std::mutex> lock(_tracked_keys_lock);
+
+  impus.assign(_tracked_impus.begin(), _tracked_impus.end());
+  impis.assign(_tracked_impis.begin(), _tracked_impis.end());
+}
+
+void ImpuStore::untrack_keys(const std::vector<std::string>& impus,
+                             const std::vector<std::string>& impis)
+{
+  std::lock_guard<std::mutex> lock(_tracked_keys_lock);
+
+  for (const std::string& impu : impus)
+  {
+    _tracked_impus.erase(impu);
+  }
+
+  for (const std::string& impi : impis)
+  {
+    _tracked_impis.erase(impi);
+  }
+
+  _tracked_keys_full = false;
 }
 
 
 ImpuStore::ImpiMapping* ImpuStore::ImpiMapping::from_json(std::string const& impi,
                                                          rapidjson::Value& json,
-                                                         unsigned long cas)
+                                                         unsigned long cas,
+                                                         int bucket)
 {
   std::vector<std::string> impus;
   int64_t expiry = 0L;
+  int64_t buckets = 0L;
 
   extract_json_string_array(json, JSON_DEFAULT_IMPUS, impus);
 
   JSON_SAFE_GET_INT_64_MEMBER(json, JSON_EXPIRY, expiry);
+  JSON_SAFE_GET_INT_64_MEMBER(json, JSON_BUCKETS, buckets);
+
+  ImpiMapping* mapping = new ImpiMapping(impi,
+                                         impus,
+                                         cas,
+                                         expiry,
+                                         bucket);
+  mapping->buckets = (int)buckets;
 
-  return new ImpiMapping(impi,
-                         impus,
-                         cas,
-                         expiry);
+  return mapping;
 }
 
 void ImpuStore::ImpiMapping::write_json(rapidjson::Writer<rapidjson::StringBuffer>& writer)
@@ -647,4 +1592,10 @@ void ImpuStore::ImpiMapping::write_json(rapidjson::Writer<rapidjson::StringBuffe
   write_json_string_array(writer, JSON_DEFAULT_IMPUS, _default_impus);
   writer.String(JSON_EXPIRY);
   writer.Int64(_expiry);
+
+  if (buckets > 0)
+  {
+    writer.String(JSON_BUCKETS);
+    writer.Int(buckets);
+  }
 }
@@ -0,0 +1,323 @@
+/**
+ * @file indexed_file.cpp Memory-mapped files of records with a hash index
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "indexed_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+const uint64_t IndexedFile::ALIGNMENT;
+const uint32_t IndexedFile::FNV1A_32_BASIS;
+const uint64_t IndexedFile::FNV1A_64_BASIS;
+
+static bool index_entry_less(const IndexedFile::IndexEntry& a,
+                             const IndexedFile::IndexEntry& b)
+{
+  return a.hash < b.hash;
+}
+
+uint32_t IndexedFile::fnv1a_32(const char* data, size_t len, uint32_t basis)
+{
+  uint32_t h = basis;
+
+  for (size_t ii = 0; ii < len; ii++)
+  {
+    h ^= (uint8_t)data[ii];
+    h *= 16777619U;
+  }
+
+  return h;
+}
+
+uint64_t IndexedFile::fnv1a_64(const char* data, size_t len, uint64_t basis)
+{
+  uint64_t h = basis;
+
+  for (size_t ii = 0; ii < len; ii++)
+  {
+    h ^= (uint8_t)data[ii];
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+uint64_t IndexedFile::hash(uint8_t type, const std::string& key)
+{
+  uint64_t h = fnv1a_64((const char*)&type, sizeof(type));
+  return fnv1a_64(key.data(), key.size(), h);
+}
+
+bool IndexedFile::write_all(int fd, const void* buf, size_t len)
+{
+  const char* p = (const char*)buf;
+
+  while (len > 0)
+  {
+    ssize_t rc = write(fd, p, len);
+
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      return false;
+    }
+
+    p += rc;
+    len -= rc;
+  }
+
+  return true;
+}
+
+IndexedFile::Writer::Writer(const std::string& path,
+                            const char (&magic)[8],
+                            uint32_t version,
+                            const std::string& description) :
+  _path(path),
+  _tmp_path(path + ".tmp"),
+  _version(version),
+  _description(description),
+  _fd(-1),
+  _offset(0)
+{
+  memcpy(_magic, magic, sizeof(_magic));
+}
+
+IndexedFile::Writer::~Writer()
+{
+  if (_fd != -1)
+  {
+    // The file was never committed, so tidy up the partial file.
+    close(_fd);
+    unlink(_tmp_path.c_str());
+  }
+}
+
+bool IndexedFile::Writer::open()
+{
+  _fd = ::open(_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+  if (_fd == -1)
+  {
+    TRC_ERROR("Failed to open %s file %s: %s",
+              _description.c_str(), _tmp_path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // Write a placeholder header - the real one is written once we know where
+  // the index is.
+  Header header;
+  memset(&header, 0, sizeof(header));
+  return append(&header, sizeof(header));
+}
+
+void IndexedFile::Writer::start_record(uint64_t hash)
+{
+  IndexEntry entry;
+  entry.hash = hash;
+  entry.offset = _offset;
+  _index.push_back(entry);
+}
+
+bool IndexedFile::Writer::append(const void* buf, size_t len)
+{
+  if (!write_all(_fd, buf, len))
+  {
+    TRC_ERROR("Failed to write to %s file %s: %s",
+              _description.c_str(), _tmp_path.c_str(), strerror(errno));
+    return false;
+  }
+
+  _offset += len;
+
+  return true;
+}
+
+bool IndexedFile::Writer::end_record()
+{
+  uint64_t padding = (ALIGNMENT - (_offset % ALIGNMENT)) % ALIGNMENT;
+  static const char zeros[ALIGNMENT] = {0};
+
+  return append(zeros, padding);
+}
+
+bool IndexedFile::Writer::commit()
+{
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, _magic, sizeof(header.magic));
+  header.version = _version;
+  header.num_records = _index.size();
+  header.index_offset = _offset;
+
+  std::stable_sort(_index.begin(), _index.end(), index_entry_less);
+
+  bool ok = append(_index.data(), _index.size() * sizeof(IndexEntry));
+
+  if (ok)
+  {
+    ok = (pwrite(_fd, &header, sizeof(header), 0) == sizeof(header)) &&
+         (fsync(_fd) == 0);
+  }
+
+  close(_fd);
+  _fd = -1;
+
+  if (ok)
+  {
+    ok = (rename(_tmp_path.c_str(), _path.c_str()) == 0);
+  }
+
+  if (!ok)
+  {
+    TRC_ERROR("Failed to commit %s file %s: %s",
+              _description.c_str(), _path.c_str(), strerror(errno));
+    unlink(_tmp_path.c_str());
+  }
+
+  return ok;
+}
+
+IndexedFile::Reader::Reader(const std::string& path,
+                            const char (&magic)[8],
+                            uint32_t version,
+                            const std::string& description,
+                            int advice) :
+  _path(path),
+  _version(version),
+  _description(description),
+  _advice(advice),
+  _fd(-1),
+  _map(nullptr),
+  _map_len(0),
+  _header(nullptr),
+  _index(nullptr)
+{
+  memcpy(_magic, magic, sizeof(_magic));
+}
+
+IndexedFile::Reader::~Reader()
+{
+  if (_map != nullptr)
+  {
+    munmap((void*)_map, _map_len);
+  }
+
+  if (_fd != -1)
+  {
+    close(_fd);
+  }
+}
+
+bool IndexedFile::Reader::open()
+{
+  _fd = ::open(_path.c_str(), O_RDONLY);
+
+  if (_fd == -1)
+  {
+    TRC_ERROR("Failed to open %s file %s: %s",
+              _description.c_str(), _path.c_str(), strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+
+  if ((fstat(_fd, &st) != 0) || ((size_t)st.st_size < sizeof(Header)))
+  {
+    TRC_ERROR("%s file %s is truncated", _description.c_str(), _path.c_str());
+    return false;
+  }
+
+  _map_len = st.st_size;
+  void* map = mmap(NULL, _map_len, PROT_READ, MAP_SHARED, _fd, 0);
+
+  if (map == MAP_FAILED)
+  {
+    TRC_ERROR("Failed to map %s file %s: %s",
+              _description.c_str(), _path.c_str(), strerror(errno));
+    return false;
+  }
+
+  _map = (const char*)map;
+  madvise(map, _map_len, _advice);
+
+  const Header* header = (const Header*)_map;
+
+  if ((memcmp(header->magic, _magic, sizeof(_magic)) != 0) ||
+      (header->version != _version))
+  {
+    TRC_ERROR("%s is not a valid %s file", _path.c_str(), _description.c_str());
+    return false;
+  }
+
+  if ((header->index_offset % ALIGNMENT != 0) ||
+      (header->index_offset > _map_len) ||
+      (header->num_records >
+         (_map_len - header->index_offset) / sizeof(IndexEntry)))
+  {
+    TRC_ERROR("%s file %s has a corrupt index",
+              _description.c_str(), _path.c_str());
+    return false;
+  }
+
+  _header = header;
+  _index = (const IndexEntry*)(_map + _header->index_offset);
+
+  TRC_STATUS("Opened %s file %s with %" PRIu64 " records",
+             _description.c_str(), _path.c_str(), _header->num_records);
+
+  return true;
+}
+
+uint64_t IndexedFile::Reader::num_records() const
+{
+  return (_header != nullptr) ? _header->num_records : 0;
+}
+
+uint64_t IndexedFile::Reader::data_end() const
+{
+  return (_header != nullptr) ? _header->index_offset : 0;
+}
+
+uint64_t IndexedFile::Reader::offset(uint64_t ii) const
+{
+  return (ii < num_records()) ? _index[ii].offset : 0;
+}
+
+std::pair<const IndexedFile::IndexEntry*, const IndexedFile::IndexEntry*>
+  IndexedFile::Reader::find(uint64_t hash) const
+{
+  if (_index == nullptr)
+  {
+    return std::make_pair(_index, _index);
+  }
+
+  IndexEntry target;
+  target.hash = hash;
+  target.offset = 0;
+
+  return std::equal_range(_index,
+                          _index + _header->num_records,
+                          target,
+                          index_entry_less);
+}
@@ -0,0 +1,14 @@
+/**
+ * @file json_response.cpp Renders JSON response bodies into per-thread buffers
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "json_response.h"
+
+template class BasicJsonResponse<rapidjson::CrtAllocator>;
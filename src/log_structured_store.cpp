@@ -0,0 +1,770 @@
+/**
+ * @file log_structured_store.cpp Store held in an append-only file on local disk
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "log_structured_store.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "indexed_file.h"
+#include "log.h"
+
+static const char LOG_MAGIC[8] = { 'H', 'S', 'L', 'O', 'G', 'S', 'T', '\0' };
+static const uint32_t RECORD_MAGIC = 0x4c535452;
+
+// Records are padded so that each record header is 8-byte aligned in the
+// mapping.
+static const uint64_t ALIGNMENT = 8;
+
+// The file starts at this size, and doubles whenever it fills up.
+static const uint64_t INITIAL_CAPACITY = 1024 * 1024;
+
+// Don't bother compacting logs smaller than this.
+static const uint64_t MIN_COMPACT_BYTES = 1024 * 1024;
+
+// The checksum covers everything after the magic number and checksum.
+static const uint64_t CHECKSUM_OFFSET = 2 * sizeof(uint32_t);
+
+static uint64_t record_length(uint64_t key_len, uint64_t data_len)
+{
+  uint64_t len = sizeof(LogStructuredStore::RecordHeader) + key_len + data_len;
+  return len + ((ALIGNMENT - (len % ALIGNMENT)) % ALIGNMENT);
+}
+
+static uint32_t checksum(const char* data, uint64_t len)
+{
+  return IndexedFile::fnv1a_32(data, len);
+}
+
+// Keys are formed in the same way as in memcached. Table names don't
+// contain the separator, so the first one splits the table from the key.
+static const std::string RECORD_KEY_SEPARATOR = "\\\\";
+
+static std::string record_key_for(const std::string& table,
+                                  const std::string& key)
+{
+  return table + RECORD_KEY_SEPARATOR + key;
+}
+
+// Copies part of one file to the end of another.
+static bool copy_range(int from_fd,
+                       uint64_t offset,
+                       uint64_t length,
+                       int to_fd,
+                       std::vector<char>& buffer)
+{
+  buffer.resize(length);
+  uint64_t done = 0;
+
+  while (done < length)
+  {
+    ssize_t rc = pread(from_fd, buffer.data() + done, length - done, offset + done);
+
+    if ((rc < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    else if (rc <= 0)
+    {
+      return false;
+    }
+
+    done += rc;
+  }
+
+  return IndexedFile::write_all(to_fd, buffer.data(), length);
+}
+
+LogStructuredStore::LogStructuredStore(const std::string& path,
+                                       int compact_interval_ms) :
+  _path(path),
+  _compact_interval_ms(compact_interval_ms),
+  _fd(-1),
+  _map(nullptr),
+  _capacity(0),
+  _tail(0),
+  _live_bytes(0),
+  _next_cas(1),
+  _terminated(false)
+{
+}
+
+LogStructuredStore::~LogStructuredStore()
+{
+  stop();
+
+  // Get the log onto disk before we let go of it, rather than leaving it to
+  // the kernel's writeback.
+  if (_map != nullptr)
+  {
+    msync(_map, _tail, MS_SYNC);
+  }
+
+  unmap();
+
+  if (_fd != -1)
+  {
+    fsync(_fd);
+    close(_fd);
+  }
+}
+
+bool LogStructuredStore::open()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  _fd = ::open(_path.c_str(), O_RDWR | O_CREAT, 0600);
+
+  if (_fd == -1)
+  {
+    TRC_ERROR("Failed to open IMPU store log %s: %s",
+              _path.c_str(), strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(_fd, &st) != 0)
+  {
+    TRC_ERROR("Failed to stat IMPU store log %s: %s",
+              _path.c_str(), strerror(errno));
+    return false;
+  }
+
+  if (st.st_size == 0)
+  {
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+
+    if (!IndexedFile::write_all(_fd, &header, sizeof(header)))
+    {
+      TRC_ERROR("Failed to write to IMPU store log %s: %s",
+                _path.c_str(), strerror(errno));
+      return false;
+    }
+
+    st.st_size = sizeof(header);
+  }
+
+  if (!map(_fd, std::max((uint64_t)st.st_size, INITIAL_CAPACITY)))
+  {
+    return false;
+  }
+
+  const Header* header = (const Header*)_map;
+
+  if ((memcmp(header->magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0) ||
+      (header->version != VERSION))
+  {
+    TRC_ERROR("%s is not an IMPU store log", _path.c_str());
+    unmap();
+    return false;
+  }
+
+  return replay();
+}
+
+bool LogStructuredStore::start()
+{
+  _compactor = std::thread(&LogStructuredStore::run_compactor, this);
+
+  return true;
+}
+
+void LogStructuredStore::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_compactor_lock);
+    _terminated = true;
+  }
+
+  _compactor_cond.notify_all();
+
+  if (_compactor.joinable())
+  {
+    _compactor.join();
+  }
+}
+
+Store::Status LogStructuredStore::get_data(const std::string& table,
+                                           const std::string& key,
+                                           std::string& data,
+                                           uint64_t& cas,
+                                           SAS::TrailId trail,
+                                           bool log_body)
+{
+  int expiry;
+  return get_record(table, key, data, cas, expiry);
+}
+
+Store::Status LogStructuredStore::get_record(const std::string& table,
+                                             const std::string& key,
+                                             std::string& data,
+                                             uint64_t& cas,
+                                             int& expiry)
+{
+  std::string record_key = record_key_for(table, key);
+  int64_t now = time(NULL);
+
+  std::lock_guard<std::mutex> lock(_lock);
+
+  if (_map == nullptr)
+  {
+    return Store::Status::ERROR;
+  }
+
+  Index::iterator entry = _index.find(record_key);
+
+  if (entry == _index.end())
+  {
+    TRC_DEBUG("No record for %s", record_key.c_str());
+    return Store::Status::NOT_FOUND;
+  }
+
+  if (entry->second.expiry <= now)
+  {
+    TRC_DEBUG("Record for %s has expired", record_key.c_str());
+    remove(entry);
+    return Store::Status::NOT_FOUND;
+  }
+
+  const RecordHeader* rh = (const RecordHeader*)(_map + entry->second.offset);
+  data.assign(_map + entry->second.offset + sizeof(RecordHeader) + rh->key_len,
+              rh->data_len);
+  cas = entry->second.cas;
+  expiry = entry->second.expiry - now;
+
+  return Store::Status::OK;
+}
+
+Store::Status LogStructuredStore::set_data(const std::string& table,
+                                           const std::string& key,
+                                           const std::string& data,
+                                           uint64_t cas,
+                                           int expiry,
+                                           SAS::TrailId trail,
+                                           bool log_body)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return write(table, key, data, true, cas, expiry);
+}
+
+Store::Status LogStructuredStore::set_data_without_cas(const std::string& table,
+                                                       const std::string& key,
+                                                       const std::string& data,
+                                                       int expiry,
+                                                       SAS::TrailId trail,
+                                                       bool log_body)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return write(table, key, data, false, 0, expiry);
+}
+
+Store::Status LogStructuredStore::delete_data(const std::string& table,
+                                              const std::string& key,
+                                              SAS::TrailId trail)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return write(table, key, "", false, 0, 0);
+}
+
+bool LogStructuredStore::compact()
+{
+  std::lock_guard<std::mutex> compact_lock(_compact_lock);
+
+  // Take a copy of the index, and note where the log ends. The records up to
+  // there don't change, so we can copy them without the lock.
+  Index index;
+  uint64_t copy_tail;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if (_map == nullptr)
+    {
+      return false;
+    }
+
+    remove_expired();
+    index = _index;
+    copy_tail = _tail;
+  }
+
+  std::string tmp_path = _path + ".compact";
+  int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  if (fd == -1)
+  {
+    TRC_ERROR("Failed to open %s: %s", tmp_path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // The records are copied as they are, as they don't depend on where they
+  // are in the file. They're read from the file rather than the mapping, as
+  // the mapping can move when the log grows.
+  std::vector<char> buffer;
+  uint64_t offset = sizeof(Header);
+  bool ok = copy_range(_fd, 0, sizeof(Header), fd, buffer);
+
+  for (Index::iterator it = index.begin();
+       ok && (it != index.end());
+       ++it)
+  {
+    ok = copy_range(_fd, it->second.offset, it->second.length, fd, buffer);
+    it->second.offset = offset;
+    offset += it->second.length;
+  }
+
+  ok = ok && (fdatasync(fd) == 0);
+
+  std::lock_guard<std::mutex> lock(_lock);
+
+  // Now copy the records written since we copied the index - these are
+  // usually few, and go after the copied records.
+  uint64_t old_tail = _tail;
+  uint64_t new_tail = offset + (_tail - copy_tail);
+
+  ok = ok &&
+       (_map != nullptr) &&
+       IndexedFile::write_all(fd, _map + copy_tail, _tail - copy_tail);
+
+  // Every record in the index is either one we copied, or one written since.
+  // Each write has a new CAS, so the CAS tells us whether we copied the
+  // current version of a record.
+  Index new_index;
+  uint64_t live_bytes = 0;
+
+  for (Index::const_iterator it = _index.begin();
+       ok && (it != _index.end());
+       ++it)
+  {
+    Entry entry = it->second;
+
+    if (entry.offset >= copy_tail)
+    {
+      entry.offset = offset + (entry.offset - copy_tail);
+    }
+    else
+    {
+      Index::const_iterator copied = index.find(it->first);
+      ok = ((copied != index.end()) && (copied->second.cas == entry.cas));
+      entry.offset = ok ? copied->second.offset : 0;
+    }
+
+    new_index.emplace(it->first, entry);
+    live_bytes += entry.length;
+  }
+
+  if ((!ok) ||
+      (fsync(fd) != 0) ||
+      (rename(tmp_path.c_str(), _path.c_str()) != 0))
+  {
+    TRC_ERROR("Failed to compact IMPU store log %s: %s",
+              _path.c_str(), strerror(errno));
+    close(fd);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  TRC_STATUS("Compacted IMPU store log %s from %lu to %lu bytes",
+             _path.c_str(), old_tail, new_tail);
+
+  unmap();
+  close(_fd);
+  _fd = fd;
+  _index.swap(new_index);
+  _tail = new_tail;
+  _live_bytes = live_bytes;
+
+  if (!map(_fd, std::max(_tail * 2, INITIAL_CAPACITY)))
+  {
+    // The records are safe on disk, but we can't get at them until we're
+    // restarted.
+    _index.clear();
+    _live_bytes = 0;
+    return false;
+  }
+
+  return true;
+}
+
+void LogStructuredStore::get_keys(std::vector<std::pair<std::string, std::string>>& keys) const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  for (Index::const_iterator it = _index.begin(); it != _index.end(); ++it)
+  {
+    size_t sep = it->first.find(RECORD_KEY_SEPARATOR);
+
+    if (sep != std::string::npos)
+    {
+      keys.emplace_back(it->first.substr(0, sep),
+                        it->first.substr(sep + RECORD_KEY_SEPARATOR.size()));
+    }
+  }
+}
+
+size_t LogStructuredStore::size() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _index.size();
+}
+
+uint64_t LogStructuredStore::log_bytes() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _tail;
+}
+
+uint64_t LogStructuredStore::live_bytes() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _live_bytes;
+}
+
+Store::Status LogStructuredStore::write(const std::string& table,
+                                        const std::string& key,
+                                        const std::string& data,
+                                        bool check_cas,
+                                        uint64_t cas,
+                                        int expiry)
+{
+  if (_map == nullptr)
+  {
+    return Store::Status::ERROR;
+  }
+
+  std::string record_key = record_key_for(table, key);
+  int64_t now = time(NULL);
+
+  Index::iterator existing = _index.find(record_key);
+
+  if ((existing != _index.end()) && (existing->second.expiry <= now))
+  {
+    // The record would be dropped on replay anyway, so there's no need to
+    // log its removal.
+    remove(existing);
+    existing = _index.end();
+  }
+
+  if (check_cas)
+  {
+    // As in memcached, a CAS of 0 means the record mustn't exist yet.
+    uint64_t current_cas =
+      (existing != _index.end()) ? existing->second.cas : 0;
+
+    if (cas != current_cas)
+    {
+      TRC_DEBUG("CAS mismatch for %s (%lu, expected %lu)",
+                record_key.c_str(), cas, current_cas);
+      return Store::Status::DATA_CONTENTION;
+    }
+  }
+
+  Entry entry;
+
+  if (expiry <= 0)
+  {
+    // This is a delete, or the record has already expired. Either way, log
+    // that the record has gone, so that it isn't brought back on replay.
+    if (existing != _index.end())
+    {
+      if (!append(record_key, "", _next_cas++, 0, entry))
+      {
+        return Store::Status::ERROR;
+      }
+
+      remove(existing);
+    }
+
+    return Store::Status::OK;
+  }
+
+  if (!append(record_key, data, _next_cas++, now + expiry, entry))
+  {
+    return Store::Status::ERROR;
+  }
+
+  if (existing != _index.end())
+  {
+    _live_bytes -= existing->second.length;
+    existing->second = entry;
+  }
+  else
+  {
+    _index.emplace(record_key, entry);
+  }
+
+  _live_bytes += entry.length;
+
+  return Store::Status::OK;
+}
+
+bool LogStructuredStore::append(const std::string& record_key,
+                                const std::string& data,
+                                uint64_t cas,
+                                int64_t expiry,
+                                Entry& entry)
+{
+  uint64_t length = record_length(record_key.size(), data.size());
+
+  if (!reserve(length))
+  {
+    return false;
+  }
+
+  char* p = _map + _tail;
+  RecordHeader* rh = (RecordHeader*)p;
+  rh->magic = 0;
+  rh->cas = cas;
+  rh->expiry = expiry;
+  rh->key_len = record_key.size();
+  rh->data_len = data.size();
+
+  uint64_t offset = sizeof(RecordHeader);
+  memcpy(p + offset, record_key.data(), record_key.size());
+  offset += record_key.size();
+  memcpy(p + offset, data.data(), data.size());
+  offset += data.size();
+  memset(p + offset, 0, length - offset);
+
+  rh->checksum = checksum(p + CHECKSUM_OFFSET, length - CHECKSUM_OFFSET);
+
+  // Write the magic number last, so that if we crash part way through the
+  // record, replay stops here.
+  std::atomic_signal_fence(std::memory_order_release);
+  rh->magic = RECORD_MAGIC;
+
+  entry.offset = _tail;
+  entry.length = length;
+  entry.cas = cas;
+  entry.expiry = expiry;
+
+  _tail += length;
+
+  return true;
+}
+
+bool LogStructuredStore::reserve(uint64_t length)
+{
+  if (_tail + length <= _capacity)
+  {
+    return true;
+  }
+
+  uint64_t capacity = std::max(_capacity * 2, _tail + length);
+
+  if (ftruncate(_fd, capacity) != 0)
+  {
+    TRC_ERROR("Failed to grow IMPU store log %s to %lu bytes: %s",
+              _path.c_str(), capacity, strerror(errno));
+    return false;
+  }
+
+  void* map = mremap(_map, _capacity, capacity, MREMAP_MAYMOVE);
+
+  if (map == MAP_FAILED)
+  {
+    TRC_ERROR("Failed to remap IMPU store log %s: %s",
+              _path.c_str(), strerror(errno));
+    return false;
+  }
+
+  _map = (char*)map;
+  _capacity = capacity;
+
+  return true;
+}
+
+bool LogStructuredStore::map(int fd, uint64_t capacity)
+{
+  // Extend the file first, so that the whole mapping is backed by the file.
+  // The extension reads as zeros, which replay treats as the end of the log.
+  struct stat st;
+
+  if ((fstat(fd, &st) != 0) ||
+      (((uint64_t)st.st_size < capacity) && (ftruncate(fd, capacity) != 0)))
+  {
+    TRC_ERROR("Failed to size IMPU store log %s: %s",
+              _path.c_str(), strerror(errno));
+    return false;
+  }
+
+  void* map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED)
+  {
+    TRC_ERROR("Failed to map IMPU store log %s: %s",
+              _path.c_str(), strerror(errno));
+    return false;
+  }
+
+  _map = (char*)map;
+  _capacity = capacity;
+
+  return true;
+}
+
+void LogStructuredStore::unmap()
+{
+  if (_map != nullptr)
+  {
+    munmap(_map, _capacity);
+    _map = nullptr;
+    _capacity = 0;
+  }
+}
+
+bool LogStructuredStore::replay()
+{
+  uint64_t offset = sizeof(Header);
+  uint64_t replayed = 0;
+  bool torn = false;
+
+  while (offset + sizeof(RecordHeader) <= _capacity)
+  {
+    const RecordHeader* rh = (const RecordHeader*)(_map + offset);
+
+    if (rh->magic != RECORD_MAGIC)
+    {
+      // Past the last record, the file is zeros.
+      torn = (rh->magic != 0);
+      break;
+    }
+
+    uint64_t length = record_length(rh->key_len, rh->data_len);
+
+    if ((offset + length > _capacity) ||
+        (checksum(_map + offset + CHECKSUM_OFFSET, length - CHECKSUM_OFFSET) !=
+         rh->checksum))
+    {
+      torn = true;
+      break;
+    }
+
+    std::string record_key(_map + offset + sizeof(RecordHeader), rh->key_len);
+
+    if (rh->cas >= _next_cas)
+    {
+      _next_cas = rh->cas + 1;
+    }
+
+    Index::iterator existing = _index.find(record_key);
+
+    if (existing != _index.end())
+    {
+      remove(existing);
+    }
+
+    if (rh->expiry != 0)
+    {
+      Entry entry;
+      entry.offset = offset;
+      entry.length = length;
+      entry.cas = rh->cas;
+      entry.expiry = rh->expiry;
+      _index.emplace(record_key, entry);
+      _live_bytes += length;
+    }
+
+    offset += length;
+    replayed++;
+  }
+
+  _tail = offset;
+
+  if (torn)
+  {
+    // Clear out the partial record, so that none of it can be mistaken for
+    // a record once we've written over the start of it.
+    TRC_WARNING("IMPU store log %s has a torn or corrupt record at offset %lu "
+                "- discarding the rest of the log",
+                _path.c_str(), _tail);
+    memset(_map + _tail, 0, _capacity - _tail);
+  }
+
+  remove_expired();
+
+  TRC_STATUS("Replayed %lu records from IMPU store log %s - %lu live",
+             replayed, _path.c_str(), _index.size());
+
+  return true;
+}
+
+void LogStructuredStore::remove(Index::iterator entry)
+{
+  _live_bytes -= entry->second.length;
+  _index.erase(entry);
+}
+
+void LogStructuredStore::remove_expired()
+{
+  int64_t now = time(NULL);
+  Index::iterator entry = _index.begin();
+
+  while (entry != _index.end())
+  {
+    Index::iterator next = std::next(entry);
+
+    if (entry->second.expiry <= now)
+    {
+      remove(entry);
+    }
+
+    entry = next;
+  }
+}
+
+void LogStructuredStore::run_compactor()
+{
+  std::unique_lock<std::mutex> lock(_compactor_lock);
+
+  while (!_terminated)
+  {
+    _compactor_cond.wait_for(lock,
+                             std::chrono::milliseconds(_compact_interval_ms));
+
+    if (!_terminated)
+    {
+      lock.unlock();
+
+      bool needs_compacting;
+
+      {
+        std::lock_guard<std::mutex> store_lock(_lock);
+        remove_expired();
+
+        // Compact once most of the log is dead records.
+        uint64_t dead_bytes = _tail - sizeof(Header) - _live_bytes;
+        needs_compacting = ((_tail > MIN_COMPACT_BYTES) &&
+                            (dead_bytes > _live_bytes));
+      }
+
+      if (needs_compacting)
+      {
+        compact();
+      }
+
+      lock.lock();
+    }
+  }
+}
@@ -15,20 +15,33 @@
 #include <boost/filesystem.hpp>
 
 #include "accesslogger.h"
+#include "cpu_affinity.h"
 #include "log.h"
 #include "statisticsmanager.h"
 #include "load_monitor.h"
 #include "diameterstack.h"
 #include "diameter_handlers.h"
 #include "diameter_hss_connection.h"
+#include "embedded_store.h"
+#include "log_structured_store.h"
+#include "write_through_store.h"
 #include "httpstack.h"
 #include "http_handlers.h"
 #include "logger.h"
+#include "async_memcached_store.h"
 #include "memcached_cache.h"
 #include "memcachedstore.h"
+#include "flight_recorder.h"
+#include "hsprov_cache.h"
 #include "hsprov_hss_connection.h"
+#include "hsprov_snapshot.h"
 #include "hsprov_store.h"
 #include "hss_cache_processor.h"
+#include "impu_snapshot.h"
+#include "reregistration_refresher.h"
+#include "registration_dampener.h"
+#include "negative_cache.h"
+#include "sas_encoder.h"
 #include "saslogger.h"
 #include "sas.h"
 #include "sasevent.h"
@@ -67,6 +80,8 @@ struct options
   int impu_cache_ttl;
   int hss_reregistration_time;
   int reg_max_expires;
+  int hss_reregistration_jitter;
+  int hss_refresh_rate;
   std::string sprout_http_name;
   std::string scheme_unknown;
   std::string scheme_digest;
@@ -79,6 +94,10 @@ struct options
   int log_level;
   int cache_threads;
   int cassandra_threads;
+  int hsprov_cache_ttl;
+  int hsprov_cache_size;
+  std::string hsprov_snapshot_file;
+  bool hsprov_snapshot_serve;
   std::string sas_server;
   std::string sas_system_name;
   int diameter_timeout_ms;
@@ -95,6 +114,33 @@ struct options
   bool daemon;
   bool sas_signaling_if;
   bool request_shared_ifcs;
+  std::string impu_snapshot_file;
+  bool impu_snapshot_restore;
+  bool diameter_adaptive_timeout;
+  bool diameter_hedge_requests;
+  bool diameter_load_balance;
+  int slow_request_threshold_ms;
+  int slow_request_buffer_size;
+  int sas_encoder_queue_size;
+  int sas_profile_sample_percent;
+  int sas_profile_max_size;
+  int impu_store_event_loops;
+  int lookup_record_lifetime;
+  int impi_mapping_buckets;
+  int associated_impu_chunk_size;
+  bool associated_impu_chunk_hash_tags;
+  int wildcard_index_size;
+  std::string http_cpus;
+  std::string cache_cpus;
+  std::string cassandra_cpus;
+  std::string diameter_cpus;
+  int embedded_impu_store_size;
+  std::string impu_store_log;
+  bool impu_store_log_only;
+  int reg_dampening_window_ms;
+  int reg_dampening_max_sars;
+  int negative_cache_ttl;
+  int negative_cache_size;
 };
 
 // Enum for option types not assigned short-forms
@@ -124,7 +170,40 @@ enum OptionTypes
   PIDFILE,
   DAEMON,
   REG_MAX_EXPIRES,
-  CASSANDRA_THREADS
+  CASSANDRA_THREADS,
+  IMPU_SNAPSHOT_FILE,
+  IMPU_SNAPSHOT_RESTORE,
+  HSS_REREGISTRATION_JITTER,
+  HSS_REFRESH_RATE,
+  DIAMETER_ADAPTIVE_TIMEOUT,
+  DIAMETER_HEDGE_REQUESTS,
+  DIAMETER_LOAD_BALANCE,
+  HSPROV_CACHE_TTL,
+  HSPROV_CACHE_SIZE,
+  HSPROV_SNAPSHOT_FILE,
+  HSPROV_SNAPSHOT_SERVE,
+  SLOW_REQUEST_THRESHOLD,
+  SLOW_REQUEST_BUFFER_SIZE,
+  SAS_ENCODER_QUEUE_SIZE,
+  SAS_PROFILE_SAMPLE_PERCENT,
+  SAS_PROFILE_MAX_SIZE,
+  IMPU_STORE_EVENT_LOOPS,
+  LOOKUP_RECORD_LIFETIME,
+  IMPI_MAPPING_BUCKETS,
+  ASSOCIATED_IMPU_CHUNK_SIZE,
+  ASSOCIATED_IMPU_CHUNK_HASH_TAGS,
+  WILDCARD_INDEX_SIZE,
+  HTTP_CPUS,
+  CACHE_CPUS,
+  CASSANDRA_CPUS,
+  DIAMETER_CPUS,
+  EMBEDDED_IMPU_STORE_SIZE,
+  IMPU_STORE_LOG,
+  IMPU_STORE_LOG_ONLY,
+  REG_DAMPENING_WINDOW_MS,
+  REG_DAMPENING_MAX_SARS,
+  NEGATIVE_CACHE_TTL,
+  NEGATIVE_CACHE_SIZE
 };
 
 const static struct option long_opt[] =
@@ -138,6 +217,10 @@ const static struct option long_opt[] =
   {"cache-threads",               required_argument, NULL, 'u'},
   {"cassandra-threads",           required_argument, NULL, CASSANDRA_THREADS},
   {"cassandra",                   required_argument, NULL, 'S'},
+  {"hsprov-cache-ttl",            required_argument, NULL, HSPROV_CACHE_TTL},
+  {"hsprov-cache-size",           required_argument, NULL, HSPROV_CACHE_SIZE},
+  {"hsprov-snapshot-file",        required_argument, NULL, HSPROV_SNAPSHOT_FILE},
+  {"hsprov-snapshot-serve",       no_argument,       NULL, HSPROV_SNAPSHOT_SERVE},
   {"local-site-name",             required_argument, NULL, LOCAL_SITE_NAME},
   {"impu-stores",                 required_argument, NULL, 'M'},
   {"dest-realm",                  required_argument, NULL, 'D'},
@@ -148,6 +231,8 @@ const static struct option long_opt[] =
   {"impu-cache-ttl",              required_argument, NULL, 'i'},
   {"hss-reregistration-time",     required_argument, NULL, 'I'},
   {"reg-max-expires",             required_argument, NULL, REG_MAX_EXPIRES},
+  {"hss-reregistration-jitter",   required_argument, NULL, HSS_REREGISTRATION_JITTER},
+  {"hss-refresh-rate",            required_argument, NULL, HSS_REFRESH_RATE},
   {"sprout-http-name",            required_argument, NULL, 'j'},
   {"scheme-unknown",              required_argument, NULL, SCHEME_UNKNOWN},
   {"scheme-digest",               required_argument, NULL, SCHEME_DIGEST},
@@ -156,6 +241,9 @@ const static struct option long_opt[] =
   {"access-log",                  required_argument, NULL, 'a'},
   {"sas",                         required_argument, NULL, SAS_CONFIG},
   {"diameter-timeout-ms",         required_argument, NULL, DIAMETER_TIMEOUT_MS},
+  {"diameter-adaptive-timeout",   no_argument,       NULL, DIAMETER_ADAPTIVE_TIMEOUT},
+  {"diameter-hedge-requests",     no_argument,       NULL, DIAMETER_HEDGE_REQUESTS},
+  {"diameter-load-balance",       no_argument,       NULL, DIAMETER_LOAD_BALANCE},
   {"log-file",                    required_argument, NULL, 'F'},
   {"log-level",                   required_argument, NULL, 'L'},
   {"help",                        no_argument,       NULL, 'h'},
@@ -172,6 +260,30 @@ const static struct option long_opt[] =
   {"daemon",                      no_argument,       NULL, DAEMON},
   {"sas-use-signaling-interface", no_argument,       NULL, SAS_USE_SIGNALING_IF},
   {"request-shared-ifcs",         no_argument,       NULL, REQUEST_SHARED_IFCS},
+  {"impu-snapshot-file",          required_argument, NULL, IMPU_SNAPSHOT_FILE},
+  {"impu-snapshot-restore",       no_argument,       NULL, IMPU_SNAPSHOT_RESTORE},
+  {"slow-request-threshold",      required_argument, NULL, SLOW_REQUEST_THRESHOLD},
+  {"slow-request-buffer-size",    required_argument, NULL, SLOW_REQUEST_BUFFER_SIZE},
+  {"sas-encoder-queue-size",      required_argument, NULL, SAS_ENCODER_QUEUE_SIZE},
+  {"sas-profile-sample-percent",  required_argument, NULL, SAS_PROFILE_SAMPLE_PERCENT},
+  {"sas-profile-max-size",        required_argument, NULL, SAS_PROFILE_MAX_SIZE},
+  {"impu-store-event-loops",      required_argument, NULL, IMPU_STORE_EVENT_LOOPS},
+  {"lookup-record-lifetime",      required_argument, NULL, LOOKUP_RECORD_LIFETIME},
+  {"impi-mapping-buckets",        required_argument, NULL, IMPI_MAPPING_BUCKETS},
+  {"associated-impu-chunk-size",  required_argument, NULL, ASSOCIATED_IMPU_CHUNK_SIZE},
+  {"associated-impu-chunk-hash-tags", no_argument,   NULL, ASSOCIATED_IMPU_CHUNK_HASH_TAGS},
+  {"wildcard-index-size",         required_argument, NULL, WILDCARD_INDEX_SIZE},
+  {"http-cpus",                   required_argument, NULL, HTTP_CPUS},
+  {"cache-cpus",                  required_argument, NULL, CACHE_CPUS},
+  {"cassandra-cpus",              required_argument, NULL, CASSANDRA_CPUS},
+  {"diameter-cpus",               required_argument, NULL, DIAMETER_CPUS},
+  {"embedded-impu-store-size",    required_argument, NULL, EMBEDDED_IMPU_STORE_SIZE},
+  {"impu-store-log",              required_argument, NULL, IMPU_STORE_LOG},
+  {"impu-store-log-only",         no_argument,       NULL, IMPU_STORE_LOG_ONLY},
+  {"reg-dampening-window-ms",     required_argument, NULL, REG_DAMPENING_WINDOW_MS},
+  {"reg-dampening-max-sars",      required_argument, NULL, REG_DAMPENING_MAX_SARS},
+  {"negative-cache-ttl",          required_argument, NULL, NEGATIVE_CACHE_TTL},
+  {"negative-cache-size",         required_argument, NULL, NEGATIVE_CACHE_SIZE},
   {NULL,                          0,                 NULL, 0},
 };
 
@@ -179,6 +291,10 @@ static std::string options_description = "l:r:c:H:t:u:S:D:d:p:s:i:I:a:F:L:h";
 
 static const std::string HTTP_MGMT_SOCKET_PATH = "/tmp/homestead-http-mgmt-socket";
 static const int NUM_HTTP_MGMT_THREADS = 5;
+static const unsigned int REREGISTRATION_REFRESH_QUEUE_SIZE = 10000;
+static const size_t REGISTRATION_DAMPENER_MAX_ENTRIES = 100000;
+static const size_t IMPU_SNAPSHOT_MAX_KEYS = 1000000;
+static const int DIAMETER_MIN_TIMEOUT_MS = 20;
 
 void usage(void)
 {
@@ -191,6 +307,17 @@ void usage(void)
        " -t, --http-threads N       Number of HTTP threads (default: 1)\n"
        " -u, --cache-threads N      Number of cache threads (default: 50)\n"
        "     --cassandra-threads N  Number of cassandra threads (default: 10)\n"
+       "     --hsprov-cache-ttl <secs>\n"
+       "                            Cache auth vectors and registration data read from Homestead-prov\n"
+       "                            for this long (default: 0, meaning no caching)\n"
+       "     --hsprov-cache-size N  Maximum number of auth vectors, and of sets of registration data,\n"
+       "                            to cache from Homestead-prov (default: 10000)\n"
+       "     --hsprov-snapshot-file <file>\n"
+       "                            Snapshot file for the Homestead-prov keyspace. The keyspace is\n"
+       "                            exported to this file over the management API\n"
+       "     --hsprov-snapshot-serve\n"
+       "                            Serve Homestead-prov data from the snapshot file rather than from\n"
+       "                            Cassandra\n"
        " -S, --cassandra <address>  Set the IP address or FQDN of the Cassandra database (default: 127.0.0.1 or [::1])"
        " -M  --impu-stores <site_name>=domain[:<port>][,<site_name>=<domain>:<port>,...]\n"
        "                            Enables memcached store for IMPU cache data\n"
@@ -199,6 +326,34 @@ void usage(void)
        "                            be the local site. Remote sites for\n"
        "                            geo-redundant storage are optional.\n "
        "                            (If not provided, localhost is used.)\n"
+       "     --embedded-impu-store-size N\n"
+       "                            Hold the local IMPU store in Homestead's own memory, using up to\n"
+       "                            N MB, rather than in memcached. Remote sites' IMPU stores are\n"
+       "                            still used (default: 0, meaning use memcached)\n"
+       "     --impu-store-log <file>\n"
+       "                            Keep a copy of the local IMPU store in this file, so that it\n"
+       "                            survives memcached or Homestead restarting. If the local IMPU\n"
+       "                            store has lost its data when Homestead starts, the records in the\n"
+       "                            file are restored to it. The file only holds this Homestead's\n"
+       "                            writes, so this is only for deployments with a single Homestead,\n"
+       "                            and can't be used with remote IMPU stores\n"
+       "     --impu-store-log-only\n"
+       "                            Use the --impu-store-log file as the local IMPU store by itself\n"
+       "     --reg-dampening-window-ms N\n"
+       "                            Once a subscriber has re-registered with the HSS\n"
+       "                            --reg-dampening-max-sars times within N ms, answer its further\n"
+       "                            re-registrations in that time from the cache, even if they don't\n"
+       "                            allow cached responses (default: 0, meaning never)\n"
+       "     --reg-dampening-max-sars N\n"
+       "                            The number of registration SARs allowed for a subscriber in each\n"
+       "                            --reg-dampening-window-ms (default: 1)\n"
+       "     --negative-cache-ttl <secs>\n"
+       "                            When the HSS says it doesn't know a subscriber, reject the same\n"
+       "                            request for them for this long without asking the HSS again. A\n"
+       "                            newly provisioned subscriber may be rejected for up to this long\n"
+       "                            (default: 0, meaning no caching)\n"
+       "     --negative-cache-size N\n"
+       "                            Maximum number of unknown subscribers to remember (default: 10000)\n"
        " -D, --dest-realm <name>    Set Destination-Realm on Cx messages\n"
        " -d, --dest-host <name>     Set Destination-Host on Cx messages\n"
        "     --hss-peer <name>      IP address of HSS to connect to (rather than resolving Destination-Realm/Destination-Host)\n"
@@ -208,6 +363,12 @@ void usage(void)
        "                            IMPU cache time-to-live in seconds (default: 0)\n"
        " -I, --hss-reregistration-time <secs>\n"
        "                            How often a RE_REGISTRATION SAR should be sent to the HSS in seconds (default: 1800)\n"
+       "     --hss-reregistration-jitter <percent>\n"
+       "                            Enables HSS offload mode. Each subscriber's RE_REGISTRATION SAR is\n"
+       "                            due up to this percentage of the HSS reregistration time early, and\n"
+       "                            is sent in the background ahead of the deadline (default: 0, disabled)\n"
+       "     --hss-refresh-rate N   Maximum rate of background RE_REGISTRATION SARs per second in HSS\n"
+       "                            offload mode (default: 100)\n"
        " -j, --http-sprout-name <name>\n"
        "                            Set HTTP address to send deregistration information from RTRs\n"
        "     --local-site-name <name>\n"
@@ -225,6 +386,17 @@ void usage(void)
        "                            system name to identify this system to SAS.  If this option isn't\n"
        "                            specified SAS is disabled\n"
        "     --diameter-timeout-ms  Length of time (in ms) before timing out a Diameter request to the HSS\n"
+       "     --diameter-adaptive-timeout\n"
+       "                            Time out MARs, UARs and LIRs to each HSS peer based on the latency\n"
+       "                            of recent requests to it, up to the --diameter-timeout-ms\n"
+       "     --diameter-hedge-requests\n"
+       "                            Resend MARs, UARs and LIRs to a second HSS peer if the first hasn't\n"
+       "                            answered within its 99th percentile latency. Implies\n"
+       "                            --diameter-adaptive-timeout. Has no effect if --dest-host is set\n"
+       "     --diameter-load-balance\n"
+       "                            Send each Cx request to the HSS peer with the fewest requests in\n"
+       "                            flight (weighted by its latency), rather than leaving the choice of\n"
+       "                            peer to the Diameter stack. Ignored if --dest-host is set\n"
        "     --target-latency-us <usecs>\n"
        "                            Target latency above which throttling applies (default: 100000)\n"
        "     --max-tokens N         Maximum number of tokens allowed in the token bucket (used by\n"
@@ -248,6 +420,65 @@ void usage(void)
        "     --dns-timeout <milliseconds>\n"
        "                            The amount of time to wait for a DNS response (default: 200)n"
        "     --request-shared-ifcs  Indicate support for Shared IFC sets in the Supported-Features AVP.\n"
+       "     --impu-snapshot-file <file>\n"
+       "                            Track the records in the local IMPU store so that they can be\n"
+       "                            snapshotted to this file, on shutdown or over the management API\n"
+       "     --impu-snapshot-restore\n"
+       "                            Restore the local IMPU store from the snapshot file on startup\n"
+       "     --slow-request-threshold <milliseconds>\n"
+       "                            Record the stage timeline of requests that take at least this long,\n"
+       "                            for retrieval over the management API (default: 0, meaning none)\n"
+       "     --slow-request-buffer-size N\n"
+       "                            Number of slow requests to keep (default: 256)\n"
+       "     --sas-encoder-queue-size N\n"
+       "                            Maximum number of SAS events carrying service profiles waiting to\n"
+       "                            be compressed in the background. Further events are dropped\n"
+       "                            (default: 1000)\n"
+       "     --sas-profile-sample-percent <percent>\n"
+       "                            Percentage of SAS trails on which service profiles are logged\n"
+       "                            (default: 100)\n"
+       "     --sas-profile-max-size <bytes>\n"
+       "                            Truncate service profiles logged to SAS to this size (default: 0,\n"
+       "                            meaning no limit)\n"
+       "     --impu-store-event-loops N\n"
+       "                            Read IRSs from a memcached IMPU store on N event loop threads, which\n"
+       "                            don't block waiting for each read, rather than on the cache threads\n"
+       "                            (default: 0, meaning reads are done on the cache threads). An IRS's\n"
+       "                            associated IMPU chunks are then read, and unless there's an IMPU\n"
+       "                            store log, written, in one batch\n"
+       "     --lookup-record-lifetime N\n"
+       "                            Keep the associated IMPU and IMPI mapping records in the IMPU store\n"
+       "                            for N times the lifetime of their IRS, so that they needn't be\n"
+       "                            rewritten each time the IRS is refreshed (default: 1)\n"
+       "     --impi-mapping-buckets N\n"
+       "                            Split the mapping from each IMPI to its IRSs into N records in the\n"
+       "                            IMPU store, so that IMPIs with many IRSs don't have one large record\n"
+       "                            (default: 0, meaning mappings aren't split). Homesteads that don't\n"
+       "                            split mappings don't read split ones, so set this on every\n"
+       "                            Homestead in the deployment\n"
+       "     --associated-impu-chunk-size N\n"
+       "                            Store the associated IMPUs of IRSs with more than N of them in\n"
+       "                            separate chunk records in the IMPU store, so that only the chunks\n"
+       "                            that change are rewritten (default: 0, meaning they aren't chunked).\n"
+       "                            Only set this once every Homestead in the deployment can read\n"
+       "                            chunked associated IMPUs\n"
+       "     --associated-impu-chunk-hash-tags\n"
+       "                            Key each IRS's associated IMPU chunks with a {...} hash tag of its\n"
+       "                            default IMPU record's key, so that a memcached proxy that hashes on\n"
+       "                            tags places them on the same server, and they are read and written\n"
+       "                            in one batch. Existing chunks move to the new keys the next time\n"
+       "                            their IRS is written. Only set this once every Homestead in the\n"
+       "                            deployment can read hash-tagged chunks\n"
+       "     --wildcard-index-size N\n"
+       "                            Remember up to N wildcarded IMPUs seen in the cache, so that a request\n"
+       "                            for an uncached IMPU matching one of them is served from the wildcard's\n"
+       "                            IRS (default: 0, meaning uncached IMPUs always go to the HSS)\n"
+       "     --http-cpus <cpus>     Run the signaling HTTP threads on these CPUs, e.g. 0-3,8 or node0\n"
+       "                            for the CPUs on NUMA node 0 (default: any CPU)\n"
+       "     --cache-cpus <cpus>    Run the cache threads on these CPUs (default: any CPU)\n"
+       "     --cassandra-cpus <cpus>\n"
+       "                            Run the Cassandra threads on these CPUs (default: any CPU)\n"
+       "     --diameter-cpus <cpus> Run the Diameter stack's threads on these CPUs (default: any CPU)\n"
        " -F, --log-file <directory>\n"
        "                            Log to file in specified directory\n"
        " -L, --log-level N          Set log level to N (default: 4)\n"
@@ -339,6 +570,236 @@ int init_options(int argc, char**argv, struct options& options)
       options.cassandra = std::string(optarg);
       break;
 
+    case HSPROV_CACHE_TTL:
+      options.hsprov_cache_ttl = atoi(optarg);
+      if (options.hsprov_cache_ttl < 0)
+      {
+        TRC_ERROR("Invalid --hsprov-cache-ttl option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Homestead-prov cache TTL: %s", optarg);
+      break;
+
+    case HSPROV_CACHE_SIZE:
+      options.hsprov_cache_size = atoi(optarg);
+      if (options.hsprov_cache_size <= 0)
+      {
+        TRC_ERROR("Invalid --hsprov-cache-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Homestead-prov cache size: %s", optarg);
+      break;
+
+    case HSPROV_SNAPSHOT_FILE:
+      TRC_INFO("Homestead-prov snapshot file: %s", optarg);
+      options.hsprov_snapshot_file = std::string(optarg);
+      break;
+
+    case HSPROV_SNAPSHOT_SERVE:
+      TRC_INFO("Homestead-prov data will be served from the snapshot file");
+      options.hsprov_snapshot_serve = true;
+      break;
+
+    case SLOW_REQUEST_THRESHOLD:
+      options.slow_request_threshold_ms = atoi(optarg);
+      if (options.slow_request_threshold_ms < 0)
+      {
+        TRC_ERROR("Invalid --slow-request-threshold option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Slow request threshold: %s ms", optarg);
+      break;
+
+    case SLOW_REQUEST_BUFFER_SIZE:
+      options.slow_request_buffer_size = atoi(optarg);
+      if (options.slow_request_buffer_size <= 0)
+      {
+        TRC_ERROR("Invalid --slow-request-buffer-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Slow request buffer size: %s", optarg);
+      break;
+
+    case SAS_ENCODER_QUEUE_SIZE:
+      options.sas_encoder_queue_size = atoi(optarg);
+      if (options.sas_encoder_queue_size <= 0)
+      {
+        TRC_ERROR("Invalid --sas-encoder-queue-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("SAS encoder queue size: %s", optarg);
+      break;
+
+    case SAS_PROFILE_SAMPLE_PERCENT:
+      options.sas_profile_sample_percent = atoi(optarg);
+      if ((options.sas_profile_sample_percent < 0) ||
+          (options.sas_profile_sample_percent > 100))
+      {
+        TRC_ERROR("Invalid --sas-profile-sample-percent option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("SAS profile sample percentage: %s%%", optarg);
+      break;
+
+    case SAS_PROFILE_MAX_SIZE:
+      options.sas_profile_max_size = atoi(optarg);
+      if (options.sas_profile_max_size < 0)
+      {
+        TRC_ERROR("Invalid --sas-profile-max-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("SAS profile maximum size: %s bytes", optarg);
+      break;
+
+    case IMPU_STORE_EVENT_LOOPS:
+      options.impu_store_event_loops = atoi(optarg);
+      if (options.impu_store_event_loops < 0)
+      {
+        TRC_ERROR("Invalid --impu-store-event-loops option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("IMPU store event loops: %s", optarg);
+      break;
+
+    case LOOKUP_RECORD_LIFETIME:
+      options.lookup_record_lifetime = atoi(optarg);
+      if (options.lookup_record_lifetime < 1)
+      {
+        TRC_ERROR("Invalid --lookup-record-lifetime option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Lookup record lifetime: %s", optarg);
+      break;
+
+    case IMPI_MAPPING_BUCKETS:
+      options.impi_mapping_buckets = atoi(optarg);
+      if (options.impi_mapping_buckets < 0)
+      {
+        TRC_ERROR("Invalid --impi-mapping-buckets option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("IMPI mapping buckets: %s", optarg);
+      break;
+
+    case ASSOCIATED_IMPU_CHUNK_SIZE:
+      options.associated_impu_chunk_size = atoi(optarg);
+      if (options.associated_impu_chunk_size < 0)
+      {
+        TRC_ERROR("Invalid --associated-impu-chunk-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Associated IMPU chunk size: %s", optarg);
+      break;
+
+    case ASSOCIATED_IMPU_CHUNK_HASH_TAGS:
+      TRC_INFO("Associated IMPU chunks will be keyed with hash tags");
+      options.associated_impu_chunk_hash_tags = true;
+      break;
+
+    case WILDCARD_INDEX_SIZE:
+      options.wildcard_index_size = atoi(optarg);
+      if (options.wildcard_index_size < 0)
+      {
+        TRC_ERROR("Invalid --wildcard-index-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Wildcard index size: %s", optarg);
+      break;
+
+    case EMBEDDED_IMPU_STORE_SIZE:
+      options.embedded_impu_store_size = atoi(optarg);
+      if (options.embedded_impu_store_size < 0)
+      {
+        TRC_ERROR("Invalid --embedded-impu-store-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Embedded IMPU store size: %s MB", optarg);
+      break;
+
+    case IMPU_STORE_LOG:
+      TRC_INFO("IMPU store log: %s", optarg);
+      options.impu_store_log = std::string(optarg);
+      break;
+
+    case IMPU_STORE_LOG_ONLY:
+      TRC_INFO("The IMPU store log will be used as the local IMPU store");
+      options.impu_store_log_only = true;
+      break;
+
+    case REG_DAMPENING_WINDOW_MS:
+      options.reg_dampening_window_ms = atoi(optarg);
+      if (options.reg_dampening_window_ms < 0)
+      {
+        TRC_ERROR("Invalid --reg-dampening-window-ms option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Registration dampening window: %s ms", optarg);
+      break;
+
+    case REG_DAMPENING_MAX_SARS:
+      options.reg_dampening_max_sars = atoi(optarg);
+      if (options.reg_dampening_max_sars < 1)
+      {
+        TRC_ERROR("Invalid --reg-dampening-max-sars option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Registration dampening max SARs: %s", optarg);
+      break;
+
+    case NEGATIVE_CACHE_TTL:
+      options.negative_cache_ttl = atoi(optarg);
+      if (options.negative_cache_ttl < 0)
+      {
+        TRC_ERROR("Invalid --negative-cache-ttl option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Negative cache TTL: %s", optarg);
+      break;
+
+    case NEGATIVE_CACHE_SIZE:
+      options.negative_cache_size = atoi(optarg);
+      if (options.negative_cache_size <= 0)
+      {
+        TRC_ERROR("Invalid --negative-cache-size option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("Negative cache size: %s", optarg);
+      break;
+
+    case HTTP_CPUS:
+    case CACHE_CPUS:
+    case CASSANDRA_CPUS:
+    case DIAMETER_CPUS:
+      {
+        cpu_set_t cpus;
+
+        if (!CpuAffinity::parse(optarg, cpus))
+        {
+          TRC_ERROR("Invalid CPU set %s", optarg);
+          return -1;
+        }
+
+        if (opt == HTTP_CPUS)
+        {
+          options.http_cpus = std::string(optarg);
+        }
+        else if (opt == CACHE_CPUS)
+        {
+          options.cache_cpus = std::string(optarg);
+        }
+        else if (opt == CASSANDRA_CPUS)
+        {
+          options.cassandra_cpus = std::string(optarg);
+        }
+        else
+        {
+          options.diameter_cpus = std::string(optarg);
+        }
+
+        TRC_INFO("Thread pool CPUs (%s): %s", long_opt[long_opt_ind].name, optarg);
+      }
+      break;
+
     case 'M':
       {
         // This option has the format
@@ -389,6 +850,27 @@ int init_options(int argc, char**argv, struct options& options)
       options.reg_max_expires = atoi(optarg);
       break;
 
+    case HSS_REREGISTRATION_JITTER:
+      options.hss_reregistration_jitter = atoi(optarg);
+      if ((options.hss_reregistration_jitter < 0) ||
+          (options.hss_reregistration_jitter > 100))
+      {
+        TRC_ERROR("Invalid --hss-reregistration-jitter option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("HSS reregistration jitter: %s%%", optarg);
+      break;
+
+    case HSS_REFRESH_RATE:
+      options.hss_refresh_rate = atoi(optarg);
+      if (options.hss_refresh_rate <= 0)
+      {
+        TRC_ERROR("Invalid --hss-refresh-rate option %s", optarg);
+        return -1;
+      }
+      TRC_INFO("HSS refresh rate: %s", optarg);
+      break;
+
     case 'j':
       TRC_INFO("Sprout HTTP name: %s", optarg);
       options.sprout_http_name = std::string(optarg);
@@ -458,6 +940,22 @@ int init_options(int argc, char**argv, struct options& options)
       options.diameter_timeout_ms = atoi(optarg);
       break;
 
+    case DIAMETER_ADAPTIVE_TIMEOUT:
+      TRC_INFO("Diameter timeouts will adapt to HSS peer latency");
+      options.diameter_adaptive_timeout = true;
+      break;
+
+    case DIAMETER_HEDGE_REQUESTS:
+      TRC_INFO("Idempotent Diameter requests will be hedged");
+      options.diameter_adaptive_timeout = true;
+      options.diameter_hedge_requests = true;
+      break;
+
+    case DIAMETER_LOAD_BALANCE:
+      TRC_INFO("Cx requests will be load balanced across HSS peers");
+      options.diameter_load_balance = true;
+      break;
+
     case DNS_SERVER:
       options.dns_servers.clear();
       Utils::split_string(std::string(optarg), ',', options.dns_servers, 0, false);
@@ -540,6 +1038,16 @@ int init_options(int argc, char**argv, struct options& options)
       options.request_shared_ifcs = true;
       break;
 
+    case IMPU_SNAPSHOT_FILE:
+      TRC_INFO("IMPU snapshot file: %s", optarg);
+      options.impu_snapshot_file = std::string(optarg);
+      break;
+
+    case IMPU_SNAPSHOT_RESTORE:
+      TRC_INFO("IMPU store will be restored from snapshot on startup");
+      options.impu_snapshot_restore = true;
+      break;
+
     case DAEMON:
     case 'F':
     case 'L':
@@ -598,6 +1106,38 @@ void signal_handler(int sig)
   abort();
 }
 
+// Dummy exception handler callback for the IMPU snapshot thread pool
+static void impu_snapshot_exception_callback(std::function<void()> callable)
+{
+}
+
+// Creates the async store that an IMPU store in memcached reads IRSs
+// through, so that the reads don't block the cache threads. If chunk_writes
+// is set, associated IMPU chunks are written through it too, in batches -
+// this mustn't be set if the IMPU store's writes need to be seen by anything
+// else, such as an IMPU store log.
+static void create_async_impu_store(ImpuStore* impu_store,
+                                    const std::string& location,
+                                    options& options,
+                                    bool chunk_writes,
+                                    std::vector<AsyncMemcachedStore*>& async_impu_stores)
+{
+  AsyncMemcachedStore* async_store =
+    new AsyncMemcachedStore(location, options.impu_store_event_loops);
+
+  if (!async_store->start())
+  {
+    TRC_ERROR("Failed to start the event loops for IMPU store %s - reading it on the cache threads",
+              location.c_str());
+    delete async_store; async_store = nullptr;
+    return;
+  }
+
+  impu_store->set_async_store(async_store);
+  impu_store->set_async_chunk_writes(chunk_writes);
+  async_impu_stores.push_back(async_store);
+}
+
 void create_memcached_cache(HssCacheProcessor*& cache_processor,
                             options& options,
                             DnsCachedResolver* dns_resolver,
@@ -606,12 +1146,14 @@ void create_memcached_cache(HssCacheProcessor*& cache_processor,
                             ImpuStore*& local_impu_store,
                             std::vector<Store*>& remote_impu_data_stores,
                             std::vector<ImpuStore*>& remote_impu_stores,
+                            std::vector<AsyncMemcachedStore*>& async_impu_stores,
                             MemcachedCache*& memcached_cache,
                             CommunicationMonitor*& astaire_comm_monitor,
                             CommunicationMonitor*& remote_astaire_comm_monitor,
                             AlarmManager* alarm_manager,
                             std::vector<std::string>& remote_impu_stores_locations,
                             std::string& impu_store_location,
+                            StatisticsManager* stats_manager,
                             int af)
 {
   astaire_comm_monitor = new CommunicationMonitor(new Alarm(alarm_manager,
@@ -633,14 +1175,117 @@ void create_memcached_cache(HssCacheProcessor*& cache_processor,
                                          af,
                                          options.astaire_blacklist_duration);
 
-  if (impu_store_location != "")
+  if ((options.embedded_impu_store_size > 0) ||
+      (options.impu_store_log_only) ||
+      (impu_store_location != ""))
   {
-    TRC_STATUS("Using local impu store: %s", impu_store_location.c_str());
-    local_impu_data_store = (Store*)new TopologyNeutralMemcachedStore(impu_store_location,
-                                                                      astaire_resolver,
-                                                                      false,
-                                                                      astaire_comm_monitor);
-    local_impu_store = new ImpuStore(local_impu_data_store);
+    LogStructuredStore* impu_store_log = nullptr;
+    bool local_store_in_memcached = false;
+
+    if (!options.impu_store_log.empty())
+    {
+      // The log only holds this node's writes, so restoring it to a store
+      // that other sites also write to would bring back records that they
+      // have changed or deleted.
+      if ((!options.impu_store_log_only) &&
+          (!remote_impu_stores_locations.empty()))
+      {
+        TRC_ERROR("--impu-store-log can't be used with remote IMPU stores");
+        TRC_STATUS("Homestead is shutting down");
+        exit(2);
+      }
+
+      TRC_STATUS("Using impu store log: %s", options.impu_store_log.c_str());
+      impu_store_log = new LogStructuredStore(options.impu_store_log);
+
+      if (!impu_store_log->open())
+      {
+        TRC_ERROR("Failed to open the IMPU store log");
+        TRC_STATUS("Homestead is shutting down");
+        exit(2);
+      }
+
+      impu_store_log->start();
+    }
+    else if (options.impu_store_log_only)
+    {
+      TRC_ERROR("--impu-store-log-only requires --impu-store-log");
+      TRC_STATUS("Homestead is shutting down");
+      exit(2);
+    }
+
+    if (options.impu_store_log_only)
+    {
+      local_impu_data_store = (Store*)impu_store_log;
+    }
+    else if (options.embedded_impu_store_size > 0)
+    {
+      TRC_STATUS("Using embedded impu store (%d MB)",
+                 options.embedded_impu_store_size);
+      EmbeddedStore* embedded_store =
+        new EmbeddedStore(((size_t)options.embedded_impu_store_size) << 20);
+      embedded_store->start();
+      local_impu_data_store = (Store*)embedded_store;
+    }
+    else
+    {
+      TRC_STATUS("Using local impu store: %s", impu_store_location.c_str());
+      local_impu_data_store = (Store*)new TopologyNeutralMemcachedStore(impu_store_location,
+                                                                        astaire_resolver,
+                                                                        false,
+                                                                        astaire_comm_monitor);
+      local_store_in_memcached = true;
+    }
+
+    if ((impu_store_log != nullptr) && (!options.impu_store_log_only))
+    {
+      // An IMPU store in memcached may be shared with the site's other
+      // Homesteads, whose writes this node's log doesn't see. We can't tell
+      // how many there are, so just warn.
+      if (local_store_in_memcached)
+      {
+        CL_HOMESTEAD_IMPU_STORE_LOG_SHARED.log();
+        TRC_WARNING("The IMPU store log only holds this node's writes - it "
+                    "must only be used with a memcached IMPU store that no "
+                    "other Homestead writes to");
+      }
+
+      // Write through to the log, and restore the records in it if the
+      // store has lost its data.
+      WriteThroughStore* write_through_store =
+        new WriteThroughStore(local_impu_data_store,
+                              impu_store_log,
+                              options.local_host);
+      uint64_t restored;
+
+      if (write_through_store->restore(restored) != Store::Status::OK)
+      {
+        TRC_ERROR("Failed to restore the IMPU store from its log");
+      }
+
+      local_impu_data_store = (Store*)write_through_store;
+    }
+
+    local_impu_store = new ImpuStore(local_impu_data_store, stats_manager, false);
+    local_impu_store->set_impi_mapping_buckets(options.impi_mapping_buckets);
+    local_impu_store->set_associated_impu_chunk_size(options.associated_impu_chunk_size);
+    local_impu_store->set_hash_tags(options.associated_impu_chunk_hash_tags);
+
+    if (options.impu_store_event_loops > 0)
+    {
+      if (local_store_in_memcached)
+      {
+        create_async_impu_store(local_impu_store,
+                                impu_store_location,
+                                options,
+                                (impu_store_log == nullptr),
+                                async_impu_stores);
+      }
+      else
+      {
+        TRC_WARNING("--impu-store-event-loops only applies to an IMPU store in memcached");
+      }
+    }
 
     for (std::vector<std::string>::iterator it = remote_impu_stores_locations.begin();
            it != remote_impu_stores_locations.end();
@@ -652,11 +1297,27 @@ void create_memcached_cache(HssCacheProcessor*& cache_processor,
                                                                              true,
                                                                              remote_astaire_comm_monitor);
         remote_impu_data_stores.push_back(remote_data_store);
-        remote_impu_stores.push_back(new ImpuStore(remote_data_store));
+        ImpuStore* remote_impu_store = new ImpuStore(remote_data_store, stats_manager, true);
+        remote_impu_store->set_impi_mapping_buckets(options.impi_mapping_buckets);
+        remote_impu_store->set_associated_impu_chunk_size(options.associated_impu_chunk_size);
+        remote_impu_store->set_hash_tags(options.associated_impu_chunk_hash_tags);
+
+        if (options.impu_store_event_loops > 0)
+        {
+          create_async_impu_store(remote_impu_store,
+                                  *it,
+                                  options,
+                                  true,
+                                  async_impu_stores);
+        }
+
+        remote_impu_stores.push_back(remote_impu_store);
       }
 
-    memcached_cache = new MemcachedCache(local_impu_store, remote_impu_stores);
-    cache_processor = new HssCacheProcessor(memcached_cache);
+    memcached_cache = new MemcachedCache(local_impu_store,
+                                         remote_impu_stores,
+                                         options.lookup_record_lifetime);
+    cache_processor = new HssCacheProcessor(memcached_cache, stats_manager);
   }
   else
   {
@@ -687,6 +1348,28 @@ int main(int argc, char**argv)
   options.cache_threads = 50;
   options.cassandra_threads = 10;
   options.cassandra = "";
+  options.hsprov_cache_ttl = 0;
+  options.hsprov_cache_size = 10000;
+  options.hsprov_snapshot_file = "";
+  options.hsprov_snapshot_serve = false;
+  options.slow_request_threshold_ms = 0;
+  options.slow_request_buffer_size = 256;
+  options.sas_encoder_queue_size = 1000;
+  options.sas_profile_sample_percent = 100;
+  options.sas_profile_max_size = 0;
+  options.impu_store_event_loops = 0;
+  options.lookup_record_lifetime = 1;
+  options.impi_mapping_buckets = 0;
+  options.associated_impu_chunk_size = 0;
+  options.associated_impu_chunk_hash_tags = false;
+  options.wildcard_index_size = 0;
+  options.embedded_impu_store_size = 0;
+  options.impu_store_log = "";
+  options.impu_store_log_only = false;
+  options.reg_dampening_window_ms = 0;
+  options.reg_dampening_max_sars = 1;
+  options.negative_cache_ttl = 0;
+  options.negative_cache_size = 10000;
   options.dest_realm = "";
   options.dest_host = "dest-host.unknown";
   options.force_hss_peer = "";
@@ -696,6 +1379,8 @@ int main(int argc, char**argv)
   options.impu_cache_ttl = 0;
   options.hss_reregistration_time = 1800;
   options.reg_max_expires = 300;
+  options.hss_reregistration_jitter = 0;
+  options.hss_refresh_rate = 100;
   options.sprout_http_name = "sprout-http-name.unknown";
   options.log_to_file = false;
   options.log_level = 0;
@@ -714,6 +1399,11 @@ int main(int argc, char**argv)
   options.daemon = false;
   options.sas_signaling_if = false;
   options.request_shared_ifcs = false;
+  options.impu_snapshot_file = "";
+  options.impu_snapshot_restore = false;
+  options.diameter_adaptive_timeout = false;
+  options.diameter_hedge_requests = false;
+  options.diameter_load_balance = false;
 
   if (init_logging_options(argc, argv, options) != 0)
   {
@@ -862,6 +1552,7 @@ int main(int argc, char**argv)
   ImpuStore* local_impu_store = nullptr;
   std::vector<Store*> remote_impu_data_stores;
   std::vector<ImpuStore*> remote_impu_stores;
+  std::vector<AsyncMemcachedStore*> async_impu_stores;
   MemcachedCache* memcached_cache = nullptr;
   CommunicationMonitor* astaire_comm_monitor = nullptr;
   CommunicationMonitor* remote_astaire_comm_monitor = nullptr;
@@ -875,18 +1566,57 @@ int main(int argc, char**argv)
                          local_impu_store,
                          remote_impu_data_stores,
                          remote_impu_stores,
+                         async_impu_stores,
                          memcached_cache,
                          astaire_comm_monitor,
                          remote_astaire_comm_monitor,
                          alarm_manager,
                          remote_impu_stores_locations,
                          impu_store_location,
+                         stats_manager,
                          af);
 
+  if (!options.impu_snapshot_file.empty())
+  {
+    local_impu_store->enable_key_tracking(IMPU_SNAPSHOT_MAX_KEYS);
+
+    // Restore before we start taking traffic, so that subscribers don't all
+    // need to re-register against the HSS.
+    if (options.impu_snapshot_restore)
+    {
+      if (boost::filesystem::exists(options.impu_snapshot_file))
+      {
+        uint64_t restored = 0;
+        Store::Status status = ImpuSnapshot::restore(local_impu_store,
+                                                     options.impu_snapshot_file,
+                                                     options.cache_threads,
+                                                     0,
+                                                     restored);
+        if (status != Store::Status::OK)
+        {
+          TRC_ERROR("Failed to restore the IMPU store from %s",
+                    options.impu_snapshot_file.c_str());
+        }
+      }
+      else
+      {
+        TRC_WARNING("No IMPU snapshot at %s to restore from",
+                    options.impu_snapshot_file.c_str());
+      }
+    }
+  }
+
   HssCacheTask::configure_cache(cache_processor);
-  bool started = cache_processor->start_threads(options.cache_threads,
-                                                exception_handler,
-                                                0);
+  bool started;
+
+  {
+    // Threads inherit the CPU affinity of the thread that starts them.
+    CpuAffinity::Scope affinity(options.cache_cpus);
+    started = cache_processor->start_threads(options.cache_threads,
+                                             exception_handler,
+                                             0);
+  }
+
   if (!started)
   {
     CL_HOMESTEAD_CACHE_INIT_FAIL.log();
@@ -895,7 +1625,37 @@ int main(int argc, char**argv)
     exit(2);
   }
 
+  // If configured, the cache remembers the wildcarded IMPUs it sees, and
+  // looks up uncached IMPUs by the wildcard they match.
+  WildcardIndex* wildcard_index = NULL;
+
+  if (options.wildcard_index_size > 0)
+  {
+    wildcard_index = new WildcardIndex(options.wildcard_index_size);
+    memcached_cache->set_wildcard_index(wildcard_index);
+  }
+
   HssCacheTask::configure_health_checker(hc);
+  HssCacheTask::configure_stats(stats_manager);
+
+  // Only keep track of slow requests if asked to.
+  FlightRecorder* flight_recorder = nullptr;
+
+  if (options.slow_request_threshold_ms > 0)
+  {
+    flight_recorder = new FlightRecorder(options.slow_request_threshold_ms,
+                                         options.slow_request_buffer_size);
+  }
+
+  HssCacheTask::configure_flight_recorder(flight_recorder);
+
+  // Compress the service profiles in SAS events off the request threads.
+  SasEncoder* sas_encoder = new SasEncoder(options.sas_encoder_queue_size,
+                                           options.sas_profile_sample_percent,
+                                           options.sas_profile_max_size,
+                                           stats_manager);
+  sas_encoder->start();
+  HssCacheTask::configure_sas_encoder(sas_encoder);
 
   HttpConnection* http = new HttpConnection(options.sprout_http_name,
                                             false,
@@ -904,6 +1664,9 @@ int main(int argc, char**argv)
                                             NULL);
   SproutConnection* sprout_conn = new SproutConnection(http);
   HssConnection::HssConnection* hss_conn = nullptr;
+  PeerLatencyTracker* hss_latency_tracker = nullptr;
+  TimerQueue* hss_hedge_timer = nullptr;
+  PeerSelector* hss_peer_selector = nullptr;
   RegistrationTerminationTask::Config* rtr_config = nullptr;
   PushProfileTask::Config* ppr_config = nullptr;
   Diameter::SpawningHandler<RegistrationTerminationTask, RegistrationTerminationTask::Config>* rtr_task = nullptr;
@@ -911,6 +1674,8 @@ int main(int argc, char**argv)
   Cx::Dictionary* dict = nullptr;
   Diameter::Stack* diameter_stack = nullptr;
   HsProvStore* hs_prov_store = nullptr;
+  HsProvCache* hs_prov_cache = nullptr;
+  HsProvSnapshotStore* hs_prov_snapshot_store = nullptr;
   CassandraResolver* cassandra_resolver = nullptr;
 
   // We need the record to last twice the HSS Re-registration
@@ -929,6 +1694,8 @@ int main(int argc, char**argv)
 
     try
     {
+      // The Diameter stack's threads are created while this is in scope.
+      CpuAffinity::Scope affinity(options.diameter_cpus);
       diameter_stack->initialize();
       diameter_stack->configure(options.diameter_conf,
                                 exception_handler,
@@ -962,72 +1729,129 @@ int main(int argc, char**argv)
       exit(2);
     }
 
+    if (options.diameter_adaptive_timeout)
+    {
+      hss_latency_tracker = new PeerLatencyTracker(DIAMETER_MIN_TIMEOUT_MS,
+                                                   options.diameter_timeout_ms);
+    }
+
+    if (options.diameter_hedge_requests)
+    {
+      hss_hedge_timer = new TimerQueue();
+      hss_hedge_timer->start();
+    }
+
+    if (options.diameter_load_balance)
+    {
+      hss_peer_selector = new PeerSelector(options.diameter_timeout_ms);
+    }
+
     hss_conn = new HssConnection::DiameterHssConnection(stats_manager,
                                                         dict,
                                                         diameter_stack,
                                                         options.dest_realm.empty() ? options.home_domain : options.dest_realm,
                                                         options.dest_host == "0.0.0.0" ? "" : options.dest_host,
-                                                        options.diameter_timeout_ms);
+                                                        options.diameter_timeout_ms,
+                                                        hss_latency_tracker,
+                                                        hss_hedge_timer,
+                                                        hss_peer_selector);
 
     HssConnection::configure_cx_results_tables(mar_results_table,
                                                sar_results_table,
                                                uar_results_table,
                                                lir_results_table);
     configure_handler_cx_results_tables(ppr_results_table, rtr_results_table);
+    configure_handler_stats(stats_manager);
+    configure_handler_flight_recorder(flight_recorder);
+    configure_handler_sas_encoder(sas_encoder);
   }
   else
   {
     TRC_STATUS("No HSS configured - using Homestead-prov");
 
-    // Use a 30s black- and gray- list duration
-    cassandra_resolver = new CassandraResolver(dns_resolver,
-                                               af,
-                                               30,
-                                               30,
-                                               9160);
-
-    // Default the cassandra hostname to the loopback IP
-    if (options.cassandra == "")
+    if (options.hsprov_snapshot_serve)
     {
-      if (af == AF_INET6)
+      if (options.hsprov_snapshot_file.empty())
       {
-        options.cassandra = "[::1]";
+        TRC_ERROR("--hsprov-snapshot-serve requires --hsprov-snapshot-file");
+        TRC_STATUS("Homestead is shutting down");
+        exit(2);
       }
-      else
+
+      // Serve from the snapshot, without connecting to Cassandra.
+      hs_prov_snapshot_store = new HsProvSnapshotStore(options.hsprov_snapshot_file);
+
+      if (!hs_prov_snapshot_store->open())
       {
-        options.cassandra = "127.0.0.1";
+        TRC_ERROR("Failed to open Homestead-prov snapshot %s",
+                  options.hsprov_snapshot_file.c_str());
+        TRC_STATUS("Homestead is shutting down");
+        exit(2);
       }
+
+      hs_prov_store = hs_prov_snapshot_store;
     }
+    else
+    {
+      // Use a 30s black- and gray- list duration
+      cassandra_resolver = new CassandraResolver(dns_resolver,
+                                                 af,
+                                                 30,
+                                                 30,
+                                                 9160);
 
-    hs_prov_store = HsProvStore::get_instance();
-    hs_prov_store->configure_connection(options.cassandra,
-                                        9160,
-                                        cassandra_comm_monitor,
-                                        cassandra_resolver);
-    hs_prov_store->configure_workers(exception_handler,
-                                     options.cassandra_threads,
-                                     0);
+      // Default the cassandra hostname to the loopback IP
+      if (options.cassandra == "")
+      {
+        if (af == AF_INET6)
+        {
+          options.cassandra = "[::1]";
+        }
+        else
+        {
+          options.cassandra = "127.0.0.1";
+        }
+      }
 
-    // Test the connection to Cassandra before starting the store.
-    CassandraStore::ResultCode rc = hs_prov_store->connection_test();
+      hs_prov_store = HsProvStore::get_instance();
+      hs_prov_store->configure_connection(options.cassandra,
+                                          9160,
+                                          cassandra_comm_monitor,
+                                          cassandra_resolver);
+      hs_prov_store->configure_workers(exception_handler,
+                                       options.cassandra_threads,
+                                       0);
 
-    if (rc == CassandraStore::OK)
-    {
-      // Cassandra connection is good, so start the store.
-      rc = hs_prov_store->start();
+      // Test the connection to Cassandra before starting the store.
+      CassandraStore::ResultCode rc = hs_prov_store->connection_test();
+
+      if (rc == CassandraStore::OK)
+      {
+        // Cassandra connection is good, so start the store.
+        CpuAffinity::Scope affinity(options.cassandra_cpus);
+        rc = hs_prov_store->start();
+      }
+
+      if (rc != CassandraStore::OK)
+      {
+        CL_HOMESTEAD_CASSANDRA_INIT_FAIL.log(rc);
+        TRC_ERROR("Failed to initialize the Cassandra store with error code %d.", rc);
+        TRC_STATUS("Homestead is shutting down");
+        exit(2);
+      }
     }
 
-    if (rc != CassandraStore::OK)
+    if (options.hsprov_cache_ttl > 0)
     {
-      CL_HOMESTEAD_CASSANDRA_INIT_FAIL.log(rc);
-      TRC_ERROR("Failed to initialize the Cassandra store with error code %d.", rc);
-      TRC_STATUS("Homestead is shutting down");
-      exit(2);
+      hs_prov_cache = new HsProvCache(options.hsprov_cache_ttl,
+                                      options.hsprov_cache_size,
+                                      stats_manager);
     }
 
     hss_conn = new HssConnection::HsProvHssConnection(stats_manager,
                                                       hs_prov_store,
-                                                      options.server_name);
+                                                      options.server_name,
+                                                      hs_prov_cache);
   }
 
   // Common setup
@@ -1037,6 +1861,16 @@ int main(int argc, char**argv)
 
   HssCacheTask::configure_hss_connection(hss_conn, options.server_name);
 
+  NegativeCache* negative_cache = NULL;
+
+  if (options.negative_cache_ttl > 0)
+  {
+    negative_cache = new NegativeCache(options.negative_cache_ttl,
+                                       options.negative_cache_size,
+                                       stats_manager);
+    HssCacheTask::configure_negative_cache(negative_cache);
+  }
+
   ImpiTask::Config impi_handler_config(options.scheme_unknown,
                                        options.scheme_digest,
                                        options.scheme_akav1,
@@ -1045,10 +1879,43 @@ int main(int argc, char**argv)
                                                                           options.home_domain :
                                                                           options.dest_realm);
   ImpuLocationInfoTask::Config location_info_handler_config;
+  // In HSS offload mode, re-registration SARs are sent in the background
+  // ahead of a jittered deadline, rather than when a re-registration finds
+  // the record has expired.
+  ReregistrationRefresher* reregistration_refresher = NULL;
+
+  if (hss_configured && (options.hss_reregistration_jitter > 0))
+  {
+    TRC_STATUS("HSS offload mode enabled");
+    reregistration_refresher = new ReregistrationRefresher(hss_conn,
+                                                           cache_processor,
+                                                           options.hss_reregistration_time,
+                                                           record_ttl,
+                                                           options.hss_reregistration_jitter,
+                                                           options.hss_refresh_rate,
+                                                           REREGISTRATION_REFRESH_QUEUE_SIZE);
+    reregistration_refresher->start();
+  }
+
+  // Subscribers that re-register with the HSS too often have their further
+  // re-registrations answered from the cache.
+  RegistrationDampener* registration_dampener = NULL;
+
+  if (hss_configured && (options.reg_dampening_window_ms > 0))
+  {
+    TRC_STATUS("Registration dampening enabled");
+    registration_dampener = new RegistrationDampener(options.reg_dampening_window_ms,
+                                                     options.reg_dampening_max_sars,
+                                                     REGISTRATION_DAMPENER_MAX_ENTRIES,
+                                                     stats_manager);
+  }
+
   ImpuRegDataTask::Config impu_handler_config(hss_configured,
                                               options.hss_reregistration_time,
                                               record_ttl,
-                                              options.request_shared_ifcs);
+                                              options.request_shared_ifcs,
+                                              reregistration_refresher,
+                                              registration_dampener);
 
   HttpStackUtils::PingHandler ping_handler;
   HttpStackUtils::SpawningHandler<ImpiDigestTask, ImpiTask::Config> impi_digest_handler(&impi_handler_config);
@@ -1079,7 +1946,11 @@ int main(int argc, char**argv)
                                      &impu_loc_info_handler);
     http_stack_sig->register_handler("^/impu/[^/]*/reg-data$",
                                      &impu_reg_data_handler);
-    http_stack_sig->start();
+
+    {
+      CpuAffinity::Scope affinity(options.http_cpus);
+      http_stack_sig->start();
+    }
   }
   catch (HttpStack::Exception& e)
   {
@@ -1092,6 +1963,41 @@ int main(int argc, char**argv)
 
   HttpStackUtils::SpawningHandler<ImpuReadRegDataTask, ImpuRegDataTask::Config>
     impu_read_reg_data_handler(&impu_handler_config);
+  // Snapshots requested over the management API are taken one at a time on
+  // their own thread, so they don't tie up a management HTTP thread.
+  FunctorThreadPool* impu_snapshot_pool = NULL;
+
+  if (!options.impu_snapshot_file.empty())
+  {
+    impu_snapshot_pool = new FunctorThreadPool(1,
+                                               exception_handler,
+                                               impu_snapshot_exception_callback,
+                                               0);
+
+    if (!impu_snapshot_pool->start())
+    {
+      TRC_ERROR("Failed to start the IMPU snapshot thread");
+      TRC_STATUS("Homestead is shutting down");
+      exit(2);
+    }
+  }
+
+  ImpuSnapshotTask::Config impu_snapshot_config(local_impu_store,
+                                                options.impu_snapshot_file,
+                                                options.cache_threads,
+                                                impu_snapshot_pool);
+  HttpStackUtils::SpawningHandler<ImpuSnapshotTask, ImpuSnapshotTask::Config>
+    impu_snapshot_handler(&impu_snapshot_config);
+  HsProvCacheTask::Config hsprov_cache_config(hs_prov_cache);
+  HttpStackUtils::SpawningHandler<HsProvCacheTask, HsProvCacheTask::Config>
+    hsprov_cache_handler(&hsprov_cache_config);
+  HsProvSnapshotTask::Config hsprov_snapshot_config(hs_prov_store,
+                                                    options.hsprov_snapshot_file);
+  HttpStackUtils::SpawningHandler<HsProvSnapshotTask, HsProvSnapshotTask::Config>
+    hsprov_snapshot_handler(&hsprov_snapshot_config);
+  SlowRequestsTask::Config slow_requests_config(flight_recorder);
+  HttpStackUtils::SpawningHandler<SlowRequestsTask, SlowRequestsTask::Config>
+    slow_requests_handler(&slow_requests_config);
 
   HttpStack* http_stack_mgmt = new HttpStack(NUM_HTTP_MGMT_THREADS,
                                              exception_handler,
@@ -1105,6 +2011,34 @@ int main(int argc, char**argv)
                                       &ping_handler);
     http_stack_mgmt->register_handler("^/impu/[^/]*/reg-data$",
                                       &impu_read_reg_data_handler);
+
+    if (!options.impu_snapshot_file.empty())
+    {
+      http_stack_mgmt->register_handler("^/impu-snapshot(/restore)?$",
+                                        &impu_snapshot_handler);
+    }
+
+    if (hs_prov_cache != NULL)
+    {
+      http_stack_mgmt->register_handler("^/hsprov-cache(/imp[iu]/[^/]*)?$",
+                                        &hsprov_cache_handler);
+    }
+
+    // Snapshots can only be exported when we're reading from Cassandra.
+    if ((hs_prov_store != NULL) &&
+        (hs_prov_snapshot_store == NULL) &&
+        (!options.hsprov_snapshot_file.empty()))
+    {
+      http_stack_mgmt->register_handler("^/hsprov-snapshot$",
+                                        &hsprov_snapshot_handler);
+    }
+
+    if (flight_recorder != NULL)
+    {
+      http_stack_mgmt->register_handler("^/slow-requests$",
+                                        &slow_requests_handler);
+    }
+
     http_stack_mgmt->start();
   }
   catch (HttpStack::Exception& e)
@@ -1161,6 +2095,15 @@ int main(int argc, char**argv)
               e._func, e._rc);
   }
 
+  // Let any snapshot requested over the management API finish and send its
+  // response before the management HTTP stack stops.
+  if (impu_snapshot_pool != NULL)
+  {
+    impu_snapshot_pool->stop();
+    impu_snapshot_pool->join();
+    delete impu_snapshot_pool; impu_snapshot_pool = NULL;
+  }
+
   try
   {
     http_stack_mgmt->stop();
@@ -1173,9 +2116,33 @@ int main(int argc, char**argv)
               e._func, e._rc);
   }
 
+  if (reregistration_refresher != NULL)
+  {
+    reregistration_refresher->stop();
+  }
+
   cache_processor->stop();
   cache_processor->wait_stopped();
 
+  // Snapshot the IMPU store now that we've stopped taking traffic, and the
+  // refreshes and cache writes have finished, so that it can be restored
+  // after maintenance. This reads chunks through the async IMPU stores, so
+  // must be done before they stop.
+  if (!options.impu_snapshot_file.empty())
+  {
+    uint64_t records = 0;
+    ImpuSnapshot::dump(local_impu_store,
+                       options.impu_snapshot_file,
+                       0,
+                       records);
+  }
+
+  // Any IRS reads still in flight fail once the event loops stop.
+  for (AsyncMemcachedStore* async_impu_store : async_impu_stores)
+  {
+    async_impu_store->stop();
+  }
+
   if (hss_configured)
   {
     realm_manager->stop();
@@ -1187,6 +2154,11 @@ int main(int argc, char**argv)
     delete ppr_task; ppr_task = NULL;
     delete rtr_task; rtr_task = NULL;
 
+    if (hss_hedge_timer != NULL)
+    {
+      hss_hedge_timer->stop();
+    }
+
     try
     {
       diameter_stack->stop();
@@ -1197,21 +2169,41 @@ int main(int argc, char**argv)
       CL_HOMESTEAD_DIAMETER_STOP_FAIL.log(e._func, e._rc);
       TRC_ERROR("Failed to stop Diameter stack - function %s, rc %d", e._func, e._rc);
     }
+
+    delete hss_hedge_timer; hss_hedge_timer = NULL;
+    delete hss_latency_tracker; hss_latency_tracker = NULL;
+    delete hss_peer_selector; hss_peer_selector = NULL;
   }
   else
   {
-    hs_prov_store->stop();
-    hs_prov_store->wait_stopped();
+    if (hs_prov_snapshot_store != NULL)
+    {
+      delete hs_prov_snapshot_store; hs_prov_snapshot_store = NULL;
+    }
+    else
+    {
+      hs_prov_store->stop();
+      hs_prov_store->wait_stopped();
+    }
+
+    delete hs_prov_cache; hs_prov_cache = NULL;
     delete cassandra_resolver; cassandra_resolver = NULL;
   }
 
+  // Nothing else will be logged now, so report the events still queued.
+  sas_encoder->stop();
 
+  delete reregistration_refresher; reregistration_refresher = NULL;
+  delete registration_dampener; registration_dampener = NULL;
+  delete negative_cache; negative_cache = NULL;
   delete http_resolver; http_resolver = NULL;
   delete dns_resolver; dns_resolver = NULL;
   delete sprout_conn; sprout_conn = NULL;
   delete realm_counter; realm_counter = NULL;
   delete host_counter; host_counter = NULL;
+  delete sas_encoder; sas_encoder = NULL;
   delete stats_manager; stats_manager = NULL;
+  delete flight_recorder; flight_recorder = NULL;
   delete mar_results_table; mar_results_table = NULL;
   delete sar_results_table; sar_results_table = NULL;
   delete uar_results_table; uar_results_table = NULL;
@@ -1227,6 +2219,33 @@ int main(int argc, char**argv)
 
   delete cache_processor; cache_processor = NULL;
   delete memcached_cache; memcached_cache = nullptr;
+
+  // The IMPU stores can go once nothing uses them. Deleting the local data
+  // store stops the embedded store's sweeper thread and the IMPU store log's
+  // compaction thread, if there are any, and syncs the log to disk. (A
+  // WriteThroughStore deletes the store and log under it.)
+  delete local_impu_store; local_impu_store = nullptr;
+  delete local_impu_data_store; local_impu_data_store = nullptr;
+
+  for (ImpuStore* remote_impu_store : remote_impu_stores)
+  {
+    delete remote_impu_store;
+  }
+
+  for (Store* remote_impu_data_store : remote_impu_data_stores)
+  {
+    delete remote_impu_data_store;
+  }
+
+  for (AsyncMemcachedStore* async_impu_store : async_impu_stores)
+  {
+    delete async_impu_store;
+  }
+
+  remote_impu_stores.clear();
+  remote_impu_data_stores.clear();
+  async_impu_stores.clear();
+  delete wildcard_index; wildcard_index = NULL;
   delete load_monitor; load_monitor = NULL;
 
   SAS::term();
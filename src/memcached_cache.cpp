@@ -10,7 +10,9 @@
  */
 
 #include "memcached_cache.h"
+#include <algorithm>
 #include <string>
+#include "homestead_probes.h"
 #include "homestead_xml_utils.h"
 #include "log.h"
 #include "utils.h"
@@ -24,16 +26,42 @@ ImpuStore::DefaultImpu* MemcachedImplicitRegistrationSet::create_impu(uint64_t c
   std::vector<std::string> impus = get_associated_impus();
 
   int now = time(0);
+  int64_t expiry = _ttl + now;
 
-  return new ImpuStore::DefaultImpu(_default_impu,
-                                    impus,
-                                    impis,
-                                    _registration_state,
-                                    _charging_addresses,
-                                    get_ims_sub_xml(),
-                                    cas,
-                                    _ttl + now,
-                                    store);
+  // Decide whether the lookup records need rewriting. If they're kept for
+  // longer than the IRS, they only need rewriting once they'd otherwise
+  // expire before it.
+  if (_lookup_lifetime > 1)
+  {
+    _refresh_lookups = (_lookup_expiry < expiry);
+
+    if (_refresh_lookups)
+    {
+      _lookup_expiry = now + (int64_t)_ttl * _lookup_lifetime;
+    }
+  }
+  else
+  {
+    _refresh_lookups = true;
+    _lookup_expiry = 0;
+  }
+
+  ImpuStore::DefaultImpu* impu = new ImpuStore::DefaultImpu(_default_impu,
+                                                            impus,
+                                                            impis,
+                                                            _registration_state,
+                                                            _charging_addresses,
+                                                            get_ims_sub_xml(),
+                                                            cas,
+                                                            expiry,
+                                                            store,
+                                                            _refresh_deadline,
+                                                            _lookup_expiry);
+  impu->assoc_impu_chunks = _assoc_impu_chunks;
+  impu->assoc_impu_chunk_expiry = _assoc_impu_chunk_expiry;
+  impu->assoc_impu_chunks_hash_tagged = _assoc_impu_chunks_hash_tagged;
+
+  return impu;
 }
 
 ImpuStore::DefaultImpu* MemcachedImplicitRegistrationSet::get_impu()
@@ -76,14 +104,20 @@ void set_elements(const std::vector<std::string>& updated,
                   MemcachedImplicitRegistrationSet::Data& data,
                   const std::string ignore)
 {
-  for (std::pair<const std::string, MemcachedImplicitRegistrationSet::State>& entry : data)
+  // Sort the updated elements, so that large IRSs don't take quadratic time.
+  std::vector<std::string> sorted = updated;
+  std::sort(sorted.begin(), sorted.end());
+
+  for (MemcachedImplicitRegistrationSet::Data::Entry& entry : data)
   {
-    if (!Utils::in_vector(entry.first, updated))
+    if (!std::binary_search(sorted.begin(), sorted.end(), entry.first))
     {
       entry.second = MemcachedImplicitRegistrationSet::State::DELETED;
     }
   }
 
+  std::vector<std::string> added;
+
   for (const std::string& entry : updated)
   {
     if (entry != ignore)
@@ -92,7 +126,7 @@ void set_elements(const std::vector<std::string>& updated,
 
       if (it == data.end())
       {
-        data[entry] = MemcachedImplicitRegistrationSet::State::ADDED;
+        added.push_back(entry);
       }
       else if (it->second == MemcachedImplicitRegistrationSet::State::DELETED)
       {
@@ -100,6 +134,8 @@ void set_elements(const std::vector<std::string>& updated,
       }
     }
   }
+
+  data.add_all(added, MemcachedImplicitRegistrationSet::State::ADDED);
 }
 
 void MemcachedImplicitRegistrationSet::set_ims_sub_xml(const std::string& xml)
@@ -133,12 +169,12 @@ void MemcachedImplicitRegistrationSet::set_ims_sub_xml(const std::string& xml)
 
 void MemcachedImplicitRegistrationSet::add_associated_impi(const std::string& impi)
 {
-  _impis[impi] = MemcachedImplicitRegistrationSet::State::ADDED;
+  _impis.set(impi, MemcachedImplicitRegistrationSet::State::ADDED);
 }
 
 void MemcachedImplicitRegistrationSet::delete_associated_impi(const std::string& impi)
 {
-  _impis[impi] = MemcachedImplicitRegistrationSet::State::DELETED;
+  _impis.set(impi, MemcachedImplicitRegistrationSet::State::DELETED);
 }
 
 // Merge two data sets
@@ -146,21 +182,15 @@ void MemcachedImplicitRegistrationSet::delete_associated_impi(const std::string&
 // from the data set will be makred as deleted if they are unchanged currently.
 void merge_data_sets(MemcachedImplicitRegistrationSet::Data& data, std::vector<std::string> added)
 {
-  for (const std::string &key : added)
-  {
-    MemcachedImplicitRegistrationSet::Data::iterator it = data.find(key);
-
-    if (it == data.end())
-    {
-      data[key] = MemcachedImplicitRegistrationSet::State::UNCHANGED;
-    }
-  }
+  data.add_all(added, MemcachedImplicitRegistrationSet::State::UNCHANGED);
 
   // Now mark missing ones as deleted.
-  for (MemcachedImplicitRegistrationSet::Data::value_type& pair : data)
+  std::sort(added.begin(), added.end());
+
+  for (MemcachedImplicitRegistrationSet::Data::Entry& pair : data)
   {
     bool unchanged = pair.second == MemcachedImplicitRegistrationSet::State::UNCHANGED;
-    bool not_in_vector = !Utils::in_vector(pair.first, added);
+    bool not_in_vector = !std::binary_search(added.begin(), added.end(), pair.first);
     if (unchanged && not_in_vector)
     {
       pair.second = MemcachedImplicitRegistrationSet::State::DELETED;
@@ -189,6 +219,18 @@ void MemcachedImplicitRegistrationSet::update_from_impu_from_store(ImpuStore::De
     _charging_addresses = impu->charging_addresses;
   }
 
+  if (!_refresh_deadline_set)
+  {
+    _refresh_deadline = impu->refresh_deadline;
+  }
+
+  // The lookup records and chunks are per store, so always take the store's
+  // view.
+  _lookup_expiry = impu->lookup_expiry;
+  _assoc_impu_chunks = impu->assoc_impu_chunks;
+  _assoc_impu_chunk_expiry = impu->assoc_impu_chunk_expiry;
+  _assoc_impu_chunks_hash_tagged = impu->assoc_impu_chunks_hash_tagged;
+
   // Update the IRS with the details in IMPI and Associated IMPUs
 
   // For IMPIs, the store data is equivalent to ours. We mark unknown IMPIs as
@@ -202,10 +244,7 @@ void MemcachedImplicitRegistrationSet::update_from_impu_from_store(ImpuStore::De
     // references
     state = MemcachedImplicitRegistrationSet::State::DELETED;
 
-    for (const std::string& assoc_impu : impu->associated_impus)
-    {
-      _associated_impus.emplace(assoc_impu, state);
-    }
+    _associated_impus.add_all(impu->associated_impus, state);
   }
   else
   {
@@ -216,17 +255,18 @@ void MemcachedImplicitRegistrationSet::update_from_impu_from_store(ImpuStore::De
 
     // If we are marked as not refreshed, the IMPU data from the store should be
     // considered valid, and we should mark it as unchanged, if we weren't
-    // previously aware of it.
-    merge_data_sets(_associated_impus, impu->associated_impus);
+    // previously aware of it. If the store lost the chunks holding its
+    // associated IMPUs though, it doesn't know them, so we keep ours.
+    if (!impu->assoc_impu_chunks_lost)
+    {
+      merge_data_sets(_associated_impus, impu->associated_impus);
+    }
   }
 }
 
 void delete_tracked(MemcachedImplicitRegistrationSet::Data& data)
 {
-  for (std::pair<const std::string, MemcachedImplicitRegistrationSet::State>& entry : data)
-  {
-    entry.second = MemcachedImplicitRegistrationSet::State::DELETED;
-  }
+  data.set_all(MemcachedImplicitRegistrationSet::State::DELETED);
 }
 
 void MemcachedImplicitRegistrationSet::delete_assoc_impus()
@@ -302,11 +342,59 @@ ImpuStore::ImpiMapping* MemcachedCache::get_impi_mapping_gr(const std::string& i
   return mapping;
 }
 
+void MemcachedCache::get_impu_for_impu_gr_async(const std::string& impu,
+                                                SAS::TrailId trail,
+                                                ImpuStore::impu_callback callback)
+{
+  _local_store->get_impu_async(impu,
+                               trail,
+                               [this, impu, trail, callback](ImpuStore::Impu* data)
+  {
+    if (data)
+    {
+      callback(data);
+    }
+    else
+    {
+      get_impu_from_remote_async(impu, trail, 0, callback);
+    }
+  });
+}
+
+void MemcachedCache::get_impu_from_remote_async(const std::string& impu,
+                                                SAS::TrailId trail,
+                                                size_t remote_idx,
+                                                ImpuStore::impu_callback callback)
+{
+  if (remote_idx >= _remote_stores.size())
+  {
+    callback(nullptr);
+    return;
+  }
+
+  _remote_stores[remote_idx]->get_impu_async(impu,
+                                             trail,
+                                             [this, impu, trail, remote_idx, callback](ImpuStore::Impu* data)
+  {
+    if (data)
+    {
+      callback(data);
+    }
+    else
+    {
+      get_impu_from_remote_async(impu, trail, remote_idx + 1, callback);
+    }
+  });
+}
+
 Store::Status MemcachedCache::get_implicit_registration_set_for_impu(const std::string& impu,
                                                      SAS::TrailId trail,
                                                      ImplicitRegistrationSet*& result)
 {
+  HOMESTEAD_PROBE3(cache_op_start, "get_irs", impu.c_str(), trail);
+
   ImpuStore::Impu* data = get_impu_for_impu_gr(impu, trail);
+  bool via_associated_impu = false;
 
   if (data && !data->is_default_impu())
   {
@@ -315,9 +403,107 @@ Store::Status MemcachedCache::get_implicit_registration_set_for_impu(const std::
     TRC_INFO("IMPU: %s maps to IMPU: %s", impu.c_str(), assoc_impu->default_impu.c_str());
 
     data = get_impu_for_impu_gr(assoc_impu->default_impu, trail);
+    via_associated_impu = true;
 
     delete assoc_impu;
+  }
 
+  Store::Status status = irs_from_default_impu(impu, data, via_associated_impu, result);
+
+  // If the IMPU isn't cached, it may still be in the IRS of a cached
+  // wildcard.
+  std::string wildcard;
+
+  if ((status == Store::Status::NOT_FOUND) &&
+      (wildcard_for_impu(impu, wildcard)))
+  {
+    status = get_implicit_registration_set_for_impu(wildcard, trail, result);
+
+    if (status == Store::Status::NOT_FOUND)
+    {
+      _wildcard_index->remove(wildcard);
+    }
+  }
+
+  HOMESTEAD_PROBE4(cache_op_done, "get_irs", impu.c_str(), trail, status);
+
+  return status;
+}
+
+void MemcachedCache::get_implicit_registration_set_for_impu_async(const std::string& impu,
+                                                                  SAS::TrailId trail,
+                                                                  irs_result_callback callback)
+{
+  HOMESTEAD_PROBE3(cache_op_start, "get_irs", impu.c_str(), trail);
+
+  // Called once we have the default IMPU record, or know there isn't one.
+  std::function<void(ImpuStore::Impu*, bool)> complete =
+    [this, impu, trail, callback](ImpuStore::Impu* data, bool via_associated_impu)
+  {
+    ImplicitRegistrationSet* result = nullptr;
+    Store::Status status = irs_from_default_impu(impu, data, via_associated_impu, result);
+    std::string wildcard;
+
+    if ((status == Store::Status::NOT_FOUND) &&
+        (wildcard_for_impu(impu, wildcard)))
+    {
+      get_implicit_registration_set_for_impu_async(wildcard,
+                                                   trail,
+                                                   [this, impu, trail, wildcard, callback](Store::Status status,
+                                                                                           ImplicitRegistrationSet* result)
+      {
+        if (status == Store::Status::NOT_FOUND)
+        {
+          _wildcard_index->remove(wildcard);
+        }
+
+        HOMESTEAD_PROBE4(cache_op_done, "get_irs", impu.c_str(), trail, status);
+
+        callback(status, result);
+      });
+
+      return;
+    }
+
+    HOMESTEAD_PROBE4(cache_op_done, "get_irs", impu.c_str(), trail, status);
+
+    callback(status, result);
+  };
+
+  get_impu_for_impu_gr_async(impu,
+                             trail,
+                             [this, impu, trail, complete](ImpuStore::Impu* data)
+  {
+    if (data && !data->is_default_impu())
+    {
+      ImpuStore::AssociatedImpu* assoc_impu = (ImpuStore::AssociatedImpu*)data;
+
+      TRC_INFO("IMPU: %s maps to IMPU: %s", impu.c_str(), assoc_impu->default_impu.c_str());
+
+      std::string default_impu = assoc_impu->default_impu;
+      delete assoc_impu;
+
+      get_impu_for_impu_gr_async(default_impu,
+                                 trail,
+                                 [complete](ImpuStore::Impu* default_data)
+      {
+        complete(default_data, true);
+      });
+    }
+    else
+    {
+      complete(data, false);
+    }
+  });
+}
+
+Store::Status MemcachedCache::irs_from_default_impu(const std::string& impu,
+                                                    ImpuStore::Impu* data,
+                                                    bool via_associated_impu,
+                                                    ImplicitRegistrationSet*& result)
+{
+  if (via_associated_impu)
+  {
     if (data)
     {
       // Is the target IMPU a default IMPU?
@@ -353,12 +539,79 @@ Store::Status MemcachedCache::get_implicit_registration_set_for_impu(const std::
     return Store::Status::NOT_FOUND;
   }
 
-  result = new MemcachedImplicitRegistrationSet((ImpuStore::DefaultImpu*) data);
+  MemcachedImplicitRegistrationSet* mirs =
+    new MemcachedImplicitRegistrationSet((ImpuStore::DefaultImpu*) data);
   delete data;
 
+  update_wildcard_index(mirs, false);
+  result = mirs;
+
   return Store::Status::OK;
 }
 
+bool MemcachedCache::wildcard_for_impu(const std::string& impu,
+                                       std::string& wildcard)
+{
+  if ((_wildcard_index == nullptr) ||
+      (WildcardIndex::is_wildcard(impu)) ||
+      (!_wildcard_index->match(impu, wildcard)))
+  {
+    return false;
+  }
+
+  TRC_DEBUG("IMPU %s not cached, but matches wildcard %s",
+            impu.c_str(), wildcard.c_str());
+  return true;
+}
+
+void MemcachedCache::update_wildcard_index(MemcachedImplicitRegistrationSet* irs,
+                                           bool deleted)
+{
+  if (_wildcard_index == nullptr)
+  {
+    return;
+  }
+
+  if (WildcardIndex::is_wildcard(irs->get_default_impu()))
+  {
+    if (deleted)
+    {
+      _wildcard_index->remove(irs->get_default_impu());
+    }
+    else
+    {
+      _wildcard_index->add(irs->get_default_impu());
+    }
+  }
+
+  for (const std::string& impu : irs->impus(MemcachedImplicitRegistrationSet::State::DELETED))
+  {
+    if (WildcardIndex::is_wildcard(impu))
+    {
+      _wildcard_index->remove(impu);
+    }
+  }
+
+  if (!deleted)
+  {
+    for (const std::string& impu : irs->impus(MemcachedImplicitRegistrationSet::State::UNCHANGED))
+    {
+      if (WildcardIndex::is_wildcard(impu))
+      {
+        _wildcard_index->add(impu);
+      }
+    }
+
+    for (const std::string& impu : irs->impus(MemcachedImplicitRegistrationSet::State::ADDED))
+    {
+      if (WildcardIndex::is_wildcard(impu))
+      {
+        _wildcard_index->add(impu);
+      }
+    }
+  }
+}
+
 Store::Status MemcachedCache::perform(MemcachedCache::store_action action,
                                       progress_callback progress_cb)
 {
@@ -393,6 +646,7 @@ Store::Status MemcachedCache::put_implicit_registration_set(ImplicitRegistration
   Store::Status status = Store::Status::OK;
 
   MemcachedImplicitRegistrationSet* mirs = (MemcachedImplicitRegistrationSet*)irs;
+  HOMESTEAD_PROBE3(cache_op_start, "put_irs", mirs->get_default_impu().c_str(), trail);
 
   if (mirs->has_changed())
   {
@@ -407,6 +661,13 @@ Store::Status MemcachedCache::put_implicit_registration_set(ImplicitRegistration
     progress_cb();
   }
 
+  if (status == Store::Status::OK)
+  {
+    update_wildcard_index(mirs, false);
+  }
+
+  HOMESTEAD_PROBE4(cache_op_done, "put_irs", mirs->get_default_impu().c_str(), trail, status);
+
   return status;
 }
 
@@ -417,14 +678,19 @@ Store::Status MemcachedCache::update_irs_impi_mappings(MemcachedImplicitRegistra
   Store::Status status = Store::Status::OK;
 
   // Updating the mappings needs to be CASed, as each of the IMPIs maps
-  // to an array, which may be mutated by multiple Homesteads simultaneously
+  // to an array, which may be mutated by multiple Homesteads simultaneously.
+  // If the mappings are split into buckets, we only update the bucket that
+  // holds this IRS.
+  int bucket = store->impi_mapping_bucket(irs->get_default_impu());
 
   // Remove old IMPI mappings
   for (const std::string& impi : irs->impis(MemcachedImplicitRegistrationSet::State::DELETED))
   {
     do
     {
-      ImpuStore::ImpiMapping* mapping = store->get_impi_mapping(impi, trail);
+      ImpuStore::ImpiMapping* mapping = store->get_impi_mapping_record(impi,
+                                                                       bucket,
+                                                                       trail);
 
       if (mapping)
       {
@@ -446,22 +712,35 @@ Store::Status MemcachedCache::update_irs_impi_mappings(MemcachedImplicitRegistra
       delete mapping;
 
     } while(status == Store::Status::DATA_CONTENTION);
+
+    if ((status == Store::Status::OK) && (bucket != ImpuStore::NO_BUCKET))
+    {
+      status = update_split_impi_mapping(irs, impi, 0, trail, store);
+
+      if (status != Store::Status::OK)
+      {
+        return status;
+      }
+    }
   }
 
-  // Refresh unchanged IMPIs if the IRS is being refreshed
-  if (irs->is_refreshed())
+  // Refresh unchanged IMPIs if the IRS is being refreshed, and they'd
+  // otherwise expire before it
+  if (irs->is_refreshed() && irs->refresh_lookups())
   {
     for (const std::string& impi : irs->impis(MemcachedImplicitRegistrationSet::State::UNCHANGED))
     {
+      int64_t expiry;
+
       do
       {
-        ImpuStore::ImpiMapping* mapping = store->get_impi_mapping(impi,
-                                                                  trail);
+        ImpuStore::ImpiMapping* mapping = store->get_impi_mapping_record(impi,
+                                                                         bucket,
+                                                                         trail);
 
         if (mapping)
         {
-          int now = time(0);
-          mapping->set_expiry(irs->get_ttl() + now);
+          mapping->set_expiry(irs->get_lookup_expiry(mapping->get_expiry()));
 
           // Although we believe the IMPI-IMPU mapping is unchanged,
           // in the background it may have been deleted, and re-added,
@@ -474,21 +753,34 @@ Store::Status MemcachedCache::update_irs_impi_mappings(MemcachedImplicitRegistra
         }
         else
         {
-          int now = time(0);
-          mapping = new ImpuStore::ImpiMapping(impi, irs->get_default_impu(), irs->get_ttl() + now);
+          mapping = new ImpuStore::ImpiMapping(impi,
+                                               irs->get_default_impu(),
+                                               irs->get_lookup_expiry(),
+                                               bucket);
         }
 
+        expiry = mapping->get_expiry();
         status = store->set_impi_mapping(mapping, trail);
 
         delete mapping;
       } while(status == Store::Status::DATA_CONTENTION);
+
+      if ((status == Store::Status::OK) && (bucket != ImpuStore::NO_BUCKET))
+      {
+        status = update_split_impi_mapping(irs, impi, expiry, trail, store);
+
+        if (status != Store::Status::OK)
+        {
+          return status;
+        }
+      }
     }
   }
 
   // Add new IMPIs
   for (const std::string& impi : irs->impis(MemcachedImplicitRegistrationSet::State::ADDED))
   {
-    int64_t expiry = time(0) + irs->get_ttl();
+    int64_t expiry = irs->get_lookup_expiry();
 
     // Given we think this IMPI-IMPU mapping is new, and given
     // multiple IMPI mapping to multiple IRS is rare, we assume
@@ -496,7 +788,8 @@ Store::Status MemcachedCache::update_irs_impi_mappings(MemcachedImplicitRegistra
     // perform a CAS contention resolution
     ImpuStore::ImpiMapping* mapping = new ImpuStore::ImpiMapping(impi,
                                                                  irs->get_default_impu(),
-                                                                 expiry);
+                                                                 expiry,
+                                                                 bucket);
 
     do
     {
@@ -506,10 +799,20 @@ Store::Status MemcachedCache::update_irs_impi_mappings(MemcachedImplicitRegistra
       {
         delete mapping;
 
-        mapping = store->get_impi_mapping(impi, trail);
+        mapping = store->get_impi_mapping_record(impi, bucket, trail);
+
+        if (mapping == nullptr)
+        {
+          // The mapping has been deleted since we tried to add it, so try
+          // again.
+          mapping = new ImpuStore::ImpiMapping(impi,
+                                               irs->get_default_impu(),
+                                               expiry,
+                                               bucket);
+          continue;
+        }
 
-        int now = time(0);
-        mapping->set_expiry(irs->get_ttl() + now);
+        mapping->set_expiry(irs->get_lookup_expiry(mapping->get_expiry()));
 
         if (!mapping->has_default_impu(irs->get_default_impu()))
         {
@@ -524,11 +827,108 @@ Store::Status MemcachedCache::update_irs_impi_mappings(MemcachedImplicitRegistra
       }
     } while(status == Store::Status::DATA_CONTENTION);
 
+    expiry = mapping->get_expiry();
     delete mapping;
+
+    if ((status == Store::Status::OK) && (bucket != ImpuStore::NO_BUCKET))
+    {
+      status = update_split_impi_mapping(irs, impi, expiry, trail, store);
+
+      if (status != Store::Status::OK)
+      {
+        return status;
+      }
+    }
   }
   return status;
 }
 
+Store::Status MemcachedCache::update_split_impi_mapping(MemcachedImplicitRegistrationSet* irs,
+                                                        const std::string& impi,
+                                                        int64_t bucket_expiry,
+                                                        SAS::TrailId trail,
+                                                        ImpuStore* store)
+{
+  Store::Status status;
+
+  // If the IRS was mapped before the mapping was split, it's listed in the
+  // unsplit record. It's now in its bucket, so remove it, deleting the
+  // record once it's empty as Homesteads that don't split mappings do.
+  do
+  {
+    status = Store::Status::OK;
+
+    ImpuStore::ImpiMapping* mapping =
+      store->get_impi_mapping_record(impi, ImpuStore::NO_BUCKET, trail);
+
+    if ((mapping != nullptr) &&
+        (mapping->has_default_impu(irs->get_default_impu())))
+    {
+      mapping->remove_default_impu(irs->get_default_impu());
+
+      if (mapping->is_empty())
+      {
+        status = store->delete_impi_mapping(mapping, trail);
+      }
+      else
+      {
+        status = store->set_impi_mapping(mapping, trail);
+      }
+    }
+
+    delete mapping;
+  } while (status == Store::Status::DATA_CONTENTION);
+
+  if ((status != Store::Status::OK) || (bucket_expiry == 0))
+  {
+    return status;
+  }
+
+  // Make sure the bucket count record covers our buckets, and outlives them.
+  // It's extended by twice the bucket's lifetime, so that it isn't rewritten
+  // each time an IRS for the IMPI is refreshed.
+  do
+  {
+    status = Store::Status::OK;
+
+    ImpuStore::ImpiMapping* count =
+      store->get_impi_mapping_record(impi, ImpuStore::BUCKET_COUNT, trail);
+
+    if (count == nullptr)
+    {
+      count = new ImpuStore::ImpiMapping(impi,
+                                         std::vector<std::string>(),
+                                         0L,
+                                         0L,
+                                         ImpuStore::BUCKET_COUNT);
+    }
+
+    bool changed = false;
+
+    if (count->buckets < store->impi_mapping_buckets())
+    {
+      count->buckets = store->impi_mapping_buckets();
+      changed = true;
+    }
+
+    if (count->get_expiry() < bucket_expiry)
+    {
+      int64_t now = time(0);
+      count->set_expiry(bucket_expiry + (bucket_expiry - now));
+      changed = true;
+    }
+
+    if (changed)
+    {
+      status = store->set_impi_mapping(count, trail);
+    }
+
+    delete count;
+  } while (status == Store::Status::DATA_CONTENTION);
+
+  return status;
+}
+
 Store::Status MemcachedCache::update_irs_associated_impus(MemcachedImplicitRegistrationSet* irs,
                                                           SAS::TrailId trail,
                                                           ImpuStore* store)
@@ -556,12 +956,13 @@ Store::Status MemcachedCache::update_irs_associated_impus(MemcachedImplicitRegis
     } while(status == Store::Status::DATA_CONTENTION);
   }
 
-  // Refresh unchanged associated IMPUs if the IRS is being refreshed
-  if (irs->is_refreshed())
+  // Refresh unchanged associated IMPUs if the IRS is being refreshed, and
+  // they'd otherwise expire before it
+  if (irs->is_refreshed() && irs->refresh_lookups())
   {
     for (const std::string& associated_impu : irs->impus(MemcachedImplicitRegistrationSet::State::UNCHANGED))
     {
-      int64_t expiry = time(0) + irs->get_ttl();
+      int64_t expiry = irs->get_lookup_expiry();
       ImpuStore::AssociatedImpu* impu = new ImpuStore::AssociatedImpu(associated_impu,
                                                                       irs->get_default_impu(),
                                                                       0L,
@@ -576,7 +977,7 @@ Store::Status MemcachedCache::update_irs_associated_impus(MemcachedImplicitRegis
   // Add new associated IMPUs
   for (const std::string& associated_impu : irs->impus(MemcachedImplicitRegistrationSet::State::ADDED))
   {
-    int64_t expiry = time(0) + irs->get_ttl();
+    int64_t expiry = irs->get_lookup_expiry();
     ImpuStore::AssociatedImpu* impu = new ImpuStore::AssociatedImpu(associated_impu,
                                                                     irs->get_default_impu(),
                                                                     0L,
@@ -633,7 +1034,13 @@ Store::Status perform_irs_impu_action(irs_impu_action action,
       // As we merge in remote stores, we'll get a fuller picture of the
       // data, but we don't attempt to update local stores, and just
       // assume they'll fall into place.
-      ImpuStore::Impu* mapped_impu = store->get_impu(irs->get_default_impu(), trail);
+      //
+      // A default IMPU record whose associated IMPU chunks have been lost
+      // is still returned, so that we overwrite it (and its chunks) rather
+      // than failing to add over it.
+      ImpuStore::Impu* mapped_impu = store->get_impu(irs->get_default_impu(),
+                                                     trail,
+                                                     true);
 
       if (mapped_impu == nullptr)
       {
@@ -646,7 +1053,8 @@ Store::Status perform_irs_impu_action(irs_impu_action action,
          else
          {
            // Nothing in the store representing this IMPU - just create
-           // a new one
+           // a new one. The store won't have the lookup records either.
+           irs->clear_store_state();
            impu = irs->get_impu();
            status = (store->*action)(impu, trail);
          }
@@ -665,6 +1073,7 @@ Store::Status perform_irs_impu_action(irs_impu_action action,
         // Default IMPU has changed - just overwrite it
         // This is safe to do because we've just hit a window of conflicts
         // and we know our data is better.
+        irs->clear_store_state();
         impu = irs->get_impu_from_impu(mapped_impu);
         status = (store->*action)(impu, trail);
       }
@@ -715,6 +1124,8 @@ Store::Status MemcachedCache::put_irs_action(MemcachedImplicitRegistrationSet* i
   // perfect consistency, but we should eventually get consistency
   Store::Status status;
 
+  irs->set_lookup_lifetime(_lookup_lifetime);
+
   if (irs->is_existing())
   {
     status = update_irs_impu(irs, trail, store);
@@ -767,12 +1178,14 @@ Store::Status MemcachedCache::delete_implicit_registration_set(ImplicitRegistrat
   Store::Status status = Store::Status::OK;
 
   MemcachedImplicitRegistrationSet* mirs = (MemcachedImplicitRegistrationSet*)irs;
+  HOMESTEAD_PROBE3(cache_op_start, "delete_irs", mirs->get_default_impu().c_str(), trail);
 
   if (mirs->is_existing())
   {
     store_action action =
       std::bind(&MemcachedCache::delete_irs_action, this, mirs, trail, _1);
     status = perform(action, progress_cb);
+    update_wildcard_index(mirs, true);
   }
   else
   {
@@ -784,6 +1197,8 @@ Store::Status MemcachedCache::delete_implicit_registration_set(ImplicitRegistrat
     progress_cb();
   }
 
+  HOMESTEAD_PROBE4(cache_op_done, "delete_irs", mirs->get_default_impu().c_str(), trail, status);
+
   return status;
 }
 
@@ -791,9 +1206,20 @@ Store::Status MemcachedCache::delete_implicit_registration_sets(const std::vecto
                                                                 progress_callback progress_cb,
                                                                 SAS::TrailId trail)
 {
+  // There's no single key for a batch delete, so the probes have an empty key.
+  HOMESTEAD_PROBE3(cache_op_start, "delete_irss", "", trail);
+
   store_action action =
     std::bind(&MemcachedCache::delete_irss_action, this, irss, trail, _1);
   Store::Status status = perform(action, progress_cb);
+
+  for (ImplicitRegistrationSet* irs : irss)
+  {
+    update_wildcard_index((MemcachedImplicitRegistrationSet*)irs, true);
+  }
+
+  HOMESTEAD_PROBE4(cache_op_done, "delete_irss", "", trail, status);
+
   return status;
 }
 
@@ -821,6 +1247,8 @@ Store::Status MemcachedCache::get_ims_subscription(const std::string& impi,
 {
   Store::Status status;
 
+  HOMESTEAD_PROBE3(cache_op_start, "get_ims_sub", impi.c_str(), trail);
+
   ImpuStore::ImpiMapping* mapping = get_impi_mapping_gr(impi, trail);
 
   if (mapping)
@@ -840,6 +1268,8 @@ Store::Status MemcachedCache::get_ims_subscription(const std::string& impi,
     status = Store::Status::NOT_FOUND;
   }
 
+  HOMESTEAD_PROBE4(cache_op_done, "get_ims_sub", impi.c_str(), trail, status);
+
   return status;
 }
 
@@ -847,9 +1277,14 @@ Store::Status MemcachedCache::put_ims_subscription(ImsSubscription* subscription
                                                    progress_callback progress_cb,
                                                    SAS::TrailId trail)
 {
+  HOMESTEAD_PROBE3(cache_op_start, "put_ims_sub", "", trail);
+
   store_action action =
     std::bind(&MemcachedCache::put_ims_sub_action, this, subscription, trail, _1);
   Store::Status status = perform(action, progress_cb);
+
+  HOMESTEAD_PROBE4(cache_op_done, "put_ims_sub", "", trail, status);
+
   return status;
 }
 
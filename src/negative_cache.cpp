@@ -0,0 +1,82 @@
+/**
+ * @file negative_cache.cpp Caches the HSS not knowing a subscriber
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "negative_cache.h"
+
+#include <time.h>
+
+#include "log.h"
+
+// Separates the parts of a key. None of them can contain a NUL.
+static const char KEY_SEPARATOR = '\0';
+
+NegativeCache::NegativeCache(int ttl_s,
+                             size_t max_entries,
+                             StatisticsManager* stats_manager) :
+  _ttl_s(ttl_s),
+  _stats_manager(stats_manager),
+  _unknown(max_entries)
+{
+}
+
+bool NegativeCache::is_unknown(Request request,
+                               const std::string& impi,
+                               const std::string& impu)
+{
+  bool unknown = false;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    unknown = (_unknown.get(key(request, impi, impu), time(NULL)) != NULL);
+  }
+
+  if (unknown)
+  {
+    TRC_DEBUG("HSS recently didn't know %s (%s) - reject", impu.c_str(), impi.c_str());
+
+    if (_stats_manager != NULL)
+    {
+      _stats_manager->incr_H_negative_cache_hits();
+    }
+  }
+
+  return unknown;
+}
+
+void NegativeCache::add_unknown(Request request,
+                                const std::string& impi,
+                                const std::string& impu)
+{
+  time_t now = time(NULL);
+  std::string unknown_key = key(request, impi, impu);
+
+  std::lock_guard<std::mutex> lock(_lock);
+
+  // Don't extend the TTL of an answer we already have.
+  if (_unknown.get(unknown_key, now) == NULL)
+  {
+    _unknown.put(unknown_key, true, now + _ttl_s);
+  }
+}
+
+std::string NegativeCache::key(Request request,
+                               const std::string& impi,
+                               const std::string& impu)
+{
+  std::string key;
+  key.reserve(2 + impi.length() + 1 + impu.length());
+  key.push_back('0' + request);
+  key.push_back(KEY_SEPARATOR);
+  key.append(impi);
+  key.push_back(KEY_SEPARATOR);
+  key.append(impu);
+  return key;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file peer_latency_tracker.cpp Tracks the latency of requests to each peer
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "peer_latency_tracker.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+PeerLatencyTracker::PeerLatencyTracker(int min_timeout_ms, int max_timeout_ms) :
+  _min_timeout_ms(std::min(min_timeout_ms, max_timeout_ms)),
+  _max_timeout_ms(max_timeout_ms)
+{
+}
+
+void PeerLatencyTracker::record(const std::string& peer, unsigned long latency_us)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  // Every sample counts towards all peers, as well as the peer itself.
+  add_sample(_peers[""], latency_us);
+
+  if (!peer.empty())
+  {
+    add_sample(_peers[peer], latency_us);
+  }
+}
+
+bool PeerLatencyTracker::p99_us(const std::string& peer, unsigned long& latency_us)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  std::map<std::string, Samples>::const_iterator it = _peers.find(peer);
+
+  if ((it == _peers.end()) || (it->second.count < MIN_SAMPLES))
+  {
+    return false;
+  }
+
+  latency_us = it->second.p99_us;
+  return true;
+}
+
+int PeerLatencyTracker::timeout_ms(const std::string& peer)
+{
+  unsigned long latency_us = 0;
+
+  if (!p99_us(peer, latency_us))
+  {
+    return _max_timeout_ms;
+  }
+
+  unsigned long timeout_ms = (latency_us * TIMEOUT_MULTIPLIER) / 1000;
+
+  return std::max(_min_timeout_ms,
+                  (int)std::min(timeout_ms, (unsigned long)_max_timeout_ms));
+}
+
+bool PeerLatencyTracker::choose_peers(const std::string& dest_host,
+                                      std::string& primary,
+                                      std::string& alternate)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  time_t now = time(NULL);
+  std::vector<std::string> live_peers;
+
+  for (std::map<std::string, Samples>::const_iterator it = _peers.begin();
+       it != _peers.end();
+       ++it)
+  {
+    if ((!it->first.empty()) && (is_live(it->second, now)))
+    {
+      live_peers.push_back(it->first);
+    }
+  }
+
+  if (!dest_host.empty())
+  {
+    primary = dest_host;
+  }
+  else if (!live_peers.empty())
+  {
+    primary = live_peers[rand() % live_peers.size()];
+  }
+  else
+  {
+    return false;
+  }
+
+  alternate.clear();
+  unsigned long best_us = 0;
+
+  for (const std::string& peer : live_peers)
+  {
+    unsigned long p50_us = _peers[peer].p50_us;
+
+    if ((peer != primary) && ((alternate.empty()) || (p50_us < best_us)))
+    {
+      alternate = peer;
+      best_us = p50_us;
+    }
+  }
+
+  return !alternate.empty();
+}
+
+void PeerLatencyTracker::add_sample(Samples& samples, unsigned long latency_us)
+{
+  samples.samples[samples.next] = latency_us;
+  samples.next = (samples.next + 1) % WINDOW_SIZE;
+  samples.count = std::min(samples.count + 1, WINDOW_SIZE);
+  samples.last_sample = time(NULL);
+
+  if ((++samples.since_recalc >= RECALC_INTERVAL) ||
+      (samples.count == MIN_SAMPLES))
+  {
+    recalculate(samples);
+  }
+}
+
+void PeerLatencyTracker::recalculate(Samples& samples)
+{
+  std::vector<unsigned long> sorted(samples.samples.begin(),
+                                    samples.samples.begin() + samples.count);
+
+  std::vector<unsigned long>::iterator p50 = sorted.begin() + (sorted.size() * 50) / 100;
+  std::nth_element(sorted.begin(), p50, sorted.end());
+  samples.p50_us = *p50;
+
+  std::vector<unsigned long>::iterator p99 = sorted.begin() + (sorted.size() * 99) / 100;
+  std::nth_element(sorted.begin(), p99, sorted.end());
+  samples.p99_us = *p99;
+
+  samples.since_recalc = 0;
+}
+
+bool PeerLatencyTracker::is_live(const Samples& samples, time_t now)
+{
+  return ((samples.count >= MIN_SAMPLES) &&
+          (now - samples.last_sample < PEER_EXPIRY_S));
+}
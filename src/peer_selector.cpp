@@ -0,0 +1,139 @@
+/**
+ * @file peer_selector.cpp Chooses the least loaded peer for each request
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "peer_selector.h"
+
+#include <algorithm>
+
+#include "log.h"
+
+PeerSelector::PeerSelector(int failure_penalty_ms) :
+  _failure_penalty_us(failure_penalty_ms * 1000UL),
+  _selections(0)
+{
+}
+
+std::string PeerSelector::select()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  time_t now = time(NULL);
+
+  // Forget any peers that have stopped answering.
+  for (std::map<std::string, Peer>::iterator it = _peers.begin();
+       it != _peers.end();)
+  {
+    if ((it->second.in_flight == 0) &&
+        (now - it->second.last_answer >= PEER_EXPIRY_S))
+    {
+      TRC_DEBUG("Forgetting peer %s", it->first.c_str());
+      _peers.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  if ((_peers.empty()) || (++_selections % DISCOVERY_INTERVAL == 0))
+  {
+    return "";
+  }
+
+  // Choose the peer with the lowest expected time to answer a new request,
+  // which is its average latency scaled by the requests already waiting on
+  // it.
+  std::string best_peer;
+  unsigned long best_score = 0;
+
+  for (std::map<std::string, Peer>::const_iterator it = _peers.begin();
+       it != _peers.end();
+       ++it)
+  {
+    unsigned long score = (it->second.in_flight + 1) *
+                          std::max(it->second.ewma_latency_us, 1UL);
+
+    if ((best_peer.empty()) || (score < best_score))
+    {
+      best_peer = it->first;
+      best_score = score;
+    }
+  }
+
+  return best_peer;
+}
+
+void PeerSelector::start(const std::string& peer)
+{
+  if (peer.empty())
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_lock);
+  _peers[peer].in_flight++;
+}
+
+void PeerSelector::complete(const std::string& peer,
+                            const std::string& answered_by,
+                            unsigned long latency_us,
+                            bool failed)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  if (!peer.empty())
+  {
+    std::map<std::string, Peer>::iterator it = _peers.find(peer);
+
+    if ((it != _peers.end()) && (it->second.in_flight > 0))
+    {
+      it->second.in_flight--;
+    }
+  }
+
+  // Update the latency of the peer that the request went to. If we didn't
+  // choose a peer, only learn from successful answers - a failure may have
+  // been generated locally by the Diameter stack rather than by a peer.
+  std::string target = peer;
+
+  if ((target.empty()) && (!failed))
+  {
+    target = answered_by;
+  }
+
+  if (target.empty())
+  {
+    return;
+  }
+
+  if (failed)
+  {
+    latency_us = std::max(latency_us, _failure_penalty_us);
+  }
+
+  Peer& p = _peers[target];
+
+  if (p.ewma_latency_us == 0)
+  {
+    p.ewma_latency_us = latency_us;
+  }
+  else
+  {
+    p.ewma_latency_us = p.ewma_latency_us -
+                        (p.ewma_latency_us / EWMA_WEIGHT) +
+                        (latency_us / EWMA_WEIGHT);
+  }
+
+  if (!answered_by.empty())
+  {
+    p.last_answer = time(NULL);
+  }
+}
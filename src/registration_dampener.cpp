@@ -0,0 +1,94 @@
+/**
+ * @file registration_dampener.cpp Dampens repeated re-registrations
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "registration_dampener.h"
+
+#include <time.h>
+
+#include "log.h"
+
+// Separates the public and private IDs in a key. Neither can contain a NUL.
+static const char KEY_SEPARATOR = '\0';
+
+RegistrationDampener::RegistrationDampener(int window_ms,
+                                           int max_per_window,
+                                           size_t max_entries,
+                                           StatisticsManager* stats_manager) :
+  _window_ms(window_ms),
+  _max_per_window(max_per_window),
+  _stats_manager(stats_manager),
+  _windows(max_entries)
+{
+}
+
+bool RegistrationDampener::dampen(const std::string& impu,
+                                  const std::string& impi)
+{
+  bool dampened = false;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    const Window* window = _windows.get(key(impu, impi), now_ms());
+    dampened = ((window != NULL) && (window->count >= _max_per_window));
+  }
+
+  if (dampened)
+  {
+    TRC_DEBUG("Dampening re-registration for %s (%s)",
+              impu.c_str(), impi.c_str());
+
+    if (_stats_manager != NULL)
+    {
+      _stats_manager->incr_H_reg_dampened();
+    }
+  }
+
+  return dampened;
+}
+
+void RegistrationDampener::record(const std::string& impu,
+                                  const std::string& impi)
+{
+  int64_t now = now_ms();
+  std::string window_key = key(impu, impi);
+
+  std::lock_guard<std::mutex> lock(_lock);
+  Window* window = _windows.get(window_key, now);
+
+  if (window != NULL)
+  {
+    window->count++;
+  }
+  else
+  {
+    Window new_window;
+    new_window.count = 1;
+    _windows.put(window_key, new_window, now + _window_ms);
+  }
+}
+
+std::string RegistrationDampener::key(const std::string& impu,
+                                      const std::string& impi)
+{
+  std::string key;
+  key.reserve(impu.length() + 1 + impi.length());
+  key.append(impu);
+  key.push_back(KEY_SEPARATOR);
+  key.append(impi);
+  return key;
+}
+
+int64_t RegistrationDampener::now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
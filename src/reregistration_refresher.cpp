@@ -0,0 +1,278 @@
+/**
+ * @file reregistration_refresher.cpp Background re-registration refresher
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "reregistration_refresher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "log.h"
+
+using std::placeholders::_1;
+
+ReregistrationRefresher::ReregistrationRefresher(HssConnection::HssConnection* hss,
+                                                 HssCacheProcessor* cache,
+                                                 int hss_reregistration_time,
+                                                 int record_ttl,
+                                                 int jitter_percent,
+                                                 int max_rate,
+                                                 unsigned int max_queue) :
+  _hss(hss),
+  _cache(cache),
+  _hss_reregistration_time(hss_reregistration_time),
+  _record_ttl(record_ttl),
+  _jitter((hss_reregistration_time * std::min(std::max(jitter_percent, 0), 100)) / 100),
+  _max_rate(std::max(max_rate, 1)),
+  _max_queue(max_queue),
+  _in_flight(0),
+  _terminated(false)
+{
+  // We start refreshing an IRS once a re-registration arrives within this
+  // many seconds of its deadline. It needs to be at least as big as the
+  // jitter, or the earliest deadlines would never be refreshed in the
+  // background.
+  _refresh_window = std::max(_jitter, _hss_reregistration_time / 10);
+}
+
+ReregistrationRefresher::~ReregistrationRefresher()
+{
+  stop();
+}
+
+bool ReregistrationRefresher::start()
+{
+  _thread = std::thread(&ReregistrationRefresher::run, this);
+
+  return true;
+}
+
+void ReregistrationRefresher::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _terminated = true;
+  }
+
+  _cond.notify_all();
+
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+
+  std::unique_lock<std::mutex> lock(_lock);
+
+  for (Refresh* refresh : _queue)
+  {
+    _in_progress.erase(refresh->default_impu);
+    delete refresh;
+  }
+
+  _queue.clear();
+
+  // Wait for the SARs we've already sent, and the cache updates that follow
+  // them, to call back.
+  _cond.wait(lock, [this]() { return _in_flight == 0; });
+}
+
+int64_t ReregistrationRefresher::next_deadline(int64_t now)
+{
+  // This is called on the cache threads, so each has its own generator.
+  static thread_local std::mt19937 generator(std::random_device{}());
+  int jitter = 0;
+
+  if (_jitter > 0)
+  {
+    std::uniform_int_distribution<int> distribution(0, _jitter);
+    jitter = distribution(generator);
+  }
+
+  return now + _hss_reregistration_time - jitter;
+}
+
+bool ReregistrationRefresher::in_refresh_window(int64_t deadline, int64_t now)
+{
+  return (deadline != 0) && (now >= deadline - _refresh_window);
+}
+
+bool ReregistrationRefresher::refresh(const HssConnection::ServerAssignmentRequest& request,
+                                      const std::string& default_impu,
+                                      SAS::TrailId trail)
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if (_terminated)
+    {
+      return false;
+    }
+
+    if (_in_progress.find(default_impu) != _in_progress.end())
+    {
+      TRC_DEBUG("Refresh of %s already in progress", default_impu.c_str());
+      return false;
+    }
+
+    if ((_max_queue != 0) && (_queue.size() >= _max_queue))
+    {
+      TRC_INFO("Re-registration refresh queue full - not refreshing %s",
+               default_impu.c_str());
+      return false;
+    }
+
+    Refresh* refresh = new Refresh();
+    refresh->request = request;
+    refresh->request.type = Cx::ServerAssignmentType::RE_REGISTRATION;
+    refresh->default_impu = default_impu;
+    refresh->trail = trail;
+    refresh->irs = NULL;
+
+    _in_progress.insert(default_impu);
+    _queue.push_back(refresh);
+  }
+
+  _cond.notify_one();
+
+  return true;
+}
+
+void ReregistrationRefresher::run()
+{
+  std::chrono::microseconds interval(1000000 / _max_rate);
+  std::chrono::steady_clock::time_point next_send = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(_lock);
+
+  while (!_terminated)
+  {
+    if (_queue.empty())
+    {
+      _cond.wait(lock);
+      continue;
+    }
+
+    // Pace the SARs so that we never send more than the configured rate.
+    if (std::chrono::steady_clock::now() < next_send)
+    {
+      _cond.wait_until(lock, next_send);
+      continue;
+    }
+
+    Refresh* refresh = _queue.front();
+    _queue.pop_front();
+    _in_flight++;
+    next_send = std::max(next_send, std::chrono::steady_clock::now()) + interval;
+
+    lock.unlock();
+    send_sar(refresh);
+    lock.lock();
+  }
+}
+
+void ReregistrationRefresher::send_sar(Refresh* refresh)
+{
+  TRC_DEBUG("Sending background re-registration SAR for %s",
+            refresh->default_impu.c_str());
+
+  HssConnection::saa_cb callback =
+    std::bind(&ReregistrationRefresher::on_sar_response, this, refresh, _1);
+
+  _hss->send_server_assignment_request(callback,
+                                       refresh->request,
+                                       refresh->trail);
+}
+
+void ReregistrationRefresher::on_sar_response(Refresh* refresh,
+                                              const HssConnection::ServerAssignmentAnswer& saa)
+{
+  if (saa.get_result() != HssConnection::ResultCode::SUCCESS)
+  {
+    // Leave the IRS alone - the next re-registration after the deadline will
+    // send the SAR itself, and deal with the error.
+    TRC_INFO("Background re-registration SAR for %s failed with result %d",
+             refresh->default_impu.c_str(), saa.get_result());
+    complete(refresh);
+    return;
+  }
+
+  refresh->charging_addresses = saa.get_charging_addresses();
+  refresh->service_profile = saa.get_service_profile();
+
+  irs_success_callback success_cb =
+    std::bind(&ReregistrationRefresher::on_get_irs_success, this, refresh, _1);
+  failure_callback failure_cb =
+    std::bind(&ReregistrationRefresher::on_failure, this, refresh, _1);
+
+  _cache->get_implicit_registration_set_for_impu(success_cb,
+                                                 failure_cb,
+                                                 refresh->default_impu,
+                                                 refresh->trail);
+}
+
+void ReregistrationRefresher::on_get_irs_success(Refresh* refresh,
+                                                 ImplicitRegistrationSet* irs)
+{
+  refresh->irs = irs;
+
+  if (irs->get_reg_state() != RegistrationState::REGISTERED)
+  {
+    // The subscriber has deregistered since we queued the refresh.
+    TRC_DEBUG("%s no longer registered - dropping refresh",
+              refresh->default_impu.c_str());
+    complete(refresh);
+    return;
+  }
+
+  irs->set_charging_addresses(refresh->charging_addresses);
+  irs->set_ims_sub_xml(refresh->service_profile);
+  irs->set_ttl(_record_ttl);
+  irs->set_refresh_deadline(next_deadline(time(0)));
+
+  void_success_cb success_cb =
+    std::bind(&ReregistrationRefresher::on_put_irs_success, this, refresh);
+  progress_callback progress_cb = [](){};
+  failure_callback failure_cb =
+    std::bind(&ReregistrationRefresher::on_failure, this, refresh, _1);
+
+  _cache->put_implicit_registration_set(success_cb,
+                                        progress_cb,
+                                        failure_cb,
+                                        irs,
+                                        refresh->trail);
+}
+
+void ReregistrationRefresher::on_put_irs_success(Refresh* refresh)
+{
+  TRC_DEBUG("Refreshed registration for %s", refresh->default_impu.c_str());
+  complete(refresh);
+}
+
+void ReregistrationRefresher::on_failure(Refresh* refresh, Store::Status rc)
+{
+  TRC_INFO("Failed to refresh registration for %s in the cache: %d",
+           refresh->default_impu.c_str(), rc);
+  complete(refresh);
+}
+
+void ReregistrationRefresher::complete(Refresh* refresh)
+{
+  std::string default_impu = refresh->default_impu;
+  delete refresh->irs; refresh->irs = NULL;
+  delete refresh;
+
+  // Notify with the lock held - once it's released stop() may return and
+  // this object be deleted.
+  std::lock_guard<std::mutex> lock(_lock);
+  _in_progress.erase(default_impu);
+  _in_flight--;
+  _cond.notify_all();
+}
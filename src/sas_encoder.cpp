@@ -0,0 +1,215 @@
+/**
+ * @file sas_encoder.cpp Builds SAS events with large payloads in the background
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "sas_encoder.h"
+
+#include <algorithm>
+#include <time.h>
+
+#include "log.h"
+
+const char* const SasEncoder::OMITTED_PARAM = "<not logged>";
+const char* const SasEncoder::TRUNCATED_SUFFIX = "<truncated>";
+
+SasEncoder::Event::Event(SAS::TrailId trail, uint32_t id, uint32_t instance) :
+  _trail(trail),
+  _id(id),
+  _instance(instance)
+{
+  // SAS timestamps are in milliseconds since the epoch.
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  _timestamp = (SAS::Timestamp)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+SasEncoder::Event& SasEncoder::Event::add_static_param(uint32_t param)
+{
+  _params.push_back({STATIC, param, "", NULL});
+  return *this;
+}
+
+SasEncoder::Event& SasEncoder::Event::add_var_param(const std::string& param)
+{
+  _params.push_back({VAR, 0, param, NULL});
+  return *this;
+}
+
+SasEncoder::Event& SasEncoder::Event::add_compressed_param(const std::string& param,
+                                                           const SAS::Profile* profile)
+{
+  _params.push_back({COMPRESSED, 0, param, profile});
+  return *this;
+}
+
+void SasEncoder::Event::report() const
+{
+  SAS::Event event(_trail, _id, _instance);
+  event.set_timestamp(_timestamp);
+
+  for (const Param& param : _params)
+  {
+    switch (param.type)
+    {
+    case STATIC:
+      event.add_static_param(param.static_value);
+      break;
+
+    case VAR:
+      event.add_var_param(param.value);
+      break;
+
+    case COMPRESSED:
+      event.add_compressed_param(param.value, param.profile);
+      break;
+    }
+  }
+
+  SAS::report_event(event);
+}
+
+SasEncoder::SasEncoder(unsigned int max_queue,
+                       int sample_percent,
+                       size_t max_compressed_len,
+                       StatisticsManager* stats_manager) :
+  _max_queue(max_queue),
+  _sample_percent(std::min(std::max(sample_percent, 0), 100)),
+  _max_compressed_len(max_compressed_len),
+  _stats_manager(stats_manager),
+  _terminated(false),
+  _dropped(0),
+  _omitted(0)
+{
+}
+
+SasEncoder::~SasEncoder()
+{
+  stop();
+}
+
+bool SasEncoder::start()
+{
+  _thread = std::thread(&SasEncoder::run, this);
+
+  return true;
+}
+
+void SasEncoder::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _terminated = true;
+  }
+
+  _cond.notify_all();
+
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+
+  // If the thread was never started, there may still be events queued. Drop
+  // them rather than building them on the caller's thread.
+  std::lock_guard<std::mutex> lock(_lock);
+  _queue.clear();
+}
+
+bool SasEncoder::report_event(Event& event)
+{
+  for (Event::Param& param : event._params)
+  {
+    if (param.type == Event::COMPRESSED)
+    {
+      limit_compressed_param(param.value, event._trail);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if ((_terminated) ||
+        ((_max_queue != 0) && (_queue.size() >= _max_queue)))
+    {
+      TRC_DEBUG("SAS encoder queue full - dropping event %u on trail %lu",
+                event._id, event._trail);
+      _dropped++;
+
+      if (_stats_manager != NULL)
+      {
+        _stats_manager->incr_H_sas_events_dropped();
+      }
+
+      return false;
+    }
+
+    _queue.push_back(std::move(event));
+  }
+
+  _cond.notify_one();
+
+  return true;
+}
+
+void SasEncoder::report_event(SasEncoder* encoder, Event& event)
+{
+  if (encoder != NULL)
+  {
+    encoder->report_event(event);
+  }
+  else
+  {
+    event.report();
+  }
+}
+
+void SasEncoder::limit_compressed_param(std::string& param, SAS::TrailId trail)
+{
+  // Sample by trail, so that a trail either has all its profiles or none.
+  if ((_sample_percent < 100) &&
+      ((int)(trail % 100) >= _sample_percent))
+  {
+    param = OMITTED_PARAM;
+    _omitted++;
+
+    if (_stats_manager != NULL)
+    {
+      _stats_manager->incr_H_sas_params_omitted();
+    }
+  }
+  else if ((_max_compressed_len != 0) &&
+           (param.length() > _max_compressed_len))
+  {
+    param.resize(_max_compressed_len);
+    param.append(TRUNCATED_SUFFIX);
+  }
+}
+
+void SasEncoder::run()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+
+  // Keep going until we're terminated and have built everything that was
+  // queued before then.
+  while ((!_terminated) || (!_queue.empty()))
+  {
+    if (_queue.empty())
+    {
+      _cond.wait(lock);
+      continue;
+    }
+
+    Event event = std::move(_queue.front());
+    _queue.pop_front();
+
+    lock.unlock();
+    event.report();
+    lock.lock();
+  }
+}
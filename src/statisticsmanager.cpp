@@ -27,6 +27,46 @@ StatisticsManager::StatisticsManager()
                                                    ".1.2.826.0.1.1578918.9.5.6");
   H_rejected_overload = SNMP::CounterTable::create("H_rejected_overload",
                                                    ".1.2.826.0.1.1578918.9.5.7");
+  H_hss_hedged_requests = SNMP::CounterTable::create("H_hss_hedged_requests",
+                                                     ".1.2.826.0.1.1578918.9.5.16");
+  H_hss_hedge_wins = SNMP::CounterTable::create("H_hss_hedge_wins",
+                                                ".1.2.826.0.1.1578918.9.5.17");
+  H_hss_hedge_losses = SNMP::CounterTable::create("H_hss_hedge_losses",
+                                                  ".1.2.826.0.1.1578918.9.5.18");
+  H_hsprov_cache_hits = SNMP::CounterTable::create("H_hsprov_cache_hits",
+                                                   ".1.2.826.0.1.1578918.9.5.19");
+  H_hsprov_cache_misses = SNMP::CounterTable::create("H_hsprov_cache_misses",
+                                                     ".1.2.826.0.1.1578918.9.5.20");
+  H_cache_queue_latency_us = SNMP::EventAccumulatorTable::create("H_cache_queue_latency_us",
+                                                                 ".1.2.826.0.1.1578918.9.5.21");
+  H_cache_get_irs_latency_us = SNMP::EventAccumulatorTable::create("H_cache_get_irs_latency_us",
+                                                                   ".1.2.826.0.1.1578918.9.5.22");
+  H_cache_put_irs_latency_us = SNMP::EventAccumulatorTable::create("H_cache_put_irs_latency_us",
+                                                                   ".1.2.826.0.1.1578918.9.5.23");
+  H_cache_delete_irs_latency_us = SNMP::EventAccumulatorTable::create("H_cache_delete_irs_latency_us",
+                                                                      ".1.2.826.0.1.1578918.9.5.24");
+  H_cache_get_ims_sub_latency_us = SNMP::EventAccumulatorTable::create("H_cache_get_ims_sub_latency_us",
+                                                                       ".1.2.826.0.1.1578918.9.5.25");
+  H_cache_put_ims_sub_latency_us = SNMP::EventAccumulatorTable::create("H_cache_put_ims_sub_latency_us",
+                                                                       ".1.2.826.0.1.1578918.9.5.26");
+  H_local_store_latency_us = SNMP::EventAccumulatorTable::create("H_local_store_latency_us",
+                                                                 ".1.2.826.0.1.1578918.9.5.27");
+  H_remote_store_latency_us = SNMP::EventAccumulatorTable::create("H_remote_store_latency_us",
+                                                                  ".1.2.826.0.1.1578918.9.5.28");
+  H_xml_latency_us = SNMP::EventAccumulatorTable::create("H_xml_latency_us",
+                                                         ".1.2.826.0.1.1578918.9.5.29");
+  H_ppr_latency_us = SNMP::EventAccumulatorTable::create("H_ppr_latency_us",
+                                                         ".1.2.826.0.1.1578918.9.5.30");
+  H_rtr_latency_us = SNMP::EventAccumulatorTable::create("H_rtr_latency_us",
+                                                         ".1.2.826.0.1.1578918.9.5.31");
+  H_sas_events_dropped = SNMP::CounterTable::create("H_sas_events_dropped",
+                                                    ".1.2.826.0.1.1578918.9.5.32");
+  H_sas_params_omitted = SNMP::CounterTable::create("H_sas_params_omitted",
+                                                    ".1.2.826.0.1.1578918.9.5.33");
+  H_reg_dampened = SNMP::CounterTable::create("H_reg_dampened",
+                                              ".1.2.826.0.1.1578918.9.5.34");
+  H_negative_cache_hits = SNMP::CounterTable::create("H_negative_cache_hits",
+                                                     ".1.2.826.0.1.1578918.9.5.35");
 }
 
 StatisticsManager::~StatisticsManager()
@@ -38,4 +78,24 @@ StatisticsManager::~StatisticsManager()
   delete H_hss_subscription_latency_us; H_hss_subscription_latency_us = NULL;
   delete H_incoming_requests; H_incoming_requests = NULL;
   delete H_rejected_overload; H_rejected_overload = NULL;
+  delete H_hss_hedged_requests; H_hss_hedged_requests = NULL;
+  delete H_hss_hedge_wins; H_hss_hedge_wins = NULL;
+  delete H_hss_hedge_losses; H_hss_hedge_losses = NULL;
+  delete H_hsprov_cache_hits; H_hsprov_cache_hits = NULL;
+  delete H_hsprov_cache_misses; H_hsprov_cache_misses = NULL;
+  delete H_cache_queue_latency_us; H_cache_queue_latency_us = NULL;
+  delete H_cache_get_irs_latency_us; H_cache_get_irs_latency_us = NULL;
+  delete H_cache_put_irs_latency_us; H_cache_put_irs_latency_us = NULL;
+  delete H_cache_delete_irs_latency_us; H_cache_delete_irs_latency_us = NULL;
+  delete H_cache_get_ims_sub_latency_us; H_cache_get_ims_sub_latency_us = NULL;
+  delete H_cache_put_ims_sub_latency_us; H_cache_put_ims_sub_latency_us = NULL;
+  delete H_local_store_latency_us; H_local_store_latency_us = NULL;
+  delete H_remote_store_latency_us; H_remote_store_latency_us = NULL;
+  delete H_xml_latency_us; H_xml_latency_us = NULL;
+  delete H_ppr_latency_us; H_ppr_latency_us = NULL;
+  delete H_rtr_latency_us; H_rtr_latency_us = NULL;
+  delete H_sas_events_dropped; H_sas_events_dropped = NULL;
+  delete H_sas_params_omitted; H_sas_params_omitted = NULL;
+  delete H_reg_dampened; H_reg_dampened = NULL;
+  delete H_negative_cache_hits; H_negative_cache_hits = NULL;
 }
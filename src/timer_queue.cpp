@@ -0,0 +1,94 @@
+/**
+ * @file timer_queue.cpp Runs tasks after a delay on a background thread
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "timer_queue.h"
+
+TimerQueue::TimerQueue() :
+  _terminated(false)
+{
+}
+
+TimerQueue::~TimerQueue()
+{
+  stop();
+}
+
+bool TimerQueue::start()
+{
+  _thread = std::thread(&TimerQueue::run, this);
+
+  return true;
+}
+
+void TimerQueue::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _terminated = true;
+    _tasks.clear();
+  }
+
+  _cond.notify_all();
+
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+}
+
+void TimerQueue::schedule(int delay_ms, task_t task)
+{
+  std::chrono::steady_clock::time_point due =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if (_terminated)
+    {
+      return;
+    }
+
+    _tasks.insert(std::make_pair(due, task));
+  }
+
+  _cond.notify_one();
+}
+
+void TimerQueue::run()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+
+  while (!_terminated)
+  {
+    if (_tasks.empty())
+    {
+      _cond.wait(lock);
+      continue;
+    }
+
+    std::multimap<std::chrono::steady_clock::time_point, task_t>::iterator next =
+      _tasks.begin();
+
+    if (std::chrono::steady_clock::now() < next->first)
+    {
+      _cond.wait_until(lock, next->first);
+      continue;
+    }
+
+    task_t task = next->second;
+    _tasks.erase(next);
+
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
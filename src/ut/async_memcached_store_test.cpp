@@ -0,0 +1,638 @@
+/**
+ * @file async_memcached_store_test.cpp UT for AsyncMemcachedStore
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "async_memcached_store.h"
+#include "test_utils.hpp"
+
+static const std::string TABLE = "impu";
+static const std::string KEY = "sip:impu@example.com";
+static const std::string OTHER_KEY = "sip:other_impu@example.com";
+static const uint64_t CAS = 7;
+
+/// A memcached server that answers binary protocol GETs and SETs from a map
+/// of keys.
+class FakeMemcachedServer
+{
+public:
+  FakeMemcachedServer() : _responding(true), _connections(0), _gets(0), _sets(0)
+  {
+    _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    listen(_listen_fd, 16);
+
+    socklen_t addr_len = sizeof(addr);
+    getsockname(_listen_fd, (struct sockaddr*)&addr, &addr_len);
+    _port = ntohs(addr.sin_port);
+
+    if (pipe(_stop_pipe) < 0)
+    {
+      _stop_pipe[0] = _stop_pipe[1] = -1;
+    }
+
+    _thread = std::thread(&FakeMemcachedServer::run, this);
+  }
+
+  ~FakeMemcachedServer()
+  {
+    if (write(_stop_pipe[1], "x", 1) < 0)
+    {
+    }
+
+    _thread.join();
+
+    for (int fd : _clients)
+    {
+      close(fd);
+    }
+
+    close(_listen_fd);
+    close(_stop_pipe[0]);
+    close(_stop_pipe[1]);
+  }
+
+  std::string server()
+  {
+    return "127.0.0.1:" + std::to_string(_port);
+  }
+
+  void set(const std::string& key, const std::string& value)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _records[AsyncMemcachedStore::fq_key(TABLE, key)] = value;
+  }
+
+  std::string get(const std::string& key)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _records[AsyncMemcachedStore::fq_key(TABLE, key)];
+  }
+
+  // The expiry that a key was last written with.
+  uint32_t expiry(const std::string& key)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _expiries[AsyncMemcachedStore::fq_key(TABLE, key)];
+  }
+
+  // If the server isn't responding, it reads requests but doesn't answer
+  // them.
+  void set_responding(bool responding)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _responding = responding;
+  }
+
+  // Closes the connections to the server on its next request.
+  void close_connections()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _close_connections = true;
+  }
+
+  int connections()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _connections;
+  }
+
+  int gets()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _gets;
+  }
+
+  int sets()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _sets;
+  }
+
+private:
+  void run()
+  {
+    std::map<int, std::string> buffers;
+
+    while (true)
+    {
+      std::vector<struct pollfd> fds;
+      fds.push_back({_stop_pipe[0], POLLIN, 0});
+      fds.push_back({_listen_fd, POLLIN, 0});
+
+      for (int fd : _clients)
+      {
+        fds.push_back({fd, POLLIN, 0});
+      }
+
+      poll(fds.data(), fds.size(), -1);
+
+      if (fds[0].revents)
+      {
+        return;
+      }
+
+      if (fds[1].revents)
+      {
+        int fd = accept(_listen_fd, NULL, NULL);
+        _clients.push_back(fd);
+
+        std::lock_guard<std::mutex> lock(_lock);
+        _connections++;
+      }
+
+      for (size_t ii = 2; ii < fds.size(); ii++)
+      {
+        if (!fds[ii].revents)
+        {
+          continue;
+        }
+
+        int fd = fds[ii].fd;
+        char data[4096];
+        ssize_t len = recv(fd, data, sizeof(data), 0);
+
+        bool close_connection = (len <= 0);
+
+        {
+          std::lock_guard<std::mutex> lock(_lock);
+
+          if (_close_connections)
+          {
+            close_connection = true;
+            _close_connections = false;
+          }
+        }
+
+        if (close_connection)
+        {
+          close(fd);
+          _clients.erase(std::find(_clients.begin(), _clients.end(), fd));
+          buffers.erase(fd);
+          continue;
+        }
+
+        buffers[fd].append(data, len);
+        answer(fd, buffers[fd]);
+      }
+    }
+  }
+
+  // Answers the complete requests in the buffer.
+  void answer(int fd, std::string& buffer)
+  {
+    while (buffer.size() >= 24)
+    {
+      const uint8_t* header = (const uint8_t*)buffer.data();
+      uint8_t opcode = header[1];
+      size_t key_len = (header[2] << 8) | header[3];
+      size_t extras_len = header[4];
+      size_t body_len = ntohl(*(uint32_t*)(header + 8));
+
+      if (buffer.size() < 24 + body_len)
+      {
+        break;
+      }
+
+      std::string key = buffer.substr(24 + extras_len, key_len);
+      std::string opaque = buffer.substr(12, 4);
+      std::string value;
+      bool found;
+      bool responding;
+
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+
+        if (opcode == 0x01)
+        {
+          // A SET's extras are its flags and expiry.
+          _sets++;
+          _records[key] = buffer.substr(24 + extras_len + key_len,
+                                        body_len - extras_len - key_len);
+          _expiries[key] = ntohl(*(uint32_t*)(header + 28));
+          found = false;
+        }
+        else
+        {
+          _gets++;
+          std::map<std::string, std::string>::iterator record = _records.find(key);
+          found = (record != _records.end());
+          value = found ? record->second : "";
+        }
+
+        responding = _responding;
+      }
+
+      buffer.erase(0, 24 + body_len);
+
+      if (!responding)
+      {
+        continue;
+      }
+
+      // Found records have 4 bytes of flags as extras. Not found responses
+      // have an error message as their value, and successful SETs have no
+      // body.
+      std::string body = found ? std::string(4, '\0') + value :
+                         (opcode == 0x01) ? "" : "Not found";
+      bool ok = found || (opcode == 0x01);
+      std::string response;
+      response.push_back((char)0x81);
+      response.push_back((char)opcode);
+      response.append(2, '\0');
+      response.push_back(found ? 4 : 0);
+      response.push_back(0);
+      response.push_back(0);
+      response.push_back(ok ? 0 : 1);
+      uint32_t body_len_n = htonl(body.size());
+      response.append((const char*)&body_len_n, 4);
+      response.append(opaque);
+      response.append(7, '\0');
+      response.push_back((char)CAS);
+      response.append(body);
+
+      send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+    }
+  }
+
+  int _listen_fd;
+  int _port;
+  int _stop_pipe[2];
+  std::thread _thread;
+  std::vector<int> _clients;
+
+  std::mutex _lock;
+  std::map<std::string, std::string> _records;
+  std::map<std::string, uint32_t> _expiries;
+  bool _responding;
+  bool _close_connections = false;
+  int _connections;
+  int _gets;
+  int _sets;
+};
+
+/// Collects the results of gets, so that the test can wait for them.
+class GetResults
+{
+public:
+  struct Result
+  {
+    Store::Status status;
+    std::string data;
+    uint64_t cas;
+  };
+
+  AsyncStore::get_callback callback()
+  {
+    return [this](Store::Status status, const std::string& data, uint64_t cas)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _results.push_back(Result{status, data, cas});
+      _cond.notify_all();
+    };
+  }
+
+  // Waits for the given number of gets to complete.
+  bool wait_for(size_t count)
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    return _cond.wait_for(lock,
+                          std::chrono::seconds(5),
+                          [this, count]() { return _results.size() >= count; });
+  }
+
+  std::vector<Result> results()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _results;
+  }
+
+private:
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::vector<Result> _results;
+};
+
+class AsyncMemcachedStoreTest : public testing::Test
+{
+};
+
+TEST_F(AsyncMemcachedStoreTest, Get)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "data");
+
+  AsyncMemcachedStore store(server.server(), 1);
+  ASSERT_TRUE(store.start());
+
+  GetResults results;
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  store.get_data_async(TABLE, OTHER_KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(2));
+
+  // A loop answers its gets in order.
+  std::vector<GetResults::Result> got = results.results();
+  EXPECT_EQ(Store::Status::OK, got[0].status);
+  EXPECT_EQ("data", got[0].data);
+  EXPECT_EQ(CAS, got[0].cas);
+  EXPECT_EQ(Store::Status::NOT_FOUND, got[1].status);
+  EXPECT_EQ("", got[1].data);
+
+  store.stop();
+}
+
+TEST_F(AsyncMemcachedStoreTest, EmptyRecordNotFound)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "");
+
+  AsyncMemcachedStore store(server.server(), 1);
+  ASSERT_TRUE(store.start());
+
+  GetResults results;
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(1));
+
+  EXPECT_EQ(Store::Status::NOT_FOUND, results.results()[0].status);
+}
+
+TEST_F(AsyncMemcachedStoreTest, ManyGets)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "data");
+
+  AsyncMemcachedStore store(server.server(), 2);
+  ASSERT_TRUE(store.start());
+
+  // The gets are spread over the loops, each of which has one connection,
+  // however many gets it has in flight.
+  GetResults results;
+
+  for (int ii = 0; ii < 500; ii++)
+  {
+    store.get_data_async(TABLE, KEY, 0, results.callback());
+  }
+
+  ASSERT_TRUE(results.wait_for(500));
+
+  for (const GetResults::Result& result : results.results())
+  {
+    EXPECT_EQ(Store::Status::OK, result.status);
+    EXPECT_EQ("data", result.data);
+  }
+
+  EXPECT_EQ(2, server.connections());
+  EXPECT_EQ(500, server.gets());
+}
+
+// Waits for the callback of a multi-get or multi-set.
+template <class T>
+class MultiResults
+{
+public:
+  std::function<void(std::vector<T>&)> callback()
+  {
+    return [this](std::vector<T>& results)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _results = results;
+      _called++;
+      _cond.notify_all();
+    };
+  }
+
+  bool wait()
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    return _cond.wait_for(lock,
+                          std::chrono::seconds(5),
+                          [this]() { return _called > 0; });
+  }
+
+  std::vector<T> results()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _results;
+  }
+
+  int called()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _called;
+  }
+
+private:
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::vector<T> _results;
+  int _called = 0;
+};
+
+TEST_F(AsyncMemcachedStoreTest, MultiGet)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "data");
+  server.set(OTHER_KEY, "other data");
+
+  AsyncMemcachedStore store(server.server(), 2);
+  ASSERT_TRUE(store.start());
+
+  MultiResults<AsyncStore::Result> results;
+  store.get_multi_data_async(TABLE,
+                             {OTHER_KEY, "sip:unknown@example.com", KEY},
+                             0,
+                             results.callback());
+  ASSERT_TRUE(results.wait());
+
+  // The results are in the order of the keys, and the gets all went to one
+  // loop, so on one connection.
+  std::vector<AsyncStore::Result> got = results.results();
+  ASSERT_EQ(3u, got.size());
+  EXPECT_EQ(Store::Status::OK, got[0].status);
+  EXPECT_EQ("other data", got[0].data);
+  EXPECT_EQ(Store::Status::NOT_FOUND, got[1].status);
+  EXPECT_EQ(Store::Status::OK, got[2].status);
+  EXPECT_EQ("data", got[2].data);
+  EXPECT_EQ(CAS, got[2].cas);
+  EXPECT_EQ(1, results.called());
+  EXPECT_EQ(1, server.connections());
+  EXPECT_EQ(3, server.gets());
+}
+
+TEST_F(AsyncMemcachedStoreTest, MultiSet)
+{
+  FakeMemcachedServer server;
+
+  AsyncMemcachedStore store(server.server(), 2);
+  ASSERT_TRUE(store.start());
+
+  MultiResults<Store::Status> results;
+  store.set_multi_data_async(TABLE,
+                             {{KEY, "data"}, {OTHER_KEY, "other data"}},
+                             300,
+                             0,
+                             results.callback());
+  ASSERT_TRUE(results.wait());
+
+  std::vector<Store::Status> got = results.results();
+  ASSERT_EQ(2u, got.size());
+  EXPECT_EQ(Store::Status::OK, got[0]);
+  EXPECT_EQ(Store::Status::OK, got[1]);
+  EXPECT_EQ("data", server.get(KEY));
+  EXPECT_EQ("other data", server.get(OTHER_KEY));
+  EXPECT_EQ(300u, server.expiry(KEY));
+  EXPECT_EQ(2, server.sets());
+  EXPECT_EQ(1, server.connections());
+
+  // Memcached takes expiries of more than 30 days as absolute times.
+  int long_expiry = 60 * 60 * 24 * 31;
+  uint32_t now = time(NULL);
+  MultiResults<Store::Status> long_results;
+  store.set_multi_data_async(TABLE, {{KEY, "data"}}, long_expiry, 0, long_results.callback());
+  ASSERT_TRUE(long_results.wait());
+  EXPECT_GE(server.expiry(KEY), now + long_expiry);
+  EXPECT_LE(server.expiry(KEY), now + long_expiry + 5);
+}
+
+TEST_F(AsyncMemcachedStoreTest, MultiGetTimeout)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "data");
+  server.set_responding(false);
+
+  AsyncMemcachedStore store(server.server(), 1, 50);
+  ASSERT_TRUE(store.start());
+
+  // The callback is only run once, when the last get fails.
+  MultiResults<AsyncStore::Result> results;
+  store.get_multi_data_async(TABLE, {KEY, OTHER_KEY}, 0, results.callback());
+  ASSERT_TRUE(results.wait());
+  ASSERT_EQ(2u, results.results().size());
+  EXPECT_EQ(Store::Status::ERROR, results.results()[0].status);
+  EXPECT_EQ(Store::Status::ERROR, results.results()[1].status);
+  EXPECT_EQ(1, results.called());
+}
+
+TEST_F(AsyncMemcachedStoreTest, Timeout)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "data");
+  server.set_responding(false);
+
+  AsyncMemcachedStore store(server.server(), 1, 50);
+  ASSERT_TRUE(store.start());
+
+  GetResults results;
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(1));
+  EXPECT_EQ(Store::Status::ERROR, results.results()[0].status);
+
+  // The loop gave up on the connection, and reconnects for the next get.
+  server.set_responding(true);
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(2));
+  EXPECT_EQ(Store::Status::OK, results.results()[1].status);
+  EXPECT_EQ(2, server.connections());
+}
+
+TEST_F(AsyncMemcachedStoreTest, ConnectionClosed)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "data");
+
+  AsyncMemcachedStore store(server.server(), 1);
+  ASSERT_TRUE(store.start());
+
+  GetResults results;
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(1));
+
+  // The server closes the connection rather than answering, so the get
+  // fails.
+  server.close_connections();
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(2));
+  EXPECT_EQ(Store::Status::ERROR, results.results()[1].status);
+
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(3));
+  EXPECT_EQ(Store::Status::OK, results.results()[2].status);
+  EXPECT_EQ(2, server.connections());
+}
+
+TEST_F(AsyncMemcachedStoreTest, ServerDown)
+{
+  // Find a port with nothing listening on it.
+  std::string address;
+
+  {
+    FakeMemcachedServer server;
+    address = server.server();
+  }
+
+  AsyncMemcachedStore store(address, 1);
+  ASSERT_TRUE(store.start());
+
+  GetResults results;
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_TRUE(results.wait_for(1));
+  EXPECT_EQ(Store::Status::ERROR, results.results()[0].status);
+}
+
+TEST_F(AsyncMemcachedStoreTest, Stopped)
+{
+  FakeMemcachedServer server;
+  server.set(KEY, "data");
+
+  AsyncMemcachedStore store(server.server(), 1);
+  GetResults results;
+
+  // Gets fail straight away until the store is started, and once it's
+  // stopped.
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_EQ(1u, results.results().size());
+  EXPECT_EQ(Store::Status::ERROR, results.results()[0].status);
+
+  ASSERT_TRUE(store.start());
+  store.stop();
+
+  store.get_data_async(TABLE, KEY, 0, results.callback());
+  ASSERT_EQ(2u, results.results().size());
+  EXPECT_EQ(Store::Status::ERROR, results.results()[1].status);
+
+  MultiResults<AsyncStore::Result> multi_results;
+  store.get_multi_data_async(TABLE, {KEY, OTHER_KEY}, 0, multi_results.callback());
+  ASSERT_EQ(1, multi_results.called());
+  EXPECT_EQ(Store::Status::ERROR, multi_results.results()[1].status);
+}
+
+TEST_F(AsyncMemcachedStoreTest, InvalidServer)
+{
+  AsyncMemcachedStore store("[::1", 1);
+  EXPECT_FALSE(store.start());
+}
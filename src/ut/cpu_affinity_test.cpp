@@ -0,0 +1,78 @@
+/**
+ * @file cpu_affinity_test.cpp UT for CpuAffinity
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <pthread.h>
+
+#include <thread>
+
+#include "cpu_affinity.h"
+#include "test_utils.hpp"
+
+TEST(CpuAffinityTest, Parse)
+{
+  cpu_set_t cpus;
+
+  ASSERT_TRUE(CpuAffinity::parse("0-3,8,10-11", cpus));
+  EXPECT_EQ(7, CPU_COUNT(&cpus));
+  EXPECT_TRUE(CPU_ISSET(0, &cpus));
+  EXPECT_TRUE(CPU_ISSET(3, &cpus));
+  EXPECT_FALSE(CPU_ISSET(4, &cpus));
+  EXPECT_TRUE(CPU_ISSET(8, &cpus));
+  EXPECT_TRUE(CPU_ISSET(11, &cpus));
+}
+
+TEST(CpuAffinityTest, ParseInvalid)
+{
+  cpu_set_t cpus;
+
+  EXPECT_FALSE(CpuAffinity::parse("", cpus));
+  EXPECT_FALSE(CpuAffinity::parse("a", cpus));
+  EXPECT_FALSE(CpuAffinity::parse("3-1", cpus));
+  EXPECT_FALSE(CpuAffinity::parse("1,", cpus));
+  EXPECT_FALSE(CpuAffinity::parse("-1", cpus));
+  EXPECT_FALSE(CpuAffinity::parse("100000", cpus));
+  EXPECT_FALSE(CpuAffinity::parse("nodeX", cpus));
+  EXPECT_FALSE(CpuAffinity::parse("node100000", cpus));
+}
+
+TEST(CpuAffinityTest, ScopePinsNewThreads)
+{
+  cpu_set_t original;
+  ASSERT_EQ(0, pthread_getaffinity_np(pthread_self(), sizeof(original), &original));
+
+  // Pin to the first CPU we're allowed to run on.
+  int cpu = 0;
+
+  while (!CPU_ISSET(cpu, &original))
+  {
+    cpu++;
+  }
+
+  cpu_set_t thread_cpus;
+
+  {
+    CpuAffinity::Scope scope(std::to_string(cpu));
+
+    std::thread thread([&thread_cpus]()
+    {
+      pthread_getaffinity_np(pthread_self(), sizeof(thread_cpus), &thread_cpus);
+    });
+    thread.join();
+  }
+
+  // The thread was pinned, and our own affinity has been put back.
+  EXPECT_EQ(1, CPU_COUNT(&thread_cpus));
+  EXPECT_TRUE(CPU_ISSET(cpu, &thread_cpus));
+
+  cpu_set_t restored;
+  ASSERT_EQ(0, pthread_getaffinity_np(pthread_self(), sizeof(restored), &restored));
+  EXPECT_TRUE(CPU_EQUAL(&original, &restored));
+}
@@ -0,0 +1,148 @@
+/**
+ * @file cx_benchmark.cpp Benchmark of decoding Cx answers.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+// Compares decoding a digest MAA with a lookup per field (as the message
+// accessors do) against a single AVP index (as DiameterHssConnection does).
+// This isn't part of the UT, as the timings depend on the machine. Build and
+// run it with "make benchmark".
+
+#include <stdio.h>
+#include <time.h>
+#include <string>
+
+#include <freeDiameter/freeDiameter-host.h>
+#include <freeDiameter/libfdcore.h>
+
+#include "diameterstack.h"
+#include "cx.h"
+
+static const int ITERATIONS = 100000;
+static const std::string SIP_AUTH_SCHEME_DIGEST = "SIP Digest";
+
+static const std::string BENCHMARK_FILE(__FILE__);
+static const std::string BENCHMARK_DIR =
+                     BENCHMARK_FILE.substr(0, BENCHMARK_FILE.rfind("/"));
+
+static uint64_t elapsed_ns(const struct timespec& start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) * 1000000000ULL +
+         now.tv_nsec - start.tv_nsec;
+}
+
+// Encodes and parses the message, so that it's decoded from the same
+// structures as an answer received from the HSS.
+static struct msg* received(Diameter::Message& msg)
+{
+  uint8_t* buffer;
+  size_t len;
+  struct msg* parsed_msg = NULL;
+  struct fd_pei error_info;
+
+  if ((fd_msg_bufferize(msg.fd_msg(), &buffer, &len) != 0) ||
+      (fd_msg_parse_buffer(&buffer, len, &parsed_msg) != 0) ||
+      (fd_msg_parse_dict(parsed_msg, fd_g_config->cnf_dict, &error_info) != 0))
+  {
+    return NULL;
+  }
+
+  return parsed_msg;
+}
+
+// Checks that the decoded values are the ones in the answer, so that both
+// methods are timed doing the same work.
+static bool check(const std::string& scheme,
+                  const DigestAuthVector* digest,
+                  const DigestAuthVector& expected)
+{
+  return ((scheme == SIP_AUTH_SCHEME_DIGEST) &&
+          (digest->ha1 == expected.ha1) &&
+          (digest->realm == expected.realm) &&
+          (digest->qop == expected.qop));
+}
+
+int main(int argc, char** argv)
+{
+  Diameter::Stack* stack = Diameter::Stack::get_instance();
+  stack->initialize();
+  stack->configure(BENCHMARK_DIR + "/diameterstack.conf", NULL);
+  Cx::Dictionary* dict = new Cx::Dictionary();
+
+  DigestAuthVector digest;
+  digest.ha1 = "ha1";
+  digest.realm = "realm";
+  digest.qop = "qop";
+  AKAAuthVector aka;
+
+  Cx::MultimediaAuthAnswer built(dict,
+                                 stack,
+                                 DIAMETER_SUCCESS,
+                                 0,
+                                 0,
+                                 SIP_AUTH_SCHEME_DIGEST,
+                                 digest,
+                                 aka);
+  struct msg* fd_msg = received(built);
+  if (fd_msg == NULL)
+  {
+    fprintf(stderr, "Failed to encode and parse the Multimedia-Auth answer\n");
+    return 1;
+  }
+  Diameter::Message msg(dict, fd_msg, stack);
+  Cx::MultimediaAuthAnswer maa(msg);
+  bool ok = true;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int ii = 0; ii < ITERATIONS; ii++)
+  {
+    std::string scheme = maa.sip_auth_scheme();
+    DigestAuthVector* maa_digest = maa.digest_auth_vector();
+    ok = ok && check(scheme, maa_digest, digest);
+    delete maa_digest; maa_digest = NULL;
+  }
+
+  uint64_t lookup_ns = elapsed_ns(start);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int ii = 0; ii < ITERATIONS; ii++)
+  {
+    Cx::AnswerAvps avps(maa);
+    boost::string_ref scheme;
+    avps.sip_auth_scheme(scheme);
+    DigestAuthVector* maa_digest = avps.digest_auth_vector();
+    ok = ok && check(scheme.to_string(), maa_digest, digest);
+    delete maa_digest; maa_digest = NULL;
+  }
+
+  uint64_t index_ns = elapsed_ns(start);
+
+  printf("Decoding a digest Multimedia-Auth answer (%d iterations)\n",
+         ITERATIONS);
+  printf("  Lookup per field: %lu ns per answer\n",
+         (unsigned long)(lookup_ns / ITERATIONS));
+  printf("  AVP index:        %lu ns per answer\n",
+         (unsigned long)(index_ns / ITERATIONS));
+
+  delete dict; dict = NULL;
+  stack->stop();
+  stack->wait_stopped();
+
+  if (!ok)
+  {
+    fprintf(stderr, "The two methods decoded different values\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -341,6 +341,53 @@ TEST_F(CxTest, MAATestNoAuthScheme)
   delete maa_aka; maa_aka = NULL;
 }
 
+// Test that the AVP index reads the same values from the answer as the
+// message accessors, as views of the message.
+TEST_F(CxTest, MAAAnswerAvpsTest)
+{
+  DigestAuthVector digest;
+  digest.ha1 = "ha1";
+  digest.realm = "realm";
+  digest.qop = "qop";
+
+  AKAAuthVector aka;
+  aka.challenge = "sure.";
+  aka.response = "response";
+  aka.crypt_key = "crypt_key";
+  aka.integrity_key = "integrity_key";
+
+  Cx::MultimediaAuthAnswer maa(_cx_dict,
+                               _mock_stack,
+                               RESULT_CODE_SUCCESS,
+                               0,
+                               0,
+                               SIP_AUTH_SCHEME_AKA,
+                               digest,
+                               aka);
+  launder_message(maa);
+  Cx::AnswerAvps avps(maa);
+
+  boost::string_ref value;
+  EXPECT_TRUE(avps.sip_auth_scheme(value));
+  EXPECT_EQ(SIP_AUTH_SCHEME_AKA, value.to_string());
+  EXPECT_FALSE(avps.server_name(value));
+  EXPECT_FALSE(avps.user_data(value));
+
+  DigestAuthVector* maa_digest = avps.digest_auth_vector();
+  EXPECT_EQ(digest.ha1, maa_digest->ha1);
+  EXPECT_EQ(digest.realm, maa_digest->realm);
+  EXPECT_EQ(digest.qop, maa_digest->qop);
+  delete maa_digest; maa_digest = NULL;
+
+  AKAAuthVector* maa_aka = avps.akav2_auth_vector();
+  EXPECT_EQ("c3VyZS4=", maa_aka->challenge);
+  EXPECT_EQ("726573706f6e7365", maa_aka->response);
+  EXPECT_EQ("63727970745f6b6579", maa_aka->crypt_key);
+  EXPECT_EQ("696e746567726974795f6b6579", maa_aka->integrity_key);
+  EXPECT_EQ(2, maa_aka->version);
+  delete maa_aka; maa_aka = NULL;
+}
+
 //
 // Server Assignment Requests
 //
@@ -490,6 +537,32 @@ TEST_F(CxTest, SAATest)
   EXPECT_EQ(ECFS, charging_addrs.ecfs);
 }
 
+TEST_F(CxTest, SAAAnswerAvpsTest)
+{
+  ChargingAddresses charging_addrs;
+  Cx::ServerAssignmentAnswer saa(_cx_dict,
+                                 _mock_stack,
+                                 RESULT_CODE_SUCCESS,
+                                 0,
+                                 0,
+                                 IMS_SUBSCRIPTION,
+                                 FULL_CHARGING_ADDRESSES,
+                                 WILDCARD_IMPU);
+  launder_message(saa);
+  Cx::AnswerAvps avps(saa);
+
+  boost::string_ref value;
+  EXPECT_TRUE(avps.user_data(value));
+  EXPECT_EQ(IMS_SUBSCRIPTION, value.to_string());
+  EXPECT_TRUE(avps.wildcarded_public_identity(value));
+  EXPECT_EQ(WILDCARD_IMPU, value.to_string());
+  EXPECT_FALSE(avps.sip_auth_scheme(value));
+
+  avps.charging_addrs(charging_addrs);
+  EXPECT_EQ(CCFS, charging_addrs.ccfs);
+  EXPECT_EQ(ECFS, charging_addrs.ecfs);
+}
+
 TEST_F(CxTest, SAATestNoChargingAddresses)
 {
   ChargingAddresses charging_addrs;
@@ -818,6 +891,24 @@ TEST_F(CxTest, LIATest)
             capabilities.optional_capabilities);
 }
 
+TEST_F(CxTest, LIAAnswerAvpsTest)
+{
+  Cx::LocationInfoAnswer lia(_cx_dict,
+                             _mock_stack,
+                             RESULT_CODE_SUCCESS,
+                             0,
+                             0,
+                             SERVER_NAME,
+                             CAPABILITIES);
+  launder_message(lia);
+  Cx::AnswerAvps avps(lia);
+
+  boost::string_ref value;
+  EXPECT_TRUE(avps.server_name(value));
+  EXPECT_EQ(SERVER_NAME, value.to_string());
+  EXPECT_FALSE(avps.wildcarded_public_identity(value));
+}
+
 TEST_F(CxTest, LIATestExperimentalResultCode)
 {
   Cx::LocationInfoAnswer lia(_cx_dict,
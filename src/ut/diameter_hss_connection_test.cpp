@@ -2361,4 +2361,538 @@ TEST_F(DiameterHssConnectionTest, DiameterTimeout)
 
   _caught_fd_msg = NULL;
   delete _caught_diam_tsx; _caught_diam_tsx = NULL;
-}
\ No newline at end of file
+}
+//
+// Adaptive timeout and hedging tests
+//
+
+// Catches the tasks scheduled on the timer queue so that the tests can run
+// them when they choose.
+class FakeTimerQueue : public TimerQueue
+{
+public:
+  virtual void schedule(int delay_ms, task_t task)
+  {
+    delays.push_back(delay_ms);
+    tasks.push_back(task);
+  }
+
+  std::vector<int> delays;
+  std::vector<task_t> tasks;
+};
+
+static const std::string PRIMARY_PEER = "hss1";
+static const std::string ALTERNATE_PEER = "hss2";
+
+// Gives the tracker enough samples for both peers to be used. The primary's
+// latency is 10ms, so its timeout is 20ms.
+static void add_peer_latencies(PeerLatencyTracker& tracker)
+{
+  for (size_t ii = 0; ii < PeerLatencyTracker::MIN_SAMPLES; ii++)
+  {
+    tracker.record(PRIMARY_PEER, 10000);
+    tracker.record(ALTERNATE_PEER, 5000);
+  }
+}
+
+// Teaches the selector about both peers. They're equally loaded, so the
+// primary is chosen first.
+static void add_selector_peers(PeerSelector& selector)
+{
+  selector.complete("", PRIMARY_PEER, 10000, false);
+  selector.complete("", ALTERNATE_PEER, 10000, false);
+}
+
+TEST_F(DiameterHssConnectionTest, AdaptiveTimeout)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      PRIMARY_PEER,
+                                                      TIMEOUT_MS,
+                                                      &tracker);
+
+  HssConnection::LocationInfoRequest request = {
+    IMPU,
+    "true",
+    ""
+  };
+
+  // Until we have enough samples, the configured timeout is used.
+  EXPECT_CALL(*_mock_stack, send(_, _, TIMEOUT_MS))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_location_info_request(LIA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+
+  add_peer_latencies(tracker);
+
+  // Now the timeout is derived from the peer's latency.
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_location_info_request(LIA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  _caught_diam_tsx->start_timer();
+
+  // A timeout is recorded against the peer, which pushes its timeout up for
+  // the next request.
+  EXPECT_CALL(*_answer_catcher, got_lia(
+    Field(&HssConnection::LocationInfoAnswer::_result_code, ::HssConnection::ResultCode::SERVER_UNAVAILABLE)))
+    .Times(1).RetiresOnSaturation();
+  EXPECT_CALL(*_stats, update_H_hss_latency_us(20000));
+  EXPECT_CALL(*_stats, update_H_hss_subscription_latency_us(20000));
+
+  for (size_t ii = 0; ii < PeerLatencyTracker::RECALC_INTERVAL - 1; ii++)
+  {
+    tracker.record(PRIMARY_PEER, 20000);
+  }
+
+  cwtest_advance_time_ms(20);
+  _caught_diam_tsx->on_timeout();
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+
+  unsigned long p99_us = 0;
+  EXPECT_TRUE(tracker.p99_us(PRIMARY_PEER, p99_us));
+  EXPECT_EQ(20000, p99_us);
+
+  // SARs always use the configured timeout.
+  HssConnection::ServerAssignmentRequest sar_request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    Cx::ServerAssignmentType::REGISTRATION,
+    false,
+    ""
+  };
+
+  EXPECT_CALL(*_mock_stack, send(_, _, TIMEOUT_MS))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_server_assignment_request(SAA_CB, sar_request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, HedgedLIRAlternateAnswersFirst)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer,
+                                                      &selector);
+  add_peer_latencies(tracker);
+  add_selector_peers(selector);
+
+  HssConnection::LocationInfoRequest request = {
+    IMPU,
+    "true",
+    ""
+  };
+
+  // The LIR is sent to the primary, and a hedge is scheduled for its 99th
+  // percentile latency.
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_location_info_request(LIA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  _caught_diam_tsx->start_timer();
+  Diameter::Transaction* primary_tsx = _caught_diam_tsx;
+  Diameter::Message primary_msg(_cx_dict, _caught_fd_msg, _mock_stack);
+  ASSERT_EQ(1, timer.tasks.size());
+  EXPECT_EQ(10, timer.delays[0]);
+
+  // The hedge is sent to the alternate peer.
+  EXPECT_CALL(*_stats, incr_H_hss_hedged_requests());
+  EXPECT_CALL(*_mock_stack, send(_, _, 10))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  cwtest_advance_time_ms(10);
+  timer.tasks[0]();
+  ASSERT_FALSE(_caught_diam_tsx == primary_tsx);
+  _caught_diam_tsx->start_timer();
+  Diameter::Transaction* hedge_tsx = _caught_diam_tsx;
+  Diameter::Message hedge_msg(_cx_dict, _caught_fd_msg, _mock_stack);
+  Cx::LocationInfoRequest lir(hedge_msg);
+  EXPECT_TRUE(lir.get_str_from_avp(_cx_dict->DESTINATION_HOST, test_str));
+  EXPECT_EQ(ALTERNATE_PEER, test_str);
+  EXPECT_EQ(IMPU, lir.impu());
+
+  // The alternate answers first, so its answer is used.
+  Cx::LocationInfoAnswer lia(_cx_dict,
+                             _mock_stack,
+                             DIAMETER_SUCCESS,
+                             0,
+                             0,
+                             SERVER_NAME,
+                             CAPABILITIES);
+
+  EXPECT_CALL(*_answer_catcher, got_lia(
+    AllOf(Field(&HssConnection::LocationInfoAnswer::_result_code, ::HssConnection::ResultCode::SUCCESS),
+          Field(&HssConnection::LocationInfoAnswer::_server_name, SERVER_NAME)))).Times(1).RetiresOnSaturation();
+  EXPECT_CALL(*_stats, incr_H_hss_hedge_wins());
+  EXPECT_CALL(*_stats, update_H_hss_latency_us(2000));
+  EXPECT_CALL(*_stats, update_H_hss_subscription_latency_us(2000));
+  cwtest_advance_time_ms(2);
+  hedge_tsx->on_response(lia);
+  delete hedge_tsx;
+
+  // The primary's late answer is discarded, and as the request has already
+  // been counted, it doesn't update the statistics.
+  cwtest_advance_time_ms(8);
+  primary_tsx->on_timeout();
+  delete primary_tsx;
+
+  _caught_fd_msg = NULL;
+  _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, HedgedLIRPrimaryAnswersFirst)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer,
+                                                      &selector);
+  add_peer_latencies(tracker);
+  add_selector_peers(selector);
+
+  HssConnection::LocationInfoRequest request = {
+    IMPU,
+    "true",
+    ""
+  };
+
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_location_info_request(LIA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  _caught_diam_tsx->start_timer();
+  Diameter::Message primary_msg(_cx_dict, _caught_fd_msg, _mock_stack);
+  ASSERT_EQ(1, timer.tasks.size());
+
+  // The primary answers before the hedge is due.
+  Cx::LocationInfoAnswer lia(_cx_dict,
+                             _mock_stack,
+                             DIAMETER_SUCCESS,
+                             0,
+                             0,
+                             SERVER_NAME,
+                             CAPABILITIES);
+
+  EXPECT_CALL(*_answer_catcher, got_lia(
+    Field(&HssConnection::LocationInfoAnswer::_result_code, ::HssConnection::ResultCode::SUCCESS))).Times(1).RetiresOnSaturation();
+  EXPECT_CALL(*_stats, update_H_hss_latency_us(5000));
+  EXPECT_CALL(*_stats, update_H_hss_subscription_latency_us(5000));
+  cwtest_advance_time_ms(5);
+  _caught_diam_tsx->on_response(lia);
+
+  // So the hedge is never sent.
+  timer.tasks[0]();
+
+  _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, SARNotHedged)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer,
+                                                      &selector);
+  add_peer_latencies(tracker);
+  add_selector_peers(selector);
+
+  HssConnection::ServerAssignmentRequest request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    Cx::ServerAssignmentType::REGISTRATION,
+    false,
+    ""
+  };
+
+  // SARs change state in the HSS, so must only be sent once.
+  EXPECT_CALL(*_mock_stack, send(_, _, TIMEOUT_MS))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_server_assignment_request(SAA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  EXPECT_EQ(0, timer.tasks.size());
+
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, NotHedgedWithDestHost)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      PRIMARY_PEER,
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer);
+  add_peer_latencies(tracker);
+
+  HssConnection::LocationInfoRequest request = {
+    IMPU,
+    "true",
+    ""
+  };
+
+  // A configured Destination-Host pins requests to that peer, so the LIR
+  // isn't hedged to the other one.
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_location_info_request(LIA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  EXPECT_EQ(0, timer.tasks.size());
+
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, ResyncMARNotHedged)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer,
+                                                      &selector);
+  add_peer_latencies(tracker);
+  add_selector_peers(selector);
+
+  // A MAR with an authorization resynchronises the SQN, so mustn't be sent
+  // twice.
+  HssConnection::MultimediaAuthRequest request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    SCHEME_AKA,
+    AUTHORIZATION
+  };
+
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_multimedia_auth_request(MAA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  EXPECT_EQ(0, timer.tasks.size());
+
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, DigestMARHedged)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer,
+                                                      &selector);
+  add_peer_latencies(tracker);
+  add_selector_peers(selector);
+
+  // A digest MAR doesn't change any state in the HSS, so a hedge is
+  // scheduled.
+  HssConnection::MultimediaAuthRequest request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    SCHEME_DIGEST,
+    ""
+  };
+
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_multimedia_auth_request(MAA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  EXPECT_EQ(1, timer.tasks.size());
+
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, AKAMARNotHedged)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer,
+                                                      &selector);
+  add_peer_latencies(tracker);
+  add_selector_peers(selector);
+
+  // The HSS generates a new vector and advances the SQN for each AKA MAR,
+  // so it mustn't be sent twice.
+  HssConnection::MultimediaAuthRequest request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    SCHEME_AKA,
+    ""
+  };
+
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_multimedia_auth_request(MAA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  EXPECT_EQ(0, timer.tasks.size());
+
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+TEST_F(DiameterHssConnectionTest, UnknownSchemeMARNotHedged)
+{
+  PeerLatencyTracker tracker(5, TIMEOUT_MS);
+  FakeTimerQueue timer;
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      &tracker,
+                                                      &timer,
+                                                      &selector);
+  add_peer_latencies(tracker);
+  add_selector_peers(selector);
+
+  // If we don't ask for a scheme, the HSS may choose AKA, so the MAR
+  // mustn't be sent twice.
+  HssConnection::MultimediaAuthRequest request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    SCHEME_UNKNOWN,
+    ""
+  };
+
+  EXPECT_CALL(*_mock_stack, send(_, _, 20))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_multimedia_auth_request(MAA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  EXPECT_EQ(0, timer.tasks.size());
+
+  fd_msg_free(_caught_fd_msg); _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
+
+//
+// Load balancing tests
+//
+
+TEST_F(DiameterHssConnectionTest, LoadBalancedToLeastLoadedPeer)
+{
+  PeerSelector selector(TIMEOUT_MS);
+  HssConnection::DiameterHssConnection hss_connection(_stats,
+                                                      _cx_dict,
+                                                      _mock_stack,
+                                                      DEST_REALM,
+                                                      "",
+                                                      TIMEOUT_MS,
+                                                      NULL,
+                                                      NULL,
+                                                      &selector);
+
+  // Teach the selector about two peers, and load up the first one.
+  selector.complete("", PRIMARY_PEER, 10000, false);
+  selector.complete("", ALTERNATE_PEER, 10000, false);
+  selector.start(PRIMARY_PEER);
+
+  HssConnection::ServerAssignmentRequest request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    Cx::ServerAssignmentType::REGISTRATION,
+    false,
+    ""
+  };
+
+  EXPECT_CALL(*_mock_stack, send(_, _, TIMEOUT_MS))
+    .WillOnce(WithArgs<0,1>(Invoke(store_msg_tsx)));
+  hss_connection.send_server_assignment_request(SAA_CB, request, FAKE_TRAIL_ID);
+  ASSERT_FALSE(_caught_diam_tsx == NULL);
+  _caught_diam_tsx->start_timer();
+
+  // The SAR is sent to the peer with fewer requests in flight.
+  Diameter::Message msg(_cx_dict, _caught_fd_msg, _mock_stack);
+  Cx::ServerAssignmentRequest sar(msg);
+  EXPECT_TRUE(sar.get_str_from_avp(_cx_dict->DESTINATION_HOST, test_str));
+  EXPECT_EQ(ALTERNATE_PEER, test_str);
+
+  // While it's in flight, both peers are equally loaded.
+  EXPECT_EQ(PRIMARY_PEER, selector.select());
+
+  Cx::ServerAssignmentAnswer saa(_cx_dict,
+                                 _mock_stack,
+                                 DIAMETER_SUCCESS,
+                                 0,
+                                 0,
+                                 IMS_SUB_XML,
+                                 FULL_CHARGING_ADDRESSES);
+
+  EXPECT_CALL(*_answer_catcher, got_saa(
+    Field(&HssConnection::ServerAssignmentAnswer::_result_code, ::HssConnection::ResultCode::SUCCESS)))
+    .Times(1).RetiresOnSaturation();
+  EXPECT_CALL(*_stats, update_H_hss_latency_us(12000));
+  EXPECT_CALL(*_stats, update_H_hss_subscription_latency_us(12000));
+  cwtest_advance_time_ms(12);
+
+  _caught_diam_tsx->on_response(saa);
+
+  // Once it's answered, the alternate is the least loaded again.
+  EXPECT_EQ(ALTERNATE_PEER, selector.select());
+
+  _caught_fd_msg = NULL;
+  delete _caught_diam_tsx; _caught_diam_tsx = NULL;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file embedded_store_test.cpp UT for EmbeddedStore
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <thread>
+
+#include "embedded_store.h"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+static const std::string TABLE = "impu";
+static const std::string KEY = "sip:impu@example.com";
+static const std::string OTHER_KEY = "sip:other_impu@example.com";
+
+class EmbeddedStoreTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+};
+
+TEST_F(EmbeddedStoreTest, Cas)
+{
+  EmbeddedStore store(1024 * 1024);
+  std::string data;
+  uint64_t cas = 0;
+
+  EXPECT_EQ(Store::Status::NOT_FOUND, store.get_data(TABLE, KEY, data, cas));
+
+  // A CAS of 0 adds the record, but only if it doesn't exist yet.
+  EXPECT_EQ(Store::Status::OK, store.set_data(TABLE, KEY, "one", 0, 300));
+  EXPECT_EQ(Store::Status::DATA_CONTENTION,
+            store.set_data(TABLE, KEY, "two", 0, 300));
+
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("one", data);
+
+  EXPECT_EQ(Store::Status::DATA_CONTENTION,
+            store.set_data(TABLE, KEY, "two", cas + 1, 300));
+  EXPECT_EQ(Store::Status::OK, store.set_data(TABLE, KEY, "two", cas, 300));
+
+  // The CAS has moved on, so the old one no longer works.
+  uint64_t old_cas = cas;
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("two", data);
+  EXPECT_NE(old_cas, cas);
+  EXPECT_EQ(Store::Status::DATA_CONTENTION,
+            store.set_data(TABLE, KEY, "three", old_cas, 300));
+
+  EXPECT_EQ(Store::Status::OK,
+            store.set_data_without_cas(TABLE, KEY, "four", 300));
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("four", data);
+
+  // Tables are separate.
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            store.get_data("impi_mapping", KEY, data, cas));
+
+  EXPECT_EQ(Store::Status::OK, store.delete_data(TABLE, KEY));
+  EXPECT_EQ(Store::Status::NOT_FOUND, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ(0u, store.size());
+  EXPECT_EQ(0u, store.bytes());
+}
+
+TEST_F(EmbeddedStoreTest, Expiry)
+{
+  EmbeddedStore store(1024 * 1024);
+  std::string data;
+  uint64_t cas;
+
+  store.set_data_without_cas(TABLE, KEY, "data", 10);
+  store.set_data_without_cas(TABLE, OTHER_KEY, "data", 20);
+
+  // A write that has already expired just removes the record.
+  EXPECT_EQ(Store::Status::OK,
+            store.set_data_without_cas(TABLE, "sip:expired@example.com", "data", 0));
+  EXPECT_EQ(2u, store.size());
+
+  cwtest_advance_time_ms(11000);
+
+  EXPECT_EQ(Store::Status::NOT_FOUND, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ(Store::Status::OK, store.get_data(TABLE, OTHER_KEY, data, cas));
+
+  // An expired record can be added again with a CAS of 0.
+  EXPECT_EQ(Store::Status::OK, store.set_data(TABLE, KEY, "data", 0, 10));
+
+  cwtest_advance_time_ms(11000);
+
+  // Sweeping removes the expired records without them being read.
+  EXPECT_EQ(2u, store.size());
+  store.sweep();
+  EXPECT_EQ(0u, store.size());
+}
+
+TEST_F(EmbeddedStoreTest, EvictLeastRecentlyUsed)
+{
+  // One shard with room for three of these records.
+  std::string value(150, 'x');
+  EmbeddedStore store(1000, 1);
+  std::string data;
+  uint64_t cas;
+
+  store.set_data_without_cas(TABLE, "sip:1@example.com", value, 300);
+  store.set_data_without_cas(TABLE, "sip:2@example.com", value, 300);
+  store.set_data_without_cas(TABLE, "sip:3@example.com", value, 300);
+  EXPECT_EQ(3u, store.size());
+
+  // Reading the first record makes the second the least recently used.
+  store.get_data(TABLE, "sip:1@example.com", data, cas);
+  store.set_data_without_cas(TABLE, "sip:4@example.com", value, 300);
+
+  EXPECT_EQ(3u, store.size());
+  EXPECT_LE(store.bytes(), 1000u);
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            store.get_data(TABLE, "sip:2@example.com", data, cas));
+  EXPECT_EQ(Store::Status::OK,
+            store.get_data(TABLE, "sip:1@example.com", data, cas));
+  EXPECT_EQ(Store::Status::OK,
+            store.get_data(TABLE, "sip:4@example.com", data, cas));
+
+  // A record that could never fit is rejected.
+  EXPECT_EQ(Store::Status::ERROR,
+            store.set_data_without_cas(TABLE, KEY, std::string(1000, 'x'), 300));
+}
+
+TEST_F(EmbeddedStoreTest, ConcurrentCas)
+{
+  EmbeddedStore store(1024 * 1024, 4);
+  store.set_data(TABLE, KEY, "0", 0, 300);
+
+  // Each thread increments the counter with a CAS loop, so no increments are
+  // lost however the threads interleave.
+  std::vector<std::thread> threads;
+
+  for (int ii = 0; ii < 4; ii++)
+  {
+    threads.push_back(std::thread([&store]()
+    {
+      for (int jj = 0; jj < 100; jj++)
+      {
+        Store::Status status;
+
+        do
+        {
+          std::string data;
+          uint64_t cas;
+          store.get_data(TABLE, KEY, data, cas);
+          status = store.set_data(TABLE,
+                                  KEY,
+                                  std::to_string(std::stoi(data) + 1),
+                                  cas,
+                                  300);
+        }
+        while (status == Store::Status::DATA_CONTENTION);
+      }
+    }));
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  std::string data;
+  uint64_t cas;
+  store.get_data(TABLE, KEY, data, cas);
+  EXPECT_EQ("400", data);
+}
@@ -0,0 +1,167 @@
+/**
+ * @file fake_async_store.h Fake AsyncStore for tests
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef FAKE_ASYNC_STORE_H__
+#define FAKE_ASYNC_STORE_H__
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async_store.h"
+#include "store.h"
+
+// An AsyncStore that reads from and writes to a Store. Requests are queued
+// until the test runs them, so it can check that nothing blocks waiting for
+// them, unless the store is set to run them straight away. A multi-get or
+// multi-set is queued, and counted, as one request.
+class FakeAsyncStore : public AsyncStore
+{
+public:
+  FakeAsyncStore(Store* store) :
+    _store(store),
+    _immediate(false),
+    _gets_run(0),
+    _multi_gets_run(0),
+    _multi_sets_run(0)
+  {
+  }
+
+  void get_data_async(const std::string& table,
+                      const std::string& key,
+                      SAS::TrailId trail,
+                      get_callback callback) override
+  {
+    queue([this, table, key, callback]()
+    {
+      std::string data;
+      uint64_t cas = 0;
+      Store::Status status = get(table, key, data, cas);
+      callback(status, data, cas);
+    });
+  }
+
+  void get_multi_data_async(const std::string& table,
+                            const std::vector<std::string>& keys,
+                            SAS::TrailId trail,
+                            multi_get_callback callback) override
+  {
+    queue([this, table, keys, callback]()
+    {
+      _multi_gets_run++;
+      std::vector<Result> results(keys.size());
+
+      for (size_t ii = 0; ii < keys.size(); ii++)
+      {
+        results[ii].cas = 0;
+        results[ii].status = get(table, keys[ii], results[ii].data, results[ii].cas);
+      }
+
+      callback(results);
+    });
+  }
+
+  void set_multi_data_async(const std::string& table,
+                            const std::vector<std::pair<std::string, std::string>>& records,
+                            int expiry,
+                            SAS::TrailId trail,
+                            multi_set_callback callback) override
+  {
+    queue([this, table, records, expiry, callback]()
+    {
+      _multi_sets_run++;
+      std::vector<Store::Status> statuses;
+
+      for (const std::pair<std::string, std::string>& record : records)
+      {
+        statuses.push_back(_store->set_data_without_cas(table,
+                                                        record.first,
+                                                        record.second,
+                                                        expiry,
+                                                        0));
+      }
+
+      callback(statuses);
+    });
+  }
+
+  // Runs requests as soon as they're made, for tests that use the store
+  // from blocking calls.
+  void set_immediate(bool immediate)
+  {
+    _immediate = immediate;
+  }
+
+  // Runs the queued requests, and any that they queue in turn.
+  void run()
+  {
+    while (!_queued.empty())
+    {
+      std::function<void()> request = _queued.front();
+      _queued.pop_front();
+      request();
+    }
+  }
+
+  size_t queued() const
+  {
+    return _queued.size();
+  }
+
+  // The number of records got, whether singly or by multi-gets.
+  int gets_run() const
+  {
+    return _gets_run;
+  }
+
+  int multi_gets_run() const
+  {
+    return _multi_gets_run;
+  }
+
+  int multi_sets_run() const
+  {
+    return _multi_sets_run;
+  }
+
+private:
+  void queue(std::function<void()> request)
+  {
+    if (_immediate)
+    {
+      request();
+    }
+    else
+    {
+      _queued.push_back(request);
+    }
+  }
+
+  Store::Status get(const std::string& table,
+                    const std::string& key,
+                    std::string& data,
+                    uint64_t& cas)
+  {
+    _gets_run++;
+    return _store->get_data(table, key, data, cas);
+  }
+
+  Store* _store;
+  bool _immediate;
+  std::deque<std::function<void()>> _queued;
+  int _gets_run;
+  int _multi_gets_run;
+  int _multi_sets_run;
+};
+
+#endif
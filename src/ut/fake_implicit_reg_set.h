@@ -23,7 +23,8 @@ class FakeImplicitRegistrationSet : public ImplicitRegistrationSet
   FakeImplicitRegistrationSet(const std::string& default_impu) :
     ImplicitRegistrationSet(),
     _default_impu(default_impu),
-    _ttl(0)
+    _ttl(0),
+    _refresh_deadline(0)
   {
   }
 
@@ -57,6 +58,11 @@ class FakeImplicitRegistrationSet : public ImplicitRegistrationSet
     return _ttl;
   }
 
+  virtual int64_t get_refresh_deadline() const override
+  {
+    return _refresh_deadline;
+  }
+
   virtual void set_ims_sub_xml(const std::string& xml) override
   {
     _ims_sub_xml = xml;
@@ -90,6 +96,11 @@ class FakeImplicitRegistrationSet : public ImplicitRegistrationSet
     _ttl = ttl;
   }
 
+  virtual void set_refresh_deadline(int64_t deadline) override
+  {
+    _refresh_deadline = deadline;
+  }
+
 private:
   std::string _default_impu;
   std::string _ims_sub_xml;
@@ -97,6 +108,7 @@ private:
   std::vector<std::string> _associated_impis;
   ChargingAddresses _charging_addresses;
   int32_t _ttl;
+  int64_t _refresh_deadline;
 };
 
 #endif
@@ -0,0 +1,143 @@
+/**
+ * @file flight_recorder_test.cpp UT for FlightRecorder
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <rapidjson/document.h>
+
+#include "flight_recorder.h"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+static const unsigned long THRESHOLD_MS = 100;
+static const size_t CAPACITY = 2;
+
+class FlightRecorderTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  FlightRecorderTest() :
+    _recorder(THRESHOLD_MS, CAPACITY)
+  {
+  }
+
+  // Dumps the recorder as JSON, and parses it.
+  void dump(rapidjson::Document& doc)
+  {
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    _recorder.write_json(writer);
+    doc.Parse<0>(sb.GetString());
+    ASSERT_FALSE(doc.HasParseError());
+  }
+
+  FlightRecorder _recorder;
+};
+
+TEST_F(FlightRecorderTest, FastRequestNotRecorded)
+{
+  FlightRecorder::Timeline timeline;
+  cwtest_advance_time_ms(THRESHOLD_MS - 1);
+  EXPECT_FALSE(_recorder.record("HTTP", "/impu/sip:alice@example.com/reg-data", 1, timeline));
+
+  rapidjson::Document doc;
+  dump(doc);
+  EXPECT_EQ(0u, doc["requests"].Size());
+}
+
+TEST_F(FlightRecorderTest, IsSlow)
+{
+  FlightRecorder::Timeline timeline;
+  cwtest_advance_time_ms(THRESHOLD_MS - 1);
+  EXPECT_FALSE(_recorder.is_slow(timeline));
+  cwtest_advance_time_ms(1);
+  EXPECT_TRUE(_recorder.is_slow(timeline));
+}
+
+TEST_F(FlightRecorderTest, SlowRequestRecorded)
+{
+  FlightRecorder::Timeline timeline;
+  cwtest_advance_time_ms(10);
+  timeline.mark("cache_get_sent");
+  cwtest_advance_time_ms(90);
+  timeline.mark("cache_get_done");
+  EXPECT_TRUE(_recorder.record("HTTP", "/impu/sip:alice@example.com/reg-data", 1, timeline));
+
+  rapidjson::Document doc;
+  dump(doc);
+  EXPECT_EQ(0u, doc["dropped"].GetUint64());
+  ASSERT_EQ(1u, doc["requests"].Size());
+
+  const rapidjson::Value& request = doc["requests"][0];
+  EXPECT_STREQ("HTTP", request["type"].GetString());
+  EXPECT_STREQ("/impu/sip:alice@example.com/reg-data", request["id"].GetString());
+  EXPECT_EQ(1u, request["trail"].GetUint64());
+  EXPECT_EQ(100000u, request["duration-us"].GetUint64());
+
+  const rapidjson::Value& stages = request["stages"];
+  ASSERT_EQ(2u, stages.Size());
+  EXPECT_STREQ("cache_get_sent", stages[0]["stage"].GetString());
+  EXPECT_EQ(10000u, stages[0]["time-us"].GetUint64());
+  EXPECT_STREQ("cache_get_done", stages[1]["stage"].GetString());
+  EXPECT_EQ(100000u, stages[1]["time-us"].GetUint64());
+}
+
+TEST_F(FlightRecorderTest, OldestRequestsOverwritten)
+{
+  const char* ids[] = {"impi1", "impi2", "impi3"};
+
+  for (const char* id : ids)
+  {
+    FlightRecorder::Timeline timeline;
+    cwtest_advance_time_ms(THRESHOLD_MS);
+    EXPECT_TRUE(_recorder.record("RTR", id, 0, timeline));
+  }
+
+  // Only the most recent requests are kept, oldest first.
+  rapidjson::Document doc;
+  dump(doc);
+  ASSERT_EQ(CAPACITY, doc["requests"].Size());
+  EXPECT_STREQ("impi2", doc["requests"][0]["id"].GetString());
+  EXPECT_STREQ("impi3", doc["requests"][1]["id"].GetString());
+}
+
+TEST_F(FlightRecorderTest, TooManyStages)
+{
+  FlightRecorder::Timeline timeline;
+
+  for (int ii = 0; ii < FlightRecorder::MAX_STAGES + 1; ii++)
+  {
+    timeline.mark("stage");
+  }
+
+  EXPECT_EQ(FlightRecorder::MAX_STAGES, timeline.num_stages());
+}
+
+TEST_F(FlightRecorderTest, LongIdTruncated)
+{
+  FlightRecorder::Timeline timeline;
+  cwtest_advance_time_ms(THRESHOLD_MS);
+  std::string id(FlightRecorder::MAX_ID_LENGTH * 2, 'a');
+  EXPECT_TRUE(_recorder.record("PPR", id, 0, timeline));
+
+  rapidjson::Document doc;
+  dump(doc);
+  ASSERT_EQ(1u, doc["requests"].Size());
+  EXPECT_EQ(FlightRecorder::MAX_ID_LENGTH - 1,
+            strlen(doc["requests"][0]["id"].GetString()));
+}
@@ -0,0 +1,155 @@
+/**
+ * @file hsprov_cache_test.cpp UT for HsProvCache
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "hsprov_cache.h"
+#include "mockstatisticsmanager.hpp"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+using ::testing::StrictMock;
+
+static const int TTL_S = 10;
+static const size_t MAX_ENTRIES = 3;
+
+static const std::string IMPI = "alice@example.com";
+static const std::string IMPU = "sip:alice@example.com";
+static const std::string IMS_SUB_XML = "<IMSSubscription>xml</IMSSubscription>";
+
+class HsProvCacheTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  HsProvCacheTest() :
+    _cache(TTL_S, MAX_ENTRIES, &_stats)
+  {
+    _av.ha1 = "ha1";
+    _av.realm = "realm";
+    _av.qop = "qop";
+  }
+
+  StrictMock<MockStatisticsManager> _stats;
+  HsProvCache _cache;
+  DigestAuthVector _av;
+};
+
+TEST_F(HsProvCacheTest, AuthVector)
+{
+  DigestAuthVector av;
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_misses());
+  EXPECT_FALSE(_cache.get_av(IMPI, IMPU, av));
+
+  _cache.put_av(IMPI, IMPU, _av);
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_hits());
+  EXPECT_TRUE(_cache.get_av(IMPI, IMPU, av));
+  EXPECT_EQ("ha1", av.ha1);
+  EXPECT_EQ("realm", av.realm);
+  EXPECT_EQ("qop", av.qop);
+
+  // The auth vector is only cached for the public ID it was requested with.
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_misses());
+  EXPECT_FALSE(_cache.get_av(IMPI, "sip:bob@example.com", av));
+}
+
+TEST_F(HsProvCacheTest, RegData)
+{
+  std::string xml;
+  ChargingAddresses charging_addrs;
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_misses());
+  EXPECT_FALSE(_cache.get_reg_data(IMPU, xml, charging_addrs));
+
+  ChargingAddresses cached_charging_addrs({"ccf1"}, {"ecf1"});
+  _cache.put_reg_data(IMPU, IMS_SUB_XML, cached_charging_addrs);
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_hits());
+  EXPECT_TRUE(_cache.get_reg_data(IMPU, xml, charging_addrs));
+  EXPECT_EQ(IMS_SUB_XML, xml);
+  EXPECT_EQ(cached_charging_addrs, charging_addrs);
+}
+
+TEST_F(HsProvCacheTest, Expiry)
+{
+  DigestAuthVector av;
+  _cache.put_av(IMPI, IMPU, _av);
+
+  cwtest_advance_time_ms((TTL_S - 1) * 1000);
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_hits());
+  EXPECT_TRUE(_cache.get_av(IMPI, IMPU, av));
+
+  cwtest_advance_time_ms(1000);
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_misses());
+  EXPECT_FALSE(_cache.get_av(IMPI, IMPU, av));
+}
+
+TEST_F(HsProvCacheTest, LeastRecentlyUsedEvicted)
+{
+  std::string xml;
+  ChargingAddresses charging_addrs;
+
+  _cache.put_reg_data("sip:1@example.com", IMS_SUB_XML, charging_addrs);
+  _cache.put_reg_data("sip:2@example.com", IMS_SUB_XML, charging_addrs);
+  _cache.put_reg_data("sip:3@example.com", IMS_SUB_XML, charging_addrs);
+
+  // Use the first entry, so the second is the least recently used.
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_hits());
+  EXPECT_TRUE(_cache.get_reg_data("sip:1@example.com", xml, charging_addrs));
+
+  _cache.put_reg_data("sip:4@example.com", IMS_SUB_XML, charging_addrs);
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_misses());
+  EXPECT_FALSE(_cache.get_reg_data("sip:2@example.com", xml, charging_addrs));
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_hits()).Times(3);
+  EXPECT_TRUE(_cache.get_reg_data("sip:1@example.com", xml, charging_addrs));
+  EXPECT_TRUE(_cache.get_reg_data("sip:3@example.com", xml, charging_addrs));
+  EXPECT_TRUE(_cache.get_reg_data("sip:4@example.com", xml, charging_addrs));
+}
+
+TEST_F(HsProvCacheTest, Invalidate)
+{
+  DigestAuthVector av;
+  std::string xml;
+  ChargingAddresses charging_addrs;
+
+  _cache.put_av(IMPI, IMPU, _av);
+  _cache.put_av(IMPI, "sip:alice2@example.com", _av);
+  _cache.put_reg_data(IMPU, IMS_SUB_XML, charging_addrs);
+
+  // Invalidating the public ID removes its registration data, and the auth
+  // vector requested with it.
+  EXPECT_EQ(2u, _cache.invalidate_impu(IMPU));
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_misses()).Times(2);
+  EXPECT_FALSE(_cache.get_av(IMPI, IMPU, av));
+  EXPECT_FALSE(_cache.get_reg_data(IMPU, xml, charging_addrs));
+
+  EXPECT_CALL(_stats, incr_H_hsprov_cache_hits());
+  EXPECT_TRUE(_cache.get_av(IMPI, "sip:alice2@example.com", av));
+
+  // Invalidating the private ID removes the rest of its auth vectors.
+  EXPECT_EQ(1u, _cache.invalidate_impi(IMPI));
+
+  _cache.put_av(IMPI, IMPU, _av);
+  _cache.put_reg_data(IMPU, IMS_SUB_XML, charging_addrs);
+  EXPECT_EQ(2u, _cache.invalidate_all());
+  EXPECT_EQ(0u, _cache.invalidate_all());
+}
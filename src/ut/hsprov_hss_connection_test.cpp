@@ -320,6 +320,58 @@ TEST_F(HsProvHssConnectionTest, SendMAROtherError)
   t->on_failure(&mock_op);
 }
 
+TEST_F(HsProvHssConnectionTest, SendMARCached)
+{
+  HsProvCache cache(10, 100, _stats);
+  HssConnection::HsProvHssConnection hss_connection(_stats, _mock_store, SERVER_NAME, &cache);
+
+  // Create a Digest MAR
+  HssConnection::MultimediaAuthRequest request = {
+    IMPI,
+    IMPU,
+    SERVER_NAME,
+    SCHEME_DIGEST,
+    AUTHORIZATION
+  };
+
+  // The first MAR isn't in the cache, so we request the digest from Cassandra
+  MockHsProvStore::MockGetAuthVector mock_op;
+  EXPECT_CALL(*_mock_store, create_GetAuthVector(IMPI, IMPU))
+    .WillOnce(Return(&mock_op));
+  EXPECT_DO_ASYNC(*_mock_store, mock_op);
+  EXPECT_CALL(*_stats, incr_H_hsprov_cache_misses());
+
+  hss_connection.send_multimedia_auth_request(MAA_CB, request, FAKE_TRAIL_ID);
+
+  CassandraStore::Transaction* t = mock_op.get_trx();
+  ASSERT_FALSE(t == NULL);
+  t->start_timer();
+
+  DigestAuthVector digest;
+  digest.ha1 = "ha1";
+  digest.realm = "realm";
+  digest.qop = "qop";
+
+  EXPECT_CALL(mock_op, get_result(_)).WillOnce(SetArgReferee<0>(digest));
+  EXPECT_CALL(*_answer_catcher, got_maa(
+    Field(&HssConnection::MultimediaAuthAnswer::_auth_vector,
+          IsDigestAndMatches("ha1", "realm", "qop")))).Times(1).RetiresOnSaturation();
+  EXPECT_CALL(*_stats, update_H_hsprov_latency_us(12000));
+  cwtest_advance_time_ms(12);
+
+  t->on_success(&mock_op);
+
+  // The second MAR is answered from the cache, without going to Cassandra
+  EXPECT_CALL(*_stats, incr_H_hsprov_cache_hits());
+  EXPECT_CALL(*_answer_catcher, got_maa(
+    AllOf(Field(&HssConnection::MultimediaAuthAnswer::_result_code, ::HssConnection::ResultCode::SUCCESS),
+          Field(&HssConnection::MultimediaAuthAnswer::_sip_auth_scheme, SCHEME_DIGEST),
+          Field(&HssConnection::MultimediaAuthAnswer::_auth_vector,
+            IsDigestAndMatches("ha1", "realm", "qop"))))).Times(1).RetiresOnSaturation();
+
+  hss_connection.send_multimedia_auth_request(MAA_CB, request, FAKE_TRAIL_ID);
+}
+
 //
 // UserAuthRequest tests
 //
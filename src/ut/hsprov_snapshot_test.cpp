@@ -0,0 +1,188 @@
+/**
+ * @file hsprov_snapshot_test.cpp UT for Homestead-prov snapshots
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <unistd.h>
+
+#include "hsprov_snapshot.h"
+#include "test_utils.hpp"
+
+static const std::string IMPI = "alice@example.com";
+static const std::string IMPU = "sip:alice@example.com";
+static const std::string OTHER_IMPU = "sip:bob@example.com";
+static const std::string IMS_SUB_XML = "<IMSSubscription>xml</IMSSubscription>";
+
+// Records whether a transaction succeeded, and takes the results of the
+// operation it was run with.
+class TestTransaction : public CassandraStore::Transaction
+{
+public:
+  TestTransaction(bool& success, bool& failure, std::string& xml, DigestAuthVector& av) :
+    CassandraStore::Transaction(0),
+    _success(success),
+    _failure(failure),
+    _xml(xml),
+    _av(av)
+  {}
+
+  void on_success(CassandraStore::Operation* op)
+  {
+    _success = true;
+
+    HsProvStore::GetRegData* get_reg_data = dynamic_cast<HsProvStore::GetRegData*>(op);
+    if (get_reg_data != NULL)
+    {
+      get_reg_data->get_xml(_xml);
+    }
+
+    HsProvStore::GetAuthVector* get_av = dynamic_cast<HsProvStore::GetAuthVector*>(op);
+    if (get_av != NULL)
+    {
+      get_av->get_result(_av);
+    }
+  }
+
+  void on_failure(CassandraStore::Operation* op)
+  {
+    _failure = true;
+  }
+
+private:
+  bool& _success;
+  bool& _failure;
+  std::string& _xml;
+  DigestAuthVector& _av;
+};
+
+class HsProvSnapshotTest : public testing::Test
+{
+public:
+  HsProvSnapshotTest() :
+    _path(UT_DIR + "/hsprov_snapshot_test.snap")
+  {
+  }
+
+  virtual ~HsProvSnapshotTest()
+  {
+    unlink(_path.c_str());
+  }
+
+  // Writes a snapshot holding one IMPU and one IMPI.
+  void populate()
+  {
+    HsProvSnapshot::Writer writer(_path);
+    ASSERT_TRUE(writer.open());
+    ASSERT_TRUE(writer.add(HsProvSnapshot::IMPU,
+                           IMPU,
+                           {IMS_SUB_XML, "ccf1", "", "ecf1", "ecf2"}));
+    ASSERT_TRUE(writer.add(HsProvSnapshot::IMPI,
+                           IMPI,
+                           {"ha1", "example.com", "auth", IMPU}));
+    EXPECT_EQ(2u, writer.num_records());
+    ASSERT_TRUE(writer.commit());
+  }
+
+  // Runs an operation against the snapshot store, and returns whether it
+  // succeeded.
+  bool run(HsProvSnapshotStore& store, CassandraStore::Operation* op)
+  {
+    bool success = false;
+    bool failure = false;
+    CassandraStore::Transaction* trx =
+      new TestTransaction(success, failure, _xml, _av);
+
+    store.do_async(op, trx);
+
+    // The store takes ownership of the operation and transaction.
+    EXPECT_TRUE(op == NULL);
+    EXPECT_TRUE(trx == NULL);
+    EXPECT_NE(success, failure);
+
+    return success;
+  }
+
+  std::string _path;
+  std::string _xml;
+  DigestAuthVector _av;
+};
+
+TEST_F(HsProvSnapshotTest, WriteAndRead)
+{
+  populate();
+
+  HsProvSnapshot::Reader reader(_path);
+  ASSERT_TRUE(reader.open());
+  EXPECT_EQ(2u, reader.num_records());
+
+  std::vector<HsProvSnapshot::Field> fields;
+  ASSERT_TRUE(reader.get(HsProvSnapshot::IMPU, IMPU, fields));
+  ASSERT_EQ((size_t)HsProvSnapshot::NUM_IMPU_FIELDS, fields.size());
+  EXPECT_EQ(IMS_SUB_XML, fields[HsProvSnapshot::IMS_SUB_XML].str());
+  EXPECT_EQ("ccf1", fields[HsProvSnapshot::PRIMARY_CCF].str());
+  EXPECT_EQ(0u, fields[HsProvSnapshot::SECONDARY_CCF].length);
+
+  ASSERT_TRUE(reader.get(HsProvSnapshot::IMPI, IMPI, fields));
+  ASSERT_EQ(4u, fields.size());
+  EXPECT_EQ("ha1", fields[HsProvSnapshot::DIGEST_HA1].str());
+  EXPECT_TRUE(fields[HsProvSnapshot::FIRST_PUBLIC_ID] == IMPU);
+
+  // Keys are looked up per record type.
+  EXPECT_FALSE(reader.get(HsProvSnapshot::IMPI, IMPU, fields));
+  EXPECT_FALSE(reader.get(HsProvSnapshot::IMPU, OTHER_IMPU, fields));
+}
+
+TEST_F(HsProvSnapshotTest, MissingFile)
+{
+  HsProvSnapshot::Reader reader(_path);
+  EXPECT_FALSE(reader.open());
+}
+
+TEST_F(HsProvSnapshotTest, CorruptFile)
+{
+  FILE* f = fopen(_path.c_str(), "w");
+  ASSERT_NE((FILE*)NULL, f);
+  fputs("not a snapshot", f);
+  fclose(f);
+
+  HsProvSnapshot::Reader reader(_path);
+  EXPECT_FALSE(reader.open());
+}
+
+TEST_F(HsProvSnapshotTest, StoreGetRegData)
+{
+  populate();
+
+  HsProvSnapshotStore store(_path);
+  ASSERT_TRUE(store.open());
+
+  EXPECT_TRUE(run(store, store.create_GetRegData(IMPU)));
+  EXPECT_EQ(IMS_SUB_XML, _xml);
+
+  EXPECT_FALSE(run(store, store.create_GetRegData(OTHER_IMPU)));
+}
+
+TEST_F(HsProvSnapshotTest, StoreGetAuthVector)
+{
+  populate();
+
+  HsProvSnapshotStore store(_path);
+  ASSERT_TRUE(store.open());
+
+  EXPECT_TRUE(run(store, store.create_GetAuthVector(IMPI)));
+  EXPECT_EQ("ha1", _av.ha1);
+  EXPECT_EQ("example.com", _av.realm);
+  EXPECT_EQ("auth", _av.qop);
+
+  EXPECT_TRUE(run(store, store.create_GetAuthVector(IMPI, IMPU)));
+
+  // The private ID isn't associated with this public ID.
+  EXPECT_FALSE(run(store, store.create_GetAuthVector(IMPI, OTHER_IMPU)));
+  EXPECT_FALSE(run(store, store.create_GetAuthVector("bob@example.com")));
+}
@@ -44,6 +44,8 @@
 #include "fake_implicit_reg_set.h"
 #include "http_handlers.h"
 #include "mockstatisticsmanager.hpp"
+#include "mock_sas.h"
+#include "homesteadsasevent.h"
 #include "sproutconnection.h"
 #include "mock_health_checker.hpp"
 #include "fakesnmp.hpp"
@@ -53,6 +55,8 @@
 #include "mockhssconnection.hpp"
 #include "mockhsscacheprocessor.hpp"
 #include "mockimssubscription.hpp"
+#include "mockreregistrationrefresher.hpp"
+#include "registration_dampener.h"
 
 using ::testing::Return;
 using ::testing::ReturnRef;
@@ -709,6 +713,49 @@ TEST_F(HTTPHandlersTest, ImpiDigestHssUserUnknown)
   task->run();
 }
 
+TEST_F(HTTPHandlersTest, ImpiDigestHssUserUnknownNegativeCache)
+{
+  // Tests that once the HSS has said it doesn't know a subscriber, repeated
+  // requests for them are rejected without another MAR, and that the
+  // rejection is counted and logged to SAS
+  StrictMock<MockStatisticsManager> stats;
+  NegativeCache negative_cache(30, 100, &stats);
+  HssCacheTask::configure_negative_cache(&negative_cache);
+  mock_sas_collect_messages(true);
+
+  ImpiTask::Config cfg(SCHEME_UNKNOWN, SCHEME_DIGEST, SCHEME_AKA, SCHEME_AKAV2);
+
+  HssConnection::MultimediaAuthAnswer answer =
+    HssConnection::MultimediaAuthAnswer(HssConnection::ResultCode::NOT_FOUND);
+
+  // Only the first request is sent to the HSS
+  EXPECT_CALL(*_hss, send_multimedia_auth_request(_, _, _))
+    .WillOnce(InvokeArgument<0>(ByRef(answer)));
+  EXPECT_CALL(stats, incr_H_negative_cache_hits());
+
+  for (int ii = 0; ii < 2; ii++)
+  {
+    MockHttpStack::Request req(_httpstack,
+                               "/impi/" + IMPI,
+                               "digest",
+                               "?public_id=" + IMPU);
+    ImpiDigestTask* task = new ImpiDigestTask(req, &cfg, FAKE_TRAIL_ID);
+
+    // Expect a 404
+    EXPECT_CALL(*_httpstack, send_reply(_, 404, _));
+
+    task->run();
+
+    // Only the second request is answered from the cache.
+    MockSASMessage* event = mock_sas_find_event(SASEvent::NEGATIVE_CACHE_HIT);
+    EXPECT_EQ((ii == 1), (event != NULL));
+    mock_sas_discard_messages();
+  }
+
+  mock_sas_collect_messages(false);
+  HssCacheTask::configure_negative_cache(NULL);
+}
+
 TEST_F(HTTPHandlersTest, ImpiDigestHssOtherError)
 {
   // Tests IMPI Digest task when HSS returns an unhandled error type
@@ -1781,6 +1828,59 @@ TEST_F(HTTPHandlersTest, ImpuRegDataReRegNoCache)
   EXPECT_EQ(REGDATA_RESULT, req.content());
 }
 
+TEST_F(HTTPHandlersTest, ImpuRegDataReRegNoCacheDampened)
+{
+  // Tests that once a subscriber has sent a re-registration SAR in the
+  // dampening window, another re-registration is answered from the cache
+  // even though cached responses are not allowed.
+  RegistrationDampener dampener(10000, 1, 100, NULL);
+  ImpuRegDataTask::Config cfg(true, 3600, 7200, true, NULL, &dampener);
+
+  for (int ii = 0; ii < 2; ii++)
+  {
+    MockHttpStack::Request req = make_request("reg", true, true, false);
+    req.add_header_to_incoming_req("Cache-control", "no-cache");
+    ImpuRegDataTask* task = new ImpuRegDataTask(req, &cfg, FAKE_TRAIL_ID);
+
+    // Create IRS to be returned from the cache
+    FakeImplicitRegistrationSet* irs = new FakeImplicitRegistrationSet(IMPU);
+    irs->set_ims_sub_xml(IMPU_IMS_SUBSCRIPTION);
+    irs->set_reg_state(RegistrationState::REGISTERED);
+    irs->set_charging_addresses(NO_CHARGING_ADDRESSES);
+    irs->add_associated_impi(IMPI);
+    irs->set_ttl(7200);
+
+    // Set up the cache to return our IRS
+    EXPECT_CALL(*_cache, get_implicit_registration_set_for_impu(_, _, IMPU, FAKE_TRAIL_ID))
+      .WillOnce(InvokeArgument<0>(irs));
+
+    HssConnection::ServerAssignmentAnswer answer =
+      HssConnection::ServerAssignmentAnswer(HssConnection::ResultCode::SUCCESS,
+                                            NO_CHARGING_ADDRESSES,
+                                            IMPU_IMS_SUBSCRIPTION,
+                                            "");
+
+    // Only the first re-registration is sent to the HSS and written to the
+    // cache.
+    if (ii == 0)
+    {
+      EXPECT_CALL(*_hss, send_server_assignment_request(_,
+        Field(&HssConnection::ServerAssignmentRequest::type, Cx::ServerAssignmentType::RE_REGISTRATION),
+        _))
+        .WillOnce(InvokeArgument<0>(ByRef(answer)));
+      EXPECT_CALL(*_cache, put_implicit_registration_set(_, _, _, _, FAKE_TRAIL_ID))
+        .WillOnce(DoAll(InvokeArgument<1>(), InvokeArgument<0>()));
+    }
+
+    // Expect 200 response
+    EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+
+    task->run();
+
+    EXPECT_EQ(REGDATA_RESULT, req.content());
+  }
+}
+
 TEST_F(HTTPHandlersTest, ImpuRegDataReRegCached)
 {
   // Tests that a new enough record in the cache will not trigger a SAR
@@ -1812,6 +1912,106 @@ TEST_F(HTTPHandlersTest, ImpuRegDataReRegCached)
   EXPECT_EQ(REGDATA_RESULT, req.content());
 }
 
+TEST_F(HTTPHandlersTest, ImpuRegDataReRegOffloadInRefreshWindow)
+{
+  // Tests that in HSS offload mode a re-registration near its refresh
+  // deadline is answered from the cache, and the SAR is sent in the
+  // background.
+  MockHttpStack::Request req = make_request("reg", true, true, false);
+
+  StrictMock<MockReregistrationRefresher> refresher;
+  ImpuRegDataTask::Config cfg(true, 3600, 7200, true, &refresher);
+  ImpuRegDataTask* task = new ImpuRegDataTask(req, &cfg, FAKE_TRAIL_ID);
+
+  int64_t deadline = time(0) + 60;
+
+  // Create IRS to be returned from the cache
+  FakeImplicitRegistrationSet* irs = new FakeImplicitRegistrationSet(IMPU);
+  irs->set_ims_sub_xml(IMPU_IMS_SUBSCRIPTION);
+  irs->set_reg_state(RegistrationState::REGISTERED);
+  irs->set_charging_addresses(NO_CHARGING_ADDRESSES);
+  irs->set_ttl(3600);
+  irs->set_refresh_deadline(deadline);
+  irs->add_associated_impi(IMPI);
+
+  // Set up the cache to return our IRS
+  EXPECT_CALL(*_cache, get_implicit_registration_set_for_impu(_, _, IMPU, FAKE_TRAIL_ID))
+    .WillOnce(InvokeArgument<0>(irs));
+
+  // The record is older than the HSS reregistration time, but the deadline
+  // hasn't passed, so the refresher is asked to send the SAR.
+  EXPECT_CALL(refresher, in_refresh_window(deadline, _))
+    .WillOnce(Return(true));
+  EXPECT_CALL(refresher, refresh(
+    AllOf(Field(&HssConnection::ServerAssignmentRequest::impi, IMPI),
+          Field(&HssConnection::ServerAssignmentRequest::impu, IMPU),
+          Field(&HssConnection::ServerAssignmentRequest::type, Cx::ServerAssignmentType::RE_REGISTRATION)),
+    IMPU,
+    FAKE_TRAIL_ID))
+    .WillOnce(Return(true));
+
+  // Expect 200 response
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+
+  task->run();
+
+  EXPECT_EQ(REGDATA_RESULT, req.content());
+}
+
+TEST_F(HTTPHandlersTest, ImpuRegDataReRegOffloadDeadlinePassed)
+{
+  // Tests that in HSS offload mode a re-registration after its refresh
+  // deadline sends the SAR itself, and sets a new deadline.
+  MockHttpStack::Request req = make_request("reg", true, true, false);
+
+  StrictMock<MockReregistrationRefresher> refresher;
+  ImpuRegDataTask::Config cfg(true, 3600, 7200, true, &refresher);
+  ImpuRegDataTask* task = new ImpuRegDataTask(req, &cfg, FAKE_TRAIL_ID);
+
+  // Create IRS to be returned from the cache. The record is new, but the
+  // deadline has passed.
+  FakeImplicitRegistrationSet* irs = new FakeImplicitRegistrationSet(IMPU);
+  irs->set_ims_sub_xml(IMPU_IMS_SUBSCRIPTION);
+  irs->set_reg_state(RegistrationState::REGISTERED);
+  irs->set_charging_addresses(NO_CHARGING_ADDRESSES);
+  irs->set_ttl(7200);
+  irs->set_refresh_deadline(time(0) - 1);
+  irs->add_associated_impi(IMPI);
+
+  // Set up the cache to return our IRS
+  EXPECT_CALL(*_cache, get_implicit_registration_set_for_impu(_, _, IMPU, FAKE_TRAIL_ID))
+    .WillOnce(InvokeArgument<0>(irs));
+
+  HssConnection::ServerAssignmentAnswer answer =
+    HssConnection::ServerAssignmentAnswer(HssConnection::ResultCode::SUCCESS,
+                                          NO_CHARGING_ADDRESSES,
+                                          IMPU_IMS_SUBSCRIPTION,
+                                          "");
+
+  EXPECT_CALL(*_hss, send_server_assignment_request(_,
+    Field(&HssConnection::ServerAssignmentRequest::type, Cx::ServerAssignmentType::RE_REGISTRATION),
+    _))
+    .WillOnce(InvokeArgument<0>(ByRef(answer)));
+
+  EXPECT_CALL(refresher, next_deadline(_))
+    .WillOnce(Return(123456));
+
+  // We now expect it to be put in the cache with the new deadline
+  EXPECT_CALL(*_cache, put_implicit_registration_set(_, _, _,
+    AllOf(Property(&ImplicitRegistrationSet::get_reg_state, RegistrationState::REGISTERED),
+          Property(&ImplicitRegistrationSet::get_ttl, 7200),
+          Property(&ImplicitRegistrationSet::get_refresh_deadline, 123456)),
+    FAKE_TRAIL_ID))
+    .WillOnce(DoAll(InvokeArgument<1>(), InvokeArgument<0>()));
+
+  // Expect 200 response
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+
+  task->run();
+
+  EXPECT_EQ(REGDATA_RESULT, req.content());
+}
+
 TEST_F(HTTPHandlersTest, ImpuRegDataReRegNewBinding)
 {
   MockHttpStack::Request req = make_request("reg", true, true, false);
@@ -2935,3 +3135,30 @@ TEST_F(HTTPHandlersTest, ImpuRegDataHssUnknownError)
 
   EXPECT_EQ("", req.content());
 }
+
+//
+// Homestead-prov cache tests
+//
+
+TEST_F(HTTPHandlersTest, HsProvCacheInvalidateEscapedImpu)
+{
+  HsProvCache cache(60, 10, NULL);
+  cache.put_reg_data(IMPU, IMPU_IMS_SUBSCRIPTION, NO_CHARGING_ADDRESSES);
+
+  // The IMPU in the path is URL-escaped, and must be unescaped to match the
+  // cached entry.
+  MockHttpStack::Request req(_httpstack,
+                             "/hsprov-cache/impu/sip%3Aimpu%40example.com",
+                             "",
+                             "",
+                             "",
+                             htp_method_DELETE);
+  HsProvCacheTask::Config cfg(&cache);
+  HsProvCacheTask* task = new HsProvCacheTask(req, &cfg, FAKE_TRAIL_ID);
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+
+  task->run();
+
+  EXPECT_EQ("{\"records\":1}", req.content());
+}
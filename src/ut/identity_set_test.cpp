@@ -0,0 +1,80 @@
+/**
+ * @file identity_set_test.cpp UT for IdentitySet
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "identity_set.h"
+#include "test_utils.hpp"
+
+static const std::vector<std::string> IMPUS = {"sip:c@example.com",
+                                               "sip:a@example.com",
+                                               "sip:b@example.com"};
+static const std::vector<std::string> SORTED_IMPUS = {"sip:a@example.com",
+                                                      "sip:b@example.com",
+                                                      "sip:c@example.com"};
+
+TEST(IdentitySetTest, AddAllSorts)
+{
+  IdentitySet set;
+  set.add_all(IMPUS, IdentitySet::UNCHANGED);
+
+  EXPECT_EQ(3u, set.size());
+  EXPECT_EQ(SORTED_IMPUS, set.current().to_vector());
+  EXPECT_FALSE(set.has_changes());
+}
+
+TEST(IdentitySetTest, AddAllKeepsExistingState)
+{
+  IdentitySet set;
+  set.set("sip:b@example.com", IdentitySet::DELETED);
+  set.add_all(IMPUS, IdentitySet::UNCHANGED);
+
+  // The existing entry keeps its state, and duplicates aren't added.
+  EXPECT_EQ(3u, set.size());
+  EXPECT_EQ(IdentitySet::DELETED, set.find("sip:b@example.com")->second);
+  EXPECT_TRUE(set.has_changes());
+
+  std::vector<std::string> current = {"sip:a@example.com", "sip:c@example.com"};
+  EXPECT_EQ(current, set.current().to_vector());
+}
+
+TEST(IdentitySetTest, Views)
+{
+  IdentitySet set;
+  set.add_all(IMPUS, IdentitySet::UNCHANGED);
+  set.set("sip:a@example.com", IdentitySet::DELETED);
+  set.set("sip:d@example.com", IdentitySet::ADDED);
+
+  std::vector<std::string> deleted = {"sip:a@example.com"};
+  std::vector<std::string> unchanged = {"sip:b@example.com", "sip:c@example.com"};
+  std::vector<std::string> added = {"sip:d@example.com"};
+  std::vector<std::string> current = {"sip:b@example.com",
+                                      "sip:c@example.com",
+                                      "sip:d@example.com"};
+
+  EXPECT_EQ(deleted, set.in_state(IdentitySet::DELETED).to_vector());
+  EXPECT_EQ(unchanged, set.in_state(IdentitySet::UNCHANGED).to_vector());
+  EXPECT_EQ(added, set.in_state(IdentitySet::ADDED).to_vector());
+  EXPECT_EQ(current, set.current().to_vector());
+  EXPECT_EQ(3u, set.current().size());
+
+  set.set_all(IdentitySet::DELETED);
+  EXPECT_TRUE(set.current().empty());
+  EXPECT_EQ(4u, set.in_state(IdentitySet::DELETED).size());
+}
+
+TEST(IdentitySetTest, FindMissing)
+{
+  IdentitySet set;
+  EXPECT_TRUE(set.find("sip:a@example.com") == set.end());
+
+  set.add_all(IMPUS, IdentitySet::UNCHANGED);
+  EXPECT_TRUE(set.find("sip:aa@example.com") == set.end());
+  EXPECT_TRUE(set.find("sip:d@example.com") == set.end());
+}
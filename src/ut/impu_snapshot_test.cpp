@@ -0,0 +1,284 @@
+/**
+ * @file impu_snapshot_test.cpp UT for IMPU store snapshots
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <unistd.h>
+
+#include "impu_snapshot.h"
+#include "localstore.h"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+static const std::string IMPU = "sip:impu@example.com";
+static const std::string ASSOC_IMPU = "sip:assoc_impu@example.com";
+static const std::vector<std::string> ASSOCIATED_IMPUS = { ASSOC_IMPU };
+static const ChargingAddresses NO_CHARGING_ADDRESSES = ChargingAddresses({}, {});
+static const std::string IMPI = "impi@example.com";
+static const std::vector<std::string> IMPIS = { IMPI };
+static const size_t MAX_TRACKED_KEYS = 100;
+static const std::string SERVICE_PROFILE = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><ServiceProfile></ServiceProfile>";
+
+class ImpuSnapshotTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  ImpuSnapshotTest() :
+    _path(UT_DIR + "/impu_snapshot_test.snap")
+  {
+    _local_store = new LocalStore();
+    _impu_store = new ImpuStore(_local_store);
+    _impu_store->enable_key_tracking(MAX_TRACKED_KEYS);
+  }
+
+  virtual ~ImpuSnapshotTest()
+  {
+    unlink(_path.c_str());
+    delete _impu_store; _impu_store = NULL;
+    delete _local_store; _local_store = NULL;
+  }
+
+  // Writes a default IMPU, an associated IMPU and an IMPI mapping.
+  void populate(int64_t expiry)
+  {
+    ImpuStore::DefaultImpu default_impu(IMPU,
+                                        ASSOCIATED_IMPUS,
+                                        IMPIS,
+                                        RegistrationState::REGISTERED,
+                                        NO_CHARGING_ADDRESSES,
+                                        SERVICE_PROFILE,
+                                        0L,
+                                        expiry,
+                                        _impu_store);
+    ImpuStore::AssociatedImpu assoc_impu(ASSOC_IMPU, IMPU, 0L, expiry, _impu_store);
+    ImpuStore::ImpiMapping mapping(IMPI, IMPU, expiry);
+
+    ASSERT_EQ(Store::Status::OK, _impu_store->set_impu(&default_impu, 0));
+    ASSERT_EQ(Store::Status::OK, _impu_store->set_impu(&assoc_impu, 0));
+    ASSERT_EQ(Store::Status::OK, _impu_store->set_impi_mapping(&mapping, 0));
+  }
+
+  std::string _path;
+  LocalStore* _local_store;
+  ImpuStore* _impu_store;
+};
+
+TEST_F(ImpuSnapshotTest, DumpAndRestore)
+{
+  populate(time(0) + 60);
+
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::dump(_impu_store, _path, 0, records));
+  EXPECT_EQ(3, records);
+
+  // Restore into an empty store.
+  LocalStore* new_local_store = new LocalStore();
+  ImpuStore* new_impu_store = new ImpuStore(new_local_store);
+
+  uint64_t restored = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::restore(new_impu_store, _path, 2, 0, restored));
+  EXPECT_EQ(3, restored);
+
+  ImpuStore::Impu* impu = new_impu_store->get_impu(IMPU, 0);
+  ASSERT_NE(nullptr, impu);
+  ASSERT_TRUE(impu->is_default_impu());
+  ImpuStore::DefaultImpu* default_impu = (ImpuStore::DefaultImpu*)impu;
+  EXPECT_EQ(SERVICE_PROFILE, default_impu->service_profile);
+  EXPECT_TRUE(default_impu->has_associated_impu(ASSOC_IMPU));
+  delete impu;
+
+  impu = new_impu_store->get_impu(ASSOC_IMPU, 0);
+  ASSERT_NE(nullptr, impu);
+  EXPECT_FALSE(impu->is_default_impu());
+  delete impu;
+
+  ImpuStore::ImpiMapping* mapping = new_impu_store->get_impi_mapping(IMPI, 0);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_TRUE(mapping->has_default_impu(IMPU));
+  delete mapping;
+
+  delete new_impu_store;
+  delete new_local_store;
+}
+
+TEST_F(ImpuSnapshotTest, DumpAndRestoreChunkedAssociatedImpus)
+{
+  _impu_store->set_associated_impu_chunk_size(2);
+
+  std::vector<std::string> assoc_impus;
+
+  for (int ii = 0; ii < 5; ii++)
+  {
+    assoc_impus.push_back("sip:assoc_impu_" + std::to_string(ii) + "@example.com");
+  }
+
+  ImpuStore::DefaultImpu default_impu(IMPU,
+                                      assoc_impus,
+                                      IMPIS,
+                                      RegistrationState::REGISTERED,
+                                      NO_CHARGING_ADDRESSES,
+                                      SERVICE_PROFILE,
+                                      0L,
+                                      time(0) + 60,
+                                      _impu_store);
+  ASSERT_EQ(Store::Status::OK, _impu_store->set_impu(&default_impu, 0));
+  size_t num_chunks = default_impu.assoc_impu_chunks.size();
+  ASSERT_LT(0u, num_chunks);
+
+  // The chunks are snapshotted along with the default IMPU record.
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::dump(_impu_store, _path, 0, records));
+  EXPECT_EQ(1 + num_chunks, records);
+
+  LocalStore* new_local_store = new LocalStore();
+  ImpuStore* new_impu_store = new ImpuStore(new_local_store);
+
+  uint64_t restored = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::restore(new_impu_store, _path, 2, 0, restored));
+  EXPECT_EQ(records, restored);
+
+  ImpuStore::Impu* impu = new_impu_store->get_impu(IMPU, 0);
+  ASSERT_NE(nullptr, impu);
+  ASSERT_TRUE(impu->is_default_impu());
+  EXPECT_EQ(5u, ((ImpuStore::DefaultImpu*)impu)->associated_impus.size());
+  delete impu;
+
+  delete new_impu_store;
+  delete new_local_store;
+}
+
+TEST_F(ImpuSnapshotTest, RestoreDoesNotOverwrite)
+{
+  populate(time(0) + 60);
+
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::dump(_impu_store, _path, 0, records));
+
+  // The records are all still in the store, so nothing is restored.
+  uint64_t restored = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::restore(_impu_store, _path, 1, 0, restored));
+  EXPECT_EQ(0, restored);
+}
+
+TEST_F(ImpuSnapshotTest, ExpiredRecordsNotRestored)
+{
+  populate(time(0) + 60);
+
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::dump(_impu_store, _path, 0, records));
+
+  cwtest_advance_time_ms(61000);
+
+  LocalStore* new_local_store = new LocalStore();
+  ImpuStore* new_impu_store = new ImpuStore(new_local_store);
+
+  uint64_t restored = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::restore(new_impu_store, _path, 1, 0, restored));
+  EXPECT_EQ(0, restored);
+
+  delete new_impu_store;
+  delete new_local_store;
+}
+
+TEST_F(ImpuSnapshotTest, DeletedRecordsNotDumped)
+{
+  populate(time(0) + 60);
+
+  ImpuStore::ImpiMapping mapping(IMPI, IMPU, time(0) + 60);
+  EXPECT_EQ(Store::Status::OK, _impu_store->delete_impi_mapping(&mapping, 0));
+
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::dump(_impu_store, _path, 0, records));
+  EXPECT_EQ(2, records);
+}
+
+TEST_F(ImpuSnapshotTest, IndexedLookup)
+{
+  int64_t expiry = time(0) + 60;
+  populate(expiry);
+
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::dump(_impu_store, _path, 0, records));
+
+  ImpuSnapshot::Reader reader(_path);
+  ASSERT_TRUE(reader.open());
+  EXPECT_EQ(3, reader.num_records());
+
+  std::string data;
+  int64_t record_expiry = 0;
+  EXPECT_TRUE(reader.get(ImpuSnapshot::IMPI_MAPPING, IMPI, data, record_expiry));
+  EXPECT_EQ(expiry, record_expiry);
+
+  std::string stored_data;
+  EXPECT_EQ(Store::Status::OK,
+            _impu_store->get_impi_mapping_data(IMPI, stored_data, 0));
+  EXPECT_EQ(stored_data, data);
+
+  // The key exists, but not as an IMPU.
+  EXPECT_FALSE(reader.get(ImpuSnapshot::IMPU, IMPI, data, record_expiry));
+  EXPECT_FALSE(reader.get(ImpuSnapshot::IMPU, "sip:unknown@example.com", data, record_expiry));
+}
+
+TEST_F(ImpuSnapshotTest, DumpWithoutKeyTracking)
+{
+  ImpuStore impu_store(_local_store);
+
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::ERROR,
+            ImpuSnapshot::dump(&impu_store, _path, 0, records));
+}
+
+TEST_F(ImpuSnapshotTest, KeyTrackingBounded)
+{
+  // Only track two keys, so the IMPI mapping written last isn't tracked.
+  _impu_store->enable_key_tracking(2);
+  populate(time(0) + 60);
+
+  uint64_t records = 0;
+  EXPECT_EQ(Store::Status::OK,
+            ImpuSnapshot::dump(_impu_store, _path, 0, records));
+  EXPECT_EQ(2, records);
+}
+
+TEST_F(ImpuSnapshotTest, RestoreMissingFile)
+{
+  uint64_t restored = 0;
+  EXPECT_EQ(Store::Status::ERROR,
+            ImpuSnapshot::restore(_impu_store, _path, 1, 0, restored));
+}
+
+TEST_F(ImpuSnapshotTest, RestoreInvalidFile)
+{
+  FILE* f = fopen(_path.c_str(), "w");
+  fputs("This is not a snapshot file, but it is long enough to have a header", f);
+  fclose(f);
+
+  uint64_t restored = 0;
+  EXPECT_EQ(Store::Status::ERROR,
+            ImpuSnapshot::restore(_impu_store, _path, 1, 0, restored));
+}
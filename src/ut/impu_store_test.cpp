@@ -9,11 +9,18 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include <algorithm>
+
+#include "fake_async_store.h"
 #include "impu_store.h"
 #include "localstore.h"
+#include "mockstatisticsmanager.hpp"
 #include "test_interposer.hpp"
 #include "test_utils.hpp"
 
+using ::testing::StrictMock;
+using ::testing::_;
+
 static const std::string IMPU = "sip:impu@example.com";
 static const std::string ASSOC_IMPU = "sip:assoc_impu@example.com";
 static const std::vector<std::string> NO_ASSOCIATED_IMPUS;
@@ -88,6 +95,46 @@ TEST_F(ImpuStoreTest, SetDefaultImpu)
   delete local_store;
 }
 
+TEST_F(ImpuStoreTest, LatencyStats)
+{
+  LocalStore* local_store = new LocalStore();
+  StrictMock<MockStatisticsManager> stats;
+  ImpuStore* local_impu_store = new ImpuStore(local_store, &stats, false);
+  ImpuStore* remote_impu_store = new ImpuStore(local_store, &stats, true);
+
+  int expiry = time(0) + 1;
+
+  ImpuStore::DefaultImpu* default_impu =
+    new ImpuStore::DefaultImpu(IMPU,
+                               NO_ASSOCIATED_IMPUS,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               NO_CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               expiry,
+                               local_impu_store);
+
+  // Each request to the store is recorded against the store's site.
+  EXPECT_CALL(stats, update_H_local_store_latency_us(_));
+  EXPECT_EQ(Store::Status::OK,
+            local_impu_store->set_impu(default_impu, 0));
+
+  EXPECT_CALL(stats, update_H_remote_store_latency_us(_));
+  ImpuStore::Impu* got_impu = remote_impu_store->get_impu(IMPU, 0);
+  ASSERT_NE(nullptr, got_impu);
+
+  EXPECT_CALL(stats, update_H_remote_store_latency_us(_));
+  EXPECT_EQ(Store::Status::OK,
+            remote_impu_store->delete_impu(got_impu, 0));
+
+  delete got_impu;
+  delete default_impu;
+  delete remote_impu_store;
+  delete local_impu_store;
+  delete local_store;
+}
+
 TEST_F(ImpuStoreTest, SetUnregisteredDefaultImpu)
 {
   LocalStore* local_store = new LocalStore();
@@ -184,6 +231,120 @@ TEST_F(ImpuStoreTest, GetDefaultImpu)
   delete local_store;
 }
 
+TEST_F(ImpuStoreTest, GetImpuAsync)
+{
+  LocalStore* local_store = new LocalStore();
+  ImpuStore* impu_store = new ImpuStore(local_store);
+
+  ImpuStore::DefaultImpu* default_impu =
+    new ImpuStore::DefaultImpu(IMPU,
+                               NO_ASSOCIATED_IMPUS,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               NO_CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               time(0) + 1,
+                               impu_store);
+  impu_store->set_impu(default_impu, 0);
+
+  delete default_impu;
+
+  // Without an async store, the callback is run before get_impu_async
+  // returns.
+  ASSERT_FALSE(impu_store->is_async());
+
+  ImpuStore::Impu* got_impu = nullptr;
+  bool called = false;
+  impu_store->get_impu_async(IMPU, 0L, [&](ImpuStore::Impu* impu)
+  {
+    got_impu = impu;
+    called = true;
+  });
+
+  ASSERT_TRUE(called);
+  ASSERT_NE(nullptr, got_impu);
+  ASSERT_EQ(IMPU, got_impu->impu);
+  ASSERT_TRUE(got_impu->is_default_impu());
+  delete got_impu;
+
+  called = false;
+  impu_store->get_impu_async(ASSOC_IMPU, 0L, [&](ImpuStore::Impu* impu)
+  {
+    got_impu = impu;
+    called = true;
+  });
+
+  ASSERT_TRUE(called);
+  ASSERT_EQ(nullptr, got_impu);
+
+  delete impu_store;
+  delete local_store;
+}
+
+TEST_F(ImpuStoreTest, GetImpuAsyncStore)
+{
+  LocalStore* local_store = new LocalStore();
+  FakeAsyncStore* async_store = new FakeAsyncStore(local_store);
+  StrictMock<MockStatisticsManager> stats;
+  ImpuStore* impu_store = new ImpuStore(local_store, &stats);
+  impu_store->set_async_store(async_store);
+  ASSERT_TRUE(impu_store->is_async());
+
+  ImpuStore::DefaultImpu* default_impu =
+    new ImpuStore::DefaultImpu(IMPU,
+                               NO_ASSOCIATED_IMPUS,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               NO_CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               time(0) + 1,
+                               impu_store);
+  EXPECT_CALL(stats, update_H_local_store_latency_us(_));
+  impu_store->set_impu(default_impu, 0);
+  delete default_impu;
+
+  // The get is read through the async store, and the callback isn't run
+  // until it completes.
+  ImpuStore::Impu* got_impu = nullptr;
+  bool called = false;
+  impu_store->get_impu_async(IMPU, 0L, [&](ImpuStore::Impu* impu)
+  {
+    got_impu = impu;
+    called = true;
+  });
+
+  EXPECT_FALSE(called);
+  EXPECT_EQ(1u, async_store->queued());
+
+  EXPECT_CALL(stats, update_H_local_store_latency_us(_));
+  async_store->run();
+
+  ASSERT_TRUE(called);
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_EQ(IMPU, got_impu->impu);
+  EXPECT_TRUE(got_impu->is_default_impu());
+  delete got_impu;
+
+  called = false;
+  impu_store->get_impu_async(ASSOC_IMPU, 0L, [&](ImpuStore::Impu* impu)
+  {
+    got_impu = impu;
+    called = true;
+  });
+
+  EXPECT_CALL(stats, update_H_local_store_latency_us(_));
+  async_store->run();
+
+  ASSERT_TRUE(called);
+  EXPECT_EQ(nullptr, got_impu);
+
+  delete impu_store;
+  delete async_store;
+  delete local_store;
+}
+
 TEST_F(ImpuStoreTest, SetAssociatedImpu)
 {
   LocalStore* local_store = new LocalStore();
@@ -316,6 +477,464 @@ TEST_F(ImpuStoreTest, GetAssociatedImpiMapping)
   delete local_store;
 }
 
+TEST_F(ImpuStoreTest, ImpiMappingBuckets)
+{
+  LocalStore* local_store = new LocalStore();
+  ImpuStore* impu_store = new ImpuStore(local_store);
+
+  // Mappings aren't split by default.
+  EXPECT_EQ(ImpuStore::NO_BUCKET, impu_store->impi_mapping_bucket(IMPU));
+  EXPECT_EQ(IMPI, ImpuStore::impi_mapping_key(IMPI, ImpuStore::NO_BUCKET));
+  EXPECT_EQ(IMPI + ";bucket=3", ImpuStore::impi_mapping_key(IMPI, 3));
+  EXPECT_EQ(IMPI + ";buckets", ImpuStore::impi_mapping_key(IMPI, ImpuStore::BUCKET_COUNT));
+
+  impu_store->set_impi_mapping_buckets(8);
+  int bucket = impu_store->impi_mapping_bucket(IMPU);
+  EXPECT_LE(0, bucket);
+  EXPECT_GT(8, bucket);
+  EXPECT_EQ(bucket, impu_store->impi_mapping_bucket(IMPU));
+
+  int expiry = time(0) + 1;
+
+  ImpuStore::ImpiMapping* unsplit =
+    new ImpuStore::ImpiMapping(IMPI, {ASSOC_IMPU}, 0L, expiry);
+  impu_store->set_impi_mapping(unsplit, 0L);
+  delete unsplit;
+
+  ImpuStore::ImpiMapping* mapping =
+    new ImpuStore::ImpiMapping(IMPI, IMPU, expiry + 1, bucket);
+  impu_store->set_impi_mapping(mapping, 0L);
+  delete mapping;
+
+  // Getting the whole mapping reads the unsplit record and the buckets, even
+  // without a bucket count record.
+  mapping = impu_store->get_impi_mapping(IMPI, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(std::vector<std::string>({ASSOC_IMPU, IMPU}), mapping->get_default_impus());
+  EXPECT_EQ(expiry + 1, mapping->get_expiry());
+  delete mapping;
+
+  mapping = impu_store->get_impi_mapping_record(IMPI, bucket, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(bucket, mapping->bucket);
+  EXPECT_EQ(std::vector<std::string>({IMPU}), mapping->get_default_impus());
+  delete mapping;
+
+  delete impu_store;
+  delete local_store;
+}
+
+TEST_F(ImpuStoreTest, ImpiMappingMoreBucketsThanConfigured)
+{
+  LocalStore* local_store = new LocalStore();
+  ImpuStore* impu_store = new ImpuStore(local_store);
+
+  int expiry = time(0) + 1;
+
+  // Another Homestead has split the mapping into 8 buckets, and we split
+  // mappings into 2.
+  impu_store->set_impi_mapping_buckets(2);
+
+  ImpuStore::ImpiMapping* count =
+    new ImpuStore::ImpiMapping(IMPI, std::vector<std::string>(), 0L, expiry, ImpuStore::BUCKET_COUNT);
+  count->buckets = 8;
+  impu_store->set_impi_mapping(count, 0L);
+  delete count;
+
+  ImpuStore::ImpiMapping* mapping =
+    new ImpuStore::ImpiMapping(IMPI, IMPU, expiry, 7);
+  impu_store->set_impi_mapping(mapping, 0L);
+  delete mapping;
+
+  mapping = impu_store->get_impi_mapping(IMPI, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(std::vector<std::string>({IMPU}), mapping->get_default_impus());
+  delete mapping;
+
+  // The bucket count record doesn't list any IRSs on its own.
+  mapping = impu_store->get_impi_mapping_record(IMPI, 7, 0L);
+  ASSERT_NE(nullptr, mapping);
+  impu_store->delete_impi_mapping(mapping, 0L);
+  delete mapping;
+
+  EXPECT_EQ(nullptr, impu_store->get_impi_mapping(IMPI, 0L));
+
+  delete impu_store;
+  delete local_store;
+}
+
+// Test that a store that doesn't split mappings reads only the unsplit
+// record, and one that does reads the bucket count and each bucket once.
+TEST_F(ImpuStoreTest, ImpiMappingGets)
+{
+  LocalStore* local_store = new LocalStore();
+  StrictMock<MockStatisticsManager> stats;
+  ImpuStore* impu_store = new ImpuStore(local_store, &stats, false);
+
+  int expiry = time(0) + 1;
+
+  EXPECT_CALL(stats, update_H_local_store_latency_us(_));
+  ImpuStore::ImpiMapping* mapping =
+    new ImpuStore::ImpiMapping(IMPI, IMPU, expiry, 3);
+  impu_store->set_impi_mapping(mapping, 0L);
+  delete mapping;
+
+  EXPECT_CALL(stats, update_H_local_store_latency_us(_)).Times(1);
+  EXPECT_EQ(nullptr, impu_store->get_impi_mapping(IMPI, 0L));
+
+  impu_store->set_impi_mapping_buckets(4);
+
+  EXPECT_CALL(stats, update_H_local_store_latency_us(_)).Times(6);
+  mapping = impu_store->get_impi_mapping(IMPI, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(std::vector<std::string>({IMPU}), mapping->get_default_impus());
+  delete mapping;
+
+  delete impu_store;
+  delete local_store;
+}
+
+TEST_F(ImpuStoreTest, ImpiMappingMembership)
+{
+  ImpuStore::ImpiMapping mapping(IMPI, {IMPU, ASSOC_IMPU, IMPU}, 0L, 0L);
+
+  // Duplicates are dropped.
+  EXPECT_EQ(std::vector<std::string>({IMPU, ASSOC_IMPU}), mapping.get_default_impus());
+  EXPECT_TRUE(mapping.has_default_impu(ASSOC_IMPU));
+
+  mapping.add_default_impu(ASSOC_IMPU);
+  EXPECT_EQ(2, mapping.get_default_impus().size());
+
+  // Removing an IMPU moves the last one into its place.
+  mapping.remove_default_impu(IMPU);
+  EXPECT_FALSE(mapping.has_default_impu(IMPU));
+  EXPECT_EQ(std::vector<std::string>({ASSOC_IMPU}), mapping.get_default_impus());
+
+  mapping.remove_default_impu(IMPU);
+  mapping.remove_default_impu(ASSOC_IMPU);
+  EXPECT_TRUE(mapping.is_empty());
+  EXPECT_FALSE(mapping.has_default_impu(ASSOC_IMPU));
+
+  mapping.add_default_impu(IMPU);
+  EXPECT_TRUE(mapping.has_default_impu(IMPU));
+}
+
+TEST_F(ImpuStoreTest, ChunkedAssociatedImpus)
+{
+  LocalStore* local_store = new LocalStore();
+  ImpuStore* impu_store = new ImpuStore(local_store);
+  impu_store->set_associated_impu_chunk_size(2);
+  EXPECT_EQ(IMPU + ";chunk=3;0000abcd",
+            ImpuStore::associated_impu_chunk_key(IMPU, 3, 0xabcd));
+
+  std::vector<std::string> assoc_impus;
+
+  for (int ii = 0; ii < 5; ii++)
+  {
+    assoc_impus.push_back("sip:assoc_impu_" + std::to_string(ii) + "@example.com");
+  }
+
+  ImpuStore::DefaultImpu* default_impu =
+    new ImpuStore::DefaultImpu(IMPU,
+                               assoc_impus,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               NO_CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               time(0) + 10,
+                               impu_store);
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(default_impu, 0L));
+  delete default_impu;
+
+  // The associated IMPUs are read back from the chunks.
+  ImpuStore::DefaultImpu* got_impu =
+    dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L));
+  ASSERT_NE(nullptr, got_impu);
+  size_t num_chunks = got_impu->assoc_impu_chunks.size();
+  EXPECT_EQ(8u, num_chunks);
+
+  std::vector<std::string> got_assoc_impus = got_impu->associated_impus;
+  std::sort(got_assoc_impus.begin(), got_assoc_impus.end());
+  EXPECT_EQ(assoc_impus, got_assoc_impus);
+
+  // Adding an associated IMPU only writes a new copy of its chunk. The old
+  // chunks are left alone, so the current default IMPU record still reads
+  // correctly until it's replaced.
+  std::vector<uint32_t> hashes_before = got_impu->assoc_impu_chunks;
+  std::vector<uint64_t> cas_before;
+
+  for (size_t chunk = 0; chunk < num_chunks; chunk++)
+  {
+    std::string data;
+    uint64_t cas;
+    local_store->get_data("impu_chunk",
+                          ImpuStore::associated_impu_chunk_key(IMPU, chunk, hashes_before[chunk]),
+                          data,
+                          cas,
+                          0L);
+    cas_before.push_back(cas);
+  }
+
+  ImpuStore::DefaultImpu* stale_impu =
+    dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L));
+  ASSERT_NE(nullptr, stale_impu);
+
+  got_impu->associated_impus.push_back(ASSOC_IMPU);
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(got_impu, 0L));
+
+  int changed = 0;
+
+  for (size_t chunk = 0; chunk < num_chunks; chunk++)
+  {
+    std::string data;
+    uint64_t cas;
+    EXPECT_EQ(Store::Status::OK,
+              local_store->get_data("impu_chunk",
+                                    ImpuStore::associated_impu_chunk_key(IMPU, chunk, hashes_before[chunk]),
+                                    data,
+                                    cas,
+                                    0L));
+    EXPECT_EQ(cas_before[chunk], cas);
+
+    if (got_impu->assoc_impu_chunks[chunk] != hashes_before[chunk])
+    {
+      changed++;
+    }
+  }
+
+  EXPECT_EQ(1, changed);
+  delete got_impu;
+
+  // A write that loses the CAS race leaves the winning record readable.
+  stale_impu->associated_impus.pop_back();
+  EXPECT_EQ(Store::Status::DATA_CONTENTION, impu_store->set_impu(stale_impu, 0L));
+  delete stale_impu;
+
+  got_impu = dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L));
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_EQ(6u, got_impu->associated_impus.size());
+  EXPECT_TRUE(got_impu->has_associated_impu(ASSOC_IMPU));
+
+  // If a chunk is lost, the IRS is treated as not found.
+  local_store->delete_data("impu_chunk",
+                           ImpuStore::associated_impu_chunk_key(IMPU, 0, got_impu->assoc_impu_chunks[0]),
+                           0L);
+  delete got_impu;
+  EXPECT_EQ(nullptr, impu_store->get_impu(IMPU, 0L));
+
+  // Unless the caller is going to overwrite it, in which case every chunk is
+  // rewritten.
+  got_impu = dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L, true));
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_TRUE(got_impu->assoc_impu_chunks_lost);
+  EXPECT_TRUE(got_impu->associated_impus.empty());
+
+  got_impu->associated_impus = assoc_impus;
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(got_impu, 0L));
+  delete got_impu;
+
+  got_impu = dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L));
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_EQ(5u, got_impu->associated_impus.size());
+  delete got_impu;
+
+  delete impu_store;
+  delete local_store;
+}
+
+TEST_F(ImpuStoreTest, ChunkedAssociatedImpusAsync)
+{
+  LocalStore* local_store = new LocalStore();
+  FakeAsyncStore* async_store = new FakeAsyncStore(local_store);
+  ImpuStore* impu_store = new ImpuStore(local_store);
+  impu_store->set_associated_impu_chunk_size(2);
+  impu_store->set_async_store(async_store);
+
+  std::vector<std::string> assoc_impus;
+
+  for (int ii = 0; ii < 5; ii++)
+  {
+    assoc_impus.push_back("sip:assoc_impu_" + std::to_string(ii) + "@example.com");
+  }
+
+  ImpuStore::DefaultImpu* default_impu =
+    new ImpuStore::DefaultImpu(IMPU,
+                               assoc_impus,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               NO_CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               time(0) + 10,
+                               impu_store);
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(default_impu, 0L));
+  delete default_impu;
+
+  ImpuStore::DefaultImpu* got_impu = nullptr;
+  bool called = false;
+  ImpuStore::impu_callback callback = [&](ImpuStore::Impu* impu)
+  {
+    got_impu = dynamic_cast<ImpuStore::DefaultImpu*>(impu);
+    called = true;
+  };
+
+  // Once the default IMPU record has been read, all of its chunks are read
+  // at once.
+  impu_store->get_impu_async(IMPU, 0L, callback);
+  ASSERT_EQ(1u, async_store->queued());
+  async_store->run();
+
+  ASSERT_TRUE(called);
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_EQ(9, async_store->gets_run());
+  EXPECT_EQ(1, async_store->multi_gets_run());
+
+  std::vector<std::string> got_assoc_impus = got_impu->associated_impus;
+  std::sort(got_assoc_impus.begin(), got_assoc_impus.end());
+  EXPECT_EQ(assoc_impus, got_assoc_impus);
+
+  // If a chunk is lost, the IRS is treated as not found, unless the caller
+  // is going to overwrite it.
+  local_store->delete_data("impu_chunk",
+                           ImpuStore::associated_impu_chunk_key(IMPU, 3, got_impu->assoc_impu_chunks[3]),
+                           0L);
+  delete got_impu;
+
+  called = false;
+  impu_store->get_impu_async(IMPU, 0L, callback);
+  async_store->run();
+  ASSERT_TRUE(called);
+  EXPECT_EQ(nullptr, got_impu);
+
+  called = false;
+  impu_store->get_impu_async(IMPU, 0L, callback, true);
+  async_store->run();
+  ASSERT_TRUE(called);
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_TRUE(got_impu->assoc_impu_chunks_lost);
+  EXPECT_TRUE(got_impu->associated_impus.empty());
+  delete got_impu;
+
+  delete impu_store;
+  delete async_store;
+  delete local_store;
+}
+
+TEST_F(ImpuStoreTest, HashTaggedChunks)
+{
+  LocalStore* local_store = new LocalStore();
+  FakeAsyncStore* async_store = new FakeAsyncStore(local_store);
+  async_store->set_immediate(true);
+  ImpuStore* impu_store = new ImpuStore(local_store);
+  impu_store->set_associated_impu_chunk_size(2);
+  EXPECT_EQ("{impu\\\\" + IMPU + "};chunk=3;0000abcd",
+            ImpuStore::associated_impu_chunk_key(IMPU, 3, 0xabcd, true));
+
+  std::vector<std::string> assoc_impus;
+
+  for (int ii = 0; ii < 5; ii++)
+  {
+    assoc_impus.push_back("sip:assoc_impu_" + std::to_string(ii) + "@example.com");
+  }
+
+  ImpuStore::DefaultImpu* default_impu =
+    new ImpuStore::DefaultImpu(IMPU,
+                               assoc_impus,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               NO_CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               time(0) + 10,
+                               impu_store);
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(default_impu, 0L));
+  delete default_impu;
+
+  ImpuStore::DefaultImpu* got_impu =
+    dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L));
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_FALSE(got_impu->assoc_impu_chunks_hash_tagged);
+  std::vector<uint32_t> untagged_hashes = got_impu->assoc_impu_chunks;
+
+  // Once hash tags are turned on, the next write of the IRS moves all of its
+  // chunks to tagged keys, even though they haven't changed. The old chunks
+  // are left to expire.
+  impu_store->set_hash_tags(true);
+  impu_store->set_async_store(async_store);
+  impu_store->set_async_chunk_writes(true);
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(got_impu, 0L));
+  delete got_impu;
+
+  // The chunks were written in one batch, and are read in one batch.
+  EXPECT_EQ(1, async_store->multi_sets_run());
+
+  got_impu = dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L));
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_EQ(1, async_store->multi_gets_run());
+  EXPECT_EQ(8, async_store->gets_run());
+  EXPECT_TRUE(got_impu->assoc_impu_chunks_hash_tagged);
+  EXPECT_EQ(untagged_hashes, got_impu->assoc_impu_chunks);
+
+  std::vector<std::string> got_assoc_impus = got_impu->associated_impus;
+  std::sort(got_assoc_impus.begin(), got_assoc_impus.end());
+  EXPECT_EQ(assoc_impus, got_assoc_impus);
+
+  for (size_t chunk = 0; chunk < untagged_hashes.size(); chunk++)
+  {
+    std::string data;
+    uint64_t cas;
+    EXPECT_EQ(Store::Status::OK,
+              local_store->get_data("impu_chunk",
+                                    ImpuStore::associated_impu_chunk_key(IMPU, chunk, untagged_hashes[chunk], true),
+                                    data,
+                                    cas,
+                                    0L));
+    EXPECT_EQ(Store::Status::OK,
+              local_store->get_data("impu_chunk",
+                                    ImpuStore::associated_impu_chunk_key(IMPU, chunk, untagged_hashes[chunk]),
+                                    data,
+                                    cas,
+                                    0L));
+  }
+
+  // Turning them off again moves the chunks back.
+  impu_store->set_hash_tags(false);
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(got_impu, 0L));
+  delete got_impu;
+
+  got_impu = dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(IMPU, 0L));
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_FALSE(got_impu->assoc_impu_chunks_hash_tagged);
+  EXPECT_EQ(5u, got_impu->associated_impus.size());
+  delete got_impu;
+
+  // An IMPU with braces in can't be a tag, so its chunks aren't tagged.
+  impu_store->set_hash_tags(true);
+  std::string braced_impu = "sip:{impu}@example.com";
+  default_impu = new ImpuStore::DefaultImpu(braced_impu,
+                                            assoc_impus,
+                                            IMPIS,
+                                            RegistrationState::REGISTERED,
+                                            NO_CHARGING_ADDRESSES,
+                                            SERVICE_PROFILE,
+                                            0L,
+                                            time(0) + 10,
+                                            impu_store);
+  ASSERT_EQ(Store::Status::OK, impu_store->set_impu(default_impu, 0L));
+  EXPECT_FALSE(default_impu->assoc_impu_chunks_hash_tagged);
+  delete default_impu;
+
+  got_impu = dynamic_cast<ImpuStore::DefaultImpu*>(impu_store->get_impu(braced_impu, 0L));
+  ASSERT_NE(nullptr, got_impu);
+  EXPECT_EQ(5u, got_impu->associated_impus.size());
+  delete got_impu;
+
+  delete impu_store;
+  delete async_store;
+  delete local_store;
+}
+
 TEST_F(ImpuStoreTest, ImpuFromDataEmpty)
 {
   std::string data;
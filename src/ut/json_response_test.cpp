@@ -0,0 +1,188 @@
+/**
+ * @file json_response_test.cpp UT for JsonResponse
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <cstdlib>
+#include <thread>
+
+#include "json_response.h"
+#include "test_utils.hpp"
+
+// Counts the allocations that rapidjson makes through it on this thread.
+static thread_local int allocations = 0;
+
+class CountingAllocator
+{
+public:
+  static const bool kNeedFree = true;
+
+  void* Malloc(size_t size)
+  {
+    if (size == 0)
+    {
+      return NULL;
+    }
+
+    allocations++;
+    return malloc(size);
+  }
+
+  void* Realloc(void* original_ptr, size_t original_size, size_t new_size)
+  {
+    if (new_size == 0)
+    {
+      free(original_ptr);
+      return NULL;
+    }
+
+    allocations++;
+    return realloc(original_ptr, new_size);
+  }
+
+  static void Free(void* ptr)
+  {
+    free(ptr);
+  }
+};
+
+typedef BasicJsonResponse<CountingAllocator> CountingJsonResponse;
+
+class JsonResponseTest : public testing::Test
+{
+};
+
+// Renders a digest authentication vector, as the /impi/<impi>/av handler
+// does.
+template <class Writer>
+static void render_digest(Writer& writer)
+{
+  writer.StartObject();
+  writer.String("digest");
+  writer.StartObject();
+  writer.String("ha1");
+  writer.String("0123456789abcdef0123456789abcdef");
+  writer.String("realm");
+  writer.String("example.com");
+  writer.String("qop");
+  writer.String("auth");
+  writer.EndObject();
+  writer.EndObject();
+}
+
+TEST_F(JsonResponseTest, BuffersReused)
+{
+  const char* buffer;
+
+  {
+    JsonResponse response;
+    JsonResponse::Writer& writer = response.writer();
+    writer.StartObject();
+    writer.String("digest");
+    writer.StartObject();
+    writer.String("ha1");
+    writer.String("0123456789abcdef0123456789abcdef");
+    writer.EndObject();
+    writer.EndObject();
+
+    EXPECT_EQ("{\"digest\":{\"ha1\":\"0123456789abcdef0123456789abcdef\"}}",
+              std::string(response.body(), response.size()));
+    buffer = response.body();
+  }
+
+  // The next response on the thread starts from empty, in the same buffer.
+  JsonResponse response;
+  JsonResponse::Writer& writer = response.writer();
+  writer.StartObject();
+  writer.String("result-code");
+  writer.Int(2001);
+  writer.EndObject();
+
+  EXPECT_EQ("{\"result-code\":2001}", std::string(response.body(), response.size()));
+  EXPECT_EQ(buffer, response.body());
+}
+
+TEST_F(JsonResponseTest, IncompleteResponseDiscarded)
+{
+  {
+    // Abandon a response part way through, as if rendering had failed.
+    JsonResponse response;
+    response.writer().StartObject();
+    response.writer().String("scscf");
+  }
+
+  JsonResponse response;
+  response.writer().StartArray();
+  response.writer().EndArray();
+
+  EXPECT_EQ("[]", std::string(response.body(), response.size()));
+}
+
+TEST_F(JsonResponseTest, SeparateThreads)
+{
+  JsonResponse response;
+  response.writer().StartObject();
+
+  // Another thread renders into its own buffers while this one is in use.
+  std::string other_body;
+  std::thread other([&other_body]()
+  {
+    JsonResponse other_response;
+    other_response.writer().StartArray();
+    other_response.writer().Int(1);
+    other_response.writer().EndArray();
+    other_body = std::string(other_response.body(), other_response.size());
+  });
+  other.join();
+
+  response.writer().EndObject();
+
+  EXPECT_EQ("[1]", other_body);
+  EXPECT_EQ("{}", std::string(response.body(), response.size()));
+}
+
+TEST_F(JsonResponseTest, NoAllocationsOnceWarm)
+{
+  // The first response on the thread allocates its buffers.
+  {
+    CountingJsonResponse response;
+    render_digest(response.writer());
+  }
+
+  // After that, rendering the same response doesn't allocate at all.
+  allocations = 0;
+
+  {
+    CountingJsonResponse response;
+    render_digest(response.writer());
+    EXPECT_EQ("{\"digest\":{\"ha1\":\"0123456789abcdef0123456789abcdef\","
+              "\"realm\":\"example.com\",\"qop\":\"auth\"}}",
+              std::string(response.body(), response.size()));
+  }
+
+  EXPECT_EQ(0, allocations);
+}
+
+TEST_F(JsonResponseTest, FreshWriterAllocates)
+{
+  // For comparison, this is what the handlers did before - a new buffer and
+  // writer for each response.
+  for (int ii = 0; ii < 2; ii++)
+  {
+    allocations = 0;
+
+    {
+      CountingJsonResponse::Buffer buffer;
+      CountingJsonResponse::Writer writer(buffer);
+      render_digest(writer);
+    }
+
+    EXPECT_LT(0, allocations);
+  }
+}
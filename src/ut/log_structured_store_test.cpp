@@ -0,0 +1,349 @@
+/**
+ * @file log_structured_store_test.cpp UT for LogStructuredStore and
+ * WriteThroughStore
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "embedded_store.h"
+#include "log_structured_store.h"
+#include "write_through_store.h"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+static const std::string TABLE = "impu";
+static const std::string KEY = "sip:impu@example.com";
+static const std::string OTHER_KEY = "sip:other_impu@example.com";
+static const std::string NODE_ID = "10.0.0.1";
+
+class LogStructuredStoreTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  LogStructuredStoreTest() :
+    _path(UT_DIR + "/log_structured_store_test.log")
+  {
+    unlink(_path.c_str());
+  }
+
+  virtual ~LogStructuredStoreTest()
+  {
+    unlink(_path.c_str());
+  }
+
+  std::string _path;
+};
+
+TEST_F(LogStructuredStoreTest, Cas)
+{
+  LogStructuredStore store(_path);
+  ASSERT_TRUE(store.open());
+
+  std::string data;
+  uint64_t cas;
+
+  EXPECT_EQ(Store::Status::NOT_FOUND, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ(Store::Status::OK, store.set_data(TABLE, KEY, "one", 0, 300));
+  EXPECT_EQ(Store::Status::DATA_CONTENTION,
+            store.set_data(TABLE, KEY, "two", 0, 300));
+
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("one", data);
+  EXPECT_EQ(Store::Status::DATA_CONTENTION,
+            store.set_data(TABLE, KEY, "two", cas + 1, 300));
+  EXPECT_EQ(Store::Status::OK, store.set_data(TABLE, KEY, "two", cas, 300));
+
+  int expiry;
+  ASSERT_EQ(Store::Status::OK, store.get_record(TABLE, KEY, data, cas, expiry));
+  EXPECT_EQ("two", data);
+  EXPECT_EQ(300, expiry);
+
+  EXPECT_EQ(Store::Status::OK, store.delete_data(TABLE, KEY));
+  EXPECT_EQ(Store::Status::NOT_FOUND, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ(0u, store.live_bytes());
+}
+
+TEST_F(LogStructuredStoreTest, Recovery)
+{
+  uint64_t written_cas;
+
+  {
+    LogStructuredStore store(_path);
+    ASSERT_TRUE(store.open());
+    store.set_data_without_cas(TABLE, KEY, "one", 300);
+    store.set_data_without_cas(TABLE, KEY, "two", 300);
+    store.set_data_without_cas(TABLE, OTHER_KEY, "other", 300);
+    store.set_data_without_cas(TABLE, "sip:deleted@example.com", "deleted", 300);
+    store.delete_data(TABLE, "sip:deleted@example.com");
+    store.set_data_without_cas(TABLE, "sip:expiring@example.com", "data", 10);
+
+    std::string data;
+    store.get_data(TABLE, KEY, data, written_cas);
+  }
+
+  cwtest_advance_time_ms(11000);
+
+  // The latest version of each live record comes back, with its CAS.
+  LogStructuredStore store(_path);
+  ASSERT_TRUE(store.open());
+  EXPECT_EQ(2u, store.size());
+
+  std::string data;
+  uint64_t cas;
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("two", data);
+  EXPECT_EQ(written_cas, cas);
+  EXPECT_EQ(Store::Status::OK, store.set_data(TABLE, KEY, "three", cas, 300));
+
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, OTHER_KEY, data, cas));
+  EXPECT_EQ("other", data);
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            store.get_data(TABLE, "sip:deleted@example.com", data, cas));
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            store.get_data(TABLE, "sip:expiring@example.com", data, cas));
+}
+
+TEST_F(LogStructuredStoreTest, TornWrite)
+{
+  uint64_t torn_offset;
+
+  {
+    LogStructuredStore store(_path);
+    ASSERT_TRUE(store.open());
+    store.set_data_without_cas(TABLE, KEY, "data", 300);
+    torn_offset = store.log_bytes();
+    store.set_data_without_cas(TABLE, OTHER_KEY, "data", 300);
+  }
+
+  // Corrupt the data of the second record, as if we'd crashed while writing
+  // it.
+  int fd = open(_path.c_str(), O_WRONLY);
+  ASSERT_NE(-1, fd);
+  uint64_t data_offset = torn_offset +
+                         sizeof(LogStructuredStore::RecordHeader) +
+                         TABLE.size() + 2 + OTHER_KEY.size();
+  ASSERT_EQ(4, pwrite(fd, "XXXX", 4, data_offset));
+  close(fd);
+
+  {
+    LogStructuredStore store(_path);
+    ASSERT_TRUE(store.open());
+    EXPECT_EQ(1u, store.size());
+    EXPECT_EQ(torn_offset, store.log_bytes());
+
+    // New records are written over the torn one.
+    store.set_data_without_cas(TABLE, "sip:new@example.com", "new", 300);
+  }
+
+  LogStructuredStore store(_path);
+  ASSERT_TRUE(store.open());
+  EXPECT_EQ(2u, store.size());
+
+  std::string data;
+  uint64_t cas;
+  EXPECT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ(Store::Status::NOT_FOUND, store.get_data(TABLE, OTHER_KEY, data, cas));
+  EXPECT_EQ(Store::Status::OK,
+            store.get_data(TABLE, "sip:new@example.com", data, cas));
+}
+
+TEST_F(LogStructuredStoreTest, Compact)
+{
+  {
+    LogStructuredStore store(_path);
+    ASSERT_TRUE(store.open());
+
+    for (int ii = 0; ii < 100; ii++)
+    {
+      store.set_data_without_cas(TABLE, KEY, std::to_string(ii), 300);
+    }
+
+    store.set_data_without_cas(TABLE, OTHER_KEY, "other", 10);
+
+    cwtest_advance_time_ms(11000);
+
+    uint64_t before = store.log_bytes();
+    ASSERT_TRUE(store.compact());
+    EXPECT_LT(store.log_bytes(), before);
+    EXPECT_EQ(store.log_bytes(),
+              sizeof(LogStructuredStore::Header) + store.live_bytes());
+
+    // The store carries on working after compaction.
+    store.set_data_without_cas(TABLE, "sip:new@example.com", "new", 300);
+  }
+
+  LogStructuredStore store(_path);
+  ASSERT_TRUE(store.open());
+  EXPECT_EQ(2u, store.size());
+
+  std::string data;
+  uint64_t cas;
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("99", data);
+  EXPECT_EQ(Store::Status::NOT_FOUND, store.get_data(TABLE, OTHER_KEY, data, cas));
+  EXPECT_EQ(Store::Status::OK,
+            store.get_data(TABLE, "sip:new@example.com", data, cas));
+}
+
+TEST_F(LogStructuredStoreTest, CompactWhileWriting)
+{
+  {
+    LogStructuredStore store(_path);
+    ASSERT_TRUE(store.open());
+
+    for (int ii = 0; ii < 100; ii++)
+    {
+      store.set_data_without_cas(TABLE, KEY, std::to_string(ii), 300);
+    }
+
+    // Records written while the log is being compacted end up in the new
+    // log.
+    std::thread writer([&store]()
+    {
+      for (int ii = 0; ii < 1000; ii++)
+      {
+        store.set_data_without_cas(TABLE, KEY, std::to_string(ii), 300);
+        store.set_data_without_cas(TABLE, "sip:" + std::to_string(ii) + "@example.com", "data", 300);
+      }
+    });
+
+    for (int ii = 0; ii < 10; ii++)
+    {
+      EXPECT_TRUE(store.compact());
+    }
+
+    writer.join();
+    EXPECT_EQ(1001u, store.size());
+  }
+
+  LogStructuredStore store(_path);
+  ASSERT_TRUE(store.open());
+  EXPECT_EQ(1001u, store.size());
+
+  std::string data;
+  uint64_t cas;
+  ASSERT_EQ(Store::Status::OK, store.get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("999", data);
+  EXPECT_EQ(Store::Status::OK,
+            store.get_data(TABLE, "sip:999@example.com", data, cas));
+}
+
+TEST_F(LogStructuredStoreTest, GetKeys)
+{
+  LogStructuredStore store(_path);
+  ASSERT_TRUE(store.open());
+  store.set_data_without_cas(TABLE, KEY, "data", 300);
+  store.set_data_without_cas("impi_mapping", OTHER_KEY, "data", 300);
+
+  std::vector<std::pair<std::string, std::string>> keys;
+  store.get_keys(keys);
+  std::sort(keys.begin(), keys.end());
+
+  ASSERT_EQ(2u, keys.size());
+  EXPECT_EQ(std::make_pair(std::string("impi_mapping"), OTHER_KEY), keys[0]);
+  EXPECT_EQ(std::make_pair(TABLE, KEY), keys[1]);
+}
+
+TEST_F(LogStructuredStoreTest, NotALog)
+{
+  int fd = open(_path.c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(16, write(fd, "not an IMPU log!", 16));
+  close(fd);
+
+  LogStructuredStore store(_path);
+  EXPECT_FALSE(store.open());
+
+  std::string data;
+  uint64_t cas;
+  EXPECT_EQ(Store::Status::ERROR, store.get_data(TABLE, KEY, data, cas));
+}
+
+TEST_F(LogStructuredStoreTest, WriteThrough)
+{
+  LogStructuredStore* log = new LogStructuredStore(_path);
+  ASSERT_TRUE(log->open());
+
+  EmbeddedStore* memcached = new EmbeddedStore(1024 * 1024);
+  WriteThroughStore* store = new WriteThroughStore(memcached, log, NODE_ID);
+
+  // The store is empty, so there's nothing to restore.
+  uint64_t restored;
+  EXPECT_EQ(Store::Status::OK, store->restore(restored));
+  EXPECT_EQ(0u, restored);
+
+  std::string data;
+  uint64_t cas;
+  EXPECT_EQ(Store::Status::OK, store->set_data(TABLE, KEY, "one", 0, 300));
+  EXPECT_EQ(Store::Status::DATA_CONTENTION,
+            store->set_data(TABLE, KEY, "two", 0, 300));
+  store->set_data_without_cas(TABLE, OTHER_KEY, "other", 300);
+  store->set_data_without_cas(TABLE, "sip:deleted@example.com", "deleted", 300);
+  store->delete_data(TABLE, "sip:deleted@example.com");
+
+  // Only successful writes reach the log.
+  ASSERT_EQ(Store::Status::OK, log->get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("one", data);
+  EXPECT_EQ(2u, log->size());
+
+  // A record that's gone from "memcached", e.g. because another node deleted
+  // it, isn't brought back from the log.
+  memcached->delete_data(TABLE, OTHER_KEY);
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            store->get_data(TABLE, OTHER_KEY, data, cas));
+
+  // Nor is it restored at start of day, as "memcached" hasn't lost its data.
+  EXPECT_EQ(Store::Status::OK, store->restore(restored));
+  EXPECT_EQ(0u, restored);
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            store->get_data(TABLE, OTHER_KEY, data, cas));
+
+  // Restart, losing everything in "memcached". The records come back from
+  // the log, with CASs that work with memcached, and keep the rest of their
+  // TTL.
+  delete store;
+  log = new LogStructuredStore(_path);
+  ASSERT_TRUE(log->open());
+  memcached = new EmbeddedStore(1024 * 1024);
+  store = new WriteThroughStore(memcached, log, NODE_ID);
+
+  cwtest_advance_time_ms(100000);
+
+  EXPECT_EQ(Store::Status::OK, store->restore(restored));
+  EXPECT_EQ(2u, restored);
+
+  ASSERT_EQ(Store::Status::OK, store->get_data(TABLE, KEY, data, cas));
+  EXPECT_EQ("one", data);
+  EXPECT_EQ(Store::Status::OK, store->set_data(TABLE, KEY, "two", cas, 300));
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            store->get_data(TABLE, "sip:deleted@example.com", data, cas));
+  ASSERT_EQ(Store::Status::OK,
+            memcached->get_data(TABLE, OTHER_KEY, data, cas));
+  EXPECT_EQ("other", data);
+
+  cwtest_advance_time_ms(201000);
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            memcached->get_data(TABLE, OTHER_KEY, data, cas));
+
+  delete store;
+}
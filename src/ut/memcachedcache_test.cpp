@@ -9,6 +9,7 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include "fake_async_store.h"
 #include "memcached_cache.h"
 #include "test_interposer.hpp"
 #include "test_utils.hpp"
@@ -100,6 +101,24 @@ static const std::string SERVICE_PROFILE =
       "</ServiceProfile>"
     "</IMSSubscription>";
 
+static const std::string WILDCARD_IMPU = "sip:chat!.*!@example.com";
+
+static const std::string WILDCARD_SERVICE_PROFILE =
+  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+  "<IMSSubscription>"
+    "<PrivateID>" + IMPI + "</PrivateID>"
+    "<ServiceProfile>"
+      "<PublicIdentity>"
+        "<Identity>" + IMPU + "</Identity>"
+        "<Extension><IdentityType>0</IdentityType></Extension>"
+        "</PublicIdentity>"
+      "<PublicIdentity>"
+        "<Identity>" + WILDCARD_IMPU + "</Identity>"
+        "<Extension><IdentityType>3</IdentityType></Extension>"
+        "</PublicIdentity>"
+      "</ServiceProfile>"
+    "</IMSSubscription>";
+
 static const std::string SERVICE_PROFILE_2 =
   "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
   "<IMSSubscription>"
@@ -256,7 +275,7 @@ TEST_F(MemcachedImplicitRegistrationSetTest, SetServiceProfileSame)
   mirs.set_ims_sub_xml(SERVICE_PROFILE);
   EXPECT_EQ(ASSOC_IMPUS, mirs.get_associated_impus());
   EXPECT_EQ(ASSOC_IMPUS_2,
-            mirs.impus(MemcachedImplicitRegistrationSet::State::DELETED));
+            mirs.impus(MemcachedImplicitRegistrationSet::State::DELETED).to_vector());
   EXPECT_EQ(SERVICE_PROFILE, mirs.get_ims_sub_xml());
   ASSERT_TRUE(mirs.has_changed_impus());
 
@@ -619,9 +638,9 @@ TEST_F(MemcachedImplicitRegistrationSetTest, DeleteImpus)
 
   ASSERT_EQ(NO_ASSOC_IMPUS, mirs.get_associated_impus());
   ASSERT_EQ(NO_ASSOC_IMPUS,
-            mirs.impus(MemcachedImplicitRegistrationSet::State::UNCHANGED));
+            mirs.impus(MemcachedImplicitRegistrationSet::State::UNCHANGED).to_vector());
   ASSERT_EQ(ASSOC_IMPUS,
-            mirs.impus(MemcachedImplicitRegistrationSet::State::DELETED));
+            mirs.impus(MemcachedImplicitRegistrationSet::State::DELETED).to_vector());
 }
 
 TEST_F(MemcachedImplicitRegistrationSetTest, DeleteImpis)
@@ -644,9 +663,9 @@ TEST_F(MemcachedImplicitRegistrationSetTest, DeleteImpis)
 
   ASSERT_EQ(NO_IMPIS, mirs.get_associated_impis());
   ASSERT_EQ(NO_IMPIS,
-            mirs.impis(MemcachedImplicitRegistrationSet::State::UNCHANGED));
+            mirs.impis(MemcachedImplicitRegistrationSet::State::UNCHANGED).to_vector());
   ASSERT_EQ(IMPIS,
-            mirs.impis(MemcachedImplicitRegistrationSet::State::DELETED));
+            mirs.impis(MemcachedImplicitRegistrationSet::State::DELETED).to_vector());
 }
 
 
@@ -968,6 +987,173 @@ TEST_F(MemcachedCacheTest, GetIrsForImpuRemoteStore)
   delete irs;
 }
 
+TEST_F(MemcachedCacheTest, GetIrsForImpuAsyncLocalStoreViaAssocImpu)
+{
+  int expiry = time(0) + 1;
+
+  ImpuStore::AssociatedImpu* ai =
+    new ImpuStore::AssociatedImpu(ASSOC_IMPU, IMPU, 0L, expiry, _local_store);
+
+  _local_store->set_impu(ai, 0L);
+
+  delete ai;
+
+  ImpuStore::DefaultImpu* di =
+    new ImpuStore::DefaultImpu(IMPU,
+                               ASSOC_IMPUS,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               expiry,
+                               _local_store);
+
+  _local_store->set_impu(di, 0L);
+
+  delete di;
+
+  // The stores have no async store, so the get completes inline.
+  ASSERT_FALSE(_memcached_cache->supports_async_get());
+
+  Store::Status status = Store::Status::ERROR;
+  ImplicitRegistrationSet* irs = nullptr;
+
+  _memcached_cache->get_implicit_registration_set_for_impu_async(ASSOC_IMPU,
+                                                                 0L,
+                                                                 [&](Store::Status rc,
+                                                                     ImplicitRegistrationSet* result)
+  {
+    status = rc;
+    irs = result;
+  });
+
+  ASSERT_EQ(Store::Status::OK, status);
+  ASSERT_NE(nullptr, irs);
+  ASSERT_EQ(IMPU, irs->get_default_impu());
+
+  delete irs;
+}
+
+TEST_F(MemcachedCacheTest, GetIrsForImpuAsyncRemoteStore)
+{
+  ImpuStore::DefaultImpu* di =
+    new ImpuStore::DefaultImpu(IMPU,
+                               ASSOC_IMPUS,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               time(0) + 1,
+                               _remote_store);
+
+  _remote_store->set_impu(di, 0L);
+
+  delete di;
+
+  Store::Status status = Store::Status::ERROR;
+  ImplicitRegistrationSet* irs = nullptr;
+
+  _memcached_cache->get_implicit_registration_set_for_impu_async(IMPU,
+                                                                 0L,
+                                                                 [&](Store::Status rc,
+                                                                     ImplicitRegistrationSet* result)
+  {
+    status = rc;
+    irs = result;
+  });
+
+  ASSERT_EQ(Store::Status::OK, status);
+  ASSERT_NE(nullptr, irs);
+
+  delete irs;
+}
+
+TEST_F(MemcachedCacheTest, GetIrsForImpuAsyncNotFound)
+{
+  Store::Status status = Store::Status::OK;
+  ImplicitRegistrationSet* irs = nullptr;
+
+  _memcached_cache->get_implicit_registration_set_for_impu_async(IMPU,
+                                                                 0L,
+                                                                 [&](Store::Status rc,
+                                                                     ImplicitRegistrationSet* result)
+  {
+    status = rc;
+    irs = result;
+  });
+
+  ASSERT_EQ(Store::Status::NOT_FOUND, status);
+  ASSERT_EQ(nullptr, irs);
+}
+
+TEST_F(MemcachedCacheTest, GetIrsForImpuAsyncStores)
+{
+  FakeAsyncStore local_async_store(_lls);
+  FakeAsyncStore remote_async_store(_rls);
+  _local_store->set_async_store(&local_async_store);
+  _remote_store->set_async_store(&remote_async_store);
+
+  // The associated IMPU record is only in the remote store, and the default
+  // IMPU record only in the local one.
+  int expiry = time(0) + 1;
+
+  ImpuStore::AssociatedImpu* ai =
+    new ImpuStore::AssociatedImpu(ASSOC_IMPU, IMPU, 0L, expiry, _remote_store);
+  _remote_store->set_impu(ai, 0L);
+  delete ai;
+
+  ImpuStore::DefaultImpu* di =
+    new ImpuStore::DefaultImpu(IMPU,
+                               ASSOC_IMPUS,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               expiry,
+                               _local_store);
+  _local_store->set_impu(di, 0L);
+  delete di;
+
+  ASSERT_TRUE(_memcached_cache->supports_async_get());
+
+  bool called = false;
+  Store::Status status = Store::Status::ERROR;
+  ImplicitRegistrationSet* irs = nullptr;
+
+  _memcached_cache->get_implicit_registration_set_for_impu_async(ASSOC_IMPU,
+                                                                 0L,
+                                                                 [&](Store::Status rc,
+                                                                     ImplicitRegistrationSet* result)
+  {
+    called = true;
+    status = rc;
+    irs = result;
+  });
+
+  // Each record is read in turn, as the previous read completes.
+  EXPECT_FALSE(called);
+  local_async_store.run();
+  EXPECT_FALSE(called);
+  remote_async_store.run();
+  EXPECT_FALSE(called);
+  local_async_store.run();
+
+  ASSERT_TRUE(called);
+  ASSERT_EQ(Store::Status::OK, status);
+  ASSERT_NE(nullptr, irs);
+  EXPECT_EQ(IMPU, irs->get_default_impu());
+  EXPECT_EQ(2, local_async_store.gets_run());
+  EXPECT_EQ(1, remote_async_store.gets_run());
+
+  delete irs;
+
+  _local_store->set_async_store(nullptr);
+  _remote_store->set_async_store(nullptr);
+}
+
 TEST_F(MemcachedCacheTest, PutIrs)
 {
   ImplicitRegistrationSet* irs =
@@ -984,6 +1170,249 @@ TEST_F(MemcachedCacheTest, PutIrs)
   delete irs;
 }
 
+TEST_F(MemcachedCacheTest, GetIrsForImpuViaWildcard)
+{
+  WildcardIndex wildcard_index(10);
+  _memcached_cache->set_wildcard_index(&wildcard_index);
+
+  ImplicitRegistrationSet* irs =
+    _memcached_cache->create_implicit_registration_set();
+
+  irs->set_ttl(1);
+  irs->set_ims_sub_xml(WILDCARD_SERVICE_PROFILE);
+  irs->set_reg_state(RegistrationState::REGISTERED);
+
+  // Caching the IRS indexes its wildcard.
+  EXPECT_CALL(*_mock_progress_cb, progress_callback());
+  ASSERT_EQ(Store::Status::OK,
+            _memcached_cache->put_implicit_registration_set(irs, _progress_callback, 0L));
+  EXPECT_EQ(1u, wildcard_index.size());
+
+  // A concrete IMPU that isn't cached is found in the wildcard's IRS.
+  ImplicitRegistrationSet* wildcard_irs = nullptr;
+  ASSERT_EQ(Store::Status::OK,
+            _memcached_cache->get_implicit_registration_set_for_impu("sip:chat1234@example.com",
+                                                                     0L,
+                                                                     wildcard_irs));
+  EXPECT_EQ(IMPU, wildcard_irs->get_default_impu());
+
+  // Once the IRS is deleted, the wildcard isn't used.
+  EXPECT_CALL(*_mock_progress_cb, progress_callback());
+  ASSERT_EQ(Store::Status::OK,
+            _memcached_cache->delete_implicit_registration_set(wildcard_irs, _progress_callback, 0L));
+  EXPECT_EQ(0u, wildcard_index.size());
+
+  ImplicitRegistrationSet* missing_irs = nullptr;
+  EXPECT_EQ(Store::Status::NOT_FOUND,
+            _memcached_cache->get_implicit_registration_set_for_impu("sip:chat1234@example.com",
+                                                                     0L,
+                                                                     missing_irs));
+
+  delete wildcard_irs;
+  delete irs;
+}
+
+TEST_F(MemcachedCacheTest, GetIrsForImpuViaStaleWildcard)
+{
+  WildcardIndex wildcard_index(10);
+  _memcached_cache->set_wildcard_index(&wildcard_index);
+
+  // The index has a wildcard that isn't cached, so the lookup fails and the
+  // wildcard is removed from the index.
+  wildcard_index.add(WILDCARD_IMPU);
+
+  Store::Status status = Store::Status::OK;
+  ImplicitRegistrationSet* irs = nullptr;
+
+  _memcached_cache->get_implicit_registration_set_for_impu_async("sip:chat1234@example.com",
+                                                                 0L,
+                                                                 [&](Store::Status rc,
+                                                                     ImplicitRegistrationSet* result)
+  {
+    status = rc;
+    irs = result;
+  });
+
+  EXPECT_EQ(Store::Status::NOT_FOUND, status);
+  EXPECT_EQ(nullptr, irs);
+  EXPECT_EQ(0u, wildcard_index.size());
+}
+
+TEST_F(MemcachedCacheTest, PutIrsRefreshedLongLivedLookups)
+{
+  // Keep the lookup records for three IRS lifetimes.
+  MemcachedCache memcached_cache(_local_store, {}, 3);
+
+  int64_t start = time(0);
+
+  // The lookup records are left out of the store, to show whether they're
+  // rewritten.
+  ImpuStore::DefaultImpu* di =
+    new ImpuStore::DefaultImpu(IMPU,
+                               {ASSOC_IMPU},
+                               {IMPI},
+                               RegistrationState::REGISTERED,
+                               CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               start + 10,
+                               _local_store,
+                               0,
+                               start + 30);
+
+  _local_store->set_impu(di, 0L);
+
+  delete di;
+
+  // The lookup records outlive the refreshed IRS, so aren't rewritten.
+  ImplicitRegistrationSet* irs = nullptr;
+  ASSERT_EQ(Store::Status::OK,
+            memcached_cache.get_implicit_registration_set_for_impu(IMPU, 0L, irs));
+  irs->set_ttl(10);
+
+  EXPECT_CALL(*_mock_progress_cb, progress_callback());
+  EXPECT_EQ(Store::Status::OK,
+            memcached_cache.put_implicit_registration_set(irs, _progress_callback, 0L));
+  delete irs;
+
+  EXPECT_EQ(nullptr, _local_store->get_impu(ASSOC_IMPU, 0L));
+  EXPECT_EQ(nullptr, _local_store->get_impi_mapping(IMPI, 0L));
+
+  ImpuStore::Impu* impu = _local_store->get_impu(IMPU, 0L);
+  ASSERT_NE(nullptr, impu);
+  EXPECT_EQ(start + 30, ((ImpuStore::DefaultImpu*)impu)->lookup_expiry);
+  delete impu;
+
+  // Refreshing the IRS so that it outlives the lookup records rewrites them,
+  // to last for three lifetimes.
+  cwtest_advance_time_ms(8000);
+
+  ASSERT_EQ(Store::Status::OK,
+            memcached_cache.get_implicit_registration_set_for_impu(IMPU, 0L, irs));
+  irs->set_ttl(30);
+
+  EXPECT_CALL(*_mock_progress_cb, progress_callback());
+  EXPECT_EQ(Store::Status::OK,
+            memcached_cache.put_implicit_registration_set(irs, _progress_callback, 0L));
+  delete irs;
+
+  impu = _local_store->get_impu(ASSOC_IMPU, 0L);
+  ASSERT_NE(nullptr, impu);
+  EXPECT_FALSE(impu->is_default_impu());
+  EXPECT_EQ(start + 98, impu->expiry);
+  delete impu;
+
+  ImpuStore::ImpiMapping* mapping = _local_store->get_impi_mapping(IMPI, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(start + 98, mapping->get_expiry());
+  delete mapping;
+
+  impu = _local_store->get_impu(IMPU, 0L);
+  ASSERT_NE(nullptr, impu);
+  EXPECT_EQ(start + 38, impu->expiry);
+  EXPECT_EQ(start + 98, ((ImpuStore::DefaultImpu*)impu)->lookup_expiry);
+  delete impu;
+}
+
+TEST_F(MemcachedCacheTest, PutIrsSplitImpiMapping)
+{
+  _local_store->set_impi_mapping_buckets(4);
+
+  int64_t now = time(0);
+
+  ImpuStore::DefaultImpu* di =
+    new ImpuStore::DefaultImpu(IMPU,
+                               NO_ASSOC_IMPUS,
+                               IMPIS,
+                               RegistrationState::REGISTERED,
+                               CHARGING_ADDRESSES,
+                               SERVICE_PROFILE,
+                               0L,
+                               now + 10,
+                               _local_store);
+
+  _local_store->set_impu(di, 0L);
+
+  delete di;
+
+  // The IMPI mapping was written before it was split.
+  ImpuStore::ImpiMapping* mapping =
+    new ImpuStore::ImpiMapping(IMPI, {IMPU, IMPU_2}, 0L, now + 10);
+
+  _local_store->set_impi_mapping(mapping, 0L);
+
+  delete mapping;
+
+  ImplicitRegistrationSet* irs = nullptr;
+  ASSERT_EQ(Store::Status::OK,
+            _memcached_cache->get_implicit_registration_set_for_impu(IMPU, 0L, irs));
+  irs->set_ttl(20);
+
+  EXPECT_CALL(*_mock_progress_cb, progress_callback());
+  EXPECT_EQ(Store::Status::OK,
+            _memcached_cache->put_implicit_registration_set(irs, _progress_callback, 0L));
+  delete irs;
+
+  // Refreshing the IRS moves it out of the unsplit record into its bucket,
+  // and the bucket count record now lists the buckets and outlives them.
+  int bucket = _local_store->impi_mapping_bucket(IMPU);
+
+  mapping = _local_store->get_impi_mapping_record(IMPI, bucket, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(std::vector<std::string>({IMPU}), mapping->get_default_impus());
+  EXPECT_EQ(now + 20, mapping->get_expiry());
+  delete mapping;
+
+  mapping = _local_store->get_impi_mapping_record(IMPI, ImpuStore::NO_BUCKET, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(std::vector<std::string>({IMPU_2}), mapping->get_default_impus());
+  EXPECT_EQ(now + 10, mapping->get_expiry());
+  delete mapping;
+
+  mapping = _local_store->get_impi_mapping_record(IMPI, ImpuStore::BUCKET_COUNT, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_TRUE(mapping->is_empty());
+  EXPECT_EQ(4, mapping->buckets);
+  EXPECT_EQ(now + 40, mapping->get_expiry());
+  delete mapping;
+
+  // Reading the whole mapping finds both IRSs.
+  mapping = _local_store->get_impi_mapping(IMPI, 0L);
+  ASSERT_NE(nullptr, mapping);
+  std::vector<std::string> impus = mapping->get_default_impus();
+  std::sort(impus.begin(), impus.end());
+  EXPECT_EQ(std::vector<std::string>({IMPU, IMPU_2}), impus);
+  delete mapping;
+
+  // A Homestead that doesn't split mappings only rewrites the unsplit
+  // record, and losing the bucket count record doesn't hide the buckets we
+  // write to, so the IRS is still found.
+  mapping = _local_store->get_impi_mapping_record(IMPI, ImpuStore::BUCKET_COUNT, 0L);
+  _local_store->delete_impi_mapping(mapping, 0L);
+  delete mapping;
+
+  mapping = _local_store->get_impi_mapping(IMPI, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_TRUE(mapping->has_default_impu(IMPU));
+  delete mapping;
+
+  // Deleting the IRS empties its bucket, but leaves the unsplit record.
+  ASSERT_EQ(Store::Status::OK,
+            _memcached_cache->get_implicit_registration_set_for_impu(IMPU, 0L, irs));
+
+  EXPECT_CALL(*_mock_progress_cb, progress_callback());
+  EXPECT_EQ(Store::Status::OK,
+            _memcached_cache->delete_implicit_registration_set(irs, _progress_callback, 0L));
+  delete irs;
+
+  EXPECT_EQ(nullptr, _local_store->get_impi_mapping_record(IMPI, bucket, 0L));
+
+  mapping = _local_store->get_impi_mapping(IMPI, 0L);
+  ASSERT_NE(nullptr, mapping);
+  EXPECT_EQ(std::vector<std::string>({IMPU_2}), mapping->get_default_impus());
+  delete mapping;
+}
+
 TEST_F(MemcachedCacheTest, PutIrsWithExistingUnrefreshed)
 {
   int expiry = time(0) + 1;
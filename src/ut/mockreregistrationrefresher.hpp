@@ -0,0 +1,33 @@
+/**
+ * @file mockreregistrationrefresher.hpp Mock re-registration refresher.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef MOCKREREGISTRATIONREFRESHER_H__
+#define MOCKREREGISTRATIONREFRESHER_H__
+
+#include "gmock/gmock.h"
+#include "reregistration_refresher.h"
+
+class MockReregistrationRefresher : public ReregistrationRefresher
+{
+public:
+  MockReregistrationRefresher() :
+    ReregistrationRefresher(NULL, NULL, 3600, 7200, 10, 100, 0)
+  {};
+  virtual ~MockReregistrationRefresher() {};
+
+  MOCK_METHOD1(next_deadline, int64_t(int64_t now));
+  MOCK_METHOD2(in_refresh_window, bool(int64_t deadline, int64_t now));
+  MOCK_METHOD3(refresh, bool(const HssConnection::ServerAssignmentRequest& request,
+                             const std::string& default_impu,
+                             SAS::TrailId trail));
+};
+
+#endif
@@ -27,9 +27,29 @@ public:
   MOCK_METHOD1(update_H_hss_digest_latency_us, void(unsigned long sample));
   MOCK_METHOD1(update_H_hss_subscription_latency_us, void(unsigned long sample));
   MOCK_METHOD1(update_H_hsprov_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_cache_queue_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_cache_get_irs_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_cache_put_irs_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_cache_delete_irs_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_cache_get_ims_sub_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_cache_put_ims_sub_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_local_store_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_remote_store_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_xml_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_ppr_latency_us, void(unsigned long sample));
+  MOCK_METHOD1(update_H_rtr_latency_us, void(unsigned long sample));
 
   MOCK_METHOD0(incr_H_incoming_requests, void());
   MOCK_METHOD0(incr_H_rejected_overload, void());
+  MOCK_METHOD0(incr_H_hss_hedged_requests, void());
+  MOCK_METHOD0(incr_H_hss_hedge_wins, void());
+  MOCK_METHOD0(incr_H_hss_hedge_losses, void());
+  MOCK_METHOD0(incr_H_hsprov_cache_hits, void());
+  MOCK_METHOD0(incr_H_hsprov_cache_misses, void());
+  MOCK_METHOD0(incr_H_sas_events_dropped, void());
+  MOCK_METHOD0(incr_H_sas_params_omitted, void());
+  MOCK_METHOD0(incr_H_reg_dampened, void());
+  MOCK_METHOD0(incr_H_negative_cache_hits, void());
 
   MOCK_METHOD1(update_http_latency_us, void(unsigned long sample));
   MOCK_METHOD0(incr_http_incoming_requests, void());
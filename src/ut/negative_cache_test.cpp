@@ -0,0 +1,91 @@
+/**
+ * @file negative_cache_test.cpp UT for NegativeCache
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "negative_cache.h"
+#include "mockstatisticsmanager.hpp"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+using ::testing::StrictMock;
+
+static const int TTL_S = 10;
+static const size_t MAX_ENTRIES = 2;
+
+static const std::string IMPI = "alice@example.com";
+static const std::string IMPU = "sip:alice@example.com";
+static const std::string OTHER_IMPU = "sip:bob@example.com";
+
+class NegativeCacheTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  NegativeCacheTest() :
+    _cache(TTL_S, MAX_ENTRIES, &_stats)
+  {
+  }
+
+  StrictMock<MockStatisticsManager> _stats;
+  NegativeCache _cache;
+};
+
+TEST_F(NegativeCacheTest, Unknown)
+{
+  EXPECT_FALSE(_cache.is_unknown(NegativeCache::MAR, IMPI, IMPU));
+  _cache.add_unknown(NegativeCache::MAR, IMPI, IMPU);
+
+  EXPECT_CALL(_stats, incr_H_negative_cache_hits());
+  EXPECT_TRUE(_cache.is_unknown(NegativeCache::MAR, IMPI, IMPU));
+
+  // Answers to other requests, and for other subscribers, are separate.
+  EXPECT_FALSE(_cache.is_unknown(NegativeCache::UAR, IMPI, IMPU));
+  EXPECT_FALSE(_cache.is_unknown(NegativeCache::MAR, IMPI, OTHER_IMPU));
+  EXPECT_FALSE(_cache.is_unknown(NegativeCache::MAR, "", IMPI + IMPU));
+}
+
+TEST_F(NegativeCacheTest, Expiry)
+{
+  _cache.add_unknown(NegativeCache::LIR, "", IMPU);
+  cwtest_advance_time_ms((TTL_S - 1) * 1000);
+
+  // Adding the answer again doesn't extend its TTL.
+  _cache.add_unknown(NegativeCache::LIR, "", IMPU);
+
+  EXPECT_CALL(_stats, incr_H_negative_cache_hits());
+  EXPECT_TRUE(_cache.is_unknown(NegativeCache::LIR, "", IMPU));
+
+  cwtest_advance_time_ms(1000);
+  EXPECT_FALSE(_cache.is_unknown(NegativeCache::LIR, "", IMPU));
+}
+
+TEST_F(NegativeCacheTest, LeastRecentlyUsedEvicted)
+{
+  _cache.add_unknown(NegativeCache::SAR, IMPI, IMPU);
+  _cache.add_unknown(NegativeCache::SAR, IMPI, OTHER_IMPU);
+
+  EXPECT_CALL(_stats, incr_H_negative_cache_hits());
+  EXPECT_TRUE(_cache.is_unknown(NegativeCache::SAR, IMPI, IMPU));
+
+  _cache.add_unknown(NegativeCache::UAR, IMPI, IMPU);
+
+  EXPECT_CALL(_stats, incr_H_negative_cache_hits()).Times(2);
+  EXPECT_TRUE(_cache.is_unknown(NegativeCache::SAR, IMPI, IMPU));
+  EXPECT_TRUE(_cache.is_unknown(NegativeCache::UAR, IMPI, IMPU));
+  EXPECT_FALSE(_cache.is_unknown(NegativeCache::SAR, IMPI, OTHER_IMPU));
+}
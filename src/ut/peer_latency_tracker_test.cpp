@@ -0,0 +1,134 @@
+/**
+ * @file peer_latency_tracker_test.cpp UT for PeerLatencyTracker
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "peer_latency_tracker.h"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+static const int MIN_TIMEOUT_MS = 20;
+static const int MAX_TIMEOUT_MS = 200;
+
+class PeerLatencyTrackerTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  PeerLatencyTrackerTest() :
+    _tracker(MIN_TIMEOUT_MS, MAX_TIMEOUT_MS)
+  {
+  }
+
+  void record(const std::string& peer, unsigned long latency_us, size_t count)
+  {
+    for (size_t ii = 0; ii < count; ii++)
+    {
+      _tracker.record(peer, latency_us);
+    }
+  }
+
+  PeerLatencyTracker _tracker;
+};
+
+TEST_F(PeerLatencyTrackerTest, NotEnoughSamples)
+{
+  record("hss1", 30000, PeerLatencyTracker::MIN_SAMPLES - 1);
+
+  unsigned long p99_us = 0;
+  EXPECT_FALSE(_tracker.p99_us("hss1", p99_us));
+  EXPECT_FALSE(_tracker.p99_us("hss2", p99_us));
+  EXPECT_EQ(MAX_TIMEOUT_MS, _tracker.timeout_ms("hss1"));
+  EXPECT_EQ(MAX_TIMEOUT_MS, _tracker.timeout_ms(""));
+}
+
+TEST_F(PeerLatencyTrackerTest, TimeoutFromPercentile)
+{
+  // 99% of requests are quick, and 1% take 40ms.
+  record("hss1", 1000, 99);
+  record("hss1", 40000, 1);
+
+  unsigned long p99_us = 0;
+  EXPECT_TRUE(_tracker.p99_us("hss1", p99_us));
+  EXPECT_EQ(40000, p99_us);
+  EXPECT_EQ(80, _tracker.timeout_ms("hss1"));
+
+  // The samples also count towards all peers.
+  EXPECT_EQ(80, _tracker.timeout_ms(""));
+}
+
+TEST_F(PeerLatencyTrackerTest, TimeoutBounds)
+{
+  record("fast", 1000, PeerLatencyTracker::MIN_SAMPLES);
+  record("slow", 500000, PeerLatencyTracker::MIN_SAMPLES);
+
+  EXPECT_EQ(MIN_TIMEOUT_MS, _tracker.timeout_ms("fast"));
+  EXPECT_EQ(MAX_TIMEOUT_MS, _tracker.timeout_ms("slow"));
+}
+
+TEST_F(PeerLatencyTrackerTest, SlidingWindow)
+{
+  record("hss1", 50000, PeerLatencyTracker::WINDOW_SIZE);
+  EXPECT_EQ(100, _tracker.timeout_ms("hss1"));
+
+  // Once the slow samples have left the window, the timeout comes down.
+  record("hss1", 10000, PeerLatencyTracker::WINDOW_SIZE);
+  EXPECT_EQ(MIN_TIMEOUT_MS, _tracker.timeout_ms("hss1"));
+}
+
+TEST_F(PeerLatencyTrackerTest, ChoosePeers)
+{
+  std::string primary;
+  std::string alternate;
+
+  // We need two peers to hedge.
+  EXPECT_FALSE(_tracker.choose_peers("", primary, alternate));
+  record("hss1", 10000, PeerLatencyTracker::MIN_SAMPLES);
+  EXPECT_FALSE(_tracker.choose_peers("", primary, alternate));
+
+  record("hss2", 20000, PeerLatencyTracker::MIN_SAMPLES);
+  record("hss3", 5000, PeerLatencyTracker::MIN_SAMPLES);
+
+  // The configured Destination-Host is always the primary, and the fastest
+  // other peer is the alternate.
+  EXPECT_TRUE(_tracker.choose_peers("hss1", primary, alternate));
+  EXPECT_EQ("hss1", primary);
+  EXPECT_EQ("hss3", alternate);
+
+  EXPECT_TRUE(_tracker.choose_peers("hss3", primary, alternate));
+  EXPECT_EQ("hss3", primary);
+  EXPECT_EQ("hss1", alternate);
+
+  // Without a Destination-Host, the primary is any peer, and the alternate is
+  // a different one.
+  EXPECT_TRUE(_tracker.choose_peers("", primary, alternate));
+  EXPECT_NE(primary, alternate);
+}
+
+TEST_F(PeerLatencyTrackerTest, QuietPeersNotChosen)
+{
+  record("hss1", 10000, PeerLatencyTracker::MIN_SAMPLES);
+  record("hss2", 5000, PeerLatencyTracker::MIN_SAMPLES);
+
+  // hss2 stops answering.
+  cwtest_advance_time_ms(PeerLatencyTracker::PEER_EXPIRY_S * 1000);
+  record("hss1", 10000, 1);
+
+  std::string primary;
+  std::string alternate;
+  EXPECT_FALSE(_tracker.choose_peers("hss1", primary, alternate));
+}
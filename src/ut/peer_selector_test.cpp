@@ -0,0 +1,155 @@
+/**
+ * @file peer_selector_test.cpp UT for PeerSelector
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "peer_selector.h"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+static const int FAILURE_PENALTY_MS = 200;
+
+class PeerSelectorTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  PeerSelectorTest() :
+    _selector(FAILURE_PENALTY_MS)
+  {
+  }
+
+  // Teaches the selector about a peer, as if it had answered a request that
+  // was routed by realm.
+  void learn(const std::string& peer, unsigned long latency_us)
+  {
+    _selector.start("");
+    _selector.complete("", peer, latency_us, false);
+  }
+
+  PeerSelector _selector;
+};
+
+TEST_F(PeerSelectorTest, NoPeersRoutesByRealm)
+{
+  EXPECT_EQ("", _selector.select());
+}
+
+TEST_F(PeerSelectorTest, LearnsFromAnswers)
+{
+  learn("hss1", 1000);
+  EXPECT_EQ("hss1", _selector.select());
+}
+
+TEST_F(PeerSelectorTest, FailuresNotLearned)
+{
+  // A failure on a request routed by realm may have come from the local
+  // Diameter stack, so doesn't teach us about a peer.
+  _selector.start("");
+  _selector.complete("", "homestead", 1000, true);
+  EXPECT_EQ("", _selector.select());
+}
+
+TEST_F(PeerSelectorTest, LeastOutstanding)
+{
+  learn("hss1", 10000);
+  learn("hss2", 10000);
+
+  _selector.start("hss1");
+  EXPECT_EQ("hss2", _selector.select());
+
+  _selector.start("hss2");
+  _selector.start("hss2");
+  EXPECT_EQ("hss1", _selector.select());
+
+  // Once the requests complete, both peers are equally loaded again.
+  _selector.complete("hss2", "hss2", 10000, false);
+  _selector.complete("hss2", "hss2", 10000, false);
+  _selector.start("hss2");
+  EXPECT_EQ("hss1", _selector.select());
+}
+
+TEST_F(PeerSelectorTest, WeightedByLatency)
+{
+  learn("fast", 1000);
+  learn("slow", 10000);
+
+  // The fast peer can take several requests before it is slower to answer
+  // than the slow one.
+  for (int ii = 0; ii < 9; ii++)
+  {
+    EXPECT_EQ("fast", _selector.select());
+    _selector.start("fast");
+  }
+
+  EXPECT_EQ("fast", _selector.select());
+  _selector.start("fast");
+  EXPECT_EQ("slow", _selector.select());
+}
+
+TEST_F(PeerSelectorTest, FailuresPenalised)
+{
+  learn("hss1", 1000);
+  learn("hss2", 1000);
+
+  // hss1 times out quickly, but counts as having taken the failure penalty.
+  _selector.start("hss1");
+  _selector.complete("hss1", "", 1000, true);
+
+  for (int ii = 0; ii < 5; ii++)
+  {
+    EXPECT_EQ("hss2", _selector.select());
+    _selector.start("hss2");
+  }
+}
+
+TEST_F(PeerSelectorTest, Discovery)
+{
+  learn("hss1", 1000);
+
+  // Every so often, a request is routed by realm so that we discover new
+  // peers.
+  int routed_by_realm = 0;
+
+  for (int ii = 0; ii < PeerSelector::DISCOVERY_INTERVAL; ii++)
+  {
+    if (_selector.select().empty())
+    {
+      routed_by_realm++;
+    }
+  }
+
+  EXPECT_EQ(1, routed_by_realm);
+}
+
+TEST_F(PeerSelectorTest, QuietPeersForgotten)
+{
+  learn("hss1", 1000);
+  learn("hss2", 2000);
+
+  cwtest_advance_time_ms((PeerSelector::PEER_EXPIRY_S - 1) * 1000);
+  learn("hss2", 2000);
+  cwtest_advance_time_ms(1000);
+
+  // hss1 hasn't answered for the expiry time, so only hss2 is chosen.
+  EXPECT_EQ("hss2", _selector.select());
+
+  // Peers with requests in flight are kept.
+  _selector.start("hss2");
+  cwtest_advance_time_ms(PeerSelector::PEER_EXPIRY_S * 1000);
+  EXPECT_EQ("hss2", _selector.select());
+}
@@ -0,0 +1,100 @@
+/**
+ * @file registration_dampener_test.cpp UT for RegistrationDampener
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "registration_dampener.h"
+#include "mockstatisticsmanager.hpp"
+#include "test_interposer.hpp"
+#include "test_utils.hpp"
+
+using ::testing::StrictMock;
+
+static const int WINDOW_MS = 2000;
+static const int MAX_PER_WINDOW = 2;
+static const size_t MAX_ENTRIES = 2;
+
+static const std::string IMPI = "alice@example.com";
+static const std::string IMPU = "sip:alice@example.com";
+static const std::string OTHER_IMPI = "bob@example.com";
+static const std::string OTHER_IMPU = "sip:bob@example.com";
+
+class RegistrationDampenerTest : public testing::Test
+{
+  static void SetUpTestCase()
+  {
+    cwtest_completely_control_time();
+  }
+
+  static void TearDownTestCase()
+  {
+    cwtest_reset_time();
+  }
+
+public:
+  RegistrationDampenerTest() :
+    _dampener(WINDOW_MS, MAX_PER_WINDOW, MAX_ENTRIES, &_stats)
+  {
+  }
+
+  StrictMock<MockStatisticsManager> _stats;
+  RegistrationDampener _dampener;
+};
+
+TEST_F(RegistrationDampenerTest, DampensAfterMaxPerWindow)
+{
+  EXPECT_FALSE(_dampener.dampen(IMPU, IMPI));
+  _dampener.record(IMPU, IMPI);
+  EXPECT_FALSE(_dampener.dampen(IMPU, IMPI));
+  _dampener.record(IMPU, IMPI);
+
+  EXPECT_CALL(_stats, incr_H_reg_dampened()).Times(2);
+  EXPECT_TRUE(_dampener.dampen(IMPU, IMPI));
+  EXPECT_TRUE(_dampener.dampen(IMPU, IMPI));
+
+  // Other subscribers, and the same public ID with another private ID, are
+  // counted separately.
+  EXPECT_FALSE(_dampener.dampen(OTHER_IMPU, OTHER_IMPI));
+  EXPECT_FALSE(_dampener.dampen(IMPU, OTHER_IMPI));
+}
+
+TEST_F(RegistrationDampenerTest, WindowExpires)
+{
+  _dampener.record(IMPU, IMPI);
+  cwtest_advance_time_ms(WINDOW_MS - 1);
+  _dampener.record(IMPU, IMPI);
+
+  EXPECT_CALL(_stats, incr_H_reg_dampened());
+  EXPECT_TRUE(_dampener.dampen(IMPU, IMPI));
+
+  // The window runs from the first registration, so ends here even though
+  // the last one was just now.
+  cwtest_advance_time_ms(1);
+  EXPECT_FALSE(_dampener.dampen(IMPU, IMPI));
+
+  // A new window starts with the next registration.
+  _dampener.record(IMPU, IMPI);
+  EXPECT_FALSE(_dampener.dampen(IMPU, IMPI));
+}
+
+TEST_F(RegistrationDampenerTest, LeastRecentlyUsedForgotten)
+{
+  _dampener.record(IMPU, IMPI);
+  _dampener.record(IMPU, IMPI);
+  _dampener.record(OTHER_IMPU, OTHER_IMPI);
+  _dampener.record(OTHER_IMPU, OTHER_IMPI);
+
+  // Tracking a third subscriber forgets the first.
+  _dampener.record(IMPU, OTHER_IMPI);
+
+  EXPECT_FALSE(_dampener.dampen(IMPU, IMPI));
+
+  EXPECT_CALL(_stats, incr_H_reg_dampened());
+  EXPECT_TRUE(_dampener.dampen(OTHER_IMPU, OTHER_IMPI));
+}
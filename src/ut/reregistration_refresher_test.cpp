@@ -0,0 +1,341 @@
+/**
+ * @file reregistration_refresher_test.cpp UT for ReregistrationRefresher
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "reregistration_refresher.h"
+#include "mockhssconnection.hpp"
+#include "mockhsscacheprocessor.hpp"
+#include "fake_implicit_reg_set.h"
+#include "test_utils.hpp"
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::InvokeArgument;
+using ::testing::StrictMock;
+
+static const int HSS_REREGISTRATION_TIME = 3600;
+static const int RECORD_TTL = 7200;
+static const int JITTER_PERCENT = 10;
+static const int JITTER = 360;
+static const int MAX_RATE = 10;
+static const unsigned int MAX_QUEUE = 2;
+static const SAS::TrailId FAKE_TRAIL_ID = 0x12345678;
+
+static const std::string IMPI = "alice@example.com";
+static const std::string IMPU = "sip:alice@example.com";
+static const std::string IMPU2 = "sip:bob@example.com";
+static const std::string IMPU3 = "sip:carol@example.com";
+static const std::string SERVER_NAME = "sip:scscf.example.com";
+static const std::string IMS_SUBSCRIPTION = "<IMSSubscription>refreshed</IMSSubscription>";
+
+class ReregistrationRefresherTest : public testing::Test
+{
+public:
+  ReregistrationRefresherTest()
+  {
+    _request.impi = IMPI;
+    _request.impu = IMPU;
+    _request.server_name = SERVER_NAME;
+    _request.type = Cx::ServerAssignmentType::REGISTRATION;
+    _request.support_shared_ifcs = true;
+  }
+
+  // Records a SAR sent by the refresher, without answering it.
+  void record_sar(HssConnection::saa_cb callback,
+                  HssConnection::ServerAssignmentRequest request,
+                  SAS::TrailId trail)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _callbacks.push_back(callback);
+    _requests.push_back(request);
+    _send_times.push_back(std::chrono::steady_clock::now());
+    _cond.notify_all();
+  }
+
+  // Waits for the refresher to have sent the given number of SARs.
+  bool wait_for_sars(size_t count)
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    return _cond.wait_for(lock,
+                          std::chrono::seconds(5),
+                          [this, count]() { return _requests.size() >= count; });
+  }
+
+  // Fails the SARs that have been recorded.
+  void fail_sars()
+  {
+    std::vector<HssConnection::saa_cb> callbacks;
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      callbacks.swap(_callbacks);
+    }
+
+    for (HssConnection::saa_cb& callback : callbacks)
+    {
+      callback(HssConnection::ServerAssignmentAnswer(
+                              HssConnection::ResultCode::SERVER_UNAVAILABLE));
+    }
+  }
+
+  StrictMock<MockHssConnection> _hss;
+  StrictMock<MockHssCacheProcessor> _cache;
+  HssConnection::ServerAssignmentRequest _request;
+
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::vector<HssConnection::saa_cb> _callbacks;
+  std::vector<HssConnection::ServerAssignmentRequest> _requests;
+  std::vector<std::chrono::steady_clock::time_point> _send_times;
+};
+
+// The deadline is jittered down by at most the jitter percentage of the
+// re-registration time.
+TEST_F(ReregistrationRefresherTest, NextDeadlineJitter)
+{
+  ReregistrationRefresher refresher(&_hss,
+                                    &_cache,
+                                    HSS_REREGISTRATION_TIME,
+                                    RECORD_TTL,
+                                    JITTER_PERCENT,
+                                    MAX_RATE,
+                                    MAX_QUEUE);
+  int64_t now = 1000000;
+  int64_t earliest = now + HSS_REREGISTRATION_TIME;
+  int64_t latest = now;
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    int64_t deadline = refresher.next_deadline(now);
+    EXPECT_LE(now + HSS_REREGISTRATION_TIME - JITTER, deadline);
+    EXPECT_GE(now + HSS_REREGISTRATION_TIME, deadline);
+    earliest = std::min(earliest, deadline);
+    latest = std::max(latest, deadline);
+  }
+
+  // The deadlines are actually spread over the jitter.
+  EXPECT_LT(earliest + JITTER / 2, latest);
+}
+
+TEST_F(ReregistrationRefresherTest, NextDeadlineNoJitter)
+{
+  ReregistrationRefresher refresher(&_hss,
+                                    &_cache,
+                                    HSS_REREGISTRATION_TIME,
+                                    RECORD_TTL,
+                                    0,
+                                    MAX_RATE,
+                                    MAX_QUEUE);
+  int64_t now = 1000000;
+
+  EXPECT_EQ(now + HSS_REREGISTRATION_TIME, refresher.next_deadline(now));
+}
+
+TEST_F(ReregistrationRefresherTest, RefreshWindow)
+{
+  ReregistrationRefresher refresher(&_hss,
+                                    &_cache,
+                                    HSS_REREGISTRATION_TIME,
+                                    RECORD_TTL,
+                                    JITTER_PERCENT,
+                                    MAX_RATE,
+                                    MAX_QUEUE);
+  int64_t deadline = 1000000;
+
+  // The window is the jitter, as that's bigger than a tenth of the
+  // re-registration time. An IRS with no deadline is never refreshed.
+  EXPECT_FALSE(refresher.in_refresh_window(deadline, deadline - JITTER - 1));
+  EXPECT_TRUE(refresher.in_refresh_window(deadline, deadline - JITTER));
+  EXPECT_TRUE(refresher.in_refresh_window(deadline, deadline + 1));
+  EXPECT_FALSE(refresher.in_refresh_window(0, deadline));
+}
+
+// Refreshes beyond the queue limit, and refreshes of an IRS that's already
+// queued, are dropped. Refreshes still queued on stop are dropped without
+// sending a SAR.
+TEST_F(ReregistrationRefresherTest, QueueFull)
+{
+  ReregistrationRefresher refresher(&_hss,
+                                    &_cache,
+                                    HSS_REREGISTRATION_TIME,
+                                    RECORD_TTL,
+                                    JITTER_PERCENT,
+                                    MAX_RATE,
+                                    MAX_QUEUE);
+
+  EXPECT_TRUE(refresher.refresh(_request, IMPU, FAKE_TRAIL_ID));
+  EXPECT_FALSE(refresher.refresh(_request, IMPU, FAKE_TRAIL_ID));
+  EXPECT_TRUE(refresher.refresh(_request, IMPU2, FAKE_TRAIL_ID));
+  EXPECT_FALSE(refresher.refresh(_request, IMPU3, FAKE_TRAIL_ID));
+
+  refresher.stop();
+
+  EXPECT_FALSE(refresher.refresh(_request, IMPU3, FAKE_TRAIL_ID));
+}
+
+// SARs are sent no faster than the configured rate.
+TEST_F(ReregistrationRefresherTest, RateLimit)
+{
+  ReregistrationRefresher refresher(&_hss,
+                                    &_cache,
+                                    HSS_REREGISTRATION_TIME,
+                                    RECORD_TTL,
+                                    JITTER_PERCENT,
+                                    MAX_RATE,
+                                    0);
+
+  EXPECT_CALL(_hss, send_server_assignment_request(_, _, FAKE_TRAIL_ID))
+    .Times(3)
+    .WillRepeatedly(Invoke(this, &ReregistrationRefresherTest::record_sar));
+
+  refresher.start();
+  EXPECT_TRUE(refresher.refresh(_request, IMPU, FAKE_TRAIL_ID));
+  EXPECT_TRUE(refresher.refresh(_request, IMPU2, FAKE_TRAIL_ID));
+  EXPECT_TRUE(refresher.refresh(_request, IMPU3, FAKE_TRAIL_ID));
+
+  ASSERT_TRUE(wait_for_sars(3));
+
+  std::chrono::microseconds interval(1000000 / MAX_RATE);
+
+  for (size_t ii = 1; ii < _send_times.size(); ii++)
+  {
+    EXPECT_LE(interval, _send_times[ii] - _send_times[ii - 1]);
+  }
+
+  for (const HssConnection::ServerAssignmentRequest& request : _requests)
+  {
+    EXPECT_EQ(Cx::ServerAssignmentType::RE_REGISTRATION, request.type);
+    EXPECT_EQ(IMPI, request.impi);
+  }
+
+  fail_sars();
+  refresher.stop();
+}
+
+// A successful SAA is written back to the IRS in the cache, with a new
+// deadline.
+TEST_F(ReregistrationRefresherTest, WritesBackSaa)
+{
+  ReregistrationRefresher refresher(&_hss,
+                                    &_cache,
+                                    HSS_REREGISTRATION_TIME,
+                                    RECORD_TTL,
+                                    JITTER_PERCENT,
+                                    MAX_RATE,
+                                    MAX_QUEUE);
+
+  ChargingAddresses charging_addrs;
+  charging_addrs.ccfs.push_back("ccf1");
+  charging_addrs.ecfs.push_back("ecf1");
+  HssConnection::ServerAssignmentAnswer answer(HssConnection::ResultCode::SUCCESS,
+                                               charging_addrs,
+                                               IMS_SUBSCRIPTION,
+                                               "");
+
+  FakeImplicitRegistrationSet* irs = new FakeImplicitRegistrationSet(IMPU);
+  irs->set_reg_state(RegistrationState::REGISTERED);
+  irs->set_refresh_deadline(1);
+
+  bool written = false;
+  int64_t deadline = 0;
+  int32_t ttl = 0;
+  std::string ims_sub_xml;
+  ChargingAddresses written_charging_addrs;
+
+  EXPECT_CALL(_hss, send_server_assignment_request(_, _, FAKE_TRAIL_ID))
+    .WillOnce(InvokeArgument<0>(answer));
+  EXPECT_CALL(_cache, get_implicit_registration_set_for_impu(_, _, IMPU, FAKE_TRAIL_ID))
+    .WillOnce(InvokeArgument<0>(irs));
+  EXPECT_CALL(_cache, put_implicit_registration_set(_, _, _, irs, FAKE_TRAIL_ID))
+    .WillOnce(Invoke([&](void_success_cb success_cb,
+                         progress_callback progress_cb,
+                         failure_callback failure_cb,
+                         ImplicitRegistrationSet* put_irs,
+                         SAS::TrailId trail)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        deadline = put_irs->get_refresh_deadline();
+        ttl = put_irs->get_ttl();
+        ims_sub_xml = put_irs->get_ims_sub_xml();
+        written_charging_addrs = put_irs->get_charging_addresses();
+        written = true;
+        _cond.notify_all();
+      }
+
+      success_cb();
+    }));
+
+  int64_t before = time(0);
+  refresher.start();
+  EXPECT_TRUE(refresher.refresh(_request, IMPU, FAKE_TRAIL_ID));
+
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    ASSERT_TRUE(_cond.wait_for(lock,
+                               std::chrono::seconds(5),
+                               [&written]() { return written; }));
+  }
+
+  // Waits for the refresh to complete.
+  refresher.stop();
+  int64_t after = time(0);
+
+  EXPECT_LE(before + HSS_REREGISTRATION_TIME - JITTER, deadline);
+  EXPECT_GE(after + HSS_REREGISTRATION_TIME, deadline);
+  EXPECT_EQ(RECORD_TTL, ttl);
+  EXPECT_EQ(IMS_SUBSCRIPTION, ims_sub_xml);
+  EXPECT_EQ(charging_addrs.ccfs, written_charging_addrs.ccfs);
+  EXPECT_EQ(charging_addrs.ecfs, written_charging_addrs.ecfs);
+}
+
+// stop() drops the refreshes that are still queued, and waits for those that
+// have sent their SAR to complete.
+TEST_F(ReregistrationRefresherTest, StopWaitsForInFlight)
+{
+  // At one SAR a second, the second refresh is still queued when we stop.
+  ReregistrationRefresher refresher(&_hss,
+                                    &_cache,
+                                    HSS_REREGISTRATION_TIME,
+                                    RECORD_TTL,
+                                    JITTER_PERCENT,
+                                    1,
+                                    MAX_QUEUE);
+
+  EXPECT_CALL(_hss, send_server_assignment_request(_, _, FAKE_TRAIL_ID))
+    .WillOnce(Invoke(this, &ReregistrationRefresherTest::record_sar));
+
+  refresher.start();
+  EXPECT_TRUE(refresher.refresh(_request, IMPU, FAKE_TRAIL_ID));
+  EXPECT_TRUE(refresher.refresh(_request, IMPU2, FAKE_TRAIL_ID));
+  ASSERT_TRUE(wait_for_sars(1));
+
+  std::atomic<bool> stopped(false);
+  std::thread stopper([&refresher, &stopped]()
+  {
+    refresher.stop();
+    stopped = true;
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_FALSE(stopped);
+
+  fail_sars();
+  stopper.join();
+  EXPECT_TRUE(stopped);
+}
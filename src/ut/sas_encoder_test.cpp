@@ -0,0 +1,88 @@
+/**
+ * @file sas_encoder_test.cpp UT for SasEncoder
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "homesteadsasevent.h"
+#include "sas_encoder.h"
+#include "mockstatisticsmanager.hpp"
+#include "test_utils.hpp"
+
+using ::testing::StrictMock;
+
+static const std::string PROFILE = "<IMSSubscription>xml</IMSSubscription>";
+
+TEST(SasEncoderTest, QueueFull)
+{
+  StrictMock<MockStatisticsManager> stats;
+  SasEncoder encoder(1, 100, 0, &stats);
+
+  // The encoder isn't started, so the first event stays on the queue and the
+  // second is dropped.
+  SasEncoder::Event event1(1, SASEvent::CACHE_PUT_REG_DATA, 0);
+  event1.add_compressed_param(PROFILE, &SASEvent::PROFILE_SERVICE_PROFILE);
+  EXPECT_TRUE(encoder.report_event(event1));
+
+  EXPECT_CALL(stats, incr_H_sas_events_dropped());
+  SasEncoder::Event event2(2, SASEvent::CACHE_PUT_REG_DATA, 0);
+  event2.add_compressed_param(PROFILE, &SASEvent::PROFILE_SERVICE_PROFILE);
+  EXPECT_FALSE(encoder.report_event(event2));
+
+  EXPECT_EQ(1u, encoder.num_dropped());
+}
+
+TEST(SasEncoderTest, ReportAfterStop)
+{
+  SasEncoder encoder(10, 100, 0);
+  encoder.start();
+
+  SasEncoder::Event event1(1, SASEvent::CACHE_PUT_REG_DATA, 0);
+  event1.add_var_param("sip:alice@example.com");
+  event1.add_compressed_param(PROFILE, &SASEvent::PROFILE_SERVICE_PROFILE);
+  event1.add_static_param(0);
+  EXPECT_TRUE(encoder.report_event(event1));
+
+  // Stopping the encoder reports the queued events. Events reported after
+  // that are dropped.
+  encoder.stop();
+  EXPECT_EQ(0u, encoder.num_dropped());
+
+  SasEncoder::Event event2(2, SASEvent::CACHE_PUT_REG_DATA, 0);
+  EXPECT_FALSE(encoder.report_event(event2));
+  EXPECT_EQ(1u, encoder.num_dropped());
+}
+
+TEST(SasEncoderTest, SampledByTrail)
+{
+  StrictMock<MockStatisticsManager> stats;
+  SasEncoder encoder(10, 25, 0, &stats);
+
+  // Trails whose last two digits are less than the percentage are logged.
+  std::string param = PROFILE;
+  encoder.limit_compressed_param(param, 124);
+  EXPECT_EQ(PROFILE, param);
+
+  EXPECT_CALL(stats, incr_H_sas_params_omitted());
+  encoder.limit_compressed_param(param, 125);
+  EXPECT_EQ(SasEncoder::OMITTED_PARAM, param);
+  EXPECT_EQ(1u, encoder.num_omitted());
+}
+
+TEST(SasEncoderTest, Truncated)
+{
+  SasEncoder encoder(10, 100, 16);
+
+  std::string param = PROFILE;
+  encoder.limit_compressed_param(param, 1);
+  EXPECT_EQ(PROFILE.substr(0, 16) + SasEncoder::TRUNCATED_SUFFIX, param);
+
+  std::string short_param = "short";
+  encoder.limit_compressed_param(short_param, 1);
+  EXPECT_EQ("short", short_param);
+}
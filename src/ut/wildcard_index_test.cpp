@@ -0,0 +1,95 @@
+/**
+ * @file wildcard_index_test.cpp UT for WildcardIndex
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "wildcard_index.h"
+#include "test_utils.hpp"
+
+static const std::string WILDCARD = "sip:chat!.*!@example.com";
+static const std::string OTHER_WILDCARD = "sip:chat-!.*!@example.com";
+
+TEST(WildcardIndexTest, IsWildcard)
+{
+  EXPECT_TRUE(WildcardIndex::is_wildcard(WILDCARD));
+  EXPECT_TRUE(WildcardIndex::is_wildcard("tel:+1650!.*!"));
+  EXPECT_FALSE(WildcardIndex::is_wildcard("sip:chat@example.com"));
+  EXPECT_FALSE(WildcardIndex::is_wildcard("sip:chat!@example.com"));
+}
+
+TEST(WildcardIndexTest, Match)
+{
+  WildcardIndex index(10);
+  index.add(WILDCARD);
+  index.add("tel:+1650!.*!");
+  EXPECT_EQ(2u, index.size());
+
+  std::string wildcard;
+  EXPECT_TRUE(index.match("sip:chat1234@example.com", wildcard));
+  EXPECT_EQ(WILDCARD, wildcard);
+
+  EXPECT_TRUE(index.match("tel:+16505551234", wildcard));
+  EXPECT_EQ("tel:+1650!.*!", wildcard);
+
+  // The literal parts of the wildcard must match exactly.
+  EXPECT_FALSE(index.match("sip:chat1234@example.org", wildcard));
+  EXPECT_FALSE(index.match("sip:chat1234@exampleXcom", wildcard));
+  EXPECT_FALSE(index.match("sip:talk1234@example.com", wildcard));
+}
+
+TEST(WildcardIndexTest, AmbiguousMatch)
+{
+  WildcardIndex index(10);
+  index.add(WILDCARD);
+  index.add("sip:!.*!1234@example.com");
+
+  // More than one wildcard matches, so we can't tell which IRS it's in.
+  std::string wildcard;
+  EXPECT_FALSE(index.match("sip:chat1234@example.com", wildcard));
+  EXPECT_TRUE(index.match("sip:chat5678@example.com", wildcard));
+  EXPECT_EQ(WILDCARD, wildcard);
+}
+
+TEST(WildcardIndexTest, Remove)
+{
+  WildcardIndex index(10);
+  index.add(WILDCARD);
+  index.add(OTHER_WILDCARD);
+  index.add(WILDCARD);
+  EXPECT_EQ(2u, index.size());
+
+  index.remove(WILDCARD);
+  index.remove("sip:unknown!.*!@example.com");
+  EXPECT_EQ(1u, index.size());
+
+  std::string wildcard;
+  EXPECT_FALSE(index.match("sip:chat1234@example.com", wildcard));
+  EXPECT_TRUE(index.match("sip:chat-1234@example.com", wildcard));
+  EXPECT_EQ(OTHER_WILDCARD, wildcard);
+}
+
+TEST(WildcardIndexTest, Full)
+{
+  WildcardIndex index(1);
+  index.add(WILDCARD);
+  index.add(OTHER_WILDCARD);
+  EXPECT_EQ(1u, index.size());
+
+  // The second wildcard wasn't indexed, so only the first matches.
+  std::string wildcard;
+  EXPECT_TRUE(index.match("sip:chat-1234@example.com", wildcard));
+  EXPECT_EQ(WILDCARD, wildcard);
+}
+
+TEST(WildcardIndexTest, InvalidWildcard)
+{
+  WildcardIndex index(10);
+  index.add("sip:chat!(!@example.com");
+  EXPECT_EQ(0u, index.size());
+}
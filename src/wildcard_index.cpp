@@ -0,0 +1,216 @@
+/**
+ * @file wildcard_index.cpp Index of the wildcarded IMPUs in the cache
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "wildcard_index.h"
+
+#include "log.h"
+
+// Characters that have a special meaning in a regular expression, and so
+// must be escaped in the literal parts of a wildcard.
+static const std::string REGEX_SPECIAL_CHARS = "\\^$.|?*+()[]{}";
+
+WildcardIndex::WildcardIndex(size_t max_size) :
+  _max_size(max_size),
+  _index(new Index()),
+  _size(0)
+{
+}
+
+bool WildcardIndex::is_wildcard(const std::string& impu)
+{
+  size_t start = impu.find('!');
+  return ((start != std::string::npos) &&
+          (impu.find('!', start + 1) != std::string::npos));
+}
+
+std::string WildcardIndex::domain(const std::string& impu)
+{
+  // Only look for the '@' after any regular expression, as the expression
+  // may contain an '@' itself.
+  size_t regex_end = impu.rfind('!');
+  size_t at = impu.rfind('@');
+
+  if ((at == std::string::npos) ||
+      ((regex_end != std::string::npos) && (at < regex_end)))
+  {
+    return "";
+  }
+
+  return impu.substr(at + 1);
+}
+
+void WildcardIndex::add(const std::string& wildcard)
+{
+  if (!is_wildcard(wildcard))
+  {
+    return;
+  }
+
+  std::string key = domain(wildcard);
+
+  std::lock_guard<std::mutex> lock(_lock);
+
+  Index::const_iterator it = _index->find(key);
+
+  if (it != _index->end())
+  {
+    for (const std::shared_ptr<const Pattern>& pattern : it->second)
+    {
+      if (pattern->wildcard == wildcard)
+      {
+        return;
+      }
+    }
+  }
+
+  if (_size >= _max_size)
+  {
+    TRC_DEBUG("Wildcard index full - not indexing %s", wildcard.c_str());
+    return;
+  }
+
+  // The wildcard's regular expression is between the first and last '!'.
+  // Everything else must match literally.
+  size_t start = wildcard.find('!');
+  size_t end = wildcard.rfind('!');
+  std::string expression;
+
+  for (size_t ii = 0; ii < wildcard.length(); ii++)
+  {
+    if ((ii == start) || (ii == end))
+    {
+      continue;
+    }
+
+    if (((ii < start) || (ii > end)) &&
+        (REGEX_SPECIAL_CHARS.find(wildcard[ii]) != std::string::npos))
+    {
+      expression += '\\';
+    }
+
+    expression += wildcard[ii];
+  }
+
+  std::shared_ptr<Pattern> pattern(new Pattern());
+  pattern->wildcard = wildcard;
+
+  try
+  {
+    pattern->regex = boost::regex(expression);
+  }
+  catch (const boost::regex_error& e)
+  {
+    TRC_DEBUG("Invalid wildcard %s: %s", wildcard.c_str(), e.what());
+    return;
+  }
+
+  TRC_DEBUG("Indexing wildcard %s", wildcard.c_str());
+
+  std::shared_ptr<Index> index(new Index(*_index));
+  (*index)[key].push_back(pattern);
+  _index = index;
+  _size++;
+}
+
+void WildcardIndex::remove(const std::string& wildcard)
+{
+  std::string key = domain(wildcard);
+
+  std::lock_guard<std::mutex> lock(_lock);
+
+  Index::const_iterator it = _index->find(key);
+
+  if (it == _index->end())
+  {
+    return;
+  }
+
+  std::vector<std::shared_ptr<const Pattern>> patterns;
+
+  for (const std::shared_ptr<const Pattern>& pattern : it->second)
+  {
+    if (pattern->wildcard != wildcard)
+    {
+      patterns.push_back(pattern);
+    }
+  }
+
+  if (patterns.size() == it->second.size())
+  {
+    return;
+  }
+
+  TRC_DEBUG("Removing wildcard %s from index", wildcard.c_str());
+
+  std::shared_ptr<Index> index(new Index(*_index));
+
+  if (patterns.empty())
+  {
+    index->erase(key);
+  }
+  else
+  {
+    (*index)[key] = patterns;
+  }
+
+  _index = index;
+  _size--;
+}
+
+bool WildcardIndex::match(const std::string& impu, std::string& wildcard) const
+{
+  std::shared_ptr<const Index> index = current();
+  Index::const_iterator it = index->find(domain(impu));
+
+  if (it == index->end())
+  {
+    return false;
+  }
+
+  const Pattern* found = nullptr;
+
+  for (const std::shared_ptr<const Pattern>& pattern : it->second)
+  {
+    if (boost::regex_match(impu, pattern->regex))
+    {
+      if (found != nullptr)
+      {
+        TRC_DEBUG("%s matches wildcards %s and %s",
+                  impu.c_str(),
+                  found->wildcard.c_str(),
+                  pattern->wildcard.c_str());
+        return false;
+      }
+
+      found = pattern.get();
+    }
+  }
+
+  if (found == nullptr)
+  {
+    return false;
+  }
+
+  wildcard = found->wildcard;
+  return true;
+}
+
+size_t WildcardIndex::size() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _size;
+}
+
+std::shared_ptr<const WildcardIndex::Index> WildcardIndex::current() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _index;
+}
@@ -0,0 +1,189 @@
+/**
+ * @file write_through_store.cpp Store that writes through to a local log
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "write_through_store.h"
+
+#include <inttypes.h>
+#include <time.h>
+
+#include "log.h"
+
+static const std::string MARKER_TABLE = "impu_store_log";
+
+// The marker record is kept for a week, and refreshed daily as we write to
+// the store. memcached treats expiries of more than 30 days as absolute
+// times, so this must be less than that.
+static const int MARKER_EXPIRY = 7 * 24 * 60 * 60;
+static const int MARKER_REFRESH_INTERVAL = 24 * 60 * 60;
+
+WriteThroughStore::WriteThroughStore(Store* store,
+                                     LogStructuredStore* log,
+                                     const std::string& node_id) :
+  _store(store),
+  _log(log),
+  _node_id(node_id),
+  _marker_refresh_time(0)
+{
+}
+
+WriteThroughStore::~WriteThroughStore()
+{
+  delete _store; _store = NULL;
+  delete _log; _log = NULL;
+}
+
+Store::Status WriteThroughStore::restore(uint64_t& restored)
+{
+  restored = 0;
+
+  std::string data;
+  uint64_t cas;
+  Store::Status status = _store->get_data(MARKER_TABLE, _node_id, data, cas);
+
+  if (status == Store::Status::OK)
+  {
+    TRC_STATUS("IMPU store still holds its data - not restoring from the log");
+    refresh_marker(0);
+    return Store::Status::OK;
+  }
+  else if (status != Store::Status::NOT_FOUND)
+  {
+    TRC_ERROR("Failed to read the IMPU store log marker");
+    return status;
+  }
+
+  std::vector<std::pair<std::string, std::string>> keys;
+  _log->get_keys(keys);
+
+  TRC_STATUS("IMPU store has lost its data - restoring up to %zu records from the log",
+             keys.size());
+
+  for (const std::pair<std::string, std::string>& key : keys)
+  {
+    std::string log_data;
+    uint64_t log_cas;
+    int expiry;
+
+    if (_log->get_record(key.first, key.second, log_data, log_cas, expiry) !=
+        Store::Status::OK)
+    {
+      // The record has expired since we listed the keys.
+      continue;
+    }
+
+    // A CAS of 0 only adds the record if the store doesn't have it, so we
+    // never overwrite anything written since the store lost its data.
+    status = _store->set_data(key.first, key.second, log_data, 0, expiry, 0, false);
+
+    if (status == Store::Status::OK)
+    {
+      restored++;
+    }
+    else if (status != Store::Status::DATA_CONTENTION)
+    {
+      TRC_ERROR("Failed to restore %s from the IMPU store log",
+                key.second.c_str());
+      return status;
+    }
+  }
+
+  TRC_STATUS("Restored %" PRIu64 " records from the IMPU store log", restored);
+
+  // Only write the marker once we've restored everything, so that if we
+  // fail part way through, we try again next time.
+  refresh_marker(0);
+
+  return Store::Status::OK;
+}
+
+void WriteThroughStore::refresh_marker(SAS::TrailId trail)
+{
+  int64_t now = time(NULL);
+  int64_t refresh_time = _marker_refresh_time;
+
+  // Only one thread refreshes the marker at a time.
+  if ((now >= refresh_time) &&
+      (_marker_refresh_time.compare_exchange_strong(refresh_time,
+                                                    now + MARKER_REFRESH_INTERVAL)))
+  {
+    if (_store->set_data_without_cas(MARKER_TABLE,
+                                     _node_id,
+                                     _node_id,
+                                     MARKER_EXPIRY,
+                                     trail) != Store::Status::OK)
+    {
+      // Try again on the next write.
+      TRC_WARNING("Failed to write the IMPU store log marker");
+      _marker_refresh_time = 0;
+    }
+  }
+}
+
+Store::Status WriteThroughStore::get_data(const std::string& table,
+                                          const std::string& key,
+                                          std::string& data,
+                                          uint64_t& cas,
+                                          SAS::TrailId trail,
+                                          bool log_body)
+{
+  // Records aren't restored from the log here. If the store doesn't have a
+  // record, another node may have deleted it.
+  return _store->get_data(table, key, data, cas, trail, log_body);
+}
+
+Store::Status WriteThroughStore::set_data(const std::string& table,
+                                          const std::string& key,
+                                          const std::string& data,
+                                          uint64_t cas,
+                                          int expiry,
+                                          SAS::TrailId trail,
+                                          bool log_body)
+{
+  Store::Status status =
+    _store->set_data(table, key, data, cas, expiry, trail, log_body);
+
+  if (status == Store::Status::OK)
+  {
+    _log->set_data_without_cas(table, key, data, expiry, trail, log_body);
+    refresh_marker(trail);
+  }
+
+  return status;
+}
+
+Store::Status WriteThroughStore::set_data_without_cas(const std::string& table,
+                                                      const std::string& key,
+                                                      const std::string& data,
+                                                      int expiry,
+                                                      SAS::TrailId trail,
+                                                      bool log_body)
+{
+  Store::Status status =
+    _store->set_data_without_cas(table, key, data, expiry, trail, log_body);
+
+  if (status == Store::Status::OK)
+  {
+    _log->set_data_without_cas(table, key, data, expiry, trail, log_body);
+    refresh_marker(trail);
+  }
+
+  return status;
+}
+
+Store::Status WriteThroughStore::delete_data(const std::string& table,
+                                             const std::string& key,
+                                             SAS::TrailId trail)
+{
+  // Delete from the log whatever happens, so that the record isn't restored
+  // from it later.
+  _log->delete_data(table, key, trail);
+  return _store->delete_data(table, key, trail);
+}